@@ -8,6 +8,88 @@
 #elif defined(__APPLE__)
 //	#include	<CodeFragments.h>
 #endif
+/////////////////////////////////////////////////////////////////////////////
+// Constants
+
+enum eWriteMode
+{
+	kWriteMode_Buffered = 0,		// write through the system cache
+	kWriteMode_Direct					// bypass the system cache
+};
+
+enum eWriteSync
+{
+	kWriteSync_None = 0,
+	kWriteSync_File,					// flush every file to the device when it is closed
+	kWriteSync_Group					// flush the closed files in groups by the syncer thread
+};
+
+enum eSoftAFPhase
+{
+	kSoftAFPhase_Search = 0,
+	kSoftAFPhase_Return,				// driving back to the best position
+	kSoftAFPhase_Done
+};
+
+enum eOffloadOrder
+{
+	kOffloadOrder_Smallest = 1,
+	kOffloadOrder_Newest
+};
+
+enum eIntervalPolicy
+{
+	kIntervalPolicy_Skip = 1,		// an overrun point of the grid is skipped
+	kIntervalPolicy_CatchUp			// an overrun point is taken late, and the next points stay on the grid
+};
+
+enum eSinkKind
+{
+	kSinkKind_File = 0,
+	kSinkKind_Pipe,					// FIFO on Mac, named pipe on Windows
+	kSinkKind_Socket,				// Unix domain socket
+	kSinkKind_FrameBus,				// a slot of the frame bus in shared memory
+	kSinkKind_Memory				// a buffer of the memory sink, taken in this process
+};
+
+enum eSinkRoute
+{
+	kSinkRoute_Image = 0,
+	kSinkRoute_Thumbnail,
+	kSinkRoute_LiveView,
+	kSinkRoute_Movie,
+	kSinkRoute_PictureControl,
+	kSinkRoute_Count
+};
+
+enum eSinkRecord
+{
+	kSinkRecord_Open = 1,			// followed by the name of the data
+	kSinkRecord_Data,				// followed by a chunk
+	kSinkRecord_Commit,
+	kSinkRecord_Abort
+};
+
+#define LIVEVIEW_HEADER_SIZE		512		// size of the header before the JPEG data of a live view image
+#define LIVEVIEW_CONSUMER_MAX		8
+#define LIVEVIEW_FPS_DEFAULT		15
+#define LIVEVIEW_AF_FRAME_MAX		42		// number of AF frames in the live view header
+#define FOCUS_STACK_WINDOW_MAX		4		// downloads in flight during a focus stack
+#define RAMP_AXIS_MAX				128		// elements of a capability used by the exposure ramp
+#define TRACKER_TEMPLATE			16		// pixels of a side of the template of the subject tracker
+#define MOVIE_INDEX_DEPTH			8		// nested boxes followed by the movie indexer
+#define MOVIE_INDEX_TRACKS		8		// tracks recorded by the movie indexer
+#define MOVIE_INDEX_CAPTURE		128	// bytes of a box payload kept for parsing
+#define FRAME_BUS_SLOT_MAX		32		// slots of the frame bus, a bit of a mask each
+#define FRAME_BUS_CONSUMER_MAX	8
+#define FRAME_BUS_NAME_MAX		24		// the shared memory name on Mac is limited to 31 characters
+#define FRAME_BUS_NAME_DEFAULT	"NkFrameBus"
+#define FRAME_BUS_SLOTS_DEFAULT	8
+#define FRAME_BUS_SLOT_MB_DEFAULT	64
+#define MEMORY_SINK_BUFFER_MAX	8		// delivered files kept by the memory sink
+#define INTERVAL_PERIOD_MIN	100		// shortest period of the intervalometer, msec
+#define INTERVAL_SHOTS_MAX	100000
+
 /////////////////////////////////////////////////////////////////////////////
 // Structures
 
@@ -39,8 +121,633 @@
 		ULONG	ulOffset;
 		ULONG	ulTotalLines;
 		SLONG	lID;
+		NK_UINT_64	ullCacheKey;	// key of the thumbnail cache, 0 if the data is not cached
+		NKREF	refProgress;			// reference of the data object, used to count the delivered bytes
+		LPVOID	pSink;					// LPDataSink of the file being delivered
+		char*	pszFileName;			// receives the name of the saved file if it is not NULL
 	} RefDataProc, *LPRefDataProc;
 
+	typedef struct tagRefThumbSlot
+	{
+		LPRefObj	pRefItm;
+		LPRefObj	pRefDat;
+		ULONG	ulCount;			// counted up by CompletionProc when the Acquire finished
+		BOOL	bItemOpened;		// TRUE if the item object was opened by IssueThumbnail
+		BOOL	bDataOpened;		// TRUE if the thumbnail object was opened by IssueThumbnail
+		BOOL	bBusy;
+	} RefThumbSlot, *LPRefThumbSlot;
+
+	typedef struct tagThumbCacheHeader
+	{
+		char	szMagic[8];
+		ULONG	ulVersion;
+		ULONG	ulRecords;
+		NK_UINT_64	ullCapacity;	// size of the record area
+		NK_UINT_64	ullHead;			// offset of the oldest record in the record area
+		NK_UINT_64	ullTail;			// offset where the next record is written
+	} ThumbCacheHeader, *LPThumbCacheHeader;
+
+	typedef struct tagThumbCacheRecord
+	{
+		NK_UINT_64	ullKey;
+		ULONG	ulFileDataType;
+		ULONG	ulLength;				// length of the data following this structure
+	} ThumbCacheRecord, *LPThumbCacheRecord;
+
+	// an entry of the index of the cache in memory. ullKey is 0 if the entry is free.
+	typedef struct tagThumbCacheIndex
+	{
+		NK_UINT_64	ullKey;
+		NK_UINT_64	ullPos;				// offset of the newest record of the key in the record area
+	} ThumbCacheIndex, *LPThumbCacheIndex;
+
+	typedef struct tagThumbCache
+	{
+		LPVOID	pView;
+		NK_UINT_64	ullSize;
+		LPThumbCacheIndex	pIndex;		// open addressing, never more than half full
+		ULONG	ulIndexSize;			// a power of 2, or 0
+		ULONG	ulIndexCount;
+	#if defined( _WIN32 )
+		HANDLE	hFile;
+		HANDLE	hMap;
+	#elif defined(__APPLE__)
+		int	fd;
+	#endif
+	} ThumbCache, *LPThumbCache;
+
+	typedef struct tagDataWriter
+	{
+		char	szFileName[256];
+		BOOL	bDirect;					// TRUE if the file bypasses the system cache
+		BOOL	bManifest;				// TRUE if the file is recorded in the session manifest
+	#if defined( _WIN32 )
+		HANDLE	hFile;
+	#elif defined(__APPLE__)
+		int	fd;
+	#endif
+		FILE*	pStream;					// used if bDirect is FALSE
+		LPVOID	pBuffer;					// aligned buffer from the pool
+		ULONG	ulBufferSize;
+		ULONG	ulFill;					// bytes in pBuffer not written yet
+		ULONG	ulBlockSize;
+		NK_UINT_64	ullWritten;
+	} DataWriter, *LPDataWriter;
+
+	typedef struct tagDataSink
+	{
+		ULONG	ulKind;					// eSinkKind
+		ULONG	ulRoute;				// eSinkRoute
+		ULONG	ulSinkID;				// number of the delivery in the records of a pipe or a socket
+		char	szName[256];			// the file name for a file sink
+		NK_UINT_64	ullTotal;			// size of the data, 0 if unknown
+		NK_UINT_64	ullWritten;		// end of the data written so far
+		DataWriter	stWriter;			// kSinkKind_File only
+		SLONG	lSlot;					// slot of the frame bus or buffer of the memory sink
+	} DataSink, *LPDataSink;
+
+	// header of a record sent to a pipe or a socket
+	typedef struct tagSinkRecord
+	{
+		char	cMagic[4];				// "NKSK"
+		ULONG	ulType;					// eSinkRecord
+		ULONG	ulSinkID;
+		ULONG	ulRoute;
+		NK_UINT_64	ullOffset;		// offset of the data in the delivered file
+		NK_UINT_64	ullTotal;
+		ULONG	ulLength;				// bytes following this header
+		ULONG	ulReserved;
+	} SinkRecord, *LPSinkRecord;
+
+	typedef struct tagProgressInfo
+	{
+		ULONG	ulIndex;					// index of the progress record
+		NKREF	refProc;
+		ULONG	ulCommand;
+		ULONG	ulParam;
+		ULONG	ulDone;
+		ULONG	ulTotal;
+		NK_UINT_64	ullBytes;			// bytes delivered to DataProc
+		NK_UINT_64	ullElapsed;			// msec
+		NK_UINT_64	ullBytesPerSec;
+		BOOL	bFinished;
+	} ProgressInfo, *LPProgressInfo;
+
+	typedef struct tagLiveViewFrame
+	{
+		NK_UINT_64	ullSeq;				// sequence number, starts from 1
+		NK_UINT_64	ullTime;				// host time when the frame arrived, usec
+		ULONG	ulSize;					// size of the header and the JPEG data
+		ULONG	ulHeaderSize;
+		ULONG	ulCapacity;				// size of the reused buffer
+		unsigned char*	pucData;
+	} LiveViewFrame, *LPLiveViewFrame;
+
+	// a consumer of a frame bus
+	typedef struct tagFrameBusReader
+	{
+		char	szName[FRAME_BUS_NAME_MAX + 1];
+		SLONG	lConsumer;				// entry of this consumer in the bus
+		LPVOID	pHeader;				// the header and the data, mapped read-only
+		LPVOID	pShared;				// the reference counts
+		NK_UINT_64	ullHeaderSize;
+		NK_UINT_64	ullSharedSize;
+		LPVOID	hHeader;				// handles of the file mappings on Windows
+		LPVOID	hShared;
+	#if defined( _WIN32 )
+		LPVOID	hNotify;
+	#elif defined(__APPLE__)
+		int	fdNotify;
+	#endif
+		NK_UINT_64	ullLastSeq;			// sequence number of the last frame taken
+		NK_UINT_64	ullMissed;			// frames overwritten before they were taken
+	} FrameBusReader, *LPFrameBusReader;
+
+	// a frame taken from a frame bus. pucData points into the shared memory until the frame is released.
+	typedef struct tagFrameBusFrame
+	{
+		SLONG	lSlot;
+		ULONG	ulRoute;				// eSinkRoute
+		ULONG	ulLength;
+		NK_UINT_64	ullSeq;
+		NK_UINT_64	ullTime;				// host time of the producer when the frame was published, usec
+		char	szName[64];
+		const unsigned char*	pucData;
+	} FrameBusFrame, *LPFrameBusFrame;
+
+	// a delivered file kept by the memory sink. pucData stays valid until the frame is released.
+	typedef struct tagMemorySinkFrame
+	{
+		SLONG	lBuffer;
+		ULONG	ulRoute;				// eSinkRoute
+		ULONG	ulLength;
+		NK_UINT_64	ullSeq;
+		NK_UINT_64	ullTime;				// host time when the file was committed, usec
+		char	szName[256];
+		unsigned char*	pucData;
+	} MemorySinkFrame, *LPMemorySinkFrame;
+
+	typedef struct tagIntervalometer
+	{
+		NK_UINT_64	ullPeriod;			// usec
+		NK_UINT_64	ullDelay;			// usec before the first point
+		NK_UINT_64	ullStart;			// host time of the first point, usec
+		ULONG	ulShots;
+		ULONG	ulPolicy;				// eIntervalPolicy
+		ULONG	ulFired;
+		ULONG	ulCompleted;			// counted up by CompletionProc
+		ULONG	ulSkipped;				// points skipped by kIntervalPolicy_Skip
+		ULONG	ulOverruns;
+		ULONG	ulErrors;
+		BOOL	bCanceled;				// the run was stopped by Ctrl+C
+		SLONG*	plLate;					// usec each shot was started after its point
+		NK_UINT_64	ullIssueTotal;		// usec spent in starting CaptureAsync
+		NK_UINT_64	ullIssueMax;
+		FILE*	pLog;
+	} Intervalometer, *LPIntervalometer;
+
+	typedef struct tagIntervalStats
+	{
+		ULONG	ulFired;
+		ULONG	ulSkipped;
+		ULONG	ulOverruns;
+		ULONG	ulErrors;
+		double	dLateMean;				// usec
+		double	dLateStdDev;
+		SLONG	lLateMin;
+		SLONG	lLateMedian;
+		SLONG	lLateP99;
+		SLONG	lLateMax;
+		double	dIssueMean;
+		NK_UINT_64	ullIssueMax;
+	} IntervalStats, *LPIntervalStats;
+
+	typedef struct tagLiveViewStats
+	{
+		ULONG	ulTargetFps;
+		ULONG	ulFps100;				// achieved frame rate x 100
+		NK_UINT_64	ullPolled;
+		NK_UINT_64	ullFrames;			// frames published to the consumers
+		NK_UINT_64	ullDropped;			// polls skipped because no buffer was free
+		NK_UINT_64	ullLate;				// polling periods missed because the polling fell behind
+		NK_UINT_64	ullErrors;
+		NK_UINT_64	ullBytes;
+		NK_UINT_64	ullStartTime;		// usec
+		NK_UINT_64	ullStopTime;		// usec, time of the last frame
+	} LiveViewStats, *LPLiveViewStats;
+
+	typedef struct tagLiveViewHeader
+	{
+		const unsigned char*	pucHeader;	// points to the delivered buffer
+		const unsigned char*	pucJpeg;
+		ULONG	ulJpegSize;
+	} LiveViewHeader, *LPLiveViewHeader;
+
+	typedef struct tagLiveViewRect
+	{
+		UWORD	wWidth;
+		UWORD	wHeight;
+		UWORD	wCenterX;
+		UWORD	wCenterY;
+	} LiveViewRect, *LPLiveViewRect;
+
+	typedef struct tagLiveViewFocusState
+	{
+		UCHAR	ucAFDriveEnabled;
+		UCHAR	ucFocusDriving;
+		UCHAR	ucFocusJudge;			// 0: none, 1: not focused, 2: focused
+		UCHAR	ucAFMode;
+		UCHAR	ucSelectedArea;
+		UCHAR	ucSelectedFace;
+		UCHAR	ucTrackingStatus;
+	} LiveViewFocusState, *LPLiveViewFocusState;
+
+	typedef struct tagLiveViewMovieState
+	{
+		ULONG	ulRemainTime;			// msec
+		UCHAR	ucRecInfo;
+		UCHAR	ucSoundPeakL;
+		UCHAR	ucSoundPeakR;
+		UCHAR	ucSoundLevelL;
+		UCHAR	ucSoundLevelR;
+		UCHAR	ucSyncExternal;
+		UCHAR	ucTimeCodeStatus;
+		UCHAR	ucTimeCode[4];			// hour, minute, second, frame
+		UWORD	wCountdown;
+	} LiveViewMovieState, *LPLiveViewMovieState;
+
+	typedef struct tagAviWriter
+	{
+		char	szBaseName[240];
+		char	szFileName[256];
+		ULONG	ulFileIndex;
+		FILE*	pFile;
+		unsigned char*	pucBatch;		// chunks not written yet
+		ULONG	ulBatchFill;
+		LPVOID	pIndex;					// entries of 'idx1'
+		ULONG	ulIndexCount;
+		ULONG	ulIndexCapacity;
+		ULONG	ulMoviSize;				// size of the chunks in the 'movi' list
+		ULONG	ulFrames;
+		ULONG	ulMaxFrameSize;
+		UWORD	wWidth;
+		UWORD	wHeight;
+		NK_UINT_64	ullFirstTime;		// usec
+		NK_UINT_64	ullLastTime;
+		BOOL	bClosed;					// TRUE if the index was written
+		BOOL	bFailed;
+	} AviWriter, *LPAviWriter;
+
+	typedef struct tagJpegLuma
+	{
+		UCHAR*	pucLuma;					// reused for the later frames
+		UWORD	wWidth;
+		UWORD	wHeight;
+		ULONG	ulStride;
+		ULONG	ulCapacity;
+		ULONG	ulScale;					// 1, 2, 4 or 8
+		LPVOID	pDecoder;				// tables of the decoder
+	} JpegLuma, *LPJpegLuma;
+
+	typedef struct tagLaplacianSums
+	{
+		long long	llSum;
+		NK_UINT_64	ullSquare;
+		NK_UINT_64	ullCount;
+	} LaplacianSums, *LPLaplacianSums;
+
+	typedef struct tagSharpnessSample
+	{
+		NK_UINT_64	ullSeq;
+		NK_UINT_64	ullTime;				// usec
+		ULONG	ulProcessTime;			// usec to decode and score
+		float	fScore;					// variance of the Laplacian of the whole frame
+		float	fRegion[9];				// 3x3 regions from the upper left
+	} SharpnessSample, *LPSharpnessSample;
+
+	typedef struct tagSharpnessContext
+	{
+		ULONG	ulScale;
+		ULONG	ulErrors;
+		FILE*	pCsv;
+		JpegLuma	stLuma;
+	} SharpnessContext, *LPSharpnessContext;
+
+	typedef struct tagSoftAFContext
+	{
+		ULONG	ulScale;
+		ULONG	ulStep;					// steps of MFDriveStep for the next move
+		ULONG	ulMinStep;
+		ULONG	ulFramesPerStep;		// frames to average at each position
+		ULONG	ulSettleFrames;			// frames to skip after a move
+		SLONG	lDirection;				// 1: to the infinity, -1: to the closest
+		ULONG	ulPhase;
+		SLONG	lPosition;				// counted from the start position
+		SLONG	lBestPosition;
+		float	fBestScore;
+		float	fFinalScore;
+		float	fAccum;
+		ULONG	ulSampled;
+		ULONG	ulSkip;
+		ULONG	ulMeasured;
+		ULONG	ulMoves;
+		ULONG	ulSteps;
+		ULONG	ulReversals;
+		ULONG	ulErrors;
+		BOOL	bImproved;
+		BOOL	bEnd;					// TRUE if the last move reached an end of the lens
+		BOOL	bFailed;
+		NK_UINT_64	ullStartTime;		// usec
+		NK_UINT_64	ullMoveTime;
+		NK_UINT_64	ullTotalTime;
+		FILE*	pLog;
+		JpegLuma	stLuma;
+	} SoftAFContext, *LPSoftAFContext;
+
+	typedef struct tagFocusStackShot
+	{
+		SLONG	lPosition;				// steps of MFDrive from the origin
+		ULONG	ulItemID;
+		NK_UINT_64	ullMoveStart;			// usec
+		NK_UINT_64	ullMoveEnd;
+		NK_UINT_64	ullCaptureStart;
+		NK_UINT_64	ullCaptureEnd;
+		NK_UINT_64	ullArrived;				// when the item was added
+		NK_UINT_64	ullSaved;
+		char	szFileName[256];
+	} FocusStackShot, *LPFocusStackShot;
+
+	typedef struct tagFocusStackSlot
+	{
+		LPRefObj	pRefItm;
+		LPRefObj	pRefDat;
+		ULONG	ulShot;
+		ULONG	ulCount;				// counted up by CompletionProc when the Acquire finished
+		LPRefCompletionProc	pRefCompletion;	// given to the Acquire; freed by CompletionProc
+		BOOL	bBusy;
+		char	szFileName[256];		// set by DataProc
+	} FocusStackSlot, *LPFocusStackSlot;
+
+	typedef struct tagFocusStack
+	{
+		BOOL	bHome;					// TRUE if the positions are counted from the closest end
+		ULONG	ulShots;
+		LPFocusStackShot	pShots;
+		ULONG	ulWindow;
+		FocusStackSlot	stSlots[FOCUS_STACK_WINDOW_MAX];
+		ULONG*	pulKnownIDs;			// items in the source before the stack
+		ULONG	ulKnownCount;
+		ULONG	ulCaptured;
+		ULONG	ulCaptureIssued;		// CaptureAsync started
+		ULONG	ulCaptureCount;			// counted up by CompletionProc when a CaptureAsync finished
+		LPRefCompletionProc	pRefCapture;	// given to the last CaptureAsync; freed by CompletionProc
+		ULONG	ulArrived;
+		ULONG	ulSaved;
+		ULONG	ulFailed;
+		NK_UINT_64	ullStartTime;		// usec
+		NK_UINT_64	ullHomeTime;
+		NK_UINT_64	ullMoveTime;
+		NK_UINT_64	ullCaptureTime;
+		NK_UINT_64	ullShotTime;			// until the last shot was taken
+		NK_UINT_64	ullTotalTime;
+		FILE*	pManifest;
+	} FocusStack, *LPFocusStack;
+
+	typedef struct tagMotionDetector
+	{
+		ULONG	ulBlockThreshold;		// mean absolute difference of a changed block
+		ULONG	ulOnScore;				// ratio of the changed blocks in 1/100 percent
+		ULONG	ulOffScore;
+		ULONG	ulOnFrames;
+		ULONG	ulOffFrames;
+		ULONG	ulCooldown;				// msec
+		UCHAR*	pucReference;			// downscaled luma without padding
+		ULONG*	pulBlockSad;
+		ULONG	ulBlocksX;
+		ULONG	ulBlocksY;
+		BOOL	bTriggered;
+		ULONG	ulAbove;
+		ULONG	ulBelow;
+		ULONG	ulScoreMax;
+		ULONG	ulTriggers;
+		ULONG	ulCompleted;			// counted up by CompletionProc
+		ULONG	ulFailed;
+		ULONG	ulErrors;
+		NK_UINT_64	ullLastTrigger;		// usec
+		NK_UINT_64	ullFrames;
+		NK_UINT_64	ullProcessTime;
+		NK_UINT_64	ullProcessMax;
+		NK_UINT_64	ullLatency;
+		NK_UINT_64	ullLatencyMax;
+		FILE*	pLog;
+		JpegLuma	stLuma;
+	} MotionDetector, *LPMotionDetector;
+
+	typedef struct tagPreTriggerStats
+	{
+		ULONG	ulTriggers;
+		ULONG	ulDumps;				// dumps written
+		ULONG	ulRejected;				// triggers while too many dumps were waiting
+		NK_UINT_64	ullFrames;			// frames put in the ring
+		NK_UINT_64	ullEvicted;			// frames dropped from the ring
+		NK_UINT_64	ullSkipped;			// frames larger than the ring
+		NK_UINT_64	ullBlocked;			// frames not kept while a dump held the oldest frames
+	} PreTriggerStats, *LPPreTriggerStats;
+
+	typedef struct tagPreTriggerSchedule
+	{
+		ULONG	ulInterval;				// sec, 0 for the Enter key
+		NK_UINT_64	ullNext;				// usec
+		ULONG	ulCaptures;
+		ULONG	ulCompleted;			// counted up by CompletionProc
+	} PreTriggerSchedule, *LPPreTriggerSchedule;
+
+	typedef struct tagRampStop
+	{
+		ULONG	ulIndex;				// index of the enum
+		float	fEV;					// stops of light
+		char	szName[16];
+	} RampStop, *LPRampStop;
+
+	typedef struct tagRampAxis
+	{
+		ULONG	ulCapID;
+		ULONG	ulCount;
+		ULONG	ulPos;					// current stop
+		ULONG	ulLow;					// stops the ramp can use
+		ULONG	ulHigh;
+		RampStop	stStop[RAMP_AXIS_MAX];	// in the order of the light
+	} RampAxis, *LPRampAxis;
+
+	typedef struct tagExposureRamp
+	{
+		RampAxis	stShutter;
+		RampAxis	stAperture;
+		RampAxis	stSensitivity;
+		ULONG	ulTarget;				// mean luma of the live view
+		ULONG	ulInterval;				// sec
+		ULONG	ulShots;
+		ULONG	ulTimeConstant;			// sec
+		ULONG	ulSettle;				// msec
+		float	fDesired;				// smoothed exposure in stops
+		float	fMeanLuma;
+		BOOL	bEstimated;
+		BOOL	bStepped;				// TRUE if the step after the last picture was done
+		ULONG	ulCaptures;
+		ULONG	ulCompleted;			// counted up by CompletionProc
+		ULONG	ulChanges;
+		ULONG	ulMeasured;
+		ULONG	ulErrors;
+		NK_UINT_64	ullLastSample;		// usec
+		NK_UINT_64	ullSettleEnd;
+		NK_UINT_64	ullNext;
+		FILE*	pLog;
+		JpegLuma	stLuma;
+	} ExposureRamp, *LPExposureRamp;
+
+	typedef struct tagTrackerUpdate
+	{
+		NK_UINT_64	ullSeq;				// frame of the position
+		NK_UINT_64	ullFrameTime;		// usec
+		NK_UINT_64	ullPosted;
+		ULONG	ulProcessTime;
+		ULONG	ulMad;					// mean absolute difference of the match
+		SLONG	lX;						// in the whole area
+		SLONG	lY;
+	} TrackerUpdate, *LPTrackerUpdate;
+
+	typedef struct tagSubjectTracker
+	{
+		SLONG	lStartX;				// in the whole area, 0 for the center
+		SLONG	lStartY;
+		ULONG	ulRadius;
+		ULONG	ulLostMad;
+		UCHAR	ucTemplate[TRACKER_TEMPLATE * TRACKER_TEMPLATE];
+		BOOL	bTemplate;
+		BOOL	bLocked;
+		ULONG	ulLost;					// bad matches in a row
+		UWORD	wLumaWidth;
+		UWORD	wLumaHeight;
+		float	fX;						// top left of the template in the luma
+		float	fY;
+		float	fVX;					// pixels per frame
+		float	fVY;
+		float	fPostX;					// position of the last update
+		float	fPostY;
+		float	fMapScaleX;				// from the luma to the whole area
+		float	fMapScaleY;
+		float	fMapOffsetX;
+		float	fMapOffsetY;
+		// counted on the consumer thread
+		ULONG	ulFrames;
+		ULONG	ulBadFrames;
+		ULONG	ulLocksLost;
+		ULONG	ulLocksRegained;
+		ULONG	ulErrors;
+		ULONG	ulPosted;
+		ULONG	ulSuperseded;			// updates replaced before they were sent
+		NK_UINT_64	ullProcessTime;		// usec
+		NK_UINT_64	ullProcessMax;
+		// counted on the polling thread
+		ULONG	ulSent;
+		ULONG	ulSetErrors;
+		NK_UINT_64	ullQueueTime;
+		NK_UINT_64	ullSetTime;
+		NK_UINT_64	ullLatency;
+		NK_UINT_64	ullLatencyMax;
+		FILE*	pLog;
+		JpegLuma	stLuma;
+	} SubjectTracker, *LPSubjectTracker;
+
+	typedef struct tagFocusMap
+	{
+		float	fScore[9];				// 3x3 regions from the top left
+		ULONG	ulFrames[9];			// frames read until the region was shown
+		ULONG	ulRegionTime[9];		// usec
+		BOOL	bFresh[9];				// FALSE if no frame of the region was read
+		NK_UINT_64	ullTotalTime;
+	} FocusMap, *LPFocusMap;
+
+	typedef struct tagMovieStats
+	{
+		NK_UINT_64	ullTotal;			// size of the movie
+		NK_UINT_64	ullResumed;			// bytes already in the file when the download started
+		NK_UINT_64	ullRead;				// bytes read from the camera
+		NK_UINT_64	ullWritten;			// bytes written to the file
+		NK_UINT_64	ullReadTime;		// usec spent in GetArray
+		NK_UINT_64	ullWriteTime;		// usec spent in writing
+		NK_UINT_64	ullElapsed;			// usec
+		ULONG	ulBlocks;
+		ULONG	ulBlockSize;			// block size chosen by the tuner
+		ULONG	ulReaderWaits;			// times the reader waited for a free buffer
+		ULONG	ulWriterWaits;			// times the writer waited for a block
+	} MovieStats, *LPMovieStats;
+
+	typedef struct tagMovieTrack
+	{
+		ULONG	ulTrackID;
+		ULONG	ulHandler;				// 'vide', 'soun', 'tmcd' ...
+		ULONG	ulCodec;					// format of the first sample description
+		ULONG	ulWidth;					// pixels, from tkhd
+		ULONG	ulHeight;
+		ULONG	ulTimeScale;			// from mdhd
+		NK_UINT_64	ullDuration;		// in ulTimeScale
+		ULONG	ulSampleRate;			// Hz, sound only
+		ULONG	ulTimecodeFlags;		// tmcd only. bit 0 is drop frame
+		ULONG	ulFrameRate;			// tmcd only. frames per second of the timecode
+		NK_UINT_64	ullFirstChunk;		// file offset of the first chunk
+	} MovieTrack, *LPMovieTrack;
+
+	// State of the streaming box parser. It has no pointer, so it is saved with the checkpoint.
+	typedef struct tagMovieIndex
+	{
+		NK_UINT_64	ullPosition;		// bytes parsed
+		ULONG	ulState;
+		UCHAR	ucHeader[16];			// header of the current box
+		ULONG	ulHeaderBytes;
+		ULONG	ulBoxType;
+		NK_UINT_64	ullBoxEnd;
+		ULONG	ulDepth;					// containers the current box is in
+		ULONG	ulContainerType[MOVIE_INDEX_DEPTH];
+		NK_UINT_64	ullContainerEnd[MOVIE_INDEX_DEPTH];
+		UCHAR	ucCapture[MOVIE_INDEX_CAPTURE];	// the start of the payload of the current box
+		ULONG	ulCaptureBytes;
+		ULONG	ulCaptureSize;
+		ULONG	ulBrand;					// major brand of ftyp
+		ULONG	ulTimeScale;			// from mvhd
+		NK_UINT_64	ullDuration;		// in ulTimeScale
+		NK_UINT_64	ullMoovOffset;
+		NK_UINT_64	ullMoovSize;
+		NK_UINT_64	ullMdatOffset;
+		NK_UINT_64	ullMdatSize;		// 0 if mdat runs to the end of the file
+		ULONG	ulTracks;				// stTrack[ulTracks] is the track being parsed
+		BOOL	bInTrack;
+		MovieTrack	stTrack[MOVIE_INDEX_TRACKS];
+		NK_UINT_64	ullTimecodeOffset;	// offset of the first timecode sample, 0 if unknown
+		UCHAR	ucTimecode[4];			// the first timecode sample
+		ULONG	ulTimecodeBytes;
+	} MovieIndex, *LPMovieIndex;
+
+	typedef struct tagMovieCheckpoint
+	{
+		ULONG	ulItemID;
+		NK_UINT_64	ullItemKey;			// hash of Name, DateTime and StoredBytes of the item
+		NK_UINT_64	ullTotal;			// size of the movie
+		NK_UINT_64	ullOffset;			// bytes flushed to the file
+		NK_UINT_64	ullTailHash;		// hash of the bytes just before ullOffset
+		MovieIndex	stIndex;				// the box parser at ullOffset
+	} MovieCheckpoint, *LPMovieCheckpoint;
+
+	typedef struct tagOffloadEntry
+	{
+		ULONG	ulItemID;
+		NK_UINT_64	ullSize;				// bytes the camera has not sent yet
+		NkMAIDDateTime	stDateTime;		// DateTime of the item
+		ULONG	ulIndexOfMov;			// GetRecordingInfo of the video object
+		ULONG	ulTotalMovCount;
+		NK_UINT_64	ullTotalMovSize;
+	} OffloadEntry, *LPOffloadEntry;
+
 	typedef struct tagPSDFileHeader
 	{
 		char	type[5];
@@ -79,6 +786,9 @@
 
 #pragma pack(pop)
 
+typedef void	(*LPLiveViewProc)( LPLiveViewFrame pFrame, LPVOID pContext );
+typedef BOOL	(*LPLiveViewControlProc)( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+
 
 /////////////////////////////////////////////////////////////////////////////
 // Prototype
@@ -112,6 +822,7 @@ void	CALLPASCAL CALLBACK ProgressProc( ULONG ulCommand, ULONG ulParam, NKREF ref
 ULONG	CALLPASCAL CALLBACK UIRequestProc( NKREF ref, LPNkMAIDUIRequestInfo pUIRequest );
 void	CALLPASCAL CALLBACK CompletionProc( LPNkMAIDObject pObject, ULONG ulCommand, ULONG ulParam, ULONG ulDataType, NKPARAM data, NKREF refComplete, NKERROR nResult );
 NKERROR	CALLPASCAL CALLBACK DataProc( NKREF ref, LPVOID pDataInfo, LPVOID pData );
+BOOL	MakeDataFileName( ULONG ulObjType, ULONG ulFileDataType, BOOL bRawImage, char* pszFileName );
 
 void	InitRefObj( LPRefObj pRef );
 BOOL	Search_Module( void* Path );
@@ -151,6 +862,9 @@ BOOL	SetBoolCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	SetIntegerCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	SetUnsignedCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	GetUnsignedCapability( LPRefObj pRefObj, ULONG ulCapID, ULONG* pulValue );
+BOOL	GetEnumUnsignedCapability( LPRefObj pRefObj, ULONG ulCapID, ULONG* pulValue, ULONG* pulIndex, BOOL bFind );
+BOOL	SetEnumUnsignedValue( LPRefObj pRefObj, ULONG ulCapID, ULONG ulValue );
+BOOL	SetEnumIndex( LPRefObj pRefObj, ULONG ulCapID, ULONG ulIndex );
 BOOL	SetStringCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	SetSizeCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	SetDateTimeCapability( LPRefObj pRefObj, ULONG ulCapID );
@@ -186,11 +900,232 @@ BOOL	IssueProcess( LPRefObj pRefSrc, ULONG ulCapID );
 BOOL	IssueProcessSync( LPRefObj pRefSrc, ULONG ulCapID );
 BOOL	IssueAcquire( LPRefObj pRefDat );
 BOOL	GetVideoImageExCapability(LPRefObj pRefDat, ULONG ulCapID);
-BOOL	IssueThumbnail( LPRefObj pRefSrc );
+BOOL	IssueThumbnail( LPRefObj pRefSrc, ULONG ulWindow );
+BOOL	StartThumbnailSlot( LPRefObj pRefSrc, ULONG ulItemID, LPRefThumbSlot pSlot, BOOL* pbCached );
+BOOL	FinishThumbnailSlot( LPRefObj pRefSrc, LPRefThumbSlot pSlot );
 BOOL	SetPointCapability( LPRefObj pRefObj, ULONG ulCapID );
 BOOL	TerminateCaptureCapability( LPRefObj pRefSrc );
 BOOL	GetRecordingInfoCapability(LPRefObj pRefObj);
 
+NK_UINT_64	GetThumbCacheUsed( LPThumbCacheHeader pHeader );
+void	ResetThumbCache( void );
+BOOL	NextThumbCacheRecord( NK_UINT_64* pullPos, NK_UINT_64* pullLeft, LPThumbCacheRecord* ppRecord );
+ULONG	FindThumbCacheIndex( NK_UINT_64 ullKey );
+BOOL	SetThumbCacheIndex( NK_UINT_64 ullKey, NK_UINT_64 ullPos );
+void	RemoveThumbCacheIndex( NK_UINT_64 ullKey, NK_UINT_64 ullPos );
+BOOL	OpenThumbCache( const char* pszFileName, NK_UINT_64 ullBudget );
+BOOL	CloseThumbCache( void );
+NK_UINT_64	HashThumbCacheKey( NK_UINT_64 ullHash, const void* pData, ULONG ulSize );
+BOOL	GetThumbCacheKey( LPRefObj pRefItm, NK_UINT_64* pullKey );
+LPThumbCacheRecord	LookupThumbCache( NK_UINT_64 ullKey );
+BOOL	StoreThumbCache( NK_UINT_64 ullKey, ULONG ulFileDataType, LPVOID pData, ULONG ulLength );
+BOOL	SaveThumbCache( NK_UINT_64 ullKey );
+NK_UINT_64	GetProgressTime( void );
+void	UpdateProgress( NKREF refProc, ULONG ulCommand, ULONG ulParam, ULONG ulDone, ULONG ulTotal );
+void	AddProgressBytes( NKREF refProc, ULONG ulBytes );
+void	FinishProgress( NKREF refProc, ULONG ulCommand, ULONG ulParam );
+ULONG	GetProgressSnapshot( LPProgressInfo pInfo, ULONG ulMax );
+void	ReleaseProgress( ULONG ulIndex );
+BOOL	StartProgressRenderer( ULONG ulInterval );
+BOOL	StopProgressRenderer( void );
+BOOL	IsProgressRendering( void );
+LPVOID	GetWriterBuffer( void );
+void	ReleaseWriterBuffer( LPVOID pBuffer );
+void	FreeWriterPool( void );
+BOOL	FlushDataWriter( LPDataWriter pWriter, ULONG ulLength );
+BOOL	OpenDataWriter( LPDataWriter pWriter, const char* pszFileName, NK_UINT_64 ullTotal );
+BOOL	WriteDataWriter( LPDataWriter pWriter, const void* pData, ULONG ulLength );
+BOOL	ResumeDataWriter( LPDataWriter pWriter, const char* pszFileName, NK_UINT_64 ullOffset );
+BOOL	SyncDataWriter( LPDataWriter pWriter );
+BOOL	CloseDataWriter( LPDataWriter pWriter );
+BOOL	SetWriteModeMenu( void );
+ULONG	GetSinkKind( ULONG ulRoute );
+ULONG	GetDataSinkRoute( ULONG ulObjType );
+void	DisconnectSinkStream( ULONG ulRoute );
+BOOL	ConnectSinkStream( ULONG ulRoute );
+BOOL	WriteSinkStream( ULONG ulRoute, const void* pData, ULONG ulLength );
+BOOL	SendSinkRecord( LPDataSink pSink, ULONG ulType, NK_UINT_64 ullOffset, const void* pData, ULONG ulLength );
+BOOL	ResumeDataSink( LPDataSink pSink, ULONG ulRoute, const char* pszName, NK_UINT_64 ullTotal, NK_UINT_64 ullOffset );
+BOOL	OpenDataSink( LPDataSink pSink, ULONG ulRoute, const char* pszName, NK_UINT_64 ullTotal );
+BOOL	WriteDataSink( LPDataSink pSink, NK_UINT_64 ullOffset, const void* pData, ULONG ulLength );
+BOOL	SyncDataSink( LPDataSink pSink );
+BOOL	CommitDataSink( LPDataSink pSink );
+void	AbortDataSink( LPDataSink pSink );
+BOOL	SaveDataSink( ULONG ulRoute, const char* pszName, const void* pData, ULONG ulLength );
+void	CloseSinkStreams( void );
+BOOL	SetSinkRoute( ULONG ulRoute, ULONG ulKind, const char* pszTarget );
+BOOL	SinkMenu( void );
+BOOL	WriteManifest( const char* pszState, const char* pszFileName, NK_UINT_64 ullSize, BOOL bSync );
+BOOL	WriteManifestInfo( const char* pszFileName, NK_UINT_64 ullSize, const char* pszInfo );
+void	CloseManifest( void );
+BOOL	StartSyncer( void );
+BOOL	StopSyncer( void );
+BOOL	DrainSyncer( void );
+BOOL	CommitDataWriter( LPDataWriter pWriter );
+BOOL	BenchmarkWriter( void );
+NK_UINT_64	GetHostTimeUs( void );
+SLONG	AddLiveViewConsumer( const char* pszName, LPLiveViewProc pfnFrame, LPVOID pContext );
+void	RemoveLiveViewConsumer( SLONG lIndex );
+BOOL	GetLiveViewConsumerStats( SLONG lIndex, NK_UINT_64* pullFrames, NK_UINT_64* pullDropped );
+void	GetLiveViewStats( LPLiveViewStats pStats );
+BOOL	ReadLiveViewImage( LPRefObj pRefSrc, LPLiveViewFrame pFrame );
+BOOL	RunLiveView( LPRefObj pRefSrc, ULONG ulFps, ULONG ulSeconds, LPLiveViewControlProc pfnControl, LPVOID pContext );
+LPLiveViewFrame	GrabLiveViewFrame( LPRefObj pRefSrc );
+void	ReleaseLiveViewFrame( LPLiveViewFrame pFrame );
+void	FreeLiveViewRing( void );
+BOOL	LiveViewStatsControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	StartRemoteLiveView( LPRefObj pRefSrc, ULONG* pulSaved );
+BOOL	StopRemoteLiveView( LPRefObj pRefSrc, ULONG ulSaved );
+BOOL	LiveViewStreamMenu( LPRefObj pRefSrc );
+BOOL	ParseLiveViewHeader( const unsigned char* pucData, ULONG ulSize, LPLiveViewHeader pHeader );
+void	GetLiveViewVersion( LPLiveViewHeader pHeader, UWORD* pwMajor, UWORD* pwMinor );
+void	GetLiveViewImageSize( LPLiveViewHeader pHeader, UWORD* pwWholeWidth, UWORD* pwWholeHeight, UWORD* pwImageWidth, UWORD* pwImageHeight );
+void	GetLiveViewDisplayArea( LPLiveViewHeader pHeader, LPLiveViewRect pRect );
+BOOL	GetLiveViewAFFrame( LPLiveViewHeader pHeader, ULONG ulIndex, LPLiveViewRect pRect );
+void	GetLiveViewFocusState( LPLiveViewHeader pHeader, LPLiveViewFocusState pState );
+void	GetLiveViewLevel( LPLiveViewHeader pHeader, UCHAR* pucRotation, SLONG* plRolling, SLONG* plPitching, SLONG* plYawing );
+void	GetLiveViewMovieState( LPLiveViewHeader pHeader, LPLiveViewMovieState pState );
+void	GetLiveViewExposureState( LPLiveViewHeader pHeader, UCHAR* pucQuality, UCHAR* pucSpotWB, UCHAR* pucWBForLiveView );
+void	PrintLiveViewHeader( LPLiveViewHeader pHeader );
+BOOL	OpenAviWriter( LPAviWriter pAvi, const char* pszBaseName );
+BOOL	WriteAviFrame( LPAviWriter pAvi, LPLiveViewFrame pFrame );
+BOOL	CloseAviWriter( LPAviWriter pAvi );
+void	AviWriterConsumer( LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	LiveViewRecordMenu( LPRefObj pRefSrc );
+BOOL	DecodeJpegLuma( const unsigned char* pucJpeg, ULONG ulSize, ULONG ulScale, LPJpegLuma pLuma );
+void	FreeJpegLuma( LPJpegLuma pLuma );
+void	SumLaplacian( const UCHAR* pucLuma, ULONG ulStride, ULONG ulWidth, ULONG ulHeight,
+						ULONG ulLeft, ULONG ulTop, ULONG ulRight, ULONG ulBottom, LPLaplacianSums pSums );
+float	GetLaplacianVariance( LPLaplacianSums pSums );
+void	ScoreSharpness( LPJpegLuma pLuma, LPSharpnessSample pSample );
+BOOL	MeasureSharpness( LPLiveViewFrame pFrame, ULONG ulScale, LPJpegLuma pLuma, LPSharpnessSample pSample );
+void	AddSharpnessSample( LPSharpnessSample pSample );
+ULONG	GetSharpnessSeries( LPSharpnessSample pSamples, ULONG ulMax );
+BOOL	GetLatestSharpness( LPSharpnessSample pSample );
+BOOL	SavePeakingImage( LPJpegLuma pLuma, const char* pszFileName, BOOL bPeaking );
+void	SharpnessConsumer( LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	SharpnessControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	LiveViewSharpnessMenu( LPRefObj pRefSrc );
+BOOL	WaitDeviceReady( LPRefObj pRefSrc, ULONG ulTimeout );
+BOOL	DriveManualFocus( LPRefObj pRefSrc, ULONG ulDirection, ULONG ulSteps, BOOL* pbEnd );
+BOOL	MoveSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, SLONG lTarget );
+BOOL	StepSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, float fScore );
+BOOL	SoftAFControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	RunSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, ULONG ulFps, ULONG ulTimeout );
+BOOL	SoftAFMenu( LPRefObj pRefSrc );
+BOOL	IsFocusStackItem( LPFocusStack pStack, ULONG ulItemID );
+BOOL	StartFocusStackSlot( LPFocusStack pStack, LPRefObj pRefItm, LPFocusStackSlot pSlot );
+void	FinishFocusStackSlot( LPRefObj pRefSrc, LPFocusStack pStack, LPFocusStackSlot pSlot );
+ULONG	PumpFocusStack( LPRefObj pRefSrc, LPFocusStack pStack );
+BOOL	CaptureFocusStack( LPRefObj pRefSrc, LPFocusStack pStack );
+BOOL	HomeFocusStack( LPRefObj pRefSrc );
+BOOL	RunFocusStack( LPRefObj pRefSrc, LPFocusStack pStack );
+BOOL	FocusStackMenu( LPRefObj pRefSrc );
+void	SumBlockDifference( const UCHAR* pucLuma, ULONG ulStride, UCHAR* pucReference, ULONG ulBlocksX, ULONG ulBlocksY, ULONG* pulBlockSad );
+ULONG	ScoreMotion( LPMotionDetector pMotion, LPJpegLuma pLuma );
+BOOL	StartCaptureAsync( LPRefObj pRefSrc, ULONG* pulCount );
+BOOL	MotionControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+void	FreeMotionDetector( LPMotionDetector pMotion );
+BOOL	MotionTriggerMenu( LPRefObj pRefSrc );
+void	PreTriggerConsumer( LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	StartPreTrigger( NK_UINT_64 ullBudget, ULONG ulSeconds );
+BOOL	TriggerPreTrigger( const char* pszReason );
+void	StopPreTrigger( LPPreTriggerStats pStats );
+BOOL	PollEnterKey( void );
+BOOL	PreTriggerControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	PreTriggerMenu( LPRefObj pRefSrc );
+BOOL	ParseRampValue( ULONG ulCapID, const char* psz, float* pfEV );
+BOOL	ReadRampAxis( LPRefObj pRefSrc, ULONG ulCapID, LPRampAxis pAxis );
+void	LimitRampAxis( LPRampAxis pAxis, float fLow, float fHigh );
+float	GetMeanLuma( LPJpegLuma pLuma );
+float	GetRampExposure( LPExposureRamp pRamp );
+void	UpdateRampEstimate( LPExposureRamp pRamp, float fMeanLuma, NK_UINT_64 ullTime );
+LPRampAxis	PlanRampStep( LPExposureRamp pRamp, SLONG* plDelta );
+BOOL	StepRamp( LPRefObj pRefSrc, LPExposureRamp pRamp );
+BOOL	RampControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	ExposureRampMenu( LPRefObj pRefSrc );
+ULONG	SumTemplateDifference( const UCHAR* pucTemplate, const UCHAR* pucLuma, ULONG ulStride );
+void	UpdateTemplate( UCHAR* pucTemplate, const UCHAR* pucLuma, ULONG ulStride, BOOL bBlend );
+ULONG	SearchTemplate( LPSubjectTracker pTracker, SLONG lCenterX, SLONG lCenterY, ULONG ulRadius, float* pfX, float* pfY );
+void	PostTrackerUpdate( LPSubjectTracker pTracker, LPTrackerUpdate pUpdate );
+BOOL	TakeTrackerUpdate( LPTrackerUpdate pUpdate );
+void	TrackerConsumer( LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	TrackerControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext );
+BOOL	SubjectTrackerMenu( LPRefObj pRefSrc );
+BOOL	WaitFocusMapFrame( LPRefObj pRefSrc, LPLiveViewFrame pFrame, SLONG lX, SLONG lY, ULONG ulTimeout, ULONG* pulFrames );
+BOOL	RunFocusMap( LPRefObj pRefSrc, ULONG ulZoom, LPFocusMap pMap );
+void	PrintFocusMap( LPFocusMap pMap );
+BOOL	FocusMapMenu( LPRefObj pRefSrc );
+void	CheckFocusBeforeSequence( LPRefObj pRefSrc );
+BOOL	ReserveMovieBlock( ULONG ulIndex, ULONG ulSize );
+void	FreeMoviePool( void );
+void	UpdateMovieTail( const UCHAR* pucData, ULONG ulSize );
+NK_UINT_64	HashMovieTail( void );
+BOOL	SaveMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint );
+BOOL	LoadMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint );
+void	RemoveMovieCheckpoint( const char* pszFileName );
+BOOL	MatchMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint );
+BOOL	PrepareMovieDownload( LPRefObj pRefDat, ULONG ulCapID, char* pszFileName, LPMovieCheckpoint pCheckpoint );
+void	MovieWriterLoop( LPDataSink pSink, LPMovieCheckpoint pCheckpoint, LPMovieStats pStats );
+BOOL	DownloadVideoImage( LPRefObj pRefDat, ULONG ulCapID, LPMovieCheckpoint pCheckpoint, const char* pszFileName, LPMovieStats pStats );
+void	PrintMovieStats( const char* pszFileName, LPMovieStats pStats );
+void	InitMovieIndex( LPMovieIndex pIndex );
+void	SkipMovieIndex( LPMovieIndex pIndex, NK_UINT_64 ullPosition );
+void	FeedMovieIndex( LPMovieIndex pIndex, const UCHAR* pucData, ULONG ulSize );
+void	FinishMovieIndex( LPMovieIndex pIndex, const char* pszFileName, NK_UINT_64 ullFileSize );
+void	FormatMovieTimecode( LPMovieIndex pIndex, char* pszTimecode );
+BOOL	RecordMovieIndex( LPRefObj pRefSrc, LPMovieIndex pIndex, const char* pszFileName, NK_UINT_64 ullFileSize );
+LPRefObj	OpenOffloadMovie( LPRefObj pRefSrc, ULONG ulItemID, BOOL* pbItemOpened );
+void	CloseOffloadMovie( LPRefObj pRefSrc, LPRefObj pRefItm, BOOL bItemOpened );
+BOOL	ReadOffloadEntry( LPRefObj pRefSrc, ULONG ulItemID, LPOffloadEntry pEntry );
+ULONG	ListOffloadEntries( LPRefObj pRefSrc, LPOffloadEntry* ppEntries );
+int	CompareOffloadSmallest( const void* p1, const void* p2 );
+int	CompareOffloadNewest( const void* p1, const void* p2 );
+BOOL	RunOffload( LPRefObj pRefSrc, LPOffloadEntry pEntries, ULONG ulCount );
+BOOL	OffloadMenu( LPRefObj pRefSrc );
+BOOL	CreateFrameBus( const char* pszName, ULONG ulSlots, ULONG ulSlotSize );
+void	CloseFrameBus( void );
+BOOL	IsFrameBusOpen( void );
+ULONG	ReclaimFrameBusConsumers( void );
+SLONG	ReserveFrameBusSlot( ULONG ulLength );
+unsigned char*	GetFrameBusSlotData( SLONG lSlot );
+void	CancelFrameBusSlot( SLONG lSlot );
+void	NotifyFrameBus( void );
+void	PublishFrameBusSlot( SLONG lSlot, ULONG ulRoute, const char* pszName, ULONG ulLength );
+BOOL	PublishFrameBus( ULONG ulRoute, const char* pszName, const void* pData, ULONG ulLength );
+void	PrintFrameBus( void );
+BOOL	OpenFrameBusReader( LPFrameBusReader pReader, const char* pszName );
+BOOL	WaitFrameBusReader( LPFrameBusReader pReader, ULONG ulTimeout );
+BOOL	AcquireFrameBusFrame( LPFrameBusReader pReader, LPFrameBusFrame pFrame );
+void	ReleaseFrameBusFrame( LPFrameBusReader pReader, LPFrameBusFrame pFrame );
+void	CloseFrameBusReader( LPFrameBusReader pReader );
+BOOL	WatchFrameBus( const char* pszName );
+BOOL	FrameBusMenu( void );
+SLONG	ReserveMemorySinkBuffer( ULONG ulLength );
+unsigned char*	GetMemorySinkData( SLONG lBuffer );
+void	CancelMemorySinkBuffer( SLONG lBuffer );
+void	PublishMemorySinkBuffer( SLONG lBuffer, ULONG ulRoute, const char* pszName, ULONG ulLength );
+BOOL	TakeMemorySinkFrame( ULONG ulRoute, LPMemorySinkFrame pFrame );
+void	ReleaseMemorySinkFrame( LPMemorySinkFrame pFrame );
+void	GetMemorySinkStats( ULONG* pulReady, NK_UINT_64* pullDropped );
+void	FreeMemorySink( void );
+void	SleepUntilHostTime( NK_UINT_64 ullTime );
+BOOL	InitIntervalometer( LPIntervalometer pInterval, NK_UINT_64 ullPeriod, ULONG ulShots, ULONG ulPolicy, NK_UINT_64 ullDelay );
+void	FreeIntervalometer( LPIntervalometer pInterval );
+BOOL	WaitIntervalPoint( LPRefObj pRefSrc, NK_UINT_64 ullDeadline );
+BOOL	WaitIntervalCompletion( LPRefObj pRefSrc, LPIntervalometer pInterval );
+BOOL	FireIntervalPoint( LPRefObj pRefSrc, LPIntervalometer pInterval, ULONG ulPoint, NK_UINT_64 ullDeadline );
+BOOL	RunIntervalometer( LPRefObj pRefSrc, LPIntervalometer pInterval );
+int	CompareIntervalLate( const void* p1, const void* p2 );
+void	GetIntervalStats( LPIntervalometer pInterval, LPIntervalStats pStats );
+void	PrintIntervalStats( LPIntervalStats pStats );
+BOOL	IntervalometerMenu( LPRefObj pRefSrc );
+#if defined( _WIN32 )
+	BOOL WINAPI	cancelhandler(DWORD dwCtrlType);
+#elif defined(__APPLE__)
+	void	cancelhandler(int sig);
+#endif
+
 LPNkMAIDCapInfo	GetCapInfo( LPRefObj pRef, ULONG ulID );
 BOOL	CheckCapabilityOperation( LPRefObj pRef, ULONG ulID, ULONG ulOperations );
 LPRefObj	GetRefChildPtr_Index( LPRefObj pRefParent, ULONG ulIndex );
@@ -202,7 +1137,12 @@ LPRefObj	GetRefChildPtr_ID( LPRefObj pRefParent, SLONG lIDChild );
 
 extern LPMAIDEntryPointProc	g_pMAIDEntryPoint;
 extern UCHAR	g_bFileRemoved;
-extern BOOL		g_bFirstCall;	// used in ProgressProc, and DoDeleteDramImage
+extern BOOL	g_bCancel;
+extern ThumbCache	g_stThumbCache;
+extern ULONG	g_ulWriteMode;
+extern ULONG	g_ulWriteSync;
+extern ULONG	g_ulSyncGroupFiles;
+extern ULONG	g_ulSyncGroupInterval;
 #if defined( _WIN32 )
 	extern HINSTANCE	g_hInstModule;
 #elif defined(__APPLE__)
@@ -0,0 +1,439 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Focus stacking.
+// The focus is moved from the near limit to the far limit by kNkMAIDCapability_MFDrive, and a
+// picture is taken by kNkMAIDCapability_CaptureAsync at every position. The pictures must be saved
+// in SDRAM. The download of a picture is started as soon as its item is added, and it goes on while
+// the focus is moved and the next picture is taken, because all of them are driven by the Async of
+// the source object. The positions are counted in the steps of MFDriveStep, from the closest end of
+// the lens or from the position where the stack started.
+// Every stack has a manifest that lists the position, the timings and the file of each shot.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define STACK_SHOT_MAX			999
+#define STACK_HOME_MOVE_MAX		32			// moves of the maximum step to reach the closest end
+#define STACK_ITEM_TIMEOUT		30000		// msec to wait for the last items after the last shot
+#define STACK_CAPTURE_TIMEOUT	60000		// msec to wait for a CaptureAsync
+#define STACK_ABORT_TIMEOUT		10000		// msec to wait for the aborted commands at the end of the stack
+
+// counts up the commands given up at the end of the stack, when their CompletionProc comes after all.
+ULONG	g_ulFocusStackLost;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// check if the item was in the source before the stack or has been taken by the stack
+BOOL IsFocusStackItem( LPFocusStack pStack, ULONG ulItemID )
+{
+	ULONG i;
+	for ( i = 0; i < pStack->ulKnownCount; i++ )
+		if ( pStack->pulKnownIDs[i] == ulItemID ) return TRUE;
+	for ( i = 0; i < pStack->ulArrived; i++ )
+		if ( pStack->pShots[i].ulItemID == ulItemID ) return TRUE;
+	return FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Start the download of the image of an item that was added by a shot.
+BOOL StartFocusStackSlot( LPFocusStack pStack, LPRefObj pRefItm, LPFocusStackSlot pSlot )
+{
+	BOOL	bRet;
+	NkMAIDCallback	stProc;
+	LPRefDataProc	pRefDeliver;
+	LPRefCompletionProc	pRefCompletion;
+
+	memset( pSlot, 0, sizeof(FocusStackSlot) );
+	pSlot->pRefItm = pRefItm;
+	pSlot->ulShot = pStack->ulArrived;
+	pSlot->pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Image );
+	if ( pSlot->pRefDat == NULL ) {
+		// open the image object
+		bRet = AddChild( pRefItm, kNkMAIDDataObjType_Image );
+		if ( bRet == FALSE ) return FALSE;
+		pSlot->pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Image );
+		if ( pSlot->pRefDat == NULL ) return FALSE;
+	}
+	if ( !CheckCapabilityOperation( pSlot->pRefDat, kNkMAIDCapability_DataProc, kNkMAIDCapOperation_Set ) ) return FALSE;
+
+	pRefDeliver = (LPRefDataProc)malloc( sizeof(RefDataProc) );// this block will be freed in CompletionProc.
+	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
+	if ( pRefDeliver == NULL || pRefCompletion == NULL ) {
+		puts( "There is not enough memory." );
+		if ( pRefDeliver != NULL ) free( pRefDeliver );
+		if ( pRefCompletion != NULL ) free( pRefCompletion );
+		return FALSE;
+	}
+	pRefDeliver->pBuffer = NULL;
+	pRefDeliver->ulOffset = 0L;
+	pRefDeliver->ulTotalLines = 0L;
+	pRefDeliver->lID = pRefItm->lMyID;
+	pRefDeliver->ullCacheKey = 0;
+	pRefDeliver->refProgress = (NKREF)pSlot->pRefDat;
+	pRefDeliver->pSink = NULL;
+	pRefDeliver->pszFileName = pSlot->szFileName;
+	pRefCompletion->pulCount = &pSlot->ulCount;
+	pRefCompletion->pRef = pRefDeliver;
+	pSlot->pRefCompletion = pRefCompletion;
+
+	stProc.pProc = (LPNKFUNC)DataProc;
+	stProc.refProc = (NKREF)pRefDeliver;
+	bRet = Command_CapSet( pSlot->pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_CallbackPtr, (NKPARAM)&stProc, NULL, NULL );
+	if ( bRet == FALSE ) {
+		free( pRefDeliver );
+		free( pRefCompletion );
+		return FALSE;
+	}
+	bRet = Command_CapStart( pSlot->pRefDat->pObject, kNkMAIDCapability_Acquire, (LPNKFUNC)CompletionProc, (NKREF)pRefCompletion, NULL );
+	if ( bRet == FALSE ) return FALSE;
+	pSlot->bBusy = TRUE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Record the shot whose download has completed, and close its item.
+void FinishFocusStackSlot( LPRefObj pRefSrc, LPFocusStack pStack, LPFocusStackSlot pSlot )
+{
+	LPFocusStackShot pShot = &pStack->pShots[pSlot->ulShot];
+
+	Command_CapSet( pSlot->pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_Null, (NKPARAM)NULL, NULL, NULL );
+	pShot->ullSaved = GetHostTimeUs();
+	strcpy( pShot->szFileName, pSlot->szFileName );
+	if ( pShot->szFileName[0] != '\0' )
+		pStack->ulSaved++;
+	else
+		pStack->ulFailed++;
+	if ( pStack->pManifest != NULL ) {
+		fprintf( pStack->pManifest, "%u\t%d\t0x%08X\t%llu\t%llu\t%llu\t%llu\t%s\n", (unsigned)pSlot->ulShot, (int)pShot->lPosition,
+					(unsigned)pShot->ulItemID,
+					(unsigned long long)( ( pShot->ullMoveEnd - pShot->ullMoveStart ) / 1000 ),
+					(unsigned long long)( ( pShot->ullCaptureEnd - pShot->ullCaptureStart ) / 1000 ),
+					(unsigned long long)( ( pShot->ullArrived - pStack->ullStartTime ) / 1000 ),
+					(unsigned long long)( ( pShot->ullSaved - pStack->ullStartTime ) / 1000 ),
+					pShot->szFileName[0] != '\0' ? pShot->szFileName : "(failed)" );
+		fflush( pStack->pManifest );
+	}
+	RemoveChild( pRefSrc, pSlot->pRefItm->lMyID );
+	memset( pSlot, 0, sizeof(FocusStackSlot) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Drive the transfers, start the downloads of the new items and reap the completed ones.
+// Returns the number of downloads that completed.
+ULONG PumpFocusStack( LPRefObj pRefSrc, LPFocusStack pStack )
+{
+	ULONG i, j, ulReaped = 0;
+	LPRefObj pRefItm;
+
+	Command_Async( pRefSrc->pObject );
+
+	for ( i = 0; i < pStack->ulWindow; i++ ) {
+		if ( pStack->stSlots[i].bBusy == TRUE && pStack->stSlots[i].ulCount > 0 ) {
+			FinishFocusStackSlot( pRefSrc, pStack, &pStack->stSlots[i] );
+			ulReaped++;
+		}
+	}
+
+	// The items are added by SrcEventProc while Async runs.
+	for ( j = 0; j < pRefSrc->ulChildCount && pStack->ulArrived < pStack->ulShots; j++ ) {
+		pRefItm = GetRefChildPtr_Index( pRefSrc, j );
+		if ( pRefItm == NULL || IsFocusStackItem( pStack, (ULONG)pRefItm->lMyID ) == TRUE ) continue;
+		for ( i = 0; i < pStack->ulWindow; i++ )
+			if ( pStack->stSlots[i].bBusy == FALSE ) break;
+		// All downloads are busy. The item is taken at the next pump.
+		if ( i == pStack->ulWindow ) break;
+		pStack->pShots[pStack->ulArrived].ulItemID = (ULONG)pRefItm->lMyID;
+		pStack->pShots[pStack->ulArrived].ullArrived = GetHostTimeUs();
+		if ( StartFocusStackSlot( pStack, pRefItm, &pStack->stSlots[i] ) == FALSE ) {
+			printf( "Failed in starting the download of the item(ID=0x%X).\n", (ULONG)pRefItm->lMyID );
+			pStack->ulFailed++;
+			memset( &pStack->stSlots[i], 0, sizeof(FocusStackSlot) );
+		}
+		pStack->ulArrived++;
+	}
+	return ulReaped;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take a picture, and drive the downloads until the capture completes.
+// Returns FALSE if it was canceled or did not complete in time. The capture is aborted then.
+BOOL CaptureFocusStack( LPRefObj pRefSrc, LPFocusStack pStack )
+{
+	NK_UINT_64	ullDeadline;
+	LPRefCompletionProc pRefCompletion;
+
+	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
+	if ( pRefCompletion == NULL ) return FALSE;
+	pRefCompletion->pulCount = &pStack->ulCaptureCount;
+	pRefCompletion->pRef = NULL;
+	pStack->pRefCapture = pRefCompletion;
+	if ( Command_CapStart( pRefSrc->pObject, kNkMAIDCapability_CaptureAsync, (LPNKFUNC)CompletionProc, (NKREF)pRefCompletion, NULL ) == FALSE )
+		return FALSE;
+	pStack->ulCaptureIssued++;
+	ullDeadline = GetHostTimeUs() + (NK_UINT_64)STACK_CAPTURE_TIMEOUT * 1000;
+	while ( pStack->ulCaptureCount < pStack->ulCaptureIssued ) {
+		if ( g_bCancel == TRUE || GetHostTimeUs() >= ullDeadline ) {
+			// Its completion is waited for at the end of the stack.
+			if ( g_bCancel == FALSE )
+				printf( "The capture did not complete in %d sec.\n", STACK_CAPTURE_TIMEOUT / 1000 );
+			Command_Abort( pRefSrc->pObject, NULL, NULL );
+			return FALSE;
+		}
+		if ( PumpFocusStack( pRefSrc, pStack ) == 0 )
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Drive the focus to the closest end of the lens.
+BOOL HomeFocusStack( LPRefObj pRefSrc )
+{
+	ULONG i;
+	BOOL bEnd = FALSE;
+
+	for ( i = 0; i < STACK_HOME_MOVE_MAX && bEnd == FALSE; i++ ) {
+		if ( DriveManualFocus( pRefSrc, kNkMAIDMFDrive_InfinityToClosest, 32767, &bEnd ) == FALSE ) return FALSE;
+	}
+	if ( bEnd == FALSE ) {
+		printf( "The closest end of the lens was not reached.\n" );
+		return FALSE;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the stack. pStack has the positions of the shots and the number of downloads in flight.
+BOOL RunFocusStack( LPRefObj pRefSrc, LPFocusStack pStack )
+{
+	LPFocusStackShot pShot;
+	SLONG lPosition = 0;
+	NK_UINT_64 ullDeadline;
+	BOOL bEnd, bRet = TRUE;
+	ULONG i;
+
+	// The items in the source before the stack are not downloaded.
+	pStack->ulKnownCount = 0;
+	if ( pRefSrc->ulChildCount > 0 ) {
+		pStack->pulKnownIDs = (ULONG*)malloc( pRefSrc->ulChildCount * sizeof(ULONG) );
+		if ( pStack->pulKnownIDs == NULL ) return FALSE;
+		for ( i = 0; i < pRefSrc->ulChildCount; i++ ) {
+			LPRefObj pRefItm = GetRefChildPtr_Index( pRefSrc, i );
+			if ( pRefItm != NULL ) pStack->pulKnownIDs[pStack->ulKnownCount++] = (ULONG)pRefItm->lMyID;
+		}
+	}
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+
+	pStack->ullStartTime = GetHostTimeUs();
+	if ( pStack->bHome == TRUE )
+		bRet = HomeFocusStack( pRefSrc );
+	pStack->ullHomeTime = GetHostTimeUs() - pStack->ullStartTime;
+
+	for ( i = 0; i < pStack->ulShots && bRet == TRUE && g_bCancel == FALSE; i++ ) {
+		pShot = &pStack->pShots[i];
+		pShot->ullMoveStart = GetHostTimeUs();
+		if ( pShot->lPosition != lPosition ) {
+			// The transfers go on while MFDrive waits for its completion.
+			bRet = DriveManualFocus( pRefSrc, pShot->lPosition > lPosition ? kNkMAIDMFDrive_ClosestToInfinity : kNkMAIDMFDrive_InfinityToClosest,
+										(ULONG)( pShot->lPosition > lPosition ? pShot->lPosition - lPosition : lPosition - pShot->lPosition ), &bEnd );
+			lPosition = pShot->lPosition;
+			if ( bRet == TRUE && bEnd == TRUE )
+				printf( "The lens reached the end at the shot %u.\n", (unsigned)i );
+		}
+		pShot->ullMoveEnd = GetHostTimeUs();
+		pStack->ullMoveTime += pShot->ullMoveEnd - pShot->ullMoveStart;
+		if ( bRet == FALSE ) break;
+
+		pShot->ullCaptureStart = GetHostTimeUs();
+		bRet = CaptureFocusStack( pRefSrc, pStack );
+		pShot->ullCaptureEnd = GetHostTimeUs();
+		pStack->ullCaptureTime += pShot->ullCaptureEnd - pShot->ullCaptureStart;
+		if ( bRet == FALSE ) break;
+		pStack->ulCaptured++;
+		PumpFocusStack( pRefSrc, pStack );
+	}
+	pStack->ullShotTime = GetHostTimeUs() - pStack->ullStartTime;
+
+	// wait for the items and the downloads of the last shots.
+	ullDeadline = GetHostTimeUs() + (NK_UINT_64)STACK_ITEM_TIMEOUT * 1000;
+	while ( GetHostTimeUs() < ullDeadline ) {
+		BOOL bBusy = FALSE;
+		for ( i = 0; i < pStack->ulWindow; i++ )
+			if ( pStack->stSlots[i].bBusy == TRUE ) bBusy = TRUE;
+		if ( bBusy == FALSE && pStack->ulArrived >= pStack->ulCaptured ) break;
+		if ( PumpFocusStack( pRefSrc, pStack ) == 0 )
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	// Abort the downloads still in flight. CompletionProc of an aborted download counts up its slot in pStack and
+	// frees the blocks given to DataProc, so the slot is finished only after it was called.
+	// The same holds for a capture aborted by CaptureFocusStack.
+	ULONG ulAborted = 0;
+	for ( i = 0; i < pStack->ulWindow; i++ ) {
+		if ( pStack->stSlots[i].bBusy == TRUE ) {
+			Command_Abort( pStack->stSlots[i].pRefDat->pObject, NULL, NULL );
+			ulAborted++;
+		}
+	}
+	ullDeadline = GetHostTimeUs() + (NK_UINT_64)STACK_ABORT_TIMEOUT * 1000;
+	while ( ( ulAborted > 0 || pStack->ulCaptureCount < pStack->ulCaptureIssued ) && GetHostTimeUs() < ullDeadline ) {
+		Command_Async( pRefSrc->pObject );
+		for ( i = 0; i < pStack->ulWindow; i++ ) {
+			if ( pStack->stSlots[i].bBusy == TRUE && pStack->stSlots[i].ulCount > 0 ) {
+				FinishFocusStackSlot( pRefSrc, pStack, &pStack->stSlots[i] );
+				ulAborted--;
+			}
+		}
+		if ( ulAborted > 0 || pStack->ulCaptureCount < pStack->ulCaptureIssued )
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	}
+	// The commands that did not complete are given up. Their CompletionProc may still come later, after pStack is gone,
+	// so it counts up g_ulFocusStackLost instead, and their items are left open.
+	if ( ulAborted > 0 || pStack->ulCaptureCount < pStack->ulCaptureIssued ) {
+		printf( "%u downloads and %u captures did not complete in %d sec after they were aborted.\n", (unsigned)ulAborted,
+				(unsigned)( pStack->ulCaptureIssued - pStack->ulCaptureCount ), STACK_ABORT_TIMEOUT / 1000 );
+		for ( i = 0; i < pStack->ulWindow; i++ ) {
+			LPFocusStackSlot pSlot = &pStack->stSlots[i];
+			if ( pSlot->bBusy == FALSE ) continue;
+			printf( "The download of shot %u (item 0x%08X) was not finished.\n", (unsigned)pSlot->ulShot, (unsigned)pSlot->pRefItm->lMyID );
+			pSlot->pRefCompletion->pulCount = &g_ulFocusStackLost;
+			((LPRefDataProc)pSlot->pRefCompletion->pRef)->pszFileName = NULL;
+			pStack->ulFailed++;
+			memset( pSlot, 0, sizeof(FocusStackSlot) );
+		}
+		if ( pStack->ulCaptureCount < pStack->ulCaptureIssued )
+			pStack->pRefCapture->pulCount = &g_ulFocusStackLost;
+		bRet = FALSE;
+	}
+	pStack->ullTotalTime = GetHostTimeUs() - pStack->ullStartTime;
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	if ( g_bCancel == TRUE )
+		printf( "The stack was canceled.\n" );
+	g_bCancel = FALSE;
+	// The items were closed by the stack.
+	g_bFileRemoved = FALSE;
+
+	if ( pStack->pulKnownIDs != NULL ) {
+		free( pStack->pulKnownIDs );
+		pStack->pulKnownIDs = NULL;
+	}
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take a focus stack with the settings input by the user.
+BOOL FocusStackMenu( LPRefObj pRefSrc )
+{
+	char	buf[256], szManifest[64];
+	FocusStack	stStack;
+	SLONG	lNear, lFar;
+	ULONG	ulValue, ulStep, ulSaved, i;
+	FILE*	hFile;
+	BOOL	bRet;
+
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_MFDrive, kNkMAIDCapOperation_Set ) ) {
+		printf( "MFDrive is not supported.\n" );
+		return TRUE;
+	}
+	if ( GetUnsignedCapability( pRefSrc, kNkMAIDCapability_SaveMedia, &ulValue ) == TRUE && ulValue == 0 ) {
+		printf( "SaveMedia is Card. Please set SaveMedia to SDRAM to download the shots.\n" );
+		return TRUE;
+	}
+
+	memset( &stStack, 0, sizeof(stStack) );
+	printf( "Select the origin of the positions (1: The closest end of the lens, 2: The current position)\n>" );
+	scanf( "%s", buf );
+	stStack.bHome = ( atoi( buf ) == 2 ) ? FALSE : TRUE;
+	printf( "Input the near limit in steps of MFDrive\n>" );
+	scanf( "%s", buf );
+	lNear = atoi( buf );
+	printf( "Input the far limit in steps of MFDrive\n>" );
+	scanf( "%s", buf );
+	lFar = atoi( buf );
+	if ( lFar < lNear ) {
+		printf( "The far limit must not be nearer than the near limit.\n" );
+		return TRUE;
+	}
+	printf( "Input the number of shots (2-%d, 0: input the step between the shots)\n>", STACK_SHOT_MAX );
+	scanf( "%s", buf );
+	stStack.ulShots = atoi( buf );
+	if ( stStack.ulShots == 0 ) {
+		printf( "Input the step between the shots (the depth of field in steps of MFDrive)\n>" );
+		scanf( "%s", buf );
+		ulStep = atoi( buf );
+		if ( ulStep == 0 ) ulStep = 1;
+		stStack.ulShots = (ULONG)( lFar - lNear ) / ulStep + 1;
+		if ( (ULONG)( lFar - lNear ) % ulStep != 0 ) stStack.ulShots++;
+	}
+	if ( stStack.ulShots < 2 ) stStack.ulShots = 2;
+	if ( stStack.ulShots > STACK_SHOT_MAX ) stStack.ulShots = STACK_SHOT_MAX;
+	printf( "Input the number of downloads in flight (1-%d, 0: 2)\n>", FOCUS_STACK_WINDOW_MAX );
+	scanf( "%s", buf );
+	stStack.ulWindow = atoi( buf );
+	if ( stStack.ulWindow == 0 ) stStack.ulWindow = 2;
+	if ( stStack.ulWindow > FOCUS_STACK_WINDOW_MAX ) stStack.ulWindow = FOCUS_STACK_WINDOW_MAX;
+
+	stStack.pShots = (LPFocusStackShot)calloc( stStack.ulShots, sizeof(FocusStackShot) );
+	if ( stStack.pShots == NULL ) return FALSE;
+	for ( i = 0; i < stStack.ulShots; i++ )
+		stStack.pShots[i].lPosition = lNear + (SLONG)( ( (NK_UINT_64)( lFar - lNear ) * i + ( stStack.ulShots - 1 ) / 2 ) / ( stStack.ulShots - 1 ) );
+
+	// The manifest of the stack is not overwritten.
+	for ( i = 1; i < 1000; i++ ) {
+		sprintf( szManifest, "Stack%03u.txt", (unsigned)i );
+		if ( ( hFile = fopen( szManifest, "r" ) ) == NULL ) break;
+		fclose( hFile );
+	}
+	stStack.pManifest = fopen( szManifest, "w" );
+	if ( stStack.pManifest != NULL ) {
+		fprintf( stStack.pManifest, "# origin %s, near %d, far %d, %u shots\n", stStack.bHome == TRUE ? "closest end" : "current position",
+					(int)lNear, (int)lFar, (unsigned)stStack.ulShots );
+		fprintf( stStack.pManifest, "# shot\tposition\titem\tmove_ms\tcapture_ms\tadded_ms\tsaved_ms\tfile\n" );
+	}
+
+	// MFDrive works only in the live view.
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		if ( stStack.pManifest != NULL ) fclose( stStack.pManifest );
+		free( stStack.pShots );
+		return FALSE;
+	}
+	printf( "Taking %u shots from %d to %d. Please press the Ctrl+C to stop.\n", (unsigned)stStack.ulShots, (int)lNear, (int)lFar );
+	bRet = RunFocusStack( pRefSrc, &stStack );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+
+	printf( "%u shots were taken, %u were saved, %u failed.\n", (unsigned)stStack.ulCaptured, (unsigned)stStack.ulSaved, (unsigned)stStack.ulFailed );
+	printf( "%llu msec in total: %llu to reach the origin, %llu to move the focus, %llu to capture, %llu to finish the downloads\n",
+			(unsigned long long)( stStack.ullTotalTime / 1000 ), (unsigned long long)( stStack.ullHomeTime / 1000 ),
+			(unsigned long long)( stStack.ullMoveTime / 1000 ), (unsigned long long)( stStack.ullCaptureTime / 1000 ),
+			(unsigned long long)( ( stStack.ullTotalTime - stStack.ullShotTime ) / 1000 ) );
+	if ( stStack.pManifest != NULL ) {
+		fprintf( stStack.pManifest, "# %u shots, %u saved, %u failed, total %llu ms, move %llu ms, capture %llu ms\n",
+					(unsigned)stStack.ulCaptured, (unsigned)stStack.ulSaved, (unsigned)stStack.ulFailed,
+					(unsigned long long)( stStack.ullTotalTime / 1000 ), (unsigned long long)( stStack.ullMoveTime / 1000 ),
+					(unsigned long long)( stStack.ullCaptureTime / 1000 ) );
+		fclose( stStack.pManifest );
+		printf( "%s was saved.\n", szManifest );
+	}
+	free( stStack.pShots );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
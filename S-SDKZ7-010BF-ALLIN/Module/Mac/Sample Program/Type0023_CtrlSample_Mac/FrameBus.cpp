@@ -0,0 +1,720 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Frame bus: a ring of slots in shared memory that hands the delivered images, thumbnails and live
+// view frames to other processes on this host without files.
+// One producer (this sample) writes the slots, and up to FRAME_BUS_CONSUMER_MAX consumers map them.
+// The bus is two shared memory segments:
+//   <name>   : a header and the data of the slots. Only the producer writes it; the consumers map it read-only.
+//   <name>.r : the holders of the slots and the consumer table, written by all processes.
+// No lock is shared between the processes. Each slot has a mask of the consumers holding it. A slot
+// is taken by the producer only when its mask is 0, by setting FRAME_BUS_WRITING with a
+// compare-and-swap; a consumer takes a slot by setting its own bit only when FRAME_BUS_WRITING is
+// not set, and checks the sequence number of the slot again afterwards. So a frame is never
+// overwritten while a consumer reads it, and the producer never waits for a consumer: if all slots
+// are held, the frame is dropped and counted. The slots of a consumer that crashed are released by
+// clearing its bit, which takes nothing from the other consumers.
+// A consumer takes the frames in order, and counts the ones that were overwritten before it came.
+// Each consumer is woken by the producer through its own notification: a FIFO on Mac, which a
+// consumer can poll with its other descriptors, and an auto-reset named event on Windows.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <signal.h>
+	#include <poll.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define FRAME_BUS_MAGIC			0x42464B4E		// "NKFB"
+#define FRAME_BUS_VERSION		2
+#define FRAME_BUS_WRITING		0x80000000		// holders of a slot the producer is writing
+#define FRAME_BUS_CLAIMING		0x80000000		// set in the pid of a consumer entry until the consumer is ready
+#define FRAME_BUS_ALIGN			4096			// alignment of the data of a slot
+
+// The segments are shared by processes, so these structures are laid out naturally and hold no pointer,
+// and their atomics must not fall back to a lock of one process. (is_always_lock_free needs C++17.)
+static_assert( ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LONG_LOCK_FREE == 2, "std::atomic<ULONG> is not lock-free" );
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && sizeof(NK_UINT_64) == sizeof(long long), "std::atomic<NK_UINT_64> is not lock-free" );
+static_assert( FRAME_BUS_CONSUMER_MAX < 32, "the holders of a slot are a bit of each consumer below FRAME_BUS_WRITING" );
+
+typedef struct tagFrameBusSlotInfo
+{
+	std::atomic<NK_UINT_64>	ullSeq;		// 0 while the slot has no frame
+	ULONG	ulRoute;					// eSinkRoute
+	ULONG	ulLength;
+	NK_UINT_64	ullTime;				// host time in usec when the frame was published
+	char	szName[64];
+} FrameBusSlotInfo;
+
+typedef struct tagFrameBusHeader
+{
+	ULONG	ulMagic;
+	ULONG	ulVersion;
+	ULONG	ulSlots;
+	ULONG	ulSlotSize;
+	NK_UINT_64	ullDataOffset;			// offset of the data of slot 0 in the segment
+	std::atomic<NK_UINT_64>	ullSeq;		// sequence number of the latest frame
+	std::atomic<NK_UINT_64>	ullDropped;	// frames dropped because all slots were held
+	FrameBusSlotInfo	stSlot[FRAME_BUS_SLOT_MAX];
+} FrameBusHeader;
+
+typedef struct tagFrameBusShared
+{
+	std::atomic<ULONG>	ulRef[FRAME_BUS_SLOT_MAX];				// bits of the consumers reading a slot, or FRAME_BUS_WRITING
+	std::atomic<ULONG>	ulConsumerPid[FRAME_BUS_CONSUMER_MAX];	// 0 if the entry is free, with FRAME_BUS_CLAIMING while it is taken
+} FrameBusShared;
+
+// the bus of the producer
+typedef struct tagFrameBus
+{
+	BOOL	bOpen;
+	char	szName[FRAME_BUS_NAME_MAX + 1];
+	FrameBusHeader*	pHeader;
+	FrameBusShared*	pShared;
+	NK_UINT_64	ullHeaderSize;
+	ULONG	ulNext;						// slot tried first by the next reservation
+	NK_UINT_64	ullPublished;
+	LPVOID	hHeader;					// handles of the file mappings on Windows
+	LPVOID	hShared;
+#if defined( _WIN32 )
+	HANDLE	hNotify[FRAME_BUS_CONSUMER_MAX];
+#elif defined(__APPLE__)
+	int	fdNotify[FRAME_BUS_CONSUMER_MAX];
+#endif
+} FrameBus;
+
+FrameBus	g_stFrameBus;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// make the name of a segment or a notification of the bus pszBus. lConsumer < 0 makes the name of a segment.
+static void MakeFrameBusPath( char* pszPath, const char* pszBus, const char* pszSuffix, SLONG lConsumer )
+{
+#if defined( _WIN32 )
+	if ( lConsumer < 0 )
+		sprintf( pszPath, "Local\\%s%s", pszBus, pszSuffix );
+	else
+		sprintf( pszPath, "Local\\%s.%d", pszBus, (int)lConsumer );
+#elif defined(__APPLE__)
+	// The name of a shared memory object is limited to 31 characters.
+	if ( lConsumer < 0 )
+		sprintf( pszPath, "/%s%s", pszBus, pszSuffix );
+	else
+		sprintf( pszPath, "/tmp/%s.%d.fifo", pszBus, (int)lConsumer );
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Create (bCreate) or open a shared memory segment, and map it. *pullSize is the size to create, and receives the size mapped.
+static LPVOID MapFrameBusSegment( const char* pszPath, BOOL bCreate, BOOL bWrite, NK_UINT_64* pullSize, LPVOID* phMap )
+{
+#if defined( _WIN32 )
+	HANDLE hMap;
+	LPVOID pView;
+	MEMORY_BASIC_INFORMATION stInfo;
+
+	if ( bCreate == TRUE ) {
+		hMap = CreateFileMappingA( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(*pullSize >> 32), (DWORD)*pullSize, pszPath );
+		if ( hMap != NULL && GetLastError() == ERROR_ALREADY_EXISTS ) {
+			printf( "%s is used by another producer.\n", pszPath );
+			CloseHandle( hMap );
+			return NULL;
+		}
+	} else {
+		hMap = OpenFileMappingA( bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, FALSE, pszPath );
+	}
+	if ( hMap == NULL ) return NULL;
+	pView = MapViewOfFile( hMap, bWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0 );
+	if ( pView == NULL ) {
+		CloseHandle( hMap );
+		return NULL;
+	}
+	VirtualQuery( pView, &stInfo, sizeof(stInfo) );
+	*pullSize = stInfo.RegionSize;
+	*phMap = hMap;
+	return pView;
+#elif defined(__APPLE__)
+	struct stat stStat;
+	LPVOID pView;
+	int fd;
+
+	*phMap = NULL;
+	if ( bCreate == TRUE ) {
+		// A segment left by a producer that crashed is removed.
+		shm_unlink( pszPath );
+		fd = shm_open( pszPath, O_RDWR | O_CREAT | O_EXCL, 0644 );
+		if ( fd < 0 ) return NULL;
+		if ( ftruncate( fd, (off_t)*pullSize ) != 0 ) {
+			close( fd );
+			shm_unlink( pszPath );
+			return NULL;
+		}
+	} else {
+		fd = shm_open( pszPath, bWrite ? O_RDWR : O_RDONLY, 0 );
+		if ( fd < 0 ) return NULL;
+		if ( fstat( fd, &stStat ) != 0 ) {
+			close( fd );
+			return NULL;
+		}
+		*pullSize = (NK_UINT_64)stStat.st_size;
+	}
+	pView = mmap( NULL, (size_t)*pullSize, bWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( pView == MAP_FAILED ) {
+		if ( bCreate == TRUE ) shm_unlink( pszPath );
+		return NULL;
+	}
+	return pView;
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// unmap a segment mapped by MapFrameBusSegment.
+static void UnmapFrameBusSegment( LPVOID pView, NK_UINT_64 ullSize, LPVOID hMap )
+{
+	if ( pView == NULL ) return;
+#if defined( _WIN32 )
+	UnmapViewOfFile( pView );
+	CloseHandle( (HANDLE)hMap );
+#elif defined(__APPLE__)
+	(void)hMap;
+	munmap( pView, (size_t)ullSize );
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return TRUE if the process of a consumer is alive.
+static BOOL IsFrameBusConsumerAlive( ULONG ulPid )
+{
+#if defined( _WIN32 )
+	HANDLE hProcess = OpenProcess( SYNCHRONIZE, FALSE, ulPid );
+	BOOL bAlive;
+	if ( hProcess == NULL ) return ( GetLastError() == ERROR_ACCESS_DENIED ) ? TRUE : FALSE;
+	bAlive = ( WaitForSingleObject( hProcess, 0 ) == WAIT_TIMEOUT ) ? TRUE : FALSE;
+	CloseHandle( hProcess );
+	return bAlive;
+#elif defined(__APPLE__)
+	return ( kill( (pid_t)ulPid, 0 ) == 0 || errno == EPERM ) ? TRUE : FALSE;
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Create the bus pszName with ulSlots slots of ulSlotSize bytes. This process becomes the producer.
+BOOL CreateFrameBus( const char* pszName, ULONG ulSlots, ULONG ulSlotSize )
+{
+	char szPath[FRAME_BUS_NAME_MAX + 32];
+	NK_UINT_64 ullSize;
+	ULONG i;
+
+	if ( g_stFrameBus.bOpen == TRUE ) return FALSE;
+	if ( strlen( pszName ) == 0 || strlen( pszName ) > FRAME_BUS_NAME_MAX ) return FALSE;
+	if ( ulSlots == 0 || ulSlots > FRAME_BUS_SLOT_MAX || ulSlotSize == 0 ) return FALSE;
+	ulSlotSize = ( ulSlotSize + FRAME_BUS_ALIGN - 1 ) / FRAME_BUS_ALIGN * FRAME_BUS_ALIGN;
+
+	memset( &g_stFrameBus, 0, sizeof(FrameBus) );
+	strcpy( g_stFrameBus.szName, pszName );
+
+	MakeFrameBusPath( szPath, pszName, ".r", -1 );
+	ullSize = sizeof(FrameBusShared);
+	g_stFrameBus.pShared = (FrameBusShared*)MapFrameBusSegment( szPath, TRUE, TRUE, &ullSize, &g_stFrameBus.hShared );
+	if ( g_stFrameBus.pShared == NULL ) {
+		printf( "%s can't be created.\n", szPath );
+		return FALSE;
+	}
+
+	MakeFrameBusPath( szPath, pszName, "", -1 );
+	g_stFrameBus.ullHeaderSize = ( sizeof(FrameBusHeader) + FRAME_BUS_ALIGN - 1 ) / FRAME_BUS_ALIGN * FRAME_BUS_ALIGN;
+	ullSize = g_stFrameBus.ullHeaderSize + (NK_UINT_64)ulSlots * ulSlotSize;
+	g_stFrameBus.pHeader = (FrameBusHeader*)MapFrameBusSegment( szPath, TRUE, TRUE, &ullSize, &g_stFrameBus.hHeader );
+	if ( g_stFrameBus.pHeader == NULL ) {
+		printf( "%s can't be created.\n", szPath );
+		UnmapFrameBusSegment( g_stFrameBus.pShared, sizeof(FrameBusShared), g_stFrameBus.hShared );
+		MakeFrameBusPath( szPath, pszName, ".r", -1 );
+	#if defined(__APPLE__)
+		shm_unlink( szPath );
+	#endif
+		return FALSE;
+	}
+	g_stFrameBus.pHeader->ulVersion = FRAME_BUS_VERSION;
+	g_stFrameBus.pHeader->ulSlots = ulSlots;
+	g_stFrameBus.pHeader->ulSlotSize = ulSlotSize;
+	g_stFrameBus.pHeader->ullDataOffset = g_stFrameBus.ullHeaderSize;
+#if defined(__APPLE__)
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ )
+		g_stFrameBus.fdNotify[i] = -1;
+	// A consumer that went away must not kill the process.
+	signal( SIGPIPE, SIG_IGN );
+#endif
+	// The magic number is written last, so a consumer never maps a header that is not ready.
+	std::atomic_thread_fence( std::memory_order_release );
+	g_stFrameBus.pHeader->ulMagic = FRAME_BUS_MAGIC;
+	g_stFrameBus.bOpen = TRUE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the bus of the producer. The consumers keep their mappings until they close them.
+void CloseFrameBus( void )
+{
+	char szPath[FRAME_BUS_NAME_MAX + 32];
+	ULONG i;
+
+	if ( g_stFrameBus.bOpen == FALSE ) return;
+	g_stFrameBus.bOpen = FALSE;
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ ) {
+	#if defined( _WIN32 )
+		if ( g_stFrameBus.hNotify[i] != NULL ) CloseHandle( g_stFrameBus.hNotify[i] );
+	#elif defined(__APPLE__)
+		if ( g_stFrameBus.fdNotify[i] >= 0 ) close( g_stFrameBus.fdNotify[i] );
+	#endif
+	}
+	UnmapFrameBusSegment( g_stFrameBus.pHeader, g_stFrameBus.ullHeaderSize + (NK_UINT_64)g_stFrameBus.pHeader->ulSlots * g_stFrameBus.pHeader->ulSlotSize, g_stFrameBus.hHeader );
+	UnmapFrameBusSegment( g_stFrameBus.pShared, sizeof(FrameBusShared), g_stFrameBus.hShared );
+#if defined(__APPLE__)
+	MakeFrameBusPath( szPath, g_stFrameBus.szName, "", -1 );
+	shm_unlink( szPath );
+	MakeFrameBusPath( szPath, g_stFrameBus.szName, ".r", -1 );
+	shm_unlink( szPath );
+#endif
+	memset( &g_stFrameBus, 0, sizeof(FrameBus) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return TRUE if the bus of the producer is open.
+BOOL IsFrameBusOpen( void )
+{
+	return g_stFrameBus.bOpen;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// release the slots held by the consumers whose process has gone. Returns the number of the consumers removed.
+ULONG ReclaimFrameBusConsumers( void )
+{
+	FrameBusShared* pShared = g_stFrameBus.pShared;
+	ULONG i, j, ulPid, ulRemoved = 0;
+
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ ) {
+		// A consumer that died while it was taking the entry is removed too. The producer marks an entry it removes by
+		// FRAME_BUS_CLAIMING without a pid.
+		ulPid = pShared->ulConsumerPid[i].load();
+		if ( ( ulPid & ~FRAME_BUS_CLAIMING ) == 0 || IsFrameBusConsumerAlive( ulPid & ~FRAME_BUS_CLAIMING ) == TRUE ) continue;
+		if ( pShared->ulConsumerPid[i].compare_exchange_strong( ulPid, FRAME_BUS_CLAIMING ) == FALSE ) continue;
+		for ( j = 0; j < FRAME_BUS_SLOT_MAX; j++ )
+			pShared->ulRef[j].fetch_and( ~(1u << i) );
+		pShared->ulConsumerPid[i].store( 0 );
+		ulRemoved++;
+	}
+	return ulRemoved;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take a free slot for a frame of ulLength bytes. Returns the index of the slot, or -1 if the frame is dropped.
+SLONG ReserveFrameBusSlot( ULONG ulLength )
+{
+	FrameBusHeader* pHeader = g_stFrameBus.pHeader;
+	ULONG i, ulSlot, ulRef, ulTry;
+
+	if ( g_stFrameBus.bOpen == FALSE ) return -1;
+	if ( ulLength > pHeader->ulSlotSize ) {
+		printf( "%lu bytes don't fit in a slot of the frame bus (%lu bytes).\n", (unsigned long)ulLength, (unsigned long)pHeader->ulSlotSize );
+		pHeader->ullDropped.fetch_add( 1 );
+		return -1;
+	}
+	// If all slots are held, the slots of the consumers that crashed are released, and tried again once.
+	for ( ulTry = 0; ulTry < 2; ulTry++ ) {
+		for ( i = 0; i < pHeader->ulSlots; i++ ) {
+			ulSlot = ( g_stFrameBus.ulNext + i ) % pHeader->ulSlots;
+			ulRef = 0;
+			if ( g_stFrameBus.pShared->ulRef[ulSlot].compare_exchange_strong( ulRef, FRAME_BUS_WRITING ) == FALSE ) continue;
+			// The old frame disappears before its data is overwritten.
+			pHeader->stSlot[ulSlot].ullSeq.store( 0 );
+			g_stFrameBus.ulNext = ( ulSlot + 1 ) % pHeader->ulSlots;
+			return (SLONG)ulSlot;
+		}
+		if ( ReclaimFrameBusConsumers() == 0 ) break;
+	}
+	pHeader->ullDropped.fetch_add( 1 );
+	return -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the data of a slot reserved by ReserveFrameBusSlot.
+unsigned char* GetFrameBusSlotData( SLONG lSlot )
+{
+	FrameBusHeader* pHeader = g_stFrameBus.pHeader;
+	return (unsigned char*)pHeader + pHeader->ullDataOffset + (NK_UINT_64)lSlot * pHeader->ulSlotSize;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give back a reserved slot without publishing it.
+void CancelFrameBusSlot( SLONG lSlot )
+{
+	if ( g_stFrameBus.bOpen == FALSE || lSlot < 0 ) return;
+	g_stFrameBus.pShared->ulRef[lSlot].store( 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// wake the consumers up. A consumer that has not read its notifications yet is not notified again.
+void NotifyFrameBus( void )
+{
+	char szPath[FRAME_BUS_NAME_MAX + 32];
+	ULONG i;
+
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ ) {
+		ULONG ulPid = g_stFrameBus.pShared->ulConsumerPid[i].load();
+		if ( ulPid == 0 || ( ulPid & FRAME_BUS_CLAIMING ) ) continue;
+		MakeFrameBusPath( szPath, g_stFrameBus.szName, "", (SLONG)i );
+	#if defined( _WIN32 )
+		if ( g_stFrameBus.hNotify[i] == NULL )
+			g_stFrameBus.hNotify[i] = OpenEventA( EVENT_MODIFY_STATE, FALSE, szPath );
+		if ( g_stFrameBus.hNotify[i] != NULL ) SetEvent( g_stFrameBus.hNotify[i] );
+	#elif defined(__APPLE__)
+		// The FIFO is opened again if its reader went away, since a new consumer may have taken the entry.
+		char c = 1;
+		if ( g_stFrameBus.fdNotify[i] >= 0 && write( g_stFrameBus.fdNotify[i], &c, 1 ) < 0 && errno == EPIPE ) {
+			close( g_stFrameBus.fdNotify[i] );
+			g_stFrameBus.fdNotify[i] = -1;
+		}
+		if ( g_stFrameBus.fdNotify[i] < 0 ) {
+			g_stFrameBus.fdNotify[i] = open( szPath, O_WRONLY | O_NONBLOCK );
+			if ( g_stFrameBus.fdNotify[i] >= 0 ) write( g_stFrameBus.fdNotify[i], &c, 1 );
+		}
+	#endif
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Publish the frame written into a reserved slot, and wake the consumers up.
+void PublishFrameBusSlot( SLONG lSlot, ULONG ulRoute, const char* pszName, ULONG ulLength )
+{
+	FrameBusHeader* pHeader = g_stFrameBus.pHeader;
+	FrameBusSlotInfo* pInfo;
+	const char* pszBase;
+
+	if ( g_stFrameBus.bOpen == FALSE || lSlot < 0 ) return;
+	pInfo = &pHeader->stSlot[lSlot];
+	// The consumers see the name without the folder.
+	pszBase = strrchr( pszName, '/' );
+	if ( pszBase == NULL ) pszBase = strrchr( pszName, '\\' );
+	pszBase = ( pszBase != NULL ) ? pszBase + 1 : pszName;
+	pInfo->ulRoute = ulRoute;
+	pInfo->ulLength = ulLength;
+	pInfo->ullTime = (NK_UINT_64)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+	memset( pInfo->szName, 0, sizeof(pInfo->szName) );
+	strncpy( pInfo->szName, pszBase, sizeof(pInfo->szName) - 1 );
+
+	// Only the producer changes the sequence numbers, so they are stored without a read-modify-write.
+	NK_UINT_64 ullSeq = pHeader->ullSeq.load( std::memory_order_relaxed ) + 1;
+	pInfo->ullSeq.store( ullSeq, std::memory_order_release );
+	g_stFrameBus.pShared->ulRef[lSlot].store( 0, std::memory_order_release );
+	pHeader->ullSeq.store( ullSeq, std::memory_order_release );
+	g_stFrameBus.ullPublished++;
+	NotifyFrameBus();
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Copy a frame into a free slot and publish it. Returns FALSE if the frame was dropped.
+BOOL PublishFrameBus( ULONG ulRoute, const char* pszName, const void* pData, ULONG ulLength )
+{
+	SLONG lSlot = ReserveFrameBusSlot( ulLength );
+
+	if ( lSlot < 0 ) return FALSE;
+	memcpy( GetFrameBusSlotData( lSlot ), pData, ulLength );
+	PublishFrameBusSlot( lSlot, ulRoute, pszName, ulLength );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// print the state of the bus of the producer.
+void PrintFrameBus( void )
+{
+	FrameBusHeader* pHeader = g_stFrameBus.pHeader;
+	ULONG i, ulPid, ulConsumers = 0, ulHeld = 0;
+
+	if ( g_stFrameBus.bOpen == FALSE ) {
+		printf( "The frame bus is closed.\n" );
+		return;
+	}
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ ) {
+		ulPid = g_stFrameBus.pShared->ulConsumerPid[i].load();
+		if ( ulPid != 0 && !( ulPid & FRAME_BUS_CLAIMING ) ) ulConsumers++;
+	}
+	for ( i = 0; i < pHeader->ulSlots; i++ ) {
+		if ( g_stFrameBus.pShared->ulRef[i].load() != 0 ) ulHeld++;
+	}
+	printf( "Frame bus \"%s\": %lu slots of %lu KB, %lu held, %lu consumers, %llu published, %llu dropped\n",
+			g_stFrameBus.szName, (unsigned long)pHeader->ulSlots, (unsigned long)(pHeader->ulSlotSize / 1024), (unsigned long)ulHeld,
+			(unsigned long)ulConsumers, (unsigned long long)g_stFrameBus.ullPublished, (unsigned long long)pHeader->ullDropped.load() );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open the bus pszName as a consumer. The data is mapped read-only.
+BOOL OpenFrameBusReader( LPFrameBusReader pReader, const char* pszName )
+{
+	char szPath[FRAME_BUS_NAME_MAX + 32];
+	FrameBusHeader* pHeader;
+	FrameBusShared* pShared;
+	NK_UINT_64 ullSize;
+	ULONG i, ulPid, ulFree;
+
+	memset( pReader, 0, sizeof(FrameBusReader) );
+	pReader->lConsumer = -1;
+	if ( strlen( pszName ) == 0 || strlen( pszName ) > FRAME_BUS_NAME_MAX ) return FALSE;
+	strcpy( pReader->szName, pszName );
+	MakeFrameBusPath( szPath, pszName, "", -1 );
+	pHeader = (FrameBusHeader*)MapFrameBusSegment( szPath, FALSE, FALSE, &pReader->ullHeaderSize, &pReader->hHeader );
+	if ( pHeader == NULL ) {
+		printf( "The frame bus %s is not found.\n", pszName );
+		return FALSE;
+	}
+	pReader->pHeader = pHeader;
+	if ( pHeader->ulMagic != FRAME_BUS_MAGIC || pHeader->ulVersion != FRAME_BUS_VERSION ) {
+		printf( "%s is not a frame bus of this version.\n", pszName );
+		CloseFrameBusReader( pReader );
+		return FALSE;
+	}
+	std::atomic_thread_fence( std::memory_order_acquire );
+	MakeFrameBusPath( szPath, pszName, ".r", -1 );
+	ullSize = sizeof(FrameBusShared);
+	pShared = (FrameBusShared*)MapFrameBusSegment( szPath, FALSE, TRUE, &ullSize, &pReader->hShared );
+	if ( pShared == NULL ) {
+		CloseFrameBusReader( pReader );
+		return FALSE;
+	}
+	pReader->pShared = pShared;
+	pReader->ullSharedSize = ullSize;
+
+#if defined( _WIN32 )
+	ulPid = (ULONG)GetCurrentProcessId();
+#elif defined(__APPLE__)
+	ulPid = (ULONG)getpid();
+#endif
+	// The entry has the pid while it is taken, so the producer can remove it if this process dies before it is ready.
+	for ( i = 0; i < FRAME_BUS_CONSUMER_MAX; i++ ) {
+		ulFree = 0;
+		if ( pShared->ulConsumerPid[i].compare_exchange_strong( ulFree, ulPid | FRAME_BUS_CLAIMING ) == TRUE ) break;
+	}
+	if ( i == FRAME_BUS_CONSUMER_MAX ) {
+		printf( "The frame bus %s has %d consumers already.\n", pszName, FRAME_BUS_CONSUMER_MAX );
+		CloseFrameBusReader( pReader );
+		return FALSE;
+	}
+	pReader->lConsumer = (SLONG)i;
+
+	// The notification is ready before the producer can see this consumer.
+	MakeFrameBusPath( szPath, pszName, "", pReader->lConsumer );
+#if defined( _WIN32 )
+	pReader->hNotify = CreateEventA( NULL, FALSE, FALSE, szPath );
+	if ( pReader->hNotify == NULL ) {
+#elif defined(__APPLE__)
+	unlink( szPath );
+	if ( mkfifo( szPath, 0600 ) == 0 )
+		pReader->fdNotify = open( szPath, O_RDONLY | O_NONBLOCK );
+	else
+		pReader->fdNotify = -1;
+	if ( pReader->fdNotify < 0 ) {
+#endif
+		printf( "%s can't be created.\n", szPath );
+		pShared->ulConsumerPid[i].store( 0 );
+		pReader->lConsumer = -1;
+		CloseFrameBusReader( pReader );
+		return FALSE;
+	}
+	pShared->ulConsumerPid[i].store( ulPid );
+	// The frames published before are not taken.
+	pReader->ullLastSeq = pHeader->ullSeq.load();
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Wait until the producer publishes a frame, for ulTimeout msec at most. Returns FALSE at the timeout.
+BOOL WaitFrameBusReader( LPFrameBusReader pReader, ULONG ulTimeout )
+{
+#if defined( _WIN32 )
+	return ( WaitForSingleObject( (HANDLE)pReader->hNotify, ulTimeout ) == WAIT_OBJECT_0 ) ? TRUE : FALSE;
+#elif defined(__APPLE__)
+	struct pollfd stPoll;
+	char buf[64];
+	BOOL bNotified = FALSE;
+
+	stPoll.fd = pReader->fdNotify;
+	stPoll.events = POLLIN;
+	stPoll.revents = 0;
+	if ( poll( &stPoll, 1, (int)ulTimeout ) <= 0 ) return FALSE;
+	// All notifications are read, since the frames are taken until there is none.
+	while ( read( pReader->fdNotify, buf, sizeof(buf) ) > 0 )
+		bNotified = TRUE;
+	// poll returns at once while the FIFO has no writer, so the producer is waited for here.
+	if ( bNotified == FALSE && (stPoll.revents & POLLHUP) )
+		usleep( ulTimeout * 1000 );
+	return bNotified;
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the oldest frame newer than the last one taken. The frame must be released by ReleaseFrameBusFrame.
+// Returns FALSE if there is no new frame.
+BOOL AcquireFrameBusFrame( LPFrameBusReader pReader, LPFrameBusFrame pFrame )
+{
+	FrameBusHeader* pHeader = (FrameBusHeader*)pReader->pHeader;
+	FrameBusShared* pShared = (FrameBusShared*)pReader->pShared;
+	NK_UINT_64 ullSeq, ullSlotSeq;
+	ULONG i, ulSlot, ulRef, ulBit = 1u << pReader->lConsumer;
+
+	while ( 1 ) {
+		ullSeq = 0;
+		ulSlot = 0;
+		for ( i = 0; i < pHeader->ulSlots; i++ ) {
+			ullSlotSeq = pHeader->stSlot[i].ullSeq.load( std::memory_order_acquire );
+			if ( ullSlotSeq > pReader->ullLastSeq && ( ullSeq == 0 || ullSlotSeq < ullSeq ) ) {
+				ullSeq = ullSlotSeq;
+				ulSlot = i;
+			}
+		}
+		if ( ullSeq == 0 ) return FALSE;
+
+		ulRef = pShared->ulRef[ulSlot].load();
+		if ( ulRef & FRAME_BUS_WRITING ) continue;
+		if ( pShared->ulRef[ulSlot].compare_exchange_weak( ulRef, ulRef | ulBit ) == FALSE ) continue;
+		// The slot may have been taken by the producer before the bit was set.
+		if ( pHeader->stSlot[ulSlot].ullSeq.load( std::memory_order_acquire ) != ullSeq ) {
+			pShared->ulRef[ulSlot].fetch_and( ~ulBit );
+			continue;
+		}
+		break;
+	}
+	pReader->ullMissed += ullSeq - pReader->ullLastSeq - 1;
+	pReader->ullLastSeq = ullSeq;
+
+	pFrame->lSlot = (SLONG)ulSlot;
+	pFrame->ullSeq = ullSeq;
+	pFrame->ulRoute = pHeader->stSlot[ulSlot].ulRoute;
+	pFrame->ulLength = pHeader->stSlot[ulSlot].ulLength;
+	pFrame->ullTime = pHeader->stSlot[ulSlot].ullTime;
+	memcpy( pFrame->szName, pHeader->stSlot[ulSlot].szName, sizeof(pFrame->szName) );
+	pFrame->pucData = (const unsigned char*)pHeader + pHeader->ullDataOffset + (NK_UINT_64)ulSlot * pHeader->ulSlotSize;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give back a frame taken by AcquireFrameBusFrame. The producer may overwrite its data afterwards.
+void ReleaseFrameBusFrame( LPFrameBusReader pReader, LPFrameBusFrame pFrame )
+{
+	FrameBusShared* pShared = (FrameBusShared*)pReader->pShared;
+
+	if ( pFrame->lSlot < 0 ) return;
+	pShared->ulRef[pFrame->lSlot].fetch_and( ~(1u << pReader->lConsumer), std::memory_order_release );
+	pFrame->lSlot = -1;
+	pFrame->pucData = NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Close the bus of a consumer. The frames still held are released.
+void CloseFrameBusReader( LPFrameBusReader pReader )
+{
+	FrameBusShared* pShared = (FrameBusShared*)pReader->pShared;
+	char szPath[FRAME_BUS_NAME_MAX + 32];
+	ULONG j;
+
+	if ( pShared != NULL && pReader->lConsumer >= 0 ) {
+		for ( j = 0; j < FRAME_BUS_SLOT_MAX; j++ )
+			pShared->ulRef[j].fetch_and( ~(1u << pReader->lConsumer) );
+		pShared->ulConsumerPid[pReader->lConsumer].store( 0 );
+	}
+#if defined( _WIN32 )
+	if ( pReader->hNotify != NULL ) CloseHandle( (HANDLE)pReader->hNotify );
+#elif defined(__APPLE__)
+	if ( pReader->lConsumer >= 0 && pReader->fdNotify >= 0 ) {
+		close( pReader->fdNotify );
+		MakeFrameBusPath( szPath, pReader->szName, "", pReader->lConsumer );
+		unlink( szPath );
+	}
+#endif
+	UnmapFrameBusSegment( pReader->pShared, pReader->ullSharedSize, pReader->hShared );
+	UnmapFrameBusSegment( pReader->pHeader, pReader->ullHeaderSize, pReader->hHeader );
+	memset( pReader, 0, sizeof(FrameBusReader) );
+	pReader->lConsumer = -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the frames of the bus pszName as a consumer and print them, until the user cancels.
+BOOL WatchFrameBus( const char* pszName )
+{
+	FrameBusReader stReader;
+	FrameBusFrame stFrame;
+	NK_UINT_64 ullFrames = 0;
+
+	if ( OpenFrameBusReader( &stReader, pszName ) == FALSE ) return FALSE;
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+
+	printf( "Watching the frame bus %s as the consumer %d. Please press the Ctrl+C to stop.\n", pszName, (int)stReader.lConsumer );
+	while ( g_bCancel == FALSE ) {
+		while ( AcquireFrameBusFrame( &stReader, &stFrame ) == TRUE ) {
+			// The data is read in place, where the producer wrote it.
+			printf( "Frame %llu  %-40s %10lu bytes  route %lu  missed %llu\n", (unsigned long long)stFrame.ullSeq, stFrame.szName,
+					(unsigned long)stFrame.ulLength, (unsigned long)stFrame.ulRoute, (unsigned long long)stReader.ullMissed );
+			ReleaseFrameBusFrame( &stReader, &stFrame );
+			ullFrames++;
+		}
+		WaitFrameBusReader( &stReader, 200 );
+	}
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	g_bCancel = FALSE;
+	printf( "%llu frames taken, %llu missed.\n", (unsigned long long)ullFrames, (unsigned long long)stReader.ullMissed );
+	CloseFrameBusReader( &stReader );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Create or close the frame bus of this process, or watch a frame bus of another process.
+BOOL FrameBusMenu( void )
+{
+	char	buf[256];
+	char	szName[FRAME_BUS_NAME_MAX + 1];
+	ULONG	ulSel, ulSlots, ulSlotSize;
+
+	printf( "[Frame Bus]\n" );
+	PrintFrameBus();
+	printf( "Select (1-3, 0)\n" );
+	printf( " 1. Create\n" );
+	printf( " 2. Close\n" );
+	printf( " 3. Watch\n>" );
+	scanf( "%s", buf );
+	ulSel = atoi( buf );
+	if ( ulSel == 0 || ulSel > 3 ) return TRUE;
+	if ( ulSel == 2 ) {
+		CloseFrameBus();
+		return TRUE;
+	}
+
+	printf( "Input the name of the bus (up to %d characters, 0: %s)\n>", FRAME_BUS_NAME_MAX, FRAME_BUS_NAME_DEFAULT );
+	scanf( "%255s", buf );
+	if ( strcmp( buf, "0" ) == 0 || strlen( buf ) > FRAME_BUS_NAME_MAX ) strcpy( buf, FRAME_BUS_NAME_DEFAULT );
+	strcpy( szName, buf );
+	if ( ulSel == 3 ) return WatchFrameBus( szName );
+
+	printf( "Input the number of the slots (1-%d, 0: %d)\n>", FRAME_BUS_SLOT_MAX, FRAME_BUS_SLOTS_DEFAULT );
+	scanf( "%s", buf );
+	ulSlots = atoi( buf );
+	if ( ulSlots == 0 || ulSlots > FRAME_BUS_SLOT_MAX ) ulSlots = FRAME_BUS_SLOTS_DEFAULT;
+	printf( "Input the size of a slot in MB (1-1024, 0: %d)\n>", FRAME_BUS_SLOT_MB_DEFAULT );
+	scanf( "%s", buf );
+	ulSlotSize = atoi( buf );
+	if ( ulSlotSize == 0 || ulSlotSize > 1024 ) ulSlotSize = FRAME_BUS_SLOT_MB_DEFAULT;
+
+	if ( CreateFrameBus( szName, ulSlots, ulSlotSize * 1024 * 1024 ) == FALSE ) {
+		printf( "The frame bus %s can't be created.\n", szName );
+		return TRUE;
+	}
+	PrintFrameBus();
+	printf( "Select the frame bus as the sink of a route in the Output Sinks.\n" );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
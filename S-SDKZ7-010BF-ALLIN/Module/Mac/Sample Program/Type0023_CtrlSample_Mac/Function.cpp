@@ -20,19 +20,14 @@
 #include "CtrlSample.h"
 
 extern ULONG	g_ulCameraType;	// CameraType
-#define VIDEO_SIZE_BLOCK  0x500000		// movie data read block size : 5MB
+#define THUMBNAIL_WINDOW_DEFAULT	8		// number of thumbnail transfers in flight
+#define THUMBNAIL_WINDOW_MAX		64
 
 #define ObjectBitmapHandle_Format_MOV	11	//MOV
 #define ObjectBitmapHandle_Format_MP4	12	//MP4
 
 BOOL g_bCancel = FALSE;
 
-#if defined( _WIN32 )
-	BOOL WINAPI	cancelhandler(DWORD dwCtrlType);
-#elif defined(__APPLE__)
-	void	cancelhandler(int sig);
-#endif
-
 //------------------------------------------------------------------------------------------------
 //
 SLONG CallMAIDEntryPoint( 
@@ -2264,6 +2259,67 @@ BOOL GetUnsignedCapability( LPRefObj pRefObj, ULONG ulCapID, ULONG* pulValue )
     return Command_CapGet( pRefObj->pObject, ulCapID, kNkMAIDDataType_UnsignedPtr, ( NKPARAM )pulValue, NULL, NULL );
 }
 //------------------------------------------------------------------------------------------------------------------------------------
+// Get the current element of a Enum(Unsigned Integer) type capability.
+// If bFind is TRUE, the element *pulValue is searched and *pulIndex receives its index instead.
+BOOL GetEnumUnsignedCapability( LPRefObj pRefObj, ULONG ulCapID, ULONG* pulValue, ULONG* pulIndex, BOOL bFind )
+{
+	NkMAIDEnum	stEnum;
+	ULONG	i;
+	BOOL	bRet;
+	LPNkMAIDCapInfo pCapInfo = GetCapInfo( pRefObj, ulCapID );
+	if ( pCapInfo == NULL ) return FALSE;
+
+	// check data type of the capability
+	if ( pCapInfo->ulType != kNkMAIDCapType_Enum ) return FALSE;
+	// check if this capability supports CapGet operation.
+	if ( !CheckCapabilityOperation( pRefObj, ulCapID, kNkMAIDCapOperation_Get ) ) return FALSE;
+
+	bRet = Command_CapGet( pRefObj->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+	if ( bRet == FALSE ) return FALSE;
+	if ( stEnum.ulType != kNkMAIDArrayType_Unsigned || stEnum.wPhysicalBytes != 4 || stEnum.ulElements == 0 ) return FALSE;
+
+	// allocate memory for array data
+	stEnum.pData = malloc( stEnum.ulElements * stEnum.wPhysicalBytes );
+	if ( stEnum.pData == NULL ) return FALSE;
+	bRet = Command_CapGetArray( pRefObj->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+	if ( bRet == TRUE ) {
+		if ( bFind == FALSE ) {
+			bRet = ( stEnum.ulValue < stEnum.ulElements ) ? TRUE : FALSE;
+			if ( bRet == TRUE ) *pulValue = ((ULONG*)stEnum.pData)[stEnum.ulValue];
+			if ( pulIndex != NULL ) *pulIndex = stEnum.ulValue;
+		} else {
+			for ( i = 0; i < stEnum.ulElements; i++ )
+				if ( ((ULONG*)stEnum.pData)[i] == *pulValue ) break;
+			bRet = ( i < stEnum.ulElements ) ? TRUE : FALSE;
+			if ( pulIndex != NULL ) *pulIndex = i;
+		}
+	}
+	free( stEnum.pData );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Set the element of index ulIndex of a Enum type capability. The index is sent in a NkMAIDEnum, as in SetEnumUnsignedCapability.
+BOOL SetEnumIndex( LPRefObj pRefObj, ULONG ulCapID, ULONG ulIndex )
+{
+	NkMAIDEnum	stEnum;
+
+	if ( !CheckCapabilityOperation( pRefObj, ulCapID, kNkMAIDCapOperation_Set ) ) return FALSE;
+	if ( Command_CapGet( pRefObj->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL ) == FALSE ) return FALSE;
+	if ( ulIndex >= stEnum.ulElements ) return FALSE;
+	stEnum.pData = NULL;
+	stEnum.ulValue = ulIndex;
+	return Command_CapSet( pRefObj->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Set the element ulValue of a Enum(Unsigned Integer) type capability.
+BOOL SetEnumUnsignedValue( LPRefObj pRefObj, ULONG ulCapID, ULONG ulValue )
+{
+	ULONG	ulIndex;
+
+	if ( GetEnumUnsignedCapability( pRefObj, ulCapID, &ulValue, &ulIndex, TRUE ) == FALSE ) return FALSE;
+	return SetEnumIndex( pRefObj, ulCapID, ulIndex );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
 // Show the current setting of a Float type capability and set a value for it.
 BOOL SetFloatCapability( LPRefObj pRefObj, ULONG ulCapID )
 {
@@ -2841,7 +2897,6 @@ BOOL SetPictureControlDataCapability(LPRefObj pRefObj, NkMAIDPicCtrlData* pPicCt
 BOOL GetPictureControlDataCapability(LPRefObj pRefObj, NkMAIDPicCtrlData* pPicCtrlData, ULONG ulCapID)
 {
 	BOOL	bRet = TRUE;
-	FILE	*stream = NULL;
 	unsigned char* pucData = NULL;	// Picture Control Data pointer
 
 	if (ulCapID == kNkMAIDCapability_PictureControlDataEx2 ||
@@ -2874,30 +2929,18 @@ BOOL GetPictureControlDataCapability(LPRefObj pRefObj, NkMAIDPicCtrlData* pPicCt
 		}
 	}
 
-	// Save to file
-	// open file
-	switch (ulCapID)
-	{
-	case kNkMAIDCapability_PictureControlDataEx2:
-		stream = fopen("PicCtrlData.dat", "wb");
-		break;
-	case kNkMAIDCapability_MoviePictureControlDataEx2:
-		stream = fopen("MovPicCtrlData.dat", "wb");
-		break;
-	}
+	// Get data pointer
+	pucData = (unsigned char*)pPicCtrlData->pData;
 
-	if (stream == NULL)
+	// Save to the sink of Picture Control data
+	bRet = SaveDataSink(kSinkRoute_PictureControl, (ulCapID == kNkMAIDCapability_MoviePictureControlDataEx2) ? "MovPicCtrlData.dat" : "PicCtrlData.dat",
+						pucData, pPicCtrlData->ulSize);
+	if (bRet == FALSE)
 	{
 		printf("\nfile open error.\n");
 		free(pPicCtrlData->pData);
 		return FALSE;
 	}
-
-	// Get data pointer
-	pucData = (unsigned char*)pPicCtrlData->pData;
-
-	// write file
-	fwrite(pucData, 1, pPicCtrlData->ulSize, stream);
 	switch (ulCapID)
 	{
 	case kNkMAIDCapability_PictureControlDataEx2:
@@ -2908,8 +2951,6 @@ BOOL GetPictureControlDataCapability(LPRefObj pRefObj, NkMAIDPicCtrlData* pPicCt
 		break;
 	}
 
-	// close file
-	fclose(stream);
 	free(pPicCtrlData->pData);
 
 	return TRUE;
@@ -3483,6 +3524,10 @@ BOOL DeleteDramCapability( LPRefObj pRefItem, ULONG ulItmID )
 	pRefDeliver->ulOffset = 0L;
 	pRefDeliver->ulTotalLines = 0L;
 	pRefDeliver->lID = pRefItem->lMyID;
+	pRefDeliver->ullCacheKey = 0;
+	pRefDeliver->refProgress = (NKREF)pRefDat;
+	pRefDeliver->pSink = NULL;
+	pRefDeliver->pszFileName = NULL;
 	// 2-2. set reference from CompletionProc
 	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
 	pRefCompletion->pulCount = &ulCount;
@@ -3538,8 +3583,6 @@ BOOL DeleteDramCapability( LPRefObj pRefItem, ULONG ulItmID )
 	
 	// Upper function to close ItemObject. 
 	g_bFileRemoved = TRUE;
-	// progress proc flag reset 
-	g_bFirstCall = TRUE;
 
 	// 9. Close ImageObject
 	bRet = RemoveChild( pRefItem, kNkMAIDDataObjType_Image );
@@ -3559,11 +3602,12 @@ BOOL GetLiveViewImageCapability( LPRefObj pRefSrc )
 	NkMAIDArray	stArray;
 	int i = 0;
 	unsigned char* pucData = NULL;	// LiveView data pointer
+	LiveViewHeader	stHeader;
 	BOOL	bRet = TRUE;
 
 
 	// Set header size of LiveView
-	ulHeaderSize = 512;
+	ulHeaderSize = LIVEVIEW_HEADER_SIZE;
 
 	memset( &stArray, 0, sizeof(NkMAIDArray) );		
 	
@@ -3596,33 +3640,24 @@ BOOL GetLiveViewImageCapability( LPRefObj pRefSrc )
 		}
 	}
 		
-	// open file
-	hFileHeader = fopen( HeaderFileName, "wb" );
-	if ( hFileHeader == NULL )
-	{
-		printf("file open error.\n");
-		return FALSE;
-	}				
-	hFileImage = fopen( ImageFileName, "wb" );
-	if ( hFileImage == NULL )
+	// Get data pointer
+	pucData = (unsigned char*)stArray.pData;
+
+	// write the header and the image to the sink of the live view
+	if ( SaveDataSink( kSinkRoute_LiveView, HeaderFileName, pucData, ulHeaderSize ) == FALSE ||
+		 SaveDataSink( kSinkRoute_LiveView, ImageFileName, pucData+ulHeaderSize, (stArray.ulElements-ulHeaderSize) ) == FALSE )
 	{
-		fclose( hFileHeader );
 		printf("file open error.\n");
+		free( stArray.pData );
 		return FALSE;
 	}
-	
-	// Get data pointer
-	pucData = (unsigned char*)stArray.pData;
-
-	// write file
-	fwrite( pucData, 1, ulHeaderSize, hFileHeader );
-	fwrite( pucData+ulHeaderSize, 1, (stArray.ulElements-ulHeaderSize), hFileImage );
 	printf("\n%s was saved.\n", HeaderFileName);
 	printf("%s was saved.\n", ImageFileName);
+
+	// show the header
+	if ( ParseLiveViewHeader( pucData, stArray.ulElements * stArray.wPhysicalBytes, &stHeader ) == TRUE )
+		PrintLiveViewHeader( &stHeader );
 		
-	// close file
-	fclose( hFileHeader );
-	fclose( hFileImage );
 	free( stArray.pData );
 
 	return TRUE;
@@ -5420,6 +5455,17 @@ BOOL IssueAcquire( LPRefObj pRefDat )
 	pRefDeliver->ulOffset = 0L;
 	pRefDeliver->ulTotalLines = 0L;
 	pRefDeliver->lID = pRefItm->lMyID;
+	pRefDeliver->ullCacheKey = 0;
+	pRefDeliver->refProgress = (NKREF)pRefDat;
+	pRefDeliver->pSink = NULL;
+	pRefDeliver->pszFileName = NULL;
+	// A thumbnail that has been acquired before is read from the thumbnail cache.
+	if ( pRefDat->lMyID == kNkMAIDDataObjType_Thumbnail && GetThumbCacheKey( pRefItm, &pRefDeliver->ullCacheKey ) == TRUE ) {
+		if ( SaveThumbCache( pRefDeliver->ullCacheKey ) == TRUE ) {
+			free( pRefDeliver );
+			return TRUE;
+		}
+	}
 	// set reference from CompletionProc
 	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
 	pRefCompletion->pulCount = &ulCount;
@@ -5452,13 +5498,12 @@ BOOL GetVideoImageExCapability(LPRefObj pRefDat, ULONG ulCapID)
 {
 	BOOL	bRet = TRUE;
 	char	MovieFileName[256];
-	FILE*	hFileMovie = NULL;		// Movie file name
-	unsigned char* pucData = NULL;	// Movie data pointer
-	NK_UINT_64	ullTotalSize = 0;
-	int i = 0;
-	NkMAIDGetVideoImageEx	stVideoImage;
-	NkMAIDEnum	stEnum;
-	LPRefObj pobject;
+	MovieStats	stStats;
+	MovieCheckpoint	stCheckpoint;
+
+	// get total size and file name. A partial file of this movie is resumed.
+	bRet = PrepareMovieDownload(pRefDat, ulCapID, MovieFileName, &stCheckpoint);
+	if (bRet == FALSE) return FALSE;
 
 #if defined( _WIN32 )
 	SetConsoleCtrlHandler(cancelhandler, TRUE);
@@ -5470,127 +5515,48 @@ BOOL GetVideoImageExCapability(LPRefObj pRefDat, ULONG ulCapID)
 	sigaction(SIGINT, &action, &oldaction);
 #endif
 
-	memset(&stVideoImage, 0, sizeof(NkMAIDGetVideoImageEx));
-	memset(&pobject, 0, sizeof(LPRefObj));
-
-	// get total size
-	stVideoImage.ullDataSize = 0;
-	bRet = Command_CapGet(pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL);
-	if (bRet == FALSE) return FALSE;
-
-	ullTotalSize = stVideoImage.ullDataSize;
-	if (ullTotalSize == 0) return FALSE;
-
-	// get movie data
-	stVideoImage.ullDataSize = VIDEO_SIZE_BLOCK;		// read block size : 5MB
-	stVideoImage.ullReadSize = 0;
-	stVideoImage.ullOffset = 0;
-
-	// allocate memory for array data
-	stVideoImage.pData = malloc(VIDEO_SIZE_BLOCK);
-	if (stVideoImage.pData == NULL) return FALSE;
-
-	// get movie file type
-	LPRefObj pRefItem = (LPRefObj)pRefDat->pRefParent;
-	if (!pRefItem) return FALSE;
-	LPRefObj pRefSource = (LPRefObj)pRefItem->pRefParent;
-	if (!pRefSource) return FALSE;
-	bRet = Command_CapGet(pRefSource->pObject, kNkMAIDCapability_MovieFileType, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL);
-	if (bRet == FALSE) return FALSE;
-
-	// create file name
-	while (TRUE)
-	{
-		if (stEnum.ulValue == 0){
-			sprintf(MovieFileName, "MovieData%03d.%s", ++i, "mov");
-		}
-		else if (stEnum.ulValue == 1){
-			sprintf(MovieFileName, "MovieData%03d.%s", ++i, "mp4");
-		}
-		if ((hFileMovie = fopen(MovieFileName, "r")) != NULL)
-		{
-			// this file name is already used.
-			fclose(hFileMovie);
-			hFileMovie = NULL;
-		}
-		else
-		{
-			break;
-		}
-	}
-
-	// open file
-	hFileMovie = fopen(MovieFileName, "wb");
-	if (hFileMovie == NULL)
-	{
-		fclose(hFileMovie);
-		printf("file open error.\n");
-		return FALSE;
-	}
-
-	// Get data pointer
-	pucData = (unsigned char*)stVideoImage.pData;
-
 	printf("Please press the Ctrl+C to cancel.\n");
 
-	// write file
-	while ((stVideoImage.ullOffset < ullTotalSize) && (bRet == TRUE))
-	{
-		if (TRUE == g_bCancel)
-		{
-			stVideoImage.ullDataSize = 0;
-			bRet = Command_CapGetArray(pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL);
-			break;
-		}
-
-		bRet = Command_CapGetArray(pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL);
-
-		stVideoImage.ullOffset += (stVideoImage.ullReadSize);
-
-		fwrite(pucData, (ULONG)stVideoImage.ullReadSize, 1, hFileMovie);
+	// The camera is read on this thread while the file is written on the writer thread.
+	bRet = DownloadVideoImage(pRefDat, ulCapID, &stCheckpoint, MovieFileName, &stStats);
 
-		if (bRet == FALSE) {
-			free(stVideoImage.pData);
-			return FALSE;
-		}
-
-	}
 #if defined( _WIN32 )
 	SetConsoleCtrlHandler(cancelhandler, FALSE);
 #elif defined(__APPLE__)
 	sigaction(SIGINT, &oldaction, NULL);
 #endif
 
-	if (stVideoImage.ullOffset < ullTotalSize && TRUE == g_bCancel)
+	if (bRet == FALSE)
+	{
+		printf("Get Video image failed.\n");
+	}
+	else if (stStats.ullResumed + stStats.ullWritten < stCheckpoint.ullTotal && TRUE == g_bCancel)
 	{
-		printf("Get Video image was canceled.\n");
+		printf("Get Video image was canceled. It will be resumed from %llu bytes.\n", stStats.ullResumed + stStats.ullWritten);
 	}
 	else {
 		printf("%s was saved.\n", MovieFileName);
 	}
+	PrintMovieStats(MovieFileName, &stStats);
 	g_bCancel = FALSE;
+	FreeMoviePool();
 
-	// close file
-	fclose(hFileMovie);
-	free(stVideoImage.pData);
-
-	return TRUE;
+	return bRet;
 }
 
 //------------------------------------------------------------------------------------------------------------------------------------
-//
-BOOL IssueThumbnail( LPRefObj pRefSrc )
+// Acquire the thumbnails of all items in the source. At most 'ulWindow' transfers are kept in flight, each item and
+// thumbnail object is opened just before its Acquire and closed as soon as the delivery completes.
+BOOL IssueThumbnail( LPRefObj pRefSrc, ULONG ulWindow )
 {
 	BOOL	bRet;
-	LPRefObj	pRefItm, pRefDat;
-	NkMAIDCallback	stProc;
-	LPRefDataProc	pRefDeliver;
-	LPRefCompletionProc	pRefCompletion;
-	ULONG	ulItemID, ulFinishCount = 0L;
-	ULONG	i, j;
+	LPRefThumbSlot	pSlots;
+	ULONG	ulNext = 0L, ulActive = 0L, ulFinished = 0L, ulSkipped = 0L, ulCached = 0L;
+	BOOL	bCached;
+	ULONG	i;
 	NkMAIDEnum	stEnum;
 	LPNkMAIDCapInfo	pCapInfo;
-	
+
 	pCapInfo = GetCapInfo( pRefSrc, kNkMAIDCapability_Children );
 	// check if the CapInfo is available.
 	if ( pCapInfo == NULL )	return FALSE;
@@ -5613,101 +5579,232 @@ BOOL IssueThumbnail( LPRefObj pRefSrc )
 		return FALSE;
 	}
 
-	// Open all thumbnail objects in the current directory.
-	for ( i = 0; i < stEnum.ulElements; i++ ) {
-		ulItemID = ((ULONG*)stEnum.pData)[i];
-		pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
-		if ( pRefItm == NULL ) {
-			// open the item object
-			bRet = AddChild( pRefSrc, ulItemID );
-			if ( bRet == FALSE ) {
-				free( stEnum.pData );
-				return FALSE;
+	if ( ulWindow == 0 )
+		ulWindow = THUMBNAIL_WINDOW_DEFAULT;
+	else if ( ulWindow > THUMBNAIL_WINDOW_MAX )
+		ulWindow = THUMBNAIL_WINDOW_MAX;
+	pSlots = (LPRefThumbSlot)calloc( ulWindow, sizeof(RefThumbSlot) );
+	if ( pSlots == NULL ) {
+		free( stEnum.pData );
+		return FALSE;
+	}
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+	printf( "Acquiring %u thumbnails (%u in flight). Please press the Ctrl+C to cancel.\n", stEnum.ulElements, ulWindow );
+
+	while ( bRet == TRUE ) {
+		// refill the free slots unless the user canceled.
+		for ( i = 0; i < ulWindow && g_bCancel == FALSE; i++ ) {
+			while ( pSlots[i].bBusy == FALSE && ulNext < stEnum.ulElements ) {
+				if ( StartThumbnailSlot( pRefSrc, ((ULONG*)stEnum.pData)[ulNext++], &pSlots[i], &bCached ) == TRUE )
+					ulActive++;
+				else if ( bCached == TRUE )
+					ulCached++;
+				else
+					ulSkipped++;
 			}
-			pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
 		}
-		if ( pRefItm != NULL ) {
-			pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Thumbnail );
-			if ( pRefDat == NULL ) {
-				// open the thumbnail object
-				bRet = AddChild( pRefItm, kNkMAIDDataObjType_Thumbnail );
-				if ( bRet == FALSE ) {
-					free( stEnum.pData );
-					return FALSE;
-				}
-				pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Thumbnail );
+		if ( ulActive == 0 ) break;
+
+		// One Async to the source object drives all transfers in the window.
+		bRet = Command_Async( pRefSrc->pObject );
+		if ( bRet == FALSE ) break;
+
+		// close the objects whose delivery has completed.
+		ULONG ulReaped = 0L;
+		for ( i = 0; i < ulWindow; i++ ) {
+			if ( pSlots[i].bBusy == TRUE && pSlots[i].ulCount > 0 ) {
+				FinishThumbnailSlot( pRefSrc, &pSlots[i] );
+				ulActive--;
+				ulFinished++;
+				ulReaped++;
 			}
 		}
+		// wait a moment only when nothing has completed.
+		if ( ulReaped == 0 ) {
+		#if defined( _WIN32 )
+			Sleep(1);
+		#elif defined(__APPLE__)
+			struct timespec t;
+			t.tv_sec = 0;
+			t.tv_nsec = 1000 * 1000;// 1 msec == 1000 * 1000 nsec
+			nanosleep(&t, NULL);
+		#endif
+		}
 	}
-	free ( stEnum.pData );
 
-	// set NkMAIDCallback structure for DataProc
-	stProc.pProc = (LPNKFUNC)DataProc;
+	// If the pump failed, abort the transfers still in flight. Their objects are closed only after CompletionProc
+	// was called, since it counts up the slot and frees the blocks given to DataProc.
+	ULONG ulAborted = 0L;
+	for ( i = 0; i < ulWindow; i++ ) {
+		if ( pSlots[i].bBusy == TRUE ) {
+			Command_Abort( pSlots[i].pRefDat->pObject, NULL, NULL );
+			ulAborted++;
+		}
+	}
+	while ( ulAborted > 0 ) {
+		Command_Async( pRefSrc->pObject );
+		for ( i = 0; i < ulWindow; i++ ) {
+			if ( pSlots[i].bBusy == TRUE && pSlots[i].ulCount > 0 ) {
+				FinishThumbnailSlot( pRefSrc, &pSlots[i] );
+				ulAborted--;
+			}
+		}
+		if ( ulAborted > 0 ) {
+		#if defined( _WIN32 )
+			Sleep(1);
+		#elif defined(__APPLE__)
+			struct timespec t;
+			t.tv_sec = 0;
+			t.tv_nsec = 1000 * 1000;// 1 msec == 1000 * 1000 nsec
+			nanosleep(&t, NULL);
+		#endif
+		}
+	}
 
-	// acquire all thumbnail images.
-	for ( i = 0; i < pRefSrc->ulChildCount; i++ ) {
-		pRefItm = GetRefChildPtr_Index( pRefSrc, i );
-		pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Thumbnail );
-
-		if ( pRefDat != NULL ) {
-			// set RefDeliver structure refered in DataProc
-			pRefDeliver = (LPRefDataProc)malloc( sizeof(RefDataProc) );// this block will be freed in CompletionProc.
-			pRefDeliver->pBuffer = NULL;
-			pRefDeliver->ulOffset = 0L;
-			pRefDeliver->ulTotalLines = 0L;
-			pRefDeliver->lID = pRefItm->lMyID;
-
-			// set DataProc as data delivery callback function
-			stProc.refProc = (NKREF)pRefDeliver;
-			if( CheckCapabilityOperation( pRefDat, kNkMAIDCapability_DataProc, kNkMAIDCapOperation_Set ) ) {
-				bRet = Command_CapSet( pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_CallbackPtr, (NKPARAM)&stProc, NULL, NULL );
-				if ( bRet == FALSE ) return FALSE;
-			} else
-				return FALSE;
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	if ( g_bCancel == TRUE )
+		printf( "Acquiring thumbnails was canceled.\n" );
+	g_bCancel = FALSE;
+	printf( "%u thumbnails were acquired, %u were read from the cache, %u items were skipped.\n", ulFinished, ulCached, ulSkipped );
 
-			pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
+	free( pSlots );
+	free( stEnum.pData );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open the item and its thumbnail object if they are not opened yet, and start acquiring the thumbnail.
+// Returns FALSE if the item has no thumbnail, the thumbnail was read from the cache(*pbCached is TRUE)
+// or the Acquire could not be started.
+BOOL StartThumbnailSlot( LPRefObj pRefSrc, ULONG ulItemID, LPRefThumbSlot pSlot, BOOL* pbCached )
+{
+	BOOL	bRet;
+	ULONG	ulDataTypes = 0L;
+	NK_UINT_64	ullCacheKey = 0;
+	NkMAIDCallback	stProc;
+	LPRefDataProc	pRefDeliver;
+	LPRefCompletionProc	pRefCompletion;
 
-			// Set RefCompletion structure refered from CompletionProc.
-			pRefCompletion->pulCount = &ulFinishCount;
-			pRefCompletion->pRef = pRefDeliver;
+	memset( pSlot, 0, sizeof(RefThumbSlot) );
+	*pbCached = FALSE;
 
-			// Starting Acquire Thumbnail
-			bRet = Command_CapStart( pRefDat->pObject, kNkMAIDCapability_Acquire, (LPNKFUNC)CompletionProc, (NKREF)pRefCompletion, NULL );
-			if ( bRet == FALSE ) return FALSE;
-		} else {
-			// This item doesn't have a thumbnail, so we count up ulFinishCount.
-			ulFinishCount++;
-		}
+	pSlot->pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
+	if ( pSlot->pRefItm == NULL ) {
+		// open the item object
+		bRet = AddChild( pRefSrc, ulItemID );
+		if ( bRet == FALSE ) return FALSE;
+		pSlot->pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
+		pSlot->bItemOpened = TRUE;
+	}
 
-		// Send Async command to all DataObjects that have started acquire command.
-		for ( j = 0; j <= i; j++ ) {
-			bRet = Command_Async( GetRefChildPtr_ID(GetRefChildPtr_Index(pRefSrc, j ), kNkMAIDDataObjType_Thumbnail)->pObject );
-			if ( bRet == FALSE ) return FALSE;
-		}
+	// Movie items and so on don't have a thumbnail.
+	bRet = GetUnsignedCapability( pSlot->pRefItm, kNkMAIDCapability_DataTypes, &ulDataTypes );
+	if ( bRet == FALSE || !(ulDataTypes & kNkMAIDDataObjType_Thumbnail) ) {
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
 	}
 
-	// Send Async command to all DataObjects, untill all scanning complete.
-	while ( ulFinishCount < pRefSrc->ulChildCount ) {
-		for ( j = 0; j < pRefSrc->ulChildCount; j++ ) {
-			bRet = Command_Async( GetRefChildPtr_ID(GetRefChildPtr_Index( pRefSrc, j), kNkMAIDDataObjType_Thumbnail )->pObject );
-			if ( bRet == FALSE ) return FALSE;
+	// Consult the thumbnail cache before opening the thumbnail object.
+	if ( GetThumbCacheKey( pSlot->pRefItm, &ullCacheKey ) == TRUE && SaveThumbCache( ullCacheKey ) == TRUE ) {
+		*pbCached = TRUE;
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
+	}
+
+	pSlot->pRefDat = GetRefChildPtr_ID( pSlot->pRefItm, kNkMAIDDataObjType_Thumbnail );
+	if ( pSlot->pRefDat == NULL ) {
+		// open the thumbnail object
+		bRet = AddChild( pSlot->pRefItm, kNkMAIDDataObjType_Thumbnail );
+		if ( bRet == FALSE ) {
+			FinishThumbnailSlot( pRefSrc, pSlot );
+			return FALSE;
 		}
+		pSlot->pRefDat = GetRefChildPtr_ID( pSlot->pRefItm, kNkMAIDDataObjType_Thumbnail );
+		pSlot->bDataOpened = TRUE;
+	}
+	if( !CheckCapabilityOperation( pSlot->pRefDat, kNkMAIDCapability_DataProc, kNkMAIDCapOperation_Set ) ) {
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
 	}
 
-	// Close all item objects(include image and thumbnail object).
-	while ( pRefSrc->ulChildCount > 0 ) {
-		pRefItm = GetRefChildPtr_Index( pRefSrc, 0 );
-		ulItemID = pRefItm->lMyID;
-		// reset DataProc
-		bRet = Command_CapSet( pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_Null, (NKPARAM)NULL, NULL, NULL );
-		if ( bRet == FALSE ) return FALSE;
-		bRet = RemoveChild( pRefSrc, ulItemID );
-		if ( bRet == FALSE ) return FALSE;
+	// set RefDeliver structure refered in DataProc
+	pRefDeliver = (LPRefDataProc)malloc( sizeof(RefDataProc) );// this block will be freed in CompletionProc.
+	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
+	if ( pRefDeliver == NULL || pRefCompletion == NULL ) {
+		puts( "There is not enough memory." );
+		if ( pRefDeliver != NULL ) free( pRefDeliver );
+		if ( pRefCompletion != NULL ) free( pRefCompletion );
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
+	}
+	pRefDeliver->pBuffer = NULL;
+	pRefDeliver->ulOffset = 0L;
+	pRefDeliver->ulTotalLines = 0L;
+	pRefDeliver->lID = pSlot->pRefItm->lMyID;
+	pRefDeliver->ullCacheKey = ullCacheKey;
+	pRefDeliver->refProgress = (NKREF)pSlot->pRefDat;
+	pRefDeliver->pSink = NULL;
+	pRefDeliver->pszFileName = NULL;
+	// Set RefCompletion structure refered from CompletionProc.
+	pRefCompletion->pulCount = &pSlot->ulCount;
+	pRefCompletion->pRef = pRefDeliver;
+
+	// set DataProc as data delivery callback function
+	stProc.pProc = (LPNKFUNC)DataProc;
+	stProc.refProc = (NKREF)pRefDeliver;
+	bRet = Command_CapSet( pSlot->pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_CallbackPtr, (NKPARAM)&stProc, NULL, NULL );
+	if ( bRet == FALSE ) {
+		free( pRefDeliver );
+		free( pRefCompletion );
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
 	}
 
+	// Starting Acquire Thumbnail
+	bRet = Command_CapStart( pSlot->pRefDat->pObject, kNkMAIDCapability_Acquire, (LPNKFUNC)CompletionProc, (NKREF)pRefCompletion, NULL );
+	if ( bRet == FALSE ) {
+		FinishThumbnailSlot( pRefSrc, pSlot );
+		return FALSE;
+	}
+	pSlot->bBusy = TRUE;
+
 	return TRUE;
 }
 //------------------------------------------------------------------------------------------------------------------------------------
+// Reset DataProc of the thumbnail object in the slot and close the objects that were opened by StartThumbnailSlot.
+BOOL FinishThumbnailSlot( LPRefObj pRefSrc, LPRefThumbSlot pSlot )
+{
+	BOOL	bRet = TRUE;
+
+	if ( pSlot->pRefDat != NULL ) {
+		// reset DataProc
+		bRet = Command_CapSet( pSlot->pRefDat->pObject, kNkMAIDCapability_DataProc, kNkMAIDDataType_Null, (NKPARAM)NULL, NULL, NULL );
+	}
+	if ( pSlot->pRefItm != NULL ) {
+		if ( pSlot->bItemOpened == TRUE ) {
+			// close the item object(include the thumbnail object).
+			if ( RemoveChild( pRefSrc, pSlot->pRefItm->lMyID ) == FALSE ) bRet = FALSE;
+		} else if ( pSlot->bDataOpened == TRUE ) {
+			if ( RemoveChild( pSlot->pRefItm, kNkMAIDDataObjType_Thumbnail ) == FALSE ) bRet = FALSE;
+		}
+	}
+	memset( pSlot, 0, sizeof(RefThumbSlot) );
+
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
 // get pointer to CapInfo, the capability ID of that is 'ulID'
 LPNkMAIDCapInfo GetCapInfo(LPRefObj pRef, ULONG ulID)
 {
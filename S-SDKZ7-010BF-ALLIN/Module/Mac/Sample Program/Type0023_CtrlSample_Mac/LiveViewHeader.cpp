@@ -0,0 +1,204 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Header of the live view image.
+// A LiveViewHeader only points into the delivered buffer. Every field is decoded from the big
+// endian header when it is asked for, so the frame is never copied.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+// offsets in the header
+#define LVH_MAJOR_VERSION		0
+#define LVH_MINOR_VERSION		2
+#define LVH_DISPLAY_INFO_SIZE	8
+#define LVH_IMAGE_SIZE			12
+#define LVH_WHOLE_WIDTH			16
+#define LVH_WHOLE_HEIGHT		18
+#define LVH_DISPLAY_WIDTH		20
+#define LVH_DISPLAY_HEIGHT		22
+#define LVH_DISPLAY_CENTER_X	24
+#define LVH_DISPLAY_CENTER_Y	26
+#define LVH_IMAGE_WIDTH			28
+#define LVH_IMAGE_HEIGHT		30
+#define LVH_QUALITY				32
+#define LVH_AF_DRIVE_ENABLED	40
+#define LVH_FOCUS_DRIVING		41
+#define LVH_FOCUS_JUDGE			42
+#define LVH_AF_MODE				43
+#define LVH_SELECTED_AREA		44
+#define LVH_SELECTED_FACE		45
+#define LVH_TRACKING_STATUS		46
+#define LVH_AF_FRAME			48		// 8 bytes for each frame
+#define LVH_MOVIE_REMAIN		384
+#define LVH_SOUND_PEAK_L		388
+#define LVH_SOUND_PEAK_R		389
+#define LVH_SOUND_LEVEL_L		390
+#define LVH_SOUND_LEVEL_R		391
+#define LVH_MOVIE_REC_INFO		392
+#define LVH_SYNC_EXTERNAL		393
+#define LVH_TIME_CODE_STATUS	395
+#define LVH_TIME_CODE			396		// hour, minute, second, frame
+#define LVH_COUNTDOWN			400
+#define LVH_SPOT_WB				402
+#define LVH_ROTATION			403
+#define LVH_ROLLING				404
+#define LVH_PITCHING			408
+#define LVH_YAWING				412
+#define LVH_WB_FOR_LIVEVIEW		416
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// read big endian values from the header
+static UCHAR LVHeaderUCHAR( LPLiveViewHeader pHeader, ULONG ulOffset )
+{
+	return pHeader->pucHeader[ulOffset];
+}
+static UWORD LVHeaderUWORD( LPLiveViewHeader pHeader, ULONG ulOffset )
+{
+	const unsigned char* p = pHeader->pucHeader + ulOffset;
+	return (UWORD)( (p[0] << 8) | p[1] );
+}
+static ULONG LVHeaderULONG( LPLiveViewHeader pHeader, ULONG ulOffset )
+{
+	const unsigned char* p = pHeader->pucHeader + ulOffset;
+	return ( (ULONG)p[0] << 24 ) | ( (ULONG)p[1] << 16 ) | ( (ULONG)p[2] << 8 ) | (ULONG)p[3];
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// set up the view over a live view image. The buffer must stay valid while the view is used.
+BOOL ParseLiveViewHeader( const unsigned char* pucData, ULONG ulSize, LPLiveViewHeader pHeader )
+{
+	ULONG ulImageSize;
+
+	memset( pHeader, 0, sizeof(LiveViewHeader) );
+	if ( pucData == NULL || ulSize < LIVEVIEW_HEADER_SIZE ) return FALSE;
+	pHeader->pucHeader = pucData;
+	if ( LVHeaderUWORD( pHeader, LVH_MAJOR_VERSION ) == 0 ) return FALSE;
+
+	// The JPEG data follows the header. The size in the header is used if it fits in the buffer.
+	pHeader->pucJpeg = pucData + LIVEVIEW_HEADER_SIZE;
+	pHeader->ulJpegSize = ulSize - LIVEVIEW_HEADER_SIZE;
+	ulImageSize = LVHeaderULONG( pHeader, LVH_IMAGE_SIZE );
+	if ( ulImageSize > 0 && ulImageSize < pHeader->ulJpegSize )
+		pHeader->ulJpegSize = ulImageSize;
+	if ( pHeader->ulJpegSize < 2 || pHeader->pucJpeg[0] != 0xFF || pHeader->pucJpeg[1] != 0xD8 ) return FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// version of the header layout
+void GetLiveViewVersion( LPLiveViewHeader pHeader, UWORD* pwMajor, UWORD* pwMinor )
+{
+	*pwMajor = LVHeaderUWORD( pHeader, LVH_MAJOR_VERSION );
+	*pwMinor = LVHeaderUWORD( pHeader, LVH_MINOR_VERSION );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// size of the whole sensor area, and size of the JPEG image
+void GetLiveViewImageSize( LPLiveViewHeader pHeader, UWORD* pwWholeWidth, UWORD* pwWholeHeight, UWORD* pwImageWidth, UWORD* pwImageHeight )
+{
+	*pwWholeWidth = LVHeaderUWORD( pHeader, LVH_WHOLE_WIDTH );
+	*pwWholeHeight = LVHeaderUWORD( pHeader, LVH_WHOLE_HEIGHT );
+	*pwImageWidth = LVHeaderUWORD( pHeader, LVH_IMAGE_WIDTH );
+	*pwImageHeight = LVHeaderUWORD( pHeader, LVH_IMAGE_HEIGHT );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// area of the sensor shown in the image. It is smaller than the whole area while the live view is zoomed.
+void GetLiveViewDisplayArea( LPLiveViewHeader pHeader, LPLiveViewRect pRect )
+{
+	pRect->wWidth = LVHeaderUWORD( pHeader, LVH_DISPLAY_WIDTH );
+	pRect->wHeight = LVHeaderUWORD( pHeader, LVH_DISPLAY_HEIGHT );
+	pRect->wCenterX = LVHeaderUWORD( pHeader, LVH_DISPLAY_CENTER_X );
+	pRect->wCenterY = LVHeaderUWORD( pHeader, LVH_DISPLAY_CENTER_Y );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// AF frame in the coordinates of the whole area. Returns FALSE if the frame is not used.
+BOOL GetLiveViewAFFrame( LPLiveViewHeader pHeader, ULONG ulIndex, LPLiveViewRect pRect )
+{
+	ULONG ulOffset = LVH_AF_FRAME + ulIndex * 8;
+
+	if ( ulIndex >= LIVEVIEW_AF_FRAME_MAX ) return FALSE;
+	pRect->wWidth = LVHeaderUWORD( pHeader, ulOffset );
+	pRect->wHeight = LVHeaderUWORD( pHeader, ulOffset + 2 );
+	pRect->wCenterX = LVHeaderUWORD( pHeader, ulOffset + 4 );
+	pRect->wCenterY = LVHeaderUWORD( pHeader, ulOffset + 6 );
+	return ( pRect->wWidth != 0 && pRect->wHeight != 0 ) ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// focus and tracking state
+void GetLiveViewFocusState( LPLiveViewHeader pHeader, LPLiveViewFocusState pState )
+{
+	pState->ucAFDriveEnabled = LVHeaderUCHAR( pHeader, LVH_AF_DRIVE_ENABLED );
+	pState->ucFocusDriving = LVHeaderUCHAR( pHeader, LVH_FOCUS_DRIVING );
+	pState->ucFocusJudge = LVHeaderUCHAR( pHeader, LVH_FOCUS_JUDGE );
+	pState->ucAFMode = LVHeaderUCHAR( pHeader, LVH_AF_MODE );
+	pState->ucSelectedArea = LVHeaderUCHAR( pHeader, LVH_SELECTED_AREA );
+	pState->ucSelectedFace = LVHeaderUCHAR( pHeader, LVH_SELECTED_FACE );
+	pState->ucTrackingStatus = LVHeaderUCHAR( pHeader, LVH_TRACKING_STATUS );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// level of the camera. The values are passed as they are in the header.
+void GetLiveViewLevel( LPLiveViewHeader pHeader, UCHAR* pucRotation, SLONG* plRolling, SLONG* plPitching, SLONG* plYawing )
+{
+	*pucRotation = LVHeaderUCHAR( pHeader, LVH_ROTATION );
+	*plRolling = (SLONG)LVHeaderULONG( pHeader, LVH_ROLLING );
+	*plPitching = (SLONG)LVHeaderULONG( pHeader, LVH_PITCHING );
+	*plYawing = (SLONG)LVHeaderULONG( pHeader, LVH_YAWING );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// movie recording state
+void GetLiveViewMovieState( LPLiveViewHeader pHeader, LPLiveViewMovieState pState )
+{
+	pState->ulRemainTime = LVHeaderULONG( pHeader, LVH_MOVIE_REMAIN );
+	pState->ucRecInfo = LVHeaderUCHAR( pHeader, LVH_MOVIE_REC_INFO );
+	pState->ucSoundPeakL = LVHeaderUCHAR( pHeader, LVH_SOUND_PEAK_L );
+	pState->ucSoundPeakR = LVHeaderUCHAR( pHeader, LVH_SOUND_PEAK_R );
+	pState->ucSoundLevelL = LVHeaderUCHAR( pHeader, LVH_SOUND_LEVEL_L );
+	pState->ucSoundLevelR = LVHeaderUCHAR( pHeader, LVH_SOUND_LEVEL_R );
+	pState->ucSyncExternal = LVHeaderUCHAR( pHeader, LVH_SYNC_EXTERNAL );
+	pState->ucTimeCodeStatus = LVHeaderUCHAR( pHeader, LVH_TIME_CODE_STATUS );
+	memcpy( pState->ucTimeCode, pHeader->pucHeader + LVH_TIME_CODE, 4 );
+	pState->wCountdown = LVHeaderUWORD( pHeader, LVH_COUNTDOWN );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// exposure and white balance indicators
+void GetLiveViewExposureState( LPLiveViewHeader pHeader, UCHAR* pucQuality, UCHAR* pucSpotWB, UCHAR* pucWBForLiveView )
+{
+	*pucQuality = LVHeaderUCHAR( pHeader, LVH_QUALITY );
+	*pucSpotWB = LVHeaderUCHAR( pHeader, LVH_SPOT_WB );
+	*pucWBForLiveView = LVHeaderUCHAR( pHeader, LVH_WB_FOR_LIVEVIEW );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// show the header
+void PrintLiveViewHeader( LPLiveViewHeader pHeader )
+{
+	static const char* pszJudge[3] = { "None", "Not focused", "Focused" };
+	UWORD wMajor, wMinor, wWholeW, wWholeH, wImageW, wImageH;
+	LiveViewRect stRect;
+	LiveViewFocusState stFocus;
+	UCHAR ucRotation;
+	SLONG lRolling, lPitching, lYawing;
+	ULONG i, ulFrames = 0;
+
+	GetLiveViewVersion( pHeader, &wMajor, &wMinor );
+	GetLiveViewImageSize( pHeader, &wWholeW, &wWholeH, &wImageW, &wImageH );
+	GetLiveViewDisplayArea( pHeader, &stRect );
+	GetLiveViewFocusState( pHeader, &stFocus );
+	GetLiveViewLevel( pHeader, &ucRotation, &lRolling, &lPitching, &lYawing );
+	for ( i = 0; i < LIVEVIEW_AF_FRAME_MAX; i++ ) {
+		LiveViewRect stFrame;
+		if ( GetLiveViewAFFrame( pHeader, i, &stFrame ) == TRUE ) ulFrames++;
+	}
+
+	printf( "Header version %u.%u, JPEG %u bytes\n", wMajor, wMinor, (unsigned)pHeader->ulJpegSize );
+	printf( "Image %ux%u of %ux%u, display area %ux%u at (%u, %u)\n", wImageW, wImageH, wWholeW, wWholeH,
+			stRect.wWidth, stRect.wHeight, stRect.wCenterX, stRect.wCenterY );
+	printf( "Focus: %s%s, AF mode %u, area %u, face %u, tracking %u, %u AF frames\n",
+			stFocus.ucFocusJudge < 3 ? pszJudge[stFocus.ucFocusJudge] : "Unknown", stFocus.ucFocusDriving ? " (driving)" : "",
+			stFocus.ucAFMode, stFocus.ucSelectedArea, stFocus.ucSelectedFace, stFocus.ucTrackingStatus, (unsigned)ulFrames );
+	printf( "Rotation %u, rolling %d, pitching %d, yawing %d\n", ucRotation, (int)lRolling, (int)lPitching, (int)lYawing );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
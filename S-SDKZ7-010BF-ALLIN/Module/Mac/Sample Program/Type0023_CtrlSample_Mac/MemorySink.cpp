@@ -0,0 +1,162 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Memory sink.
+// A route of kSinkKind_Memory keeps the delivered files in this process, for a caller that reads
+// them in place, such as the nkmaid Python module. The files are written into the buffers of a
+// small pool, which are grown when a file is larger and reused for the later files.
+// A buffer is Writing while the file is delivered, Ready when it was committed, and Held while a
+// caller has taken it. The Ready buffers are taken oldest first. If no buffer is free, the oldest
+// Ready buffer is reused and its file is counted as dropped; a Held buffer is never reused.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+enum eMemorySinkState
+{
+	kMemorySinkState_Free = 0,
+	kMemorySinkState_Writing,
+	kMemorySinkState_Ready,
+	kMemorySinkState_Held
+};
+
+typedef struct tagMemorySinkBuffer
+{
+	ULONG	ulState;				// eMemorySinkState
+	MemorySinkFrame	stFrame;
+	ULONG	ulCapacity;
+} MemorySinkBuffer, *LPMemorySinkBuffer;
+
+MemorySinkBuffer	g_stMemorySink[MEMORY_SINK_BUFFER_MAX];
+NK_UINT_64	g_ullMemorySinkSeq = 0;
+NK_UINT_64	g_ullMemorySinkDropped = 0;
+std::mutex	g_MemorySinkMutex;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// take a buffer of ulLength bytes for a delivered file. Returns the index of the buffer, or -1 if all buffers are used.
+SLONG ReserveMemorySinkBuffer( ULONG ulLength )
+{
+	LPMemorySinkBuffer pBuffer;
+	SLONG i, lBuffer = -1;
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+
+	for ( i = 0; i < MEMORY_SINK_BUFFER_MAX; i++ ) {
+		if ( g_stMemorySink[i].ulState != kMemorySinkState_Free ) continue;
+		lBuffer = i;
+		break;
+	}
+	if ( lBuffer < 0 ) {
+		// The oldest file nobody has taken yet is dropped.
+		for ( i = 0; i < MEMORY_SINK_BUFFER_MAX; i++ ) {
+			if ( g_stMemorySink[i].ulState != kMemorySinkState_Ready ) continue;
+			if ( lBuffer < 0 || g_stMemorySink[i].stFrame.ullSeq < g_stMemorySink[lBuffer].stFrame.ullSeq ) lBuffer = i;
+		}
+		if ( lBuffer < 0 ) return -1;
+	}
+
+	pBuffer = &g_stMemorySink[lBuffer];
+	if ( ulLength > pBuffer->ulCapacity ) {
+		unsigned char* pucData = (unsigned char*)realloc( pBuffer->stFrame.pucData, ulLength );
+		if ( pucData == NULL ) return -1;			// the buffer keeps its file
+		pBuffer->stFrame.pucData = pucData;
+		pBuffer->ulCapacity = ulLength;
+	}
+	if ( pBuffer->ulState == kMemorySinkState_Ready ) g_ullMemorySinkDropped++;
+	pBuffer->ulState = kMemorySinkState_Writing;
+	pBuffer->stFrame.lBuffer = lBuffer;
+	pBuffer->stFrame.ulLength = 0;
+	return lBuffer;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the data of a buffer taken by ReserveMemorySinkBuffer.
+unsigned char* GetMemorySinkData( SLONG lBuffer )
+{
+	return g_stMemorySink[lBuffer].stFrame.pucData;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give back a buffer whose delivery stopped on the way.
+void CancelMemorySinkBuffer( SLONG lBuffer )
+{
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+	if ( lBuffer < 0 || lBuffer >= MEMORY_SINK_BUFFER_MAX ) return;
+	g_stMemorySink[lBuffer].ulState = kMemorySinkState_Free;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The file in the buffer is complete. It can be taken from now on.
+void PublishMemorySinkBuffer( SLONG lBuffer, ULONG ulRoute, const char* pszName, ULONG ulLength )
+{
+	LPMemorySinkFrame pFrame;
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+
+	if ( lBuffer < 0 || lBuffer >= MEMORY_SINK_BUFFER_MAX ) return;
+	pFrame = &g_stMemorySink[lBuffer].stFrame;
+	pFrame->ulRoute = ulRoute;
+	pFrame->ulLength = ulLength;
+	pFrame->ullSeq = ++g_ullMemorySinkSeq;
+	pFrame->ullTime = GetHostTimeUs();
+	strncpy( pFrame->szName, pszName, sizeof(pFrame->szName) - 1 );
+	pFrame->szName[sizeof(pFrame->szName) - 1] = 0;
+	g_stMemorySink[lBuffer].ulState = kMemorySinkState_Ready;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the oldest file of ulRoute, or of any route if ulRoute is kSinkRoute_Count.
+// The data stays in place until ReleaseMemorySinkFrame. Returns FALSE if there is no file.
+BOOL TakeMemorySinkFrame( ULONG ulRoute, LPMemorySinkFrame pFrame )
+{
+	SLONG i, lBuffer = -1;
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+
+	for ( i = 0; i < MEMORY_SINK_BUFFER_MAX; i++ ) {
+		LPMemorySinkBuffer pBuffer = &g_stMemorySink[i];
+		if ( pBuffer->ulState != kMemorySinkState_Ready ) continue;
+		if ( ulRoute < kSinkRoute_Count && pBuffer->stFrame.ulRoute != ulRoute ) continue;
+		if ( lBuffer < 0 || pBuffer->stFrame.ullSeq < g_stMemorySink[lBuffer].stFrame.ullSeq ) lBuffer = i;
+	}
+	if ( lBuffer < 0 ) return FALSE;
+	g_stMemorySink[lBuffer].ulState = kMemorySinkState_Held;
+	*pFrame = g_stMemorySink[lBuffer].stFrame;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give back a file taken by TakeMemorySinkFrame. Its buffer is reused for a later file.
+void ReleaseMemorySinkFrame( LPMemorySinkFrame pFrame )
+{
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+	if ( pFrame->lBuffer < 0 || pFrame->lBuffer >= MEMORY_SINK_BUFFER_MAX ) return;
+	if ( g_stMemorySink[pFrame->lBuffer].ulState == kMemorySinkState_Held )
+		g_stMemorySink[pFrame->lBuffer].ulState = kMemorySinkState_Free;
+	pFrame->lBuffer = -1;
+	pFrame->pucData = NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// get the number of files waiting to be taken and the number of dropped files.
+void GetMemorySinkStats( ULONG* pulReady, NK_UINT_64* pullDropped )
+{
+	ULONG i;
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+
+	*pulReady = 0;
+	for ( i = 0; i < MEMORY_SINK_BUFFER_MAX; i++ )
+		if ( g_stMemorySink[i].ulState == kMemorySinkState_Ready ) (*pulReady)++;
+	*pullDropped = g_ullMemorySinkDropped;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the buffers. The files not taken are dropped, and the buffers still held are kept for their callers.
+void FreeMemorySink( void )
+{
+	ULONG i;
+	std::lock_guard<std::mutex> lock( g_MemorySinkMutex );
+
+	for ( i = 0; i < MEMORY_SINK_BUFFER_MAX; i++ ) {
+		if ( g_stMemorySink[i].ulState == kMemorySinkState_Held || g_stMemorySink[i].ulState == kMemorySinkState_Writing ) continue;
+		free( g_stMemorySink[i].stFrame.pucData );
+		memset( &g_stMemorySink[i], 0, sizeof(MemorySinkBuffer) );
+	}
+}
@@ -0,0 +1,251 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Motion trigger.
+// The luma of every live view frame is decoded at 1/8, which needs only the DC coefficients, and it
+// is compared with a reference in blocks of 8x8 pixels. A block has changed if its mean absolute
+// difference is over a threshold, and the score of a frame is the ratio of the changed blocks. The
+// reference follows the scene slowly, so a change that stays is absorbed after some frames.
+// A picture is taken by kNkMAIDCapability_CaptureAsync when the score stays over the upper threshold
+// for some frames, and the trigger is armed again when the score stays under the lower threshold.
+// The detection runs in the control procedure of the live view, so the capture is started on the
+// same thread right after the frame arrived. The latency from the arrival to CapStart is logged.
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+	#include <emmintrin.h>
+	#define MOTION_SSE2
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define MOTION_BLOCK				8		// pixels of the downscaled luma
+#define MOTION_BLOCK_THRESHOLD		12		// mean absolute difference of a changed block
+#define MOTION_ON_DEFAULT			200		// 2.00% of the blocks
+#define MOTION_OFF_DEFAULT			50
+#define MOTION_COOLDOWN_DEFAULT		2000	// msec
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// Sum the absolute differences of the blocks, and move the reference a quarter of the way to the luma.
+void SumBlockDifference( const UCHAR* pucLuma, ULONG ulStride, UCHAR* pucReference, ULONG ulBlocksX, ULONG ulBlocksY, ULONG* pulBlockSad )
+{
+	ULONG x, y, bx, by;
+
+	memset( pulBlockSad, 0, ulBlocksX * ulBlocksY * sizeof(ULONG) );
+	for ( by = 0; by < ulBlocksY; by++ ) {
+		ULONG* pulSad = pulBlockSad + by * ulBlocksX;
+		for ( y = by * MOTION_BLOCK; y < (by + 1) * MOTION_BLOCK; y++ ) {
+			const UCHAR* pucCur = pucLuma + y * ulStride;
+			UCHAR* pucRef = pucReference + y * ulBlocksX * MOTION_BLOCK;
+			bx = 0;
+#if defined( MOTION_SSE2 )
+			// A 16 bytes load covers two blocks, and _mm_sad_epu8 sums each half separately.
+			for ( ; bx + 2 <= ulBlocksX; bx += 2 ) {
+				__m128i vCur = _mm_loadu_si128( (const __m128i*)(pucCur + bx * MOTION_BLOCK) );
+				__m128i vRef = _mm_loadu_si128( (const __m128i*)(pucRef + bx * MOTION_BLOCK) );
+				__m128i vSad = _mm_sad_epu8( vCur, vRef );
+				pulSad[bx] += (ULONG)_mm_cvtsi128_si32( vSad );
+				pulSad[bx + 1] += (ULONG)_mm_cvtsi128_si32( _mm_srli_si128( vSad, 8 ) );
+				_mm_storeu_si128( (__m128i*)(pucRef + bx * MOTION_BLOCK), _mm_avg_epu8( vRef, _mm_avg_epu8( vRef, vCur ) ) );
+			}
+#endif
+			for ( ; bx < ulBlocksX; bx++ ) {
+				for ( x = bx * MOTION_BLOCK; x < (bx + 1) * MOTION_BLOCK; x++ ) {
+					ULONG ulHalf = ( pucRef[x] + pucCur[x] + 1 ) >> 1;
+					pulSad[bx] += ( pucCur[x] > pucRef[x] ) ? pucCur[x] - pucRef[x] : pucRef[x] - pucCur[x];
+					pucRef[x] = (UCHAR)( ( pucRef[x] + ulHalf + 1 ) >> 1 );
+				}
+			}
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Score the luma against the reference. Returns the ratio of the changed blocks in 1/100 percent.
+// The first luma, or a luma of another size, becomes the reference and scores 0.
+ULONG ScoreMotion( LPMotionDetector pMotion, LPJpegLuma pLuma )
+{
+	ULONG ulBlocksX = pLuma->wWidth / MOTION_BLOCK;
+	ULONG ulBlocksY = pLuma->wHeight / MOTION_BLOCK;
+	ULONG ulChanged = 0, i, y;
+
+	if ( ulBlocksX == 0 || ulBlocksY == 0 ) return 0;
+	if ( ulBlocksX != pMotion->ulBlocksX || ulBlocksY != pMotion->ulBlocksY ) {
+		UCHAR* pucReference = (UCHAR*)realloc( pMotion->pucReference, ulBlocksX * ulBlocksY * MOTION_BLOCK * MOTION_BLOCK );
+		ULONG* pulBlockSad = (ULONG*)realloc( pMotion->pulBlockSad, ulBlocksX * ulBlocksY * sizeof(ULONG) );
+		if ( pucReference != NULL ) pMotion->pucReference = pucReference;
+		if ( pulBlockSad != NULL ) pMotion->pulBlockSad = pulBlockSad;
+		if ( pucReference == NULL || pulBlockSad == NULL ) {
+			pMotion->ulBlocksX = pMotion->ulBlocksY = 0;
+			return 0;
+		}
+		pMotion->ulBlocksX = ulBlocksX;
+		pMotion->ulBlocksY = ulBlocksY;
+		for ( y = 0; y < ulBlocksY * MOTION_BLOCK; y++ )
+			memcpy( pMotion->pucReference + y * ulBlocksX * MOTION_BLOCK, pLuma->pucLuma + y * pLuma->ulStride, ulBlocksX * MOTION_BLOCK );
+		return 0;
+	}
+
+	SumBlockDifference( pLuma->pucLuma, pLuma->ulStride, pMotion->pucReference, ulBlocksX, ulBlocksY, pMotion->pulBlockSad );
+	for ( i = 0; i < ulBlocksX * ulBlocksY; i++ )
+		if ( pMotion->pulBlockSad[i] > pMotion->ulBlockThreshold * MOTION_BLOCK * MOTION_BLOCK ) ulChanged++;
+	return ulChanged * 10000 / ( ulBlocksX * ulBlocksY );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Start CaptureAsync without waiting for its completion. *pulCount is counted up when it completes.
+BOOL StartCaptureAsync( LPRefObj pRefSrc, ULONG* pulCount )
+{
+	LPRefCompletionProc pRefCompletion;
+
+	pRefCompletion = (LPRefCompletionProc)malloc( sizeof(RefCompletionProc) );// this block will be freed in CompletionProc.
+	if ( pRefCompletion == NULL ) return FALSE;
+	pRefCompletion->pulCount = pulCount;
+	pRefCompletion->pRef = NULL;
+	return Command_CapStart( pRefSrc->pObject, kNkMAIDCapability_CaptureAsync, (LPNKFUNC)CompletionProc, (NKREF)pRefCompletion, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// control procedure of the live view to detect the motion and trigger the capture
+BOOL MotionControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPMotionDetector pMotion = (LPMotionDetector)pContext;
+	LiveViewHeader stHeader;
+	NK_UINT_64 ullStart = GetHostTimeUs(), ullProcess, ullCapStart;
+	ULONG ulScore;
+	BOOL bFire = FALSE;
+
+	if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ||
+		 DecodeJpegLuma( stHeader.pucJpeg, stHeader.ulJpegSize, 8, &pMotion->stLuma ) == FALSE ) {
+		pMotion->ulErrors++;
+		return TRUE;
+	}
+	ulScore = ScoreMotion( pMotion, &pMotion->stLuma );
+	ullProcess = GetHostTimeUs() - ullStart;
+	pMotion->ullFrames++;
+	pMotion->ullProcessTime += ullProcess;
+	if ( ullProcess > pMotion->ullProcessMax ) pMotion->ullProcessMax = ullProcess;
+	if ( ulScore > pMotion->ulScoreMax ) pMotion->ulScoreMax = ulScore;
+
+	if ( pMotion->bTriggered == FALSE ) {
+		pMotion->ulAbove = ( ulScore >= pMotion->ulOnScore ) ? pMotion->ulAbove + 1 : 0;
+		if ( pMotion->ulAbove >= pMotion->ulOnFrames &&
+			 ( pMotion->ullLastTrigger == 0 || pFrame->ullTime - pMotion->ullLastTrigger >= (NK_UINT_64)pMotion->ulCooldown * 1000 ) )
+			bFire = TRUE;
+	} else {
+		pMotion->ulBelow = ( ulScore <= pMotion->ulOffScore ) ? pMotion->ulBelow + 1 : 0;
+		if ( pMotion->ulBelow >= pMotion->ulOffFrames ) {
+			// The scene is still again.
+			pMotion->bTriggered = FALSE;
+			pMotion->ulAbove = 0;
+		}
+	}
+	if ( bFire == FALSE ) return TRUE;
+
+	ullCapStart = GetHostTimeUs();
+	if ( StartCaptureAsync( pRefSrc, &pMotion->ulCompleted ) == FALSE ) {
+		printf( "Failed in starting CaptureAsync.\n" );
+		pMotion->ulFailed++;
+		return TRUE;
+	}
+	pMotion->bTriggered = TRUE;
+	pMotion->ulBelow = 0;
+	pMotion->ullLastTrigger = pFrame->ullTime;
+	pMotion->ulTriggers++;
+	pMotion->ullLatency += ullCapStart - pFrame->ullTime;
+	// The frames before the motion are written if the pre-trigger ring is running.
+	TriggerPreTrigger( "motion" );
+	if ( ullCapStart - pFrame->ullTime > pMotion->ullLatencyMax ) pMotion->ullLatencyMax = ullCapStart - pFrame->ullTime;
+	printf( "Triggered by frame %llu: %u.%02u%% of the blocks changed, %llu usec after the arrival.\n",
+			(unsigned long long)pFrame->ullSeq, (unsigned)(ulScore / 100), (unsigned)(ulScore % 100),
+			(unsigned long long)( ullCapStart - pFrame->ullTime ) );
+	if ( pMotion->pLog != NULL ) {
+		fprintf( pMotion->pLog, "%u,%llu,%llu,%llu,%llu,%u.%02u,%llu\n", (unsigned)pMotion->ulTriggers, (unsigned long long)pFrame->ullSeq,
+					(unsigned long long)pFrame->ullTime, (unsigned long long)ullCapStart,
+					(unsigned long long)( ullCapStart - pFrame->ullTime ), (unsigned)(ulScore / 100), (unsigned)(ulScore % 100),
+					(unsigned long long)ullProcess );
+		fflush( pMotion->pLog );
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the buffers of the detector
+void FreeMotionDetector( LPMotionDetector pMotion )
+{
+	if ( pMotion->pucReference != NULL ) free( pMotion->pucReference );
+	if ( pMotion->pulBlockSad != NULL ) free( pMotion->pulBlockSad );
+	pMotion->pucReference = NULL;
+	pMotion->pulBlockSad = NULL;
+	pMotion->ulBlocksX = pMotion->ulBlocksY = 0;
+	FreeJpegLuma( &pMotion->stLuma );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take pictures when the live view changes, with the settings input by the user.
+BOOL MotionTriggerMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSeconds, ulSaved, ulValue;
+	MotionDetector	stMotion;
+	BOOL	bRet;
+
+	memset( &stMotion, 0, sizeof(stMotion) );
+	if ( GetUnsignedCapability( pRefSrc, kNkMAIDCapability_SaveMedia, &ulValue ) == TRUE && ulValue != 0 )
+		printf( "SaveMedia is not Card. The pictures stay in the camera until they are acquired.\n" );
+	printf( "Input the ratio of changed blocks to trigger in 1/100 %% (0: %d)\n>", MOTION_ON_DEFAULT );
+	scanf( "%s", buf );
+	stMotion.ulOnScore = atoi( buf );
+	if ( stMotion.ulOnScore == 0 || stMotion.ulOnScore > 10000 ) stMotion.ulOnScore = MOTION_ON_DEFAULT;
+	printf( "Input the ratio to arm again in 1/100 %% (0: %d)\n>", MOTION_OFF_DEFAULT );
+	scanf( "%s", buf );
+	stMotion.ulOffScore = atoi( buf );
+	if ( stMotion.ulOffScore == 0 || stMotion.ulOffScore > stMotion.ulOnScore ) stMotion.ulOffScore = stMotion.ulOnScore / 4;
+	printf( "Input the mean difference of a changed block (1-255, 0: %d)\n>", MOTION_BLOCK_THRESHOLD );
+	scanf( "%s", buf );
+	stMotion.ulBlockThreshold = atoi( buf );
+	if ( stMotion.ulBlockThreshold == 0 || stMotion.ulBlockThreshold > 255 ) stMotion.ulBlockThreshold = MOTION_BLOCK_THRESHOLD;
+	printf( "Input the number of frames over the threshold to trigger (1-30, 0: 2)\n>" );
+	scanf( "%s", buf );
+	stMotion.ulOnFrames = atoi( buf );
+	if ( stMotion.ulOnFrames == 0 || stMotion.ulOnFrames > 30 ) stMotion.ulOnFrames = 2;
+	stMotion.ulOffFrames = stMotion.ulOnFrames * 2;
+	printf( "Input the minimum interval between the pictures in msec (0: %d)\n>", MOTION_COOLDOWN_DEFAULT );
+	scanf( "%s", buf );
+	stMotion.ulCooldown = atoi( buf );
+	if ( stMotion.ulCooldown == 0 ) stMotion.ulCooldown = MOTION_COOLDOWN_DEFAULT;
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	printf( "Input the duration in seconds (0: until Ctrl+C)\n>" );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+
+	stMotion.pLog = fopen( "Motion.csv", "w" );
+	if ( stMotion.pLog != NULL )
+		fprintf( stMotion.pLog, "trigger,seq,arrival_us,capstart_us,latency_us,changed_percent,process_us\n" );
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		if ( stMotion.pLog != NULL ) fclose( stMotion.pLog );
+		return FALSE;
+	}
+	printf( "Watching the live view. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, ulSeconds, MotionControl, &stMotion );
+	// wait for the captures in progress.
+	IdleLoop( pRefSrc->pObject, &stMotion.ulCompleted, stMotion.ulTriggers );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+	if ( stMotion.pLog != NULL ) fclose( stMotion.pLog );
+
+	printf( "%u pictures were taken from %llu frames (%u failed, %u errors), the peak score was %u.%02u%%.\n",
+			(unsigned)stMotion.ulTriggers, (unsigned long long)stMotion.ullFrames, (unsigned)stMotion.ulFailed, (unsigned)stMotion.ulErrors,
+			(unsigned)(stMotion.ulScoreMax / 100), (unsigned)(stMotion.ulScoreMax % 100) );
+	if ( stMotion.ullFrames > 0 )
+		printf( "Detection took %llu usec per frame on average, %llu usec at most.\n",
+				(unsigned long long)( stMotion.ullProcessTime / stMotion.ullFrames ), (unsigned long long)stMotion.ullProcessMax );
+	if ( stMotion.ulTriggers > 0 )
+		printf( "Trigger latency from the arrival to CapStart: %llu usec on average, %llu usec at most.\n",
+				(unsigned long long)( stMotion.ullLatency / stMotion.ulTriggers ), (unsigned long long)stMotion.ullLatencyMax );
+	FreeMotionDetector( &stMotion );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
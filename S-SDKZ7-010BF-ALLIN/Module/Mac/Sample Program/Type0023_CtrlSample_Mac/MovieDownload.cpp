@@ -0,0 +1,572 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Overlapped movie download.
+// The calling thread reads the movie by GetVideoImageEx into a ring of pool buffers, and the
+// writer thread writes the filled buffers to the file in order, so the transfer from the camera
+// and the write to the disk overlap. The reader waits only if all buffers are waiting for the disk.
+// The block size of GetArray starts at 5MB and is tuned by the measured throughput of GetArray:
+// it is doubled while the throughput grows, halved if the first doubling did not help, and kept at
+// the best size after that. The chosen size is the first size of the next download, and the pool
+// buffers are kept until FreeMoviePool, so a batch of movies runs at the tuned size from the start.
+// The progress and MB/s are shown by the progress renderer.
+// The movie goes to the sink of kSinkRoute_Movie. Only a file sink has checkpoints and is resumed.
+// Each download keeps a checkpoint sidecar "<movie>.ckpt" with the identity of the item, the size
+// of the movie, the offset flushed to the file and a hash of the bytes just before it. A download
+// of the same item reopens the partial file, checks its tail and continues at the offset. The
+// camera can't seek: if it kept its position, the download goes on without reading anything again,
+// and if it starts again from 0, the bytes the file has are read, compared at the tail and skipped.
+// The writer also feeds every written block to the movie indexer (MovieIndex.cpp), whose state is
+// kept in the checkpoint, and the index is recorded when the movie is complete.
+
+#if defined( _WIN32 )
+	#include <io.h>
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define MOVIE_POOL_COUNT		4
+#define MOVIE_BLOCK_DEFAULT	0x500000		// first block size : 5MB
+#define MOVIE_BLOCK_MIN		0x100000		// 1MB
+#define MOVIE_BLOCK_MAX		0x2000000		// 32MB
+#define MOVIE_TUNE_BLOCKS		3				// blocks measured for each block size
+#define MOVIE_TUNE_GAIN		1.05			// a block size must be 5% faster to be chosen
+#define MOVIE_TAIL_SIZE		0x10000		// bytes checked at the end of the partial file : 64KB
+#define MOVIE_CHECKPOINT_BYTES	0x4000000	// bytes written between checkpoints : 64MB
+
+typedef struct tagMovieBlock
+{
+	LPVOID	pData;
+	ULONG	ulCapacity;
+	ULONG	ulStart;					// bytes of pData the file already has
+	ULONG	ulSize;					// bytes of pData to write after ulStart
+	NK_UINT_64	ullOffset;			// offset of pData + ulStart in the movie
+} MovieBlock, *LPMovieBlock;
+
+typedef struct tagMovieTuner
+{
+	ULONG	ulBlockSize;
+	ULONG	ulFirstSize;
+	ULONG	ulBestSize;
+	double	dBestRate;				// bytes per usec
+	SLONG	lDirection;				// 1: growing, -1: shrinking, 0: settled
+	NK_UINT_64	ullBytes;			// measured in the current window
+	NK_UINT_64	ullTime;
+	ULONG	ulBlocks;
+} MovieTuner, *LPMovieTuner;
+
+// The ring is used in order. The reader fills g_stMoviePool[g_ulMovieFilled % MOVIE_POOL_COUNT]
+// and the writer writes g_stMoviePool[g_ulMovieWritten % MOVIE_POOL_COUNT].
+MovieBlock	g_stMoviePool[MOVIE_POOL_COUNT];
+ULONG	g_ulMovieFilled = 0;
+ULONG	g_ulMovieWritten = 0;
+BOOL	g_bMovieEnd = FALSE;			// no more blocks will be filled
+BOOL	g_bMovieError = FALSE;			// the writer failed
+std::mutex	g_MovieMutex;
+std::condition_variable	g_MovieCond;	// signaled when a block was filled or written
+
+ULONG	g_ulMovieBlockSize = MOVIE_BLOCK_DEFAULT;	// block size chosen by the last download
+
+UCHAR	g_ucMovieTail[MOVIE_TAIL_SIZE];	// the last bytes written to the file
+ULONG	g_ulMovieTail = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// make the pool buffer hold ulSize bytes. The buffers are kept for the next movie.
+BOOL ReserveMovieBlock( ULONG ulIndex, ULONG ulSize )
+{
+	LPMovieBlock pBlock = &g_stMoviePool[ulIndex];
+
+	if ( pBlock->ulCapacity >= ulSize ) return TRUE;
+	free( pBlock->pData );
+	pBlock->pData = malloc( ulSize );
+	pBlock->ulCapacity = ( pBlock->pData != NULL ) ? ulSize : 0;
+	return ( pBlock->pData != NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the pool buffers. No download must be running.
+void FreeMoviePool( void )
+{
+	ULONG i;
+	for ( i = 0; i < MOVIE_POOL_COUNT; i++ ) {
+		free( g_stMoviePool[i].pData );
+		g_stMoviePool[i].pData = NULL;
+		g_stMoviePool[i].ulCapacity = 0;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+void InitMovieTuner( LPMovieTuner pTuner, ULONG ulBlockSize )
+{
+	memset( pTuner, 0, sizeof(MovieTuner) );
+	pTuner->ulBlockSize = ulBlockSize;
+	pTuner->ulFirstSize = ulBlockSize;
+	pTuner->ulBestSize = ulBlockSize;
+	pTuner->lDirection = 1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// add a GetArray of ulRead bytes that took ullTime usec, and choose the next block size at the end of a window.
+void TuneMovieBlock( LPMovieTuner pTuner, ULONG ulRead, NK_UINT_64 ullTime )
+{
+	double dRate;
+	ULONG ulNext = 0;
+
+	// The short block at the end of the movie is not measured.
+	if ( pTuner->lDirection == 0 || ulRead < pTuner->ulBlockSize ) return;
+	pTuner->ullBytes += ulRead;
+	pTuner->ullTime += ullTime;
+	if ( ++pTuner->ulBlocks < MOVIE_TUNE_BLOCKS ) return;
+
+	dRate = ( pTuner->ullTime > 0 ) ? (double)pTuner->ullBytes / pTuner->ullTime : 0;
+	pTuner->ullBytes = 0;
+	pTuner->ullTime = 0;
+	pTuner->ulBlocks = 0;
+	if ( dRate > pTuner->dBestRate * MOVIE_TUNE_GAIN ) {
+		pTuner->dBestRate = dRate;
+		pTuner->ulBestSize = pTuner->ulBlockSize;
+		ulNext = ( pTuner->lDirection > 0 ) ? pTuner->ulBlockSize * 2 : pTuner->ulBlockSize / 2;
+	} else if ( pTuner->lDirection > 0 && pTuner->ulBestSize == pTuner->ulFirstSize ) {
+		// larger blocks did not help. Try smaller ones.
+		pTuner->lDirection = -1;
+		ulNext = pTuner->ulFirstSize / 2;
+	}
+	if ( ulNext < MOVIE_BLOCK_MIN || ulNext > MOVIE_BLOCK_MAX ) {
+		pTuner->ulBlockSize = pTuner->ulBestSize;
+		pTuner->lDirection = 0;
+		return;
+	}
+	pTuner->ulBlockSize = ulNext;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// keep the last MOVIE_TAIL_SIZE bytes written to the file.
+void UpdateMovieTail( const UCHAR* pucData, ULONG ulSize )
+{
+	ULONG ulKeep;
+
+	if ( ulSize >= MOVIE_TAIL_SIZE ) {
+		memcpy( g_ucMovieTail, pucData + ulSize - MOVIE_TAIL_SIZE, MOVIE_TAIL_SIZE );
+		g_ulMovieTail = MOVIE_TAIL_SIZE;
+		return;
+	}
+	ulKeep = MOVIE_TAIL_SIZE - ulSize;
+	if ( ulKeep > g_ulMovieTail ) ulKeep = g_ulMovieTail;
+	memmove( g_ucMovieTail, g_ucMovieTail + g_ulMovieTail - ulKeep, ulKeep );
+	memcpy( g_ucMovieTail + ulKeep, pucData, ulSize );
+	g_ulMovieTail = ulKeep + ulSize;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+NK_UINT_64 HashMovieTail( void )
+{
+	return HashThumbCacheKey( 0xCBF29CE484222325ULL, g_ucMovieTail, g_ulMovieTail );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// compare the bytes read again from ullOffset with the tail of the file, which ends at ullEnd.
+BOOL CompareMovieTail( const UCHAR* pucData, NK_UINT_64 ullOffset, ULONG ulSize, NK_UINT_64 ullEnd )
+{
+	NK_UINT_64 ullTailStart = ullEnd - g_ulMovieTail;
+	NK_UINT_64 ullStart = ( ullOffset > ullTailStart ) ? ullOffset : ullTailStart;
+
+	if ( ullStart >= ullOffset + ulSize ) return TRUE;
+	return ( memcmp( pucData + (ullStart - ullOffset), g_ucMovieTail + (ullStart - ullTailStart), (size_t)(ullOffset + ulSize - ullStart) ) == 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the checkpoint to a temporary file and replace the sidecar with it.
+BOOL SaveMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint )
+{
+	char	szName[256+8], szTemp[256+12];
+	FILE*	pFile;
+	BOOL	bRet = TRUE;
+	const UCHAR*	pucIndex = (const UCHAR*)&pCheckpoint->stIndex;
+	size_t	i;
+
+	sprintf( szName, "%s.ckpt", pszFileName );
+	sprintf( szTemp, "%s.ckpt.tmp", pszFileName );
+	pFile = fopen( szTemp, "w" );
+	if ( pFile == NULL ) return FALSE;
+	fprintf( pFile, "item %u %016llX\nsize %llu\noffset %llu\ntail %016llX\n", (unsigned)pCheckpoint->ulItemID,
+				(unsigned long long)pCheckpoint->ullItemKey, (unsigned long long)pCheckpoint->ullTotal,
+				(unsigned long long)pCheckpoint->ullOffset, (unsigned long long)pCheckpoint->ullTailHash );
+	// the state of the box parser at the offset
+	fprintf( pFile, "index " );
+	for ( i = 0; i < sizeof(MovieIndex); i++ )
+		fprintf( pFile, "%02X", pucIndex[i] );
+	fprintf( pFile, "\n" );
+	if ( fflush( pFile ) != 0 ) bRet = FALSE;
+#if defined( _WIN32 )
+	if ( bRet == TRUE && FlushFileBuffers( (HANDLE)_get_osfhandle( _fileno( pFile ) ) ) == FALSE ) bRet = FALSE;
+	fclose( pFile );
+	if ( bRet == TRUE && MoveFileExA( szTemp, szName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH ) == FALSE ) bRet = FALSE;
+#elif defined(__APPLE__)
+	if ( bRet == TRUE && fcntl( fileno( pFile ), F_FULLFSYNC ) != 0 ) bRet = FALSE;
+	fclose( pFile );
+	if ( bRet == TRUE && rename( szTemp, szName ) != 0 ) bRet = FALSE;
+#endif
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// read the sidecar of pszFileName. A sidecar without the state of the box parser is loaded with the parser skipped to the offset.
+BOOL LoadMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint )
+{
+	char	szName[256+8];
+	FILE*	pFile;
+	unsigned	uItemID;
+	unsigned long long	ullItemKey, ullTotal, ullOffset, ullTailHash;
+	unsigned	uByte;
+	UCHAR*	pucIndex = (UCHAR*)&pCheckpoint->stIndex;
+	size_t	i = 0;
+	int	iCount;
+
+	sprintf( szName, "%s.ckpt", pszFileName );
+	pFile = fopen( szName, "r" );
+	if ( pFile == NULL ) return FALSE;
+	iCount = fscanf( pFile, "item %u %llX size %llu offset %llu tail %llX", &uItemID, &ullItemKey, &ullTotal, &ullOffset, &ullTailHash );
+	if ( iCount == 5 ) {
+		fscanf( pFile, " index " );
+		for ( i = 0; i < sizeof(MovieIndex); i++ ) {
+			if ( fscanf( pFile, "%2X", &uByte ) != 1 ) break;
+			pucIndex[i] = (UCHAR)uByte;
+		}
+	}
+	fclose( pFile );
+	if ( iCount != 5 ) return FALSE;
+	if ( i != sizeof(MovieIndex) || pCheckpoint->stIndex.ullPosition != ullOffset ) SkipMovieIndex( &pCheckpoint->stIndex, ullOffset );
+	pCheckpoint->ulItemID = uItemID;
+	pCheckpoint->ullItemKey = ullItemKey;
+	pCheckpoint->ullTotal = ullTotal;
+	pCheckpoint->ullOffset = ullOffset;
+	pCheckpoint->ullTailHash = ullTailHash;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// remove the sidecar of a finished movie.
+void RemoveMovieCheckpoint( const char* pszFileName )
+{
+	char	szName[256+8];
+
+	sprintf( szName, "%s.ckpt", pszFileName );
+	remove( szName );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Check if pszFileName is a partial file of the item in pCheckpoint, whose ullTotal is the size the camera has not sent yet.
+// If it is, pCheckpoint is filled from the sidecar and the tail of the file is loaded.
+BOOL MatchMovieCheckpoint( const char* pszFileName, LPMovieCheckpoint pCheckpoint )
+{
+	MovieCheckpoint	stSaved;
+	FILE*	pFile;
+	NK_UINT_64	ullSize;
+	ULONG	ulTail;
+	int	iRet;
+
+	if ( LoadMovieCheckpoint( pszFileName, &stSaved ) == FALSE ) return FALSE;
+	if ( stSaved.ulItemID != pCheckpoint->ulItemID || stSaved.ullItemKey != pCheckpoint->ullItemKey ||
+		 stSaved.ullTotal < pCheckpoint->ullTotal || stSaved.ullOffset > stSaved.ullTotal )
+		return FALSE;
+
+	// The file must still have the flushed bytes, and the bytes just before the offset must not have changed.
+	pFile = fopen( pszFileName, "rb" );
+	if ( pFile == NULL ) return FALSE;
+	ulTail = ( stSaved.ullOffset < MOVIE_TAIL_SIZE ) ? (ULONG)stSaved.ullOffset : MOVIE_TAIL_SIZE;
+#if defined( _WIN32 )
+	iRet = _fseeki64( pFile, 0, SEEK_END );
+	ullSize = (NK_UINT_64)_ftelli64( pFile );
+	if ( iRet == 0 && ullSize >= stSaved.ullOffset ) iRet = _fseeki64( pFile, (__int64)(stSaved.ullOffset - ulTail), SEEK_SET );
+#elif defined(__APPLE__)
+	iRet = fseeko( pFile, 0, SEEK_END );
+	ullSize = (NK_UINT_64)ftello( pFile );
+	if ( iRet == 0 && ullSize >= stSaved.ullOffset ) iRet = fseeko( pFile, (off_t)(stSaved.ullOffset - ulTail), SEEK_SET );
+#endif
+	if ( iRet != 0 || ullSize < stSaved.ullOffset || fread( g_ucMovieTail, 1, ulTail, pFile ) != ulTail ) {
+		fclose( pFile );
+		return FALSE;
+	}
+	fclose( pFile );
+	g_ulMovieTail = ulTail;
+	if ( HashMovieTail() != stSaved.ullTailHash ) {
+		g_ulMovieTail = 0;
+		return FALSE;
+	}
+	*pCheckpoint = stSaved;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// flush the file and record the offset in the checkpoint. Call it without g_MovieMutex; the reader thread sets ullTotal under it.
+BOOL CheckpointMovie( LPDataSink pSink, LPMovieCheckpoint pCheckpoint )
+{
+	MovieCheckpoint	stCheckpoint;
+
+	if ( SyncDataSink( pSink ) == FALSE ) return FALSE;
+	pCheckpoint->ullOffset = pSink->ullWritten;
+	pCheckpoint->ullTailHash = HashMovieTail();
+	{
+		std::lock_guard<std::mutex> lock( g_MovieMutex );
+		stCheckpoint = *pCheckpoint;
+	}
+	return SaveMovieCheckpoint( pSink->szName, &stCheckpoint );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Get the size of the movie and make the file name. If a partial file of this movie has a checkpoint, its name and the
+// checkpoint are returned. Otherwise pCheckpoint has the identity of the movie and the offset 0.
+BOOL PrepareMovieDownload( LPRefObj pRefDat, ULONG ulCapID, char* pszFileName, LPMovieCheckpoint pCheckpoint )
+{
+	BOOL	bRet;
+	FILE*	hFileMovie = NULL;
+	int	i = 0;
+	NkMAIDGetVideoImageEx	stVideoImage;
+	NkMAIDEnum	stEnum;
+
+	// get total size. This is the size the camera has not sent yet.
+	memset( &stVideoImage, 0, sizeof(NkMAIDGetVideoImageEx) );
+	bRet = Command_CapGet( pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL );
+	if ( bRet == FALSE || stVideoImage.ullDataSize == 0 ) return FALSE;
+
+	// get movie file type
+	LPRefObj pRefItem = (LPRefObj)pRefDat->pRefParent;
+	if ( !pRefItem ) return FALSE;
+	LPRefObj pRefSource = (LPRefObj)pRefItem->pRefParent;
+	if ( !pRefSource ) return FALSE;
+	bRet = Command_CapGet( pRefSource->pObject, kNkMAIDCapability_MovieFileType, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+	if ( bRet == FALSE ) return FALSE;
+
+	memset( pCheckpoint, 0, sizeof(MovieCheckpoint) );
+	pCheckpoint->ulItemID = (ULONG)pRefItem->lMyID;
+	GetThumbCacheKey( pRefItem, &pCheckpoint->ullItemKey );
+	pCheckpoint->ullTotal = stVideoImage.ullDataSize;
+
+	// create file name
+	while ( TRUE ) {
+		sprintf( pszFileName, "MovieData%03d.%s", ++i, stEnum.ulValue == 1 ? "mp4" : "mov" );
+		if ( (hFileMovie = fopen( pszFileName, "r" )) == NULL ) break;
+		// this file name is already used.
+		fclose( hFileMovie );
+		if ( GetSinkKind( kSinkRoute_Movie ) == kSinkKind_File && MatchMovieCheckpoint( pszFileName, pCheckpoint ) == TRUE ) {
+			printf( "%s is resumed from %llu of %llu bytes.\n", pszFileName,
+					(unsigned long long)pCheckpoint->ullOffset, (unsigned long long)pCheckpoint->ullTotal );
+			break;
+		}
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the filled blocks in order until the reader ends.
+void MovieWriterLoop( LPDataSink pSink, LPMovieCheckpoint pCheckpoint, LPMovieStats pStats )
+{
+	std::unique_lock<std::mutex> lock( g_MovieMutex );
+	LPMovieBlock pBlock;
+	NK_UINT_64 ullStart;
+	BOOL bRet;
+
+	while ( TRUE ) {
+		if ( g_ulMovieWritten == g_ulMovieFilled ) {
+			if ( g_bMovieEnd == TRUE ) break;
+			pStats->ulWriterWaits++;
+			g_MovieCond.wait( lock, []{ return g_ulMovieWritten != g_ulMovieFilled || g_bMovieEnd == TRUE; } );
+			continue;
+		}
+		pBlock = &g_stMoviePool[g_ulMovieWritten % MOVIE_POOL_COUNT];
+		lock.unlock();
+		ullStart = GetHostTimeUs();
+		bRet = WriteDataSink( pSink, pBlock->ullOffset, (UCHAR*)pBlock->pData + pBlock->ulStart, pBlock->ulSize );
+		if ( bRet == TRUE ) {
+			UpdateMovieTail( (UCHAR*)pBlock->pData + pBlock->ulStart, pBlock->ulSize );
+			FeedMovieIndex( &pCheckpoint->stIndex, (UCHAR*)pBlock->pData + pBlock->ulStart, pBlock->ulSize );
+			if ( pSink->ulKind == kSinkKind_File && pSink->ullWritten - pCheckpoint->ullOffset >= MOVIE_CHECKPOINT_BYTES )
+				bRet = CheckpointMovie( pSink, pCheckpoint );
+		}
+		lock.lock();
+		pStats->ullWriteTime += GetHostTimeUs() - ullStart;
+		if ( bRet == FALSE ) {
+			g_bMovieError = TRUE;
+			g_MovieCond.notify_all();
+			break;
+		}
+		pStats->ullWritten += pBlock->ulSize;
+		g_ulMovieWritten++;
+		g_MovieCond.notify_all();
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Download the movie in pCheckpoint to pszFileName from pCheckpoint->ullOffset. Returns TRUE if the movie was saved or the
+// download was canceled. A canceled download keeps the position of the camera, so the next download continues without reading again.
+BOOL DownloadVideoImage( LPRefObj pRefDat, ULONG ulCapID, LPMovieCheckpoint pCheckpoint, const char* pszFileName, LPMovieStats pStats )
+{
+	NkMAIDGetVideoImageEx	stVideoImage;
+	DataSink	stSink;
+	MovieTuner	stTuner;
+	LPMovieBlock	pBlock;
+	ULONG	ulIndex, ulSkip;
+	NK_UINT_64	ullTotal = pCheckpoint->ullTotal;
+	NK_UINT_64	ullNext = pCheckpoint->ullOffset;		// offset of the next byte the file needs
+	NK_UINT_64	ullStart, ullCall;
+	BOOL	bRet = TRUE, bAbort = FALSE, bRestarted = FALSE;
+	std::thread	Writer;
+
+	memset( pStats, 0, sizeof(MovieStats) );
+	pStats->ullTotal = ullTotal;
+	pStats->ullResumed = ullNext;
+	if ( ullNext == 0 ) {
+		g_ulMovieTail = 0;
+		InitMovieIndex( &pCheckpoint->stIndex );
+	}
+	if ( ResumeDataSink( &stSink, kSinkRoute_Movie, pszFileName, ullTotal, ullNext ) == FALSE ) return FALSE;
+
+	InitMovieTuner( &stTuner, g_ulMovieBlockSize );
+	g_ulMovieFilled = 0;
+	g_ulMovieWritten = 0;
+	g_bMovieEnd = FALSE;
+	g_bMovieError = FALSE;
+	memset( &stVideoImage, 0, sizeof(NkMAIDGetVideoImageEx) );
+	// The progress is counted in KB, so that a movie over 4GB fits in ULONG.
+	UpdateProgress( (NKREF)pRefDat, kNkMAIDCommand_CapGetArray, ulCapID, (ULONG)( ullNext / 1024 ), (ULONG)( ullTotal / 1024 ) );
+	ullStart = GetHostTimeUs();
+	Writer = std::thread( MovieWriterLoop, &stSink, pCheckpoint, pStats );
+
+	while ( ullNext < ullTotal ) {
+		{
+			std::unique_lock<std::mutex> lock( g_MovieMutex );
+			if ( g_ulMovieFilled - g_ulMovieWritten == MOVIE_POOL_COUNT ) pStats->ulReaderWaits++;
+			g_MovieCond.wait( lock, []{ return g_ulMovieFilled - g_ulMovieWritten < MOVIE_POOL_COUNT || g_bMovieError == TRUE; } );
+			if ( g_bMovieError == TRUE ) {
+				printf( "%s can't be written.\n", pszFileName );
+				bRet = FALSE;
+				bAbort = TRUE;
+				break;
+			}
+		}
+		if ( g_bCancel == TRUE ) break;
+		// Only the reader changes g_ulMovieFilled, and the writer does not touch this block until it is filled.
+		ulIndex = g_ulMovieFilled % MOVIE_POOL_COUNT;
+		if ( ReserveMovieBlock( ulIndex, stTuner.ulBlockSize ) == FALSE ) {
+			printf( "Memory allocation error.\n" );
+			bRet = FALSE;
+			bAbort = TRUE;
+			break;
+		}
+		pBlock = &g_stMoviePool[ulIndex];
+		stVideoImage.ullDataSize = stTuner.ulBlockSize;
+		stVideoImage.ullReadSize = 0;
+		stVideoImage.pData = pBlock->pData;
+		ullCall = GetHostTimeUs();
+		bRet = Command_CapGetArray( pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL );
+		ullCall = GetHostTimeUs() - ullCall;
+		if ( bRet == FALSE || stVideoImage.ullReadSize == 0 ) {
+			bRet = FALSE;
+			bAbort = TRUE;
+			break;
+		}
+		pStats->ullRead += stVideoImage.ullReadSize;
+		pStats->ullReadTime += ullCall;
+		pStats->ulBlocks++;
+		AddProgressBytes( (NKREF)pRefDat, (ULONG)stVideoImage.ullReadSize );
+		TuneMovieBlock( &stTuner, (ULONG)stVideoImage.ullReadSize, ullCall );
+
+		// ullOffset is the offset of the data in the movie.
+		if ( stVideoImage.ullOffset > ullNext ) {
+			// The camera is ahead of the file, e.g. the last download stopped after the checkpoint. Start the camera again from 0.
+			if ( bRestarted == TRUE ) {
+				printf( "The camera can't read the movie from the offset of %s.\n", pszFileName );
+				bRet = FALSE;
+				bAbort = TRUE;
+				break;
+			}
+			stVideoImage.ullDataSize = 0;
+			Command_CapGetArray( pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL );
+			bRestarted = TRUE;
+			// The size the camera has not sent is the whole movie again.
+			if ( Command_CapGet( pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL ) == TRUE &&
+				 stVideoImage.ullDataSize > ullTotal ) {
+				std::lock_guard<std::mutex> lock( g_MovieMutex );
+				ullTotal = stVideoImage.ullDataSize;
+				pCheckpoint->ullTotal = ullTotal;
+				pStats->ullTotal = ullTotal;
+			}
+			continue;
+		}
+		ulSkip = 0;
+		if ( stVideoImage.ullOffset < ullNext ) {
+			// The camera started again before the end of the file. The bytes the file has are compared at the tail and skipped.
+			ulSkip = ( ullNext - stVideoImage.ullOffset < stVideoImage.ullReadSize ) ? (ULONG)( ullNext - stVideoImage.ullOffset ) : (ULONG)stVideoImage.ullReadSize;
+			if ( CompareMovieTail( (UCHAR*)pBlock->pData, stVideoImage.ullOffset, ulSkip, ullNext ) == FALSE ) {
+				printf( "%s is not a part of this movie.\n", pszFileName );
+				bRet = FALSE;
+				bAbort = TRUE;
+				break;
+			}
+		}
+		pBlock->ulStart = ulSkip;
+		pBlock->ulSize = (ULONG)stVideoImage.ullReadSize - ulSkip;
+		pBlock->ullOffset = stVideoImage.ullOffset + ulSkip;
+		ullNext += pBlock->ulSize;
+		UpdateProgress( (NKREF)pRefDat, kNkMAIDCommand_CapGetArray, ulCapID, (ULONG)( ullNext / 1024 ), (ULONG)( ullTotal / 1024 ) );
+		if ( pBlock->ulSize == 0 ) continue;
+
+		std::lock_guard<std::mutex> lock( g_MovieMutex );
+		g_ulMovieFilled++;
+		g_MovieCond.notify_all();
+	}
+
+	// stop the acquisition on the way. The camera starts again from 0 at the next download.
+	if ( bAbort == TRUE ) {
+		stVideoImage.ullDataSize = 0;
+		Command_CapGetArray( pRefDat->pObject, ulCapID, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( g_MovieMutex );
+		g_bMovieEnd = TRUE;
+		g_MovieCond.notify_all();
+	}
+	Writer.join();
+	if ( g_bMovieError == TRUE ) bRet = FALSE;
+
+	// An unfinished file keeps its checkpoint and is not recorded in the manifest.
+	if ( stSink.ullWritten < ullTotal ) {
+		if ( stSink.ulKind == kSinkKind_File && g_bMovieError == FALSE && CheckpointMovie( &stSink, pCheckpoint ) == FALSE )
+			printf( "The checkpoint of %s can't be saved.\n", pszFileName );
+		AbortDataSink( &stSink );
+	} else if ( CommitDataSink( &stSink ) == FALSE ) {
+		bRet = FALSE;
+	}
+	if ( stSink.ullWritten == ullTotal && bRet == TRUE ) {
+		RemoveMovieCheckpoint( pszFileName );
+		LPRefObj pRefItem = (LPRefObj)pRefDat->pRefParent;
+		RecordMovieIndex( pRefItem != NULL ? (LPRefObj)pRefItem->pRefParent : NULL, &pCheckpoint->stIndex, pszFileName, stSink.ullWritten );
+	}
+	FinishProgress( (NKREF)pRefDat, kNkMAIDCommand_CapGetArray, ulCapID );
+	pStats->ullElapsed = GetHostTimeUs() - ullStart;
+	pStats->ulBlockSize = stTuner.ulBlockSize;
+	g_ulMovieBlockSize = stTuner.ulBlockSize;
+
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Show the throughput of a download.
+void PrintMovieStats( const char* pszFileName, LPMovieStats pStats )
+{
+	double dMB = 1024.0 * 1024.0;
+
+	if ( pStats->ullResumed > 0 )
+		printf( "%s was resumed at %llu bytes.\n", pszFileName, (unsigned long long)pStats->ullResumed );
+	printf( "%s: %llu of %llu bytes in %llu msec, %.2f MB/s\n", pszFileName, (unsigned long long)( pStats->ullResumed + pStats->ullWritten ),
+			(unsigned long long)pStats->ullTotal, (unsigned long long)( pStats->ullElapsed / 1000 ),
+			pStats->ullElapsed > 0 ? pStats->ullWritten * 1000000.0 / pStats->ullElapsed / dMB : 0.0 );
+	printf( "  camera %.2f MB/s, disk %.2f MB/s, %u blocks, block size %u KB\n",
+			pStats->ullReadTime > 0 ? pStats->ullRead * 1000000.0 / pStats->ullReadTime / dMB : 0.0,
+			pStats->ullWriteTime > 0 ? pStats->ullWritten * 1000000.0 / pStats->ullWriteTime / dMB : 0.0,
+			(unsigned)pStats->ulBlocks, (unsigned)( pStats->ulBlockSize / 1024 ) );
+	printf( "  the camera waited for the disk %u times, the disk waited for the camera %u times\n",
+			(unsigned)pStats->ulReaderWaits, (unsigned)pStats->ulWriterWaits );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
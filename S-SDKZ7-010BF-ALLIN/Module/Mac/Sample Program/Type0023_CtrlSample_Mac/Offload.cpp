@@ -0,0 +1,255 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Batch movie offload.
+// Every item of the source is opened once to read its DataTypes. For the items with a video
+// object, the size to transfer (GetVideoImageEx), the recording information (GetRecordingInfo)
+// and the DateTime of the item are listed, and the objects are closed again. The list is ordered
+// smallest first or newest first, and the movies are downloaded back to back by
+// DownloadVideoImage, which keeps its pool buffers and the tuned block size between movies.
+// The ETA is computed from the bytes and the time of the movies downloaded so far.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open the item and its video object if they are not opened yet. *pbItemOpened tells if the item was opened here.
+LPRefObj OpenOffloadMovie( LPRefObj pRefSrc, ULONG ulItemID, BOOL* pbItemOpened )
+{
+	LPRefObj	pRefItm, pRefDat;
+	ULONG	ulDataTypes = 0L;
+
+	*pbItemOpened = FALSE;
+	pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
+	if ( pRefItm == NULL ) {
+		if ( AddChild( pRefSrc, ulItemID ) == FALSE ) return NULL;
+		pRefItm = GetRefChildPtr_ID( pRefSrc, ulItemID );
+		*pbItemOpened = TRUE;
+	}
+	if ( GetUnsignedCapability( pRefItm, kNkMAIDCapability_DataTypes, &ulDataTypes ) == FALSE || !(ulDataTypes & kNkMAIDDataObjType_Video) ) {
+		CloseOffloadMovie( pRefSrc, pRefItm, *pbItemOpened );
+		return NULL;
+	}
+	pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Video );
+	if ( pRefDat == NULL ) {
+		if ( AddChild( pRefItm, kNkMAIDDataObjType_Video ) == FALSE ) {
+			CloseOffloadMovie( pRefSrc, pRefItm, *pbItemOpened );
+			return NULL;
+		}
+		pRefDat = GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Video );
+	}
+	return pRefDat;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Close the video object, and the item if it was opened by OpenOffloadMovie.
+void CloseOffloadMovie( LPRefObj pRefSrc, LPRefObj pRefItm, BOOL bItemOpened )
+{
+	if ( bItemOpened == TRUE )
+		RemoveChild( pRefSrc, pRefItm->lMyID );
+	else if ( GetRefChildPtr_ID( pRefItm, kNkMAIDDataObjType_Video ) != NULL )
+		RemoveChild( pRefItm, kNkMAIDDataObjType_Video );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Read the entry of an item. Returns FALSE if the item has no movie.
+BOOL ReadOffloadEntry( LPRefObj pRefSrc, ULONG ulItemID, LPOffloadEntry pEntry )
+{
+	LPRefObj	pRefDat;
+	BOOL	bItemOpened, bRet;
+	NkMAIDGetVideoImageEx	stVideoImage;
+	NkMAIDGetRecordingInfo	stInfo;
+
+	memset( pEntry, 0, sizeof(OffloadEntry) );
+	pEntry->ulItemID = ulItemID;
+	pRefDat = OpenOffloadMovie( pRefSrc, ulItemID, &bItemOpened );
+	if ( pRefDat == NULL ) return FALSE;
+
+	memset( &stVideoImage, 0, sizeof(NkMAIDGetVideoImageEx) );
+	bRet = Command_CapGet( pRefDat->pObject, kNkMAIDCapability_GetVideoImageEx, kNkMAIDDataType_GenericPtr, (NKPARAM)&stVideoImage, NULL, NULL );
+	pEntry->ullSize = stVideoImage.ullDataSize;
+
+	// A movie over 4GB is divided into several video objects.
+	pEntry->ulTotalMovCount = 1;
+	pEntry->ullTotalMovSize = pEntry->ullSize;
+	if ( CheckCapabilityOperation( pRefDat, kNkMAIDCapability_GetRecordingInfo, kNkMAIDCapOperation_Get ) &&
+		 Command_CapGet( pRefDat->pObject, kNkMAIDCapability_GetRecordingInfo, kNkMAIDDataType_GenericPtr, (NKPARAM)&stInfo, NULL, NULL ) == TRUE ) {
+		pEntry->ulIndexOfMov = stInfo.ulIndexOfMov;
+		pEntry->ulTotalMovCount = stInfo.ulTotalMovCount;
+		pEntry->ullTotalMovSize = stInfo.ullTotalMovSize;
+	}
+	Command_CapGet( ((LPRefObj)pRefDat->pRefParent)->pObject, kNkMAIDCapability_DateTime, kNkMAIDDataType_DateTimePtr, (NKPARAM)&pEntry->stDateTime, NULL, NULL );
+
+	CloseOffloadMovie( pRefSrc, (LPRefObj)pRefDat->pRefParent, bItemOpened );
+	return ( bRet == TRUE && pEntry->ullSize > 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// List the movies in the source. The returned array must be freed by the caller.
+ULONG ListOffloadEntries( LPRefObj pRefSrc, LPOffloadEntry* ppEntries )
+{
+	BOOL	bRet;
+	NkMAIDEnum	stEnum;
+	ULONG	i, ulCount = 0;
+
+	*ppEntries = NULL;
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_Children, kNkMAIDCapOperation_Get ) ) return 0;
+	bRet = Command_CapGet( pRefSrc->pObject, kNkMAIDCapability_Children, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+	if ( bRet == FALSE || stEnum.ulElements == 0 || stEnum.wPhysicalBytes != 4 ) return 0;
+
+	stEnum.pData = malloc( stEnum.ulElements * stEnum.wPhysicalBytes );
+	*ppEntries = (LPOffloadEntry)malloc( stEnum.ulElements * sizeof(OffloadEntry) );
+	if ( stEnum.pData == NULL || *ppEntries == NULL ) {
+		free( stEnum.pData );
+		free( *ppEntries );
+		*ppEntries = NULL;
+		return 0;
+	}
+	bRet = Command_CapGetArray( pRefSrc->pObject, kNkMAIDCapability_Children, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL );
+	for ( i = 0; i < stEnum.ulElements && bRet == TRUE; i++ ) {
+		if ( ReadOffloadEntry( pRefSrc, ((ULONG*)stEnum.pData)[i], &(*ppEntries)[ulCount] ) == TRUE )
+			ulCount++;
+	}
+	free( stEnum.pData );
+	return ulCount;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The parts of a divided movie are sorted by the size of the whole movie, so they keep their order.
+int CompareOffloadSmallest( const void* p1, const void* p2 )
+{
+	LPOffloadEntry pEntry1 = (LPOffloadEntry)p1, pEntry2 = (LPOffloadEntry)p2;
+
+	if ( pEntry1->ullTotalMovSize != pEntry2->ullTotalMovSize ) return ( pEntry1->ullTotalMovSize < pEntry2->ullTotalMovSize ) ? -1 : 1;
+	if ( pEntry1->ulIndexOfMov != pEntry2->ulIndexOfMov ) return ( pEntry1->ulIndexOfMov < pEntry2->ulIndexOfMov ) ? -1 : 1;
+	if ( pEntry1->ulItemID != pEntry2->ulItemID ) return ( pEntry1->ulItemID < pEntry2->ulItemID ) ? -1 : 1;
+	return 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+int CompareOffloadNewest( const void* p1, const void* p2 )
+{
+	LPNkMAIDDateTime pDate1 = &((LPOffloadEntry)p1)->stDateTime, pDate2 = &((LPOffloadEntry)p2)->stDateTime;
+	ULONG ulValue1[7] = { pDate1->nYear, pDate1->nMonth, pDate1->nDay, pDate1->nHour, pDate1->nMinute, pDate1->nSecond, pDate1->nSubsecond };
+	ULONG ulValue2[7] = { pDate2->nYear, pDate2->nMonth, pDate2->nDay, pDate2->nHour, pDate2->nMinute, pDate2->nSecond, pDate2->nSubsecond };
+	ULONG i;
+
+	for ( i = 0; i < 7; i++ )
+		if ( ulValue1[i] != ulValue2[i] ) return ( ulValue1[i] > ulValue2[i] ) ? -1 : 1;
+	if ( ((LPOffloadEntry)p1)->ulIndexOfMov != ((LPOffloadEntry)p2)->ulIndexOfMov )
+		return ( ((LPOffloadEntry)p1)->ulIndexOfMov < ((LPOffloadEntry)p2)->ulIndexOfMov ) ? -1 : 1;
+	return CompareOffloadSmallest( p1, p2 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Download the listed movies in order. A movie that failed is skipped, and the batch stops when it is canceled.
+BOOL RunOffload( LPRefObj pRefSrc, LPOffloadEntry pEntries, ULONG ulCount )
+{
+	LPRefObj	pRefDat;
+	BOOL	bItemOpened, bRet;
+	char	szFileName[256];
+	MovieStats	stStats;
+	MovieCheckpoint	stCheckpoint;
+	NK_UINT_64	ullQueued = 0, ullDone = 0, ullTime = 0, ullStart;
+	ULONG	i, ulSaved = 0, ulFailed = 0, ulEta;
+	double	dRate;
+
+	for ( i = 0; i < ulCount; i++ )
+		ullQueued += pEntries[i].ullSize;
+	printf( "%u movies, %llu bytes. Please press the Ctrl+C to cancel.\n", (unsigned)ulCount, (unsigned long long)ullQueued );
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+
+	ullStart = GetHostTimeUs();
+	for ( i = 0; i < ulCount && g_bCancel == FALSE; i++ ) {
+		LPOffloadEntry pEntry = &pEntries[i];
+		printf( "[%u/%u] Item %08X, %llu bytes", (unsigned)( i + 1 ), (unsigned)ulCount, (unsigned)pEntry->ulItemID, (unsigned long long)pEntry->ullSize );
+		if ( pEntry->ulTotalMovCount > 1 )
+			printf( ", part %u of %u of %llu bytes", (unsigned)( pEntry->ulIndexOfMov + 1 ), (unsigned)pEntry->ulTotalMovCount,
+					(unsigned long long)pEntry->ullTotalMovSize );
+		printf( "\n" );
+
+		pRefDat = OpenOffloadMovie( pRefSrc, pEntry->ulItemID, &bItemOpened );
+		bRet = ( pRefDat != NULL );
+		if ( bRet == TRUE ) {
+			bRet = PrepareMovieDownload( pRefDat, kNkMAIDCapability_GetVideoImageEx, szFileName, &stCheckpoint );
+			if ( bRet == TRUE )
+				bRet = DownloadVideoImage( pRefDat, kNkMAIDCapability_GetVideoImageEx, &stCheckpoint, szFileName, &stStats );
+			CloseOffloadMovie( pRefSrc, (LPRefObj)pRefDat->pRefParent, bItemOpened );
+		}
+		if ( bRet == FALSE ) {
+			printf( "Item %08X can't be downloaded. It is skipped.\n", (unsigned)pEntry->ulItemID );
+			ullQueued -= pEntry->ullSize;
+			ulFailed++;
+			continue;
+		}
+		PrintMovieStats( szFileName, &stStats );
+		if ( stStats.ullResumed + stStats.ullWritten == stStats.ullTotal ) ulSaved++;
+
+		// The ETA is based on the throughput of the whole batch, including opening the objects.
+		ullDone += pEntry->ullSize;
+		ullTime = GetHostTimeUs() - ullStart;
+		dRate = ( ullTime > 0 ) ? (double)ullDone / ullTime : 0;
+		ulEta = ( dRate > 0 ) ? (ULONG)( (ullQueued - ullDone) / dRate / 1000000 ) : 0;
+		printf( "Offloaded %llu of %llu bytes, %.2f MB/s, ETA %u:%02u\n", (unsigned long long)ullDone, (unsigned long long)ullQueued,
+				dRate * 1000000 / (1024.0 * 1024.0), (unsigned)( ulEta / 60 ), (unsigned)( ulEta % 60 ) );
+	}
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	if ( g_bCancel == TRUE )
+		printf( "The offload was canceled. The movies can be resumed.\n" );
+	g_bCancel = FALSE;
+
+	printf( "%u of %u movies were saved, %u failed, in %llu sec.\n", (unsigned)ulSaved, (unsigned)ulCount, (unsigned)ulFailed,
+			(unsigned long long)( ( GetHostTimeUs() - ullStart ) / 1000000 ) );
+	return ( ulFailed == 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Offload all movies of the source in the order selected by the user.
+BOOL OffloadMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulOrder, ulCount;
+	LPOffloadEntry	pEntries;
+	BOOL	bRet;
+
+	printf( "Select Order (1-2, 0)\n" );
+	printf( " 1. Smallest first\n" );
+	printf( " 2. Newest first\n" );
+	printf( " 0. Exit\n>" );
+	scanf( "%s", buf );
+	ulOrder = atoi( buf );
+	if ( ulOrder != kOffloadOrder_Smallest && ulOrder != kOffloadOrder_Newest ) return TRUE;
+
+	ulCount = ListOffloadEntries( pRefSrc, &pEntries );
+	if ( ulCount == 0 ) {
+		printf( "There is no movie.\n" );
+		free( pEntries );
+		return TRUE;
+	}
+	qsort( pEntries, ulCount, sizeof(OffloadEntry), ( ulOrder == kOffloadOrder_Smallest ) ? CompareOffloadSmallest : CompareOffloadNewest );
+
+	bRet = RunOffload( pRefSrc, pEntries, ulCount );
+	FreeMoviePool();
+	free( pEntries );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,413 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Pre-trigger ring.
+// The live view frames of the last seconds are kept in memory as they were delivered. They are
+// stored one after another in an arena of a fixed number of bytes, and the oldest frames are
+// dropped when a new frame does not fit or when they are older than the time limit.
+// A trigger only queues a request, so it does not delay the capture. A thread pins the frames up
+// to the time of the trigger in the arena and writes them to an AVI file with AviWriter. A pinned
+// frame is not dropped until it was written; a new frame that does not fit meanwhile is not kept.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+	#include <conio.h>
+#elif defined(__APPLE__)
+	#include <sys/select.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define PRETRIGGER_ENTRY_MAX		4096		// frames in the ring
+#define PRETRIGGER_REQUEST_MAX		8			// dumps waiting to be written
+#define PRETRIGGER_BUDGET_DEFAULT	64			// MB
+#define PRETRIGGER_SECONDS_DEFAULT	10
+
+typedef struct tagPreTriggerEntry
+{
+	NK_UINT_64	ullSeq;
+	NK_UINT_64	ullTime;
+	ULONG	ulOffset;				// in the arena
+	ULONG	ulSize;
+} PreTriggerEntry, *LPPreTriggerEntry;
+
+typedef struct tagPreTriggerRequest
+{
+	NK_UINT_64	ullTime;				// frames up to this time are written
+	char	szReason[16];
+} PreTriggerRequest, *LPPreTriggerRequest;
+
+unsigned char*	g_pucPreTriggerArena = NULL;
+ULONG	g_ulPreTriggerCapacity = 0;
+ULONG	g_ulPreTriggerTail = 0;			// offset after the newest frame
+PreTriggerEntry	g_stPreTriggerEntry[PRETRIGGER_ENTRY_MAX];
+ULONG	g_ulPreTriggerFirst = 0;			// index of the oldest entry
+ULONG	g_ulPreTriggerCount = 0;
+NK_UINT_64	g_ullPreTriggerWindow = 0;		// usec
+PreTriggerRequest	g_stPreTriggerRequest[PRETRIGGER_REQUEST_MAX];
+ULONG	g_ulPreTriggerRequests = 0;
+ULONG	g_ulPreTriggerDumps = 0;
+BOOL	g_bPreTriggerStop = FALSE;
+SLONG	g_lPreTriggerConsumer = -1;
+BOOL	g_bPreTriggerPinned = FALSE;
+NK_UINT_64	g_ullPreTriggerPinFirst = 0;		// sequence numbers of the frames being written by a dump
+NK_UINT_64	g_ullPreTriggerPinLast = 0;
+PreTriggerStats	g_stPreTriggerStats;
+std::mutex	g_PreTriggerMutex;
+std::condition_variable	g_PreTriggerCond;
+std::thread	g_PreTriggerThread;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// check if the oldest frame is being written by a dump. The mutex must be locked.
+BOOL IsPreTriggerPinned( void )
+{
+	LPPreTriggerEntry pEntry = &g_stPreTriggerEntry[g_ulPreTriggerFirst];
+
+	if ( g_bPreTriggerPinned == FALSE || g_ulPreTriggerCount == 0 ) return FALSE;
+	return ( pEntry->ullSeq >= g_ullPreTriggerPinFirst && pEntry->ullSeq <= g_ullPreTriggerPinLast ) ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// drop the oldest frame. The mutex must be locked.
+void DropPreTriggerFrame( void )
+{
+	g_stPreTriggerStats.ullEvicted++;
+	g_ulPreTriggerFirst = ( g_ulPreTriggerFirst + 1 ) % PRETRIGGER_ENTRY_MAX;
+	if ( --g_ulPreTriggerCount == 0 ) {
+		g_ulPreTriggerFirst = 0;
+		g_ulPreTriggerTail = 0;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// find the offset where ulSize bytes fit after the newest frame. The mutex must be locked.
+BOOL FitPreTriggerFrame( ULONG ulSize, ULONG* pulOffset )
+{
+	ULONG ulHead;
+
+	if ( g_ulPreTriggerCount == 0 ) {
+		*pulOffset = 0;
+		return ( ulSize <= g_ulPreTriggerCapacity ) ? TRUE : FALSE;
+	}
+	if ( g_ulPreTriggerCount == PRETRIGGER_ENTRY_MAX ) return FALSE;
+	ulHead = g_stPreTriggerEntry[g_ulPreTriggerFirst].ulOffset;
+	if ( g_ulPreTriggerTail > ulHead ) {
+		// The free space is after the tail and before the head.
+		if ( ulSize <= g_ulPreTriggerCapacity - g_ulPreTriggerTail ) {
+			*pulOffset = g_ulPreTriggerTail;
+			return TRUE;
+		}
+		*pulOffset = 0;
+		return ( ulSize <= ulHead ) ? TRUE : FALSE;
+	}
+	// The frames wrapped around. The free space is between the tail and the head.
+	*pulOffset = g_ulPreTriggerTail;
+	return ( ulSize <= ulHead - g_ulPreTriggerTail ) ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// consumer of the live view frames to keep them in the ring
+void PreTriggerConsumer( LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPPreTriggerEntry pEntry;
+	ULONG ulOffset;
+	std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+
+	if ( pFrame->ulSize > g_ulPreTriggerCapacity ) {
+		g_stPreTriggerStats.ullSkipped++;
+		return;
+	}
+	while ( g_ulPreTriggerCount > 0 && pFrame->ullTime - g_stPreTriggerEntry[g_ulPreTriggerFirst].ullTime > g_ullPreTriggerWindow &&
+			IsPreTriggerPinned() == FALSE )
+		DropPreTriggerFrame();
+	while ( FitPreTriggerFrame( pFrame->ulSize, &ulOffset ) == FALSE ) {
+		if ( g_ulPreTriggerCount == 0 || IsPreTriggerPinned() == TRUE ) {
+			g_stPreTriggerStats.ullBlocked++;
+			return;
+		}
+		DropPreTriggerFrame();
+	}
+
+	memcpy( g_pucPreTriggerArena + ulOffset, pFrame->pucData, pFrame->ulSize );
+	pEntry = &g_stPreTriggerEntry[( g_ulPreTriggerFirst + g_ulPreTriggerCount ) % PRETRIGGER_ENTRY_MAX];
+	pEntry->ullSeq = pFrame->ullSeq;
+	pEntry->ullTime = pFrame->ullTime;
+	pEntry->ulOffset = ulOffset;
+	pEntry->ulSize = pFrame->ulSize;
+	g_ulPreTriggerCount++;
+	g_ulPreTriggerTail = ulOffset + pFrame->ulSize;
+	g_stPreTriggerStats.ullFrames++;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Pin the frames up to ullTime and write them to an AVI file. Only the entries are copied under the lock;
+// the frames are written from the arena, and each is unpinned as soon as it was written.
+BOOL DumpPreTrigger( LPPreTriggerRequest pRequest, ULONG ulDump )
+{
+	LPPreTriggerEntry pEntries = NULL;
+	ULONG ulCount = 0, i;
+	LiveViewFrame stFrame;
+	AviWriter stAvi;
+	char szBaseName[64];
+	BOOL bRet = TRUE;
+
+	{
+		std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+		for ( i = 0; i < g_ulPreTriggerCount; i++ ) {
+			if ( g_stPreTriggerEntry[( g_ulPreTriggerFirst + i ) % PRETRIGGER_ENTRY_MAX].ullTime > pRequest->ullTime ) break;
+			ulCount++;
+		}
+		if ( ulCount > 0 )
+			pEntries = (LPPreTriggerEntry)malloc( ulCount * sizeof(PreTriggerEntry) );
+		if ( pEntries != NULL ) {
+			for ( i = 0; i < ulCount; i++ )
+				pEntries[i] = g_stPreTriggerEntry[( g_ulPreTriggerFirst + i ) % PRETRIGGER_ENTRY_MAX];
+			g_ullPreTriggerPinFirst = pEntries[0].ullSeq;
+			g_ullPreTriggerPinLast = pEntries[ulCount - 1].ullSeq;
+			g_bPreTriggerPinned = TRUE;
+		}
+	}
+	if ( ulCount == 0 ) {
+		printf( "No live view frame was kept before the trigger %u.\n", (unsigned)ulDump );
+		return TRUE;
+	}
+	if ( pEntries == NULL ) {
+		printf( "There is not enough memory to write the trigger %u.\n", (unsigned)ulDump );
+		return FALSE;
+	}
+
+	sprintf( szBaseName, "PreTrigger%03u_", (unsigned)ulDump );
+	if ( OpenAviWriter( &stAvi, szBaseName ) == FALSE ) bRet = FALSE;
+	for ( i = 0; i < ulCount && bRet == TRUE; i++ ) {
+		memset( &stFrame, 0, sizeof(stFrame) );
+		stFrame.ullSeq = pEntries[i].ullSeq;
+		stFrame.ullTime = pEntries[i].ullTime;
+		stFrame.ulSize = pEntries[i].ulSize;
+		stFrame.ulHeaderSize = LIVEVIEW_HEADER_SIZE;
+		stFrame.ulCapacity = pEntries[i].ulSize;
+		stFrame.pucData = g_pucPreTriggerArena + pEntries[i].ulOffset;
+		bRet = WriteAviFrame( &stAvi, &stFrame );
+		if ( i + 1 < ulCount ) {
+			std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+			g_ullPreTriggerPinFirst = pEntries[i + 1].ullSeq;
+		}
+	}
+	{
+		std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+		g_bPreTriggerPinned = FALSE;
+	}
+	if ( CloseAviWriter( &stAvi ) == FALSE ) bRet = FALSE;
+	if ( bRet == TRUE )
+		printf( "%s was saved: %u frames of %llu msec before the %s trigger.\n", stAvi.szFileName, (unsigned)ulCount,
+				(unsigned long long)( ( pRequest->ullTime - pEntries[0].ullTime ) / 1000 ), pRequest->szReason );
+	else
+		printf( "Failed in writing the frames before the trigger %u.\n", (unsigned)ulDump );
+	free( pEntries );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// thread to write the requested dumps
+void PreTriggerLoop( void )
+{
+	PreTriggerRequest stRequest;
+	ULONG ulDump;
+
+	for ( ;; ) {
+		{
+			std::unique_lock<std::mutex> lock( g_PreTriggerMutex );
+			g_PreTriggerCond.wait( lock, []{ return g_ulPreTriggerRequests > 0 || g_bPreTriggerStop == TRUE; } );
+			// The requests are written before the thread stops.
+			if ( g_ulPreTriggerRequests == 0 ) return;
+			stRequest = g_stPreTriggerRequest[0];
+			memmove( &g_stPreTriggerRequest[0], &g_stPreTriggerRequest[1], (g_ulPreTriggerRequests - 1) * sizeof(PreTriggerRequest) );
+			g_ulPreTriggerRequests--;
+			ulDump = ++g_ulPreTriggerDumps;
+		}
+		if ( DumpPreTrigger( &stRequest, ulDump ) == TRUE ) {
+			std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+			g_stPreTriggerStats.ulDumps++;
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Start keeping the live view frames of the last ulSeconds in ullBudget bytes.
+BOOL StartPreTrigger( NK_UINT_64 ullBudget, ULONG ulSeconds )
+{
+	if ( g_pucPreTriggerArena != NULL ) return TRUE;
+	// The offsets in the arena are 32 bits.
+	if ( ullBudget > 0x7FFFFFFF ) ullBudget = 0x7FFFFFFF;
+	g_pucPreTriggerArena = (unsigned char*)malloc( (size_t)ullBudget );
+	if ( g_pucPreTriggerArena == NULL ) {
+		printf( "There is not enough memory for the pre-trigger ring.\n" );
+		return FALSE;
+	}
+	g_ulPreTriggerCapacity = (ULONG)ullBudget;
+	g_ulPreTriggerFirst = g_ulPreTriggerCount = g_ulPreTriggerTail = 0;
+	g_ulPreTriggerRequests = 0;
+	g_bPreTriggerPinned = FALSE;
+	g_ullPreTriggerWindow = (NK_UINT_64)ulSeconds * 1000000;
+	g_bPreTriggerStop = FALSE;
+	memset( &g_stPreTriggerStats, 0, sizeof(g_stPreTriggerStats) );
+
+	g_lPreTriggerConsumer = AddLiveViewConsumer( "PreTrigger", PreTriggerConsumer, NULL );
+	if ( g_lPreTriggerConsumer < 0 ) {
+		free( g_pucPreTriggerArena );
+		g_pucPreTriggerArena = NULL;
+		return FALSE;
+	}
+	g_PreTriggerThread = std::thread( PreTriggerLoop );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Request a dump of the frames before now. This returns at once, and does nothing if the ring is not running.
+BOOL TriggerPreTrigger( const char* pszReason )
+{
+	std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+	if ( g_pucPreTriggerArena == NULL || g_bPreTriggerStop == TRUE ) return FALSE;
+	if ( g_ulPreTriggerRequests == PRETRIGGER_REQUEST_MAX ) {
+		g_stPreTriggerStats.ulRejected++;
+		return FALSE;
+	}
+	g_stPreTriggerRequest[g_ulPreTriggerRequests].ullTime = GetHostTimeUs();
+	strncpy( g_stPreTriggerRequest[g_ulPreTriggerRequests].szReason, pszReason, sizeof(g_stPreTriggerRequest[0].szReason) - 1 );
+	g_stPreTriggerRequest[g_ulPreTriggerRequests].szReason[sizeof(g_stPreTriggerRequest[0].szReason) - 1] = '\0';
+	g_ulPreTriggerRequests++;
+	g_stPreTriggerStats.ulTriggers++;
+	g_PreTriggerCond.notify_all();
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Stop keeping the frames. The requested dumps are written before this returns.
+void StopPreTrigger( LPPreTriggerStats pStats )
+{
+	if ( g_pucPreTriggerArena == NULL ) return;
+	RemoveLiveViewConsumer( g_lPreTriggerConsumer );
+	g_lPreTriggerConsumer = -1;
+	{
+		std::lock_guard<std::mutex> lock( g_PreTriggerMutex );
+		g_bPreTriggerStop = TRUE;
+		g_PreTriggerCond.notify_all();
+	}
+	if ( g_PreTriggerThread.joinable() ) g_PreTriggerThread.join();
+	if ( pStats != NULL ) *pStats = g_stPreTriggerStats;
+	free( g_pucPreTriggerArena );
+	g_pucPreTriggerArena = NULL;
+	g_ulPreTriggerCapacity = 0;
+	g_ulPreTriggerCount = 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// check if the Enter key was pressed without waiting
+BOOL PollEnterKey( void )
+{
+#if defined( _WIN32 )
+	while ( _kbhit() ) {
+		if ( _getch() == '\r' ) return TRUE;
+	}
+	return FALSE;
+#elif defined(__APPLE__)
+	fd_set fds;
+	struct timeval tv;
+	char buf[256];
+
+	FD_ZERO( &fds );
+	FD_SET( STDIN_FILENO, &fds );
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	// The terminal delivers the input after the Enter key.
+	if ( select( STDIN_FILENO + 1, &fds, NULL, NULL, &tv ) <= 0 ) return FALSE;
+	if ( fgets( buf, sizeof(buf), stdin ) == NULL ) return FALSE;
+	return TRUE;
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// control procedure of the live view to take pictures by the Enter key or at an interval
+BOOL PreTriggerControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPPreTriggerSchedule pControl = (LPPreTriggerSchedule)pContext;
+	const char* pszReason = NULL;
+
+	if ( pControl->ulInterval > 0 ) {
+		if ( pControl->ullNext == 0 ) pControl->ullNext = pFrame->ullTime + (NK_UINT_64)pControl->ulInterval * 1000000;
+		if ( pFrame->ullTime >= pControl->ullNext ) {
+			pControl->ullNext += (NK_UINT_64)pControl->ulInterval * 1000000;
+			pszReason = "interval";
+		}
+	} else if ( PollEnterKey() == TRUE ) {
+		pszReason = "manual";
+	}
+	if ( pszReason == NULL ) return TRUE;
+
+	if ( StartCaptureAsync( pRefSrc, &pControl->ulCompleted ) == TRUE )
+		pControl->ulCaptures++;
+	else
+		printf( "Failed in starting CaptureAsync.\n" );
+	TriggerPreTrigger( pszReason );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Keep the live view before the triggers with the settings input by the user.
+BOOL PreTriggerMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulBudget, ulSeconds, ulFps, ulSaved, ulMode;
+	PreTriggerSchedule	stControl;
+	PreTriggerStats	stStats;
+	BOOL	bRet;
+
+	printf( "Input the memory for the frames in MB (0: %d)\n>", PRETRIGGER_BUDGET_DEFAULT );
+	scanf( "%s", buf );
+	ulBudget = atoi( buf );
+	if ( ulBudget == 0 || ulBudget > 2047 ) ulBudget = PRETRIGGER_BUDGET_DEFAULT;
+	printf( "Input the seconds to keep before a trigger (0: %d)\n>", PRETRIGGER_SECONDS_DEFAULT );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+	if ( ulSeconds == 0 ) ulSeconds = PRETRIGGER_SECONDS_DEFAULT;
+	printf( "Select the trigger (1: Enter key, 2: Interval, 3: Motion)\n>" );
+	scanf( "%s", buf );
+	ulMode = atoi( buf );
+
+	memset( &stControl, 0, sizeof(stControl) );
+	if ( ulMode == 3 ) {
+		// The motion trigger requests the dumps by itself.
+		if ( StartPreTrigger( (NK_UINT_64)ulBudget * 1024 * 1024, ulSeconds ) == FALSE ) return FALSE;
+		bRet = MotionTriggerMenu( pRefSrc );
+	} else {
+		if ( ulMode == 2 ) {
+			printf( "Input the interval in seconds (1-3600)\n>" );
+			scanf( "%s", buf );
+			stControl.ulInterval = atoi( buf );
+			if ( stControl.ulInterval == 0 || stControl.ulInterval > 3600 ) stControl.ulInterval = 10;
+		}
+		printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+		scanf( "%s", buf );
+		ulFps = atoi( buf );
+		if ( ulFps > 60 ) ulFps = 60;
+		if ( StartPreTrigger( (NK_UINT_64)ulBudget * 1024 * 1024, ulSeconds ) == FALSE ) return FALSE;
+		if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+			StopPreTrigger( NULL );
+			return FALSE;
+		}
+		if ( ulMode == 2 )
+			printf( "Taking a picture every %u seconds. Please press the Ctrl+C to stop.\n", (unsigned)stControl.ulInterval );
+		else
+			printf( "Press the Enter key to take a picture. Please press the Ctrl+C to stop.\n" );
+		bRet = RunLiveView( pRefSrc, ulFps, 0, PreTriggerControl, &stControl );
+		IdleLoop( pRefSrc->pObject, &stControl.ulCompleted, stControl.ulCaptures );
+		StopRemoteLiveView( pRefSrc, ulSaved );
+	}
+
+	printf( "Writing the frames before the triggers...\n" );
+	StopPreTrigger( &stStats );
+	printf( "%u triggers, %u written, %u rejected. %llu frames were kept, %llu dropped from the ring, %llu too large, %llu not kept while writing.\n",
+			(unsigned)stStats.ulTriggers, (unsigned)stStats.ulDumps, (unsigned)stStats.ulRejected,
+			(unsigned long long)stStats.ullFrames, (unsigned long long)stStats.ullEvicted, (unsigned long long)stStats.ullSkipped,
+			(unsigned long long)stStats.ullBlocked );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,235 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Progress and throughput telemetry.
+// ProgressProc and DataProc only update atomic counters in a fixed table of records, one record
+// per running operation. Any thread can take a snapshot of the table, and the optional renderer
+// thread prints it at a limited rate, so no console I/O is done in the delivery path.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define PROGRESS_RECORD_MAX	16
+
+#define PROGRESS_FREE			0
+#define PROGRESS_CLAIMED		1		// being initialized by the writer
+#define PROGRESS_ACTIVE			2
+#define PROGRESS_FINISHED		3
+
+typedef struct tagProgressRecord
+{
+	std::atomic<ULONG>	ulState;
+	std::atomic<NKREF>	refProc;
+	std::atomic<ULONG>	ulCommand;
+	std::atomic<ULONG>	ulParam;
+	std::atomic<ULONG>	ulDone;
+	std::atomic<ULONG>	ulTotal;
+	std::atomic<NK_UINT_64>	ullBytes;
+	std::atomic<NK_UINT_64>	ullStartTime;		// msec
+	std::atomic<NK_UINT_64>	ullLastTime;		// msec
+} ProgressRecord, *LPProgressRecord;
+
+ProgressRecord	g_stProgress[PROGRESS_RECORD_MAX];
+std::atomic<bool>	g_bProgressRender( false );
+std::thread	g_ProgressRenderer;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// monotonic time in msec
+NK_UINT_64 GetProgressTime( void )
+{
+	return (NK_UINT_64)std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// find the running record of the operation. If ulCommand is 0, any operation of the object matches.
+LPProgressRecord FindProgressRecord( NKREF refProc, ULONG ulCommand, ULONG ulParam )
+{
+	ULONG i;
+	for ( i = 0; i < PROGRESS_RECORD_MAX; i++ ) {
+		LPProgressRecord pRecord = &g_stProgress[i];
+		if ( pRecord->ulState.load( std::memory_order_acquire ) != PROGRESS_ACTIVE ) continue;
+		if ( pRecord->refProc.load( std::memory_order_relaxed ) != refProc ) continue;
+		if ( ulCommand == 0 ||
+			(pRecord->ulCommand.load( std::memory_order_relaxed ) == ulCommand && pRecord->ulParam.load( std::memory_order_relaxed ) == ulParam) )
+			return pRecord;
+	}
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// take a free record, or a finished one if all records are used.
+LPProgressRecord ClaimProgressRecord( NKREF refProc, ULONG ulCommand, ULONG ulParam )
+{
+	ULONG i, j;
+	ULONG ulReusable[2] = { PROGRESS_FREE, PROGRESS_FINISHED };
+	NK_UINT_64 ullNow = GetProgressTime();
+
+	for ( j = 0; j < 2; j++ ) {
+		for ( i = 0; i < PROGRESS_RECORD_MAX; i++ ) {
+			LPProgressRecord pRecord = &g_stProgress[i];
+			ULONG ulExpected = ulReusable[j];
+			if ( !pRecord->ulState.compare_exchange_strong( ulExpected, PROGRESS_CLAIMED, std::memory_order_acq_rel ) ) continue;
+			pRecord->refProc.store( refProc, std::memory_order_relaxed );
+			pRecord->ulCommand.store( ulCommand, std::memory_order_relaxed );
+			pRecord->ulParam.store( ulParam, std::memory_order_relaxed );
+			pRecord->ulDone.store( 0, std::memory_order_relaxed );
+			pRecord->ulTotal.store( 0, std::memory_order_relaxed );
+			pRecord->ullBytes.store( 0, std::memory_order_relaxed );
+			pRecord->ullStartTime.store( ullNow, std::memory_order_relaxed );
+			pRecord->ullLastTime.store( ullNow, std::memory_order_relaxed );
+			pRecord->ulState.store( PROGRESS_ACTIVE, std::memory_order_release );
+			return pRecord;
+		}
+	}
+	// All records are running. The progress of this operation is not recorded.
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// called from ProgressProc
+void UpdateProgress( NKREF refProc, ULONG ulCommand, ULONG ulParam, ULONG ulDone, ULONG ulTotal )
+{
+	LPProgressRecord pRecord = FindProgressRecord( refProc, ulCommand, ulParam );
+
+	if ( pRecord == NULL ) {
+		pRecord = ClaimProgressRecord( refProc, ulCommand, ulParam );
+		if ( pRecord == NULL ) return;
+	}
+	pRecord->ulDone.store( ulDone, std::memory_order_relaxed );
+	pRecord->ulTotal.store( ulTotal, std::memory_order_relaxed );
+	pRecord->ullLastTime.store( GetProgressTime(), std::memory_order_relaxed );
+	// when we know how long this process is, the last call tells the end of it.
+	// An Acquire is finished by CompletionProc, because DataProc may still be called after that.
+	if ( ulTotal != 0 && ulDone >= ulTotal && !(ulCommand == kNkMAIDCommand_CapStart && ulParam == kNkMAIDCapability_Acquire) )
+		pRecord->ulState.store( PROGRESS_FINISHED, std::memory_order_release );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// called from DataProc with the number of bytes delivered
+void AddProgressBytes( NKREF refProc, ULONG ulBytes )
+{
+	LPProgressRecord pRecord = FindProgressRecord( refProc, 0, 0 );
+
+	if ( pRecord == NULL ) {
+		pRecord = ClaimProgressRecord( refProc, kNkMAIDCommand_CapStart, kNkMAIDCapability_Acquire );
+		if ( pRecord == NULL ) return;
+	}
+	pRecord->ullBytes.fetch_add( ulBytes, std::memory_order_relaxed );
+	pRecord->ullLastTime.store( GetProgressTime(), std::memory_order_relaxed );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// called from CompletionProc. The record is finished even if ProgressProc was not called with ulDone == ulTotal.
+void FinishProgress( NKREF refProc, ULONG ulCommand, ULONG ulParam )
+{
+	LPProgressRecord pRecord = FindProgressRecord( refProc, ulCommand, ulParam );
+
+	if ( pRecord != NULL ) {
+		pRecord->ullLastTime.store( GetProgressTime(), std::memory_order_relaxed );
+		pRecord->ulState.store( PROGRESS_FINISHED, std::memory_order_release );
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// copy the running and finished records to pInfo. Returns the number of copied records.
+ULONG GetProgressSnapshot( LPProgressInfo pInfo, ULONG ulMax )
+{
+	ULONG i, ulCount = 0;
+	NK_UINT_64 ullElapsed;
+
+	for ( i = 0; i < PROGRESS_RECORD_MAX && ulCount < ulMax; i++ ) {
+		LPProgressRecord pRecord = &g_stProgress[i];
+		ULONG ulState = pRecord->ulState.load( std::memory_order_acquire );
+		if ( ulState != PROGRESS_ACTIVE && ulState != PROGRESS_FINISHED ) continue;
+
+		pInfo[ulCount].ulIndex = i;
+		pInfo[ulCount].refProc = pRecord->refProc.load( std::memory_order_relaxed );
+		pInfo[ulCount].ulCommand = pRecord->ulCommand.load( std::memory_order_relaxed );
+		pInfo[ulCount].ulParam = pRecord->ulParam.load( std::memory_order_relaxed );
+		pInfo[ulCount].ulDone = pRecord->ulDone.load( std::memory_order_relaxed );
+		pInfo[ulCount].ulTotal = pRecord->ulTotal.load( std::memory_order_relaxed );
+		pInfo[ulCount].ullBytes = pRecord->ullBytes.load( std::memory_order_relaxed );
+		ullElapsed = pRecord->ullLastTime.load( std::memory_order_relaxed ) - pRecord->ullStartTime.load( std::memory_order_relaxed );
+		if ( ulState == PROGRESS_ACTIVE )
+			ullElapsed = GetProgressTime() - pRecord->ullStartTime.load( std::memory_order_relaxed );
+		pInfo[ulCount].ullElapsed = ullElapsed;
+		pInfo[ulCount].ullBytesPerSec = ( ullElapsed > 0 ) ? pInfo[ulCount].ullBytes * 1000 / ullElapsed : 0;
+		pInfo[ulCount].bFinished = ( ulState == PROGRESS_FINISHED );
+		ulCount++;
+	}
+	return ulCount;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// release a finished record after it was shown.
+void ReleaseProgress( ULONG ulIndex )
+{
+	ULONG ulExpected = PROGRESS_FINISHED;
+	if ( ulIndex < PROGRESS_RECORD_MAX )
+		g_stProgress[ulIndex].ulState.compare_exchange_strong( ulExpected, PROGRESS_FREE, std::memory_order_acq_rel );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// print one line for each operation at most every ulInterval msec.
+void ProgressRenderLoop( ULONG ulInterval )
+{
+	ProgressInfo	stInfo[PROGRESS_RECORD_MAX];
+	ULONG	ulLastDone[PROGRESS_RECORD_MAX] = { 0 };
+	NK_UINT_64	ullLastBytes[PROGRESS_RECORD_MAX] = { 0 };
+	ULONG	i, ulCount;
+
+	while ( g_bProgressRender.load() ) {
+		ulCount = GetProgressSnapshot( stInfo, PROGRESS_RECORD_MAX );
+		for ( i = 0; i < ulCount; i++ ) {
+			LPProgressInfo pInfo = &stInfo[i];
+			// don't repeat a line that has not changed.
+			if ( pInfo->bFinished == FALSE && pInfo->ulDone == ulLastDone[pInfo->ulIndex] && pInfo->ullBytes == ullLastBytes[pInfo->ulIndex] )
+				continue;
+			ulLastDone[pInfo->ulIndex] = pInfo->ulDone;
+			ullLastBytes[pInfo->ulIndex] = pInfo->ullBytes;
+
+			if ( pInfo->ulCommand == kNkMAIDCommand_CapStart && pInfo->ulParam == kNkMAIDCapability_Acquire )
+				printf( "[Acquire]" );
+			else if ( pInfo->ulCommand == kNkMAIDCommand_CapGetArray && pInfo->ulParam == kNkMAIDCapability_GetVideoImageEx )
+				printf( "[GetVideoImageEx]" );
+			else
+				printf( "[Command %u, Param 0x%X]", pInfo->ulCommand, pInfo->ulParam );
+			if ( pInfo->ulTotal != 0 )
+				printf( " %3u%%", (ULONG)((NK_UINT_64)100 * pInfo->ulDone / pInfo->ulTotal) );
+			if ( pInfo->ullBytes != 0 )
+				printf( " %llu[byte] %.2fMB/s", pInfo->ullBytes, (double)pInfo->ullBytesPerSec / (1024.0 * 1024.0) );
+			printf( " %llu[msec]%s\n", pInfo->ullElapsed, pInfo->bFinished ? " done" : "" );
+
+			if ( pInfo->bFinished ) {
+				ulLastDone[pInfo->ulIndex] = 0;
+				ullLastBytes[pInfo->ulIndex] = 0;
+				ReleaseProgress( pInfo->ulIndex );
+			}
+		}
+		std::this_thread::sleep_for( std::chrono::milliseconds( ulInterval ) );
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// start the thread printing the progress.
+BOOL StartProgressRenderer( ULONG ulInterval )
+{
+	if ( g_bProgressRender.exchange( true ) ) return TRUE;
+	g_ProgressRenderer = std::thread( ProgressRenderLoop, ulInterval );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+BOOL StopProgressRenderer( void )
+{
+	if ( !g_bProgressRender.exchange( false ) ) return TRUE;
+	if ( g_ProgressRenderer.joinable() )
+		g_ProgressRenderer.join();
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+BOOL IsProgressRendering( void )
+{
+	return g_bProgressRender.load() ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,430 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Output sinks of the delivered data.
+// Every delivered file goes through a DataSink: it is opened, its chunks are written with their
+// offsets, and it is committed when complete or aborted when the delivery stopped on the way.
+// The data is routed by its type (image, thumbnail, live view, movie, Picture Control) to one of
+//   kSinkKind_File   : a local file written by the DataWriter, as before.
+//   kSinkKind_Pipe   : a FIFO (Mac) or a named pipe such as \\.\pipe\name (Windows).
+//   kSinkKind_Socket : a Unix domain socket (SOCK_STREAM).
+//   kSinkKind_FrameBus : a slot of the frame bus, published to the other processes when committed.
+//   kSinkKind_Memory : a buffer of the memory sink, taken in this process when committed.
+// A pipe or a socket is connected at the first delivery of its route and kept for the next ones.
+// Each delivery is sent as records, a SinkRecord followed by ulLength bytes:
+//   Open   : the name of the data, with its total size and the offset it starts at.
+//   Data   : a chunk at ullOffset.
+//   Commit : the data is complete.   Abort : the data stopped at ullOffset.
+// The records of one delivery have the same ulSinkID, so a reader can tell apart the deliveries
+// of a route sent at the same time. A record is never split by a record of another delivery.
+// Only a file sink keeps a movie to resume it; a movie sent to a pipe or a socket starts from 0.
+// A frame bus or a memory sink needs the size of the data at first, and the data must fit in a slot.
+// The memory sink is chosen by a caller in this process, such as the nkmaid Python module, so it is not in the menu.
+
+#if defined( _WIN32 )
+	#include <winsock2.h>
+	#include <afunix.h>
+	#pragma comment( lib, "ws2_32.lib" )
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <signal.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define SINK_RECORD_MAGIC		"NKSK"
+
+typedef struct tagSinkRoute
+{
+	ULONG	ulKind;
+	char	szTarget[256];			// path of the pipe or the socket
+} SinkRoute, *LPSinkRoute;
+
+// the connection of a route to its pipe or socket
+typedef struct tagSinkStream
+{
+	BOOL	bConnected;
+#if defined( _WIN32 )
+	HANDLE	hPipe;
+	SOCKET	hSocket;
+#elif defined(__APPLE__)
+	int	fd;
+#endif
+} SinkStream, *LPSinkStream;
+
+SinkRoute	g_stSinkRoute[kSinkRoute_Count];		// all routes go to files at first
+SinkStream	g_stSinkStream[kSinkRoute_Count];
+std::mutex	g_SinkMutex[kSinkRoute_Count];		// one record at a time on a route
+std::atomic<ULONG>	g_ulSinkID( 0 );
+
+const char*	g_pszSinkRoute[kSinkRoute_Count] = { "Image", "Thumbnail", "LiveView", "Movie", "PictureControl" };
+const char*	g_pszSinkKind[] = { "File", "Pipe", "Socket", "Frame bus", "Memory" };
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the kind of the sink the data of ulRoute goes to.
+ULONG GetSinkKind( ULONG ulRoute )
+{
+	if ( ulRoute >= kSinkRoute_Count ) return kSinkKind_File;
+	// The data goes to a file again after the frame bus was closed.
+	if ( g_stSinkRoute[ulRoute].ulKind == kSinkKind_FrameBus && IsFrameBusOpen() == FALSE ) return kSinkKind_File;
+	return g_stSinkRoute[ulRoute].ulKind;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the route of a delivered file by the type of its data object.
+ULONG GetDataSinkRoute( ULONG ulObjType )
+{
+	return ( ulObjType & kNkMAIDDataObjType_Thumbnail ) ? kSinkRoute_Thumbnail : kSinkRoute_Image;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the connection of a route. The route lock must be held.
+void DisconnectSinkStream( ULONG ulRoute )
+{
+	LPSinkStream pStream = &g_stSinkStream[ulRoute];
+
+	if ( pStream->bConnected == FALSE ) return;
+#if defined( _WIN32 )
+	if ( g_stSinkRoute[ulRoute].ulKind == kSinkKind_Pipe )
+		CloseHandle( pStream->hPipe );
+	else
+		closesocket( pStream->hSocket );
+#elif defined(__APPLE__)
+	close( pStream->fd );
+#endif
+	pStream->bConnected = FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// connect a route to its pipe or socket. The route lock must be held.
+BOOL ConnectSinkStream( ULONG ulRoute )
+{
+	LPSinkRoute pRoute = &g_stSinkRoute[ulRoute];
+	LPSinkStream pStream = &g_stSinkStream[ulRoute];
+
+	if ( pStream->bConnected == TRUE ) return TRUE;
+#if defined( _WIN32 )
+	if ( pRoute->ulKind == kSinkKind_Pipe ) {
+		pStream->hPipe = CreateFileA( pRoute->szTarget, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL );
+		if ( pStream->hPipe == INVALID_HANDLE_VALUE ) {
+			printf( "%s can't be opened.\n", pRoute->szTarget );
+			return FALSE;
+		}
+	} else {
+		static BOOL bStarted = FALSE;
+		WSADATA stData;
+		SOCKADDR_UN stAddr;
+		if ( bStarted == FALSE ) {
+			if ( WSAStartup( MAKEWORD( 2, 2 ), &stData ) != 0 ) return FALSE;
+			bStarted = TRUE;
+		}
+		memset( &stAddr, 0, sizeof(stAddr) );
+		stAddr.sun_family = AF_UNIX;
+		strncpy( stAddr.sun_path, pRoute->szTarget, sizeof(stAddr.sun_path) - 1 );
+		pStream->hSocket = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if ( pStream->hSocket == INVALID_SOCKET ) return FALSE;
+		if ( connect( pStream->hSocket, (struct sockaddr*)&stAddr, sizeof(stAddr) ) != 0 ) {
+			printf( "%s can't be connected.\n", pRoute->szTarget );
+			closesocket( pStream->hSocket );
+			return FALSE;
+		}
+	}
+#elif defined(__APPLE__)
+	// A reader that went away must not kill the process.
+	signal( SIGPIPE, SIG_IGN );
+	if ( pRoute->ulKind == kSinkKind_Pipe ) {
+		// O_NONBLOCK makes open fail at once if nobody reads the FIFO. The writes block as usual.
+		pStream->fd = open( pRoute->szTarget, O_WRONLY | O_NONBLOCK );
+		if ( pStream->fd < 0 ) {
+			printf( "%s can't be opened%s.\n", pRoute->szTarget, errno == ENXIO ? ": no reader" : "" );
+			return FALSE;
+		}
+		fcntl( pStream->fd, F_SETFL, fcntl( pStream->fd, F_GETFL ) & ~O_NONBLOCK );
+	} else {
+		struct sockaddr_un stAddr;
+		int iOn = 1;
+		memset( &stAddr, 0, sizeof(stAddr) );
+		stAddr.sun_family = AF_UNIX;
+		strncpy( stAddr.sun_path, pRoute->szTarget, sizeof(stAddr.sun_path) - 1 );
+		pStream->fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if ( pStream->fd < 0 ) return FALSE;
+		setsockopt( pStream->fd, SOL_SOCKET, SO_NOSIGPIPE, &iOn, sizeof(iOn) );
+		if ( connect( pStream->fd, (struct sockaddr*)&stAddr, sizeof(stAddr) ) != 0 ) {
+			printf( "%s can't be connected.\n", pRoute->szTarget );
+			close( pStream->fd );
+			return FALSE;
+		}
+	}
+#endif
+	pStream->bConnected = TRUE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write all bytes to the connection of a route. The route lock must be held.
+BOOL WriteSinkStream( ULONG ulRoute, const void* pData, ULONG ulLength )
+{
+	LPSinkStream pStream = &g_stSinkStream[ulRoute];
+	const char* pcData = (const char*)pData;
+	ULONG ulDone;
+
+	while ( ulLength > 0 ) {
+	#if defined( _WIN32 )
+		DWORD dwDone = 0;
+		if ( g_stSinkRoute[ulRoute].ulKind == kSinkKind_Pipe ) {
+			if ( WriteFile( pStream->hPipe, pcData, ulLength, &dwDone, NULL ) == FALSE ) return FALSE;
+		} else {
+			int n = send( pStream->hSocket, pcData, (int)ulLength, 0 );
+			if ( n <= 0 ) return FALSE;
+			dwDone = (DWORD)n;
+		}
+		ulDone = (ULONG)dwDone;
+	#elif defined(__APPLE__)
+		ssize_t n = write( pStream->fd, pcData, ulLength );
+		if ( n < 0 && errno == EINTR ) continue;
+		if ( n <= 0 ) return FALSE;
+		ulDone = (ULONG)n;
+	#endif
+		pcData += ulDone;
+		ulLength -= ulDone;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// send a record of a pipe or socket sink. A broken connection is closed, and connected again at the next record.
+BOOL SendSinkRecord( LPDataSink pSink, ULONG ulType, NK_UINT_64 ullOffset, const void* pData, ULONG ulLength )
+{
+	SinkRecord stRecord;
+	BOOL bRet;
+	std::lock_guard<std::mutex> lock( g_SinkMutex[pSink->ulRoute] );
+
+	memcpy( stRecord.cMagic, SINK_RECORD_MAGIC, 4 );
+	stRecord.ulType = ulType;
+	stRecord.ulSinkID = pSink->ulSinkID;
+	stRecord.ulRoute = pSink->ulRoute;
+	stRecord.ullOffset = ullOffset;
+	stRecord.ullTotal = pSink->ullTotal;
+	stRecord.ulLength = ulLength;
+	stRecord.ulReserved = 0;
+
+	if ( ConnectSinkStream( pSink->ulRoute ) == FALSE ) return FALSE;
+	bRet = WriteSinkStream( pSink->ulRoute, &stRecord, sizeof(SinkRecord) );
+	if ( bRet == TRUE && ulLength > 0 ) bRet = WriteSinkStream( pSink->ulRoute, pData, ulLength );
+	if ( bRet == FALSE ) {
+		printf( "%s was disconnected.\n", g_stSinkRoute[pSink->ulRoute].szTarget );
+		DisconnectSinkStream( pSink->ulRoute );
+	}
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open a sink for the data pszName of ulRoute, whose destination already has ullOffset bytes.
+// A file sink cuts the file to ullOffset and writes through the system cache, so that it can be synced.
+BOOL ResumeDataSink( LPDataSink pSink, ULONG ulRoute, const char* pszName, NK_UINT_64 ullTotal, NK_UINT_64 ullOffset )
+{
+	memset( pSink, 0, sizeof(DataSink) );
+	pSink->ulRoute = ( ulRoute < kSinkRoute_Count ) ? (ULONG)ulRoute : (ULONG)kSinkRoute_Image;
+	pSink->ulKind = GetSinkKind( pSink->ulRoute );
+	pSink->ulSinkID = ++g_ulSinkID;
+	strncpy( pSink->szName, pszName, sizeof(pSink->szName) - 1 );
+	pSink->ullTotal = ullTotal;
+	pSink->ullWritten = ullOffset;
+	pSink->lSlot = -1;
+
+	if ( pSink->ulKind == kSinkKind_File ) return ResumeDataWriter( &pSink->stWriter, pszName, ullOffset );
+	if ( pSink->ulKind == kSinkKind_FrameBus ) {
+		if ( ullTotal == 0 || ullTotal > 0xFFFFFFFF || ullOffset > 0 ) {
+			printf( "%s can't be sent to the frame bus without its size.\n", pSink->szName );
+			return FALSE;
+		}
+		pSink->lSlot = ReserveFrameBusSlot( (ULONG)ullTotal );
+		if ( pSink->lSlot < 0 ) {
+			printf( "%s was dropped by the frame bus.\n", pSink->szName );
+			return FALSE;
+		}
+		return TRUE;
+	}
+	if ( pSink->ulKind == kSinkKind_Memory ) {
+		if ( ullTotal == 0 || ullTotal > 0xFFFFFFFF || ullOffset > 0 ) {
+			printf( "%s can't be kept in memory without its size.\n", pSink->szName );
+			return FALSE;
+		}
+		pSink->lSlot = ReserveMemorySinkBuffer( (ULONG)ullTotal );
+		if ( pSink->lSlot < 0 ) {
+			printf( "%s was dropped by the memory sink.\n", pSink->szName );
+			return FALSE;
+		}
+		return TRUE;
+	}
+	return SendSinkRecord( pSink, kSinkRecord_Open, ullOffset, pSink->szName, (ULONG)strlen( pSink->szName ) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open a sink for the data pszName of ulRoute. ullTotal is the size of the data if it is known.
+BOOL OpenDataSink( LPDataSink pSink, ULONG ulRoute, const char* pszName, NK_UINT_64 ullTotal )
+{
+	if ( GetSinkKind( ulRoute ) != kSinkKind_File ) return ResumeDataSink( pSink, ulRoute, pszName, ullTotal, 0 );
+
+	memset( pSink, 0, sizeof(DataSink) );
+	pSink->ulRoute = ulRoute;
+	pSink->ulKind = kSinkKind_File;
+	pSink->lSlot = -1;
+	pSink->ulSinkID = ++g_ulSinkID;
+	strncpy( pSink->szName, pszName, sizeof(pSink->szName) - 1 );
+	pSink->ullTotal = ullTotal;
+	return OpenDataWriter( &pSink->stWriter, pszName, ullTotal );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Write a chunk at ullOffset. A file sink writes in order, so ullOffset must be the end of the data written so far.
+BOOL WriteDataSink( LPDataSink pSink, NK_UINT_64 ullOffset, const void* pData, ULONG ulLength )
+{
+	BOOL bRet;
+
+	if ( pSink->ulKind == kSinkKind_File ) {
+		if ( ullOffset != pSink->stWriter.ullWritten + pSink->stWriter.ulFill ) {
+			printf( "%s: the chunk at %llu is out of order.\n", pSink->szName, (unsigned long long)ullOffset );
+			return FALSE;
+		}
+		bRet = WriteDataWriter( &pSink->stWriter, pData, ulLength );
+	} else if ( pSink->ulKind == kSinkKind_FrameBus ) {
+		// The chunk is written where the consumers will read it.
+		bRet = ( ullOffset + ulLength <= pSink->ullTotal ) ? TRUE : FALSE;
+		if ( bRet == TRUE ) memcpy( GetFrameBusSlotData( pSink->lSlot ) + ullOffset, pData, ulLength );
+	} else if ( pSink->ulKind == kSinkKind_Memory ) {
+		bRet = ( ullOffset + ulLength <= pSink->ullTotal ) ? TRUE : FALSE;
+		if ( bRet == TRUE ) memcpy( GetMemorySinkData( pSink->lSlot ) + ullOffset, pData, ulLength );
+	} else {
+		bRet = SendSinkRecord( pSink, kSinkRecord_Data, ullOffset, pData, ulLength );
+	}
+	if ( bRet == TRUE && ullOffset + ulLength > pSink->ullWritten ) pSink->ullWritten = ullOffset + ulLength;
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Flush the data written so far to the device. A pipe, a socket, the frame bus or the memory has nothing to flush.
+BOOL SyncDataSink( LPDataSink pSink )
+{
+	if ( pSink->ulKind == kSinkKind_File ) return SyncDataWriter( &pSink->stWriter );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The data is complete. A file is closed and recorded in the session manifest, and a slot of the frame bus or a buffer of the memory sink is published.
+BOOL CommitDataSink( LPDataSink pSink )
+{
+	if ( pSink->ulKind == kSinkKind_File ) return CloseDataWriter( &pSink->stWriter );
+	if ( pSink->ulKind == kSinkKind_FrameBus ) {
+		PublishFrameBusSlot( pSink->lSlot, pSink->ulRoute, pSink->szName, (ULONG)pSink->ullWritten );
+		pSink->lSlot = -1;
+		return TRUE;
+	}
+	if ( pSink->ulKind == kSinkKind_Memory ) {
+		PublishMemorySinkBuffer( pSink->lSlot, pSink->ulRoute, pSink->szName, (ULONG)pSink->ullWritten );
+		pSink->lSlot = -1;
+		return TRUE;
+	}
+	return SendSinkRecord( pSink, kSinkRecord_Commit, pSink->ullWritten, NULL, 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The delivery stopped on the way. A file is closed without being recorded, and kept as it is.
+void AbortDataSink( LPDataSink pSink )
+{
+	if ( pSink->ulKind == kSinkKind_File ) {
+		pSink->stWriter.bManifest = FALSE;
+		CloseDataWriter( &pSink->stWriter );
+		return;
+	}
+	if ( pSink->ulKind == kSinkKind_FrameBus ) {
+		CancelFrameBusSlot( pSink->lSlot );
+		pSink->lSlot = -1;
+		return;
+	}
+	if ( pSink->ulKind == kSinkKind_Memory ) {
+		CancelMemorySinkBuffer( pSink->lSlot );
+		pSink->lSlot = -1;
+		return;
+	}
+	SendSinkRecord( pSink, kSinkRecord_Abort, pSink->ullWritten, NULL, 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// send data that is in memory as a whole to the sink of ulRoute.
+BOOL SaveDataSink( ULONG ulRoute, const char* pszName, const void* pData, ULONG ulLength )
+{
+	DataSink stSink;
+
+	if ( OpenDataSink( &stSink, ulRoute, pszName, ulLength ) == FALSE ) return FALSE;
+	if ( WriteDataSink( &stSink, 0, pData, ulLength ) == FALSE ) {
+		AbortDataSink( &stSink );
+		return FALSE;
+	}
+	return CommitDataSink( &stSink );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the connections of all routes.
+void CloseSinkStreams( void )
+{
+	ULONG i;
+
+	for ( i = 0; i < kSinkRoute_Count; i++ ) {
+		std::lock_guard<std::mutex> lock( g_SinkMutex[i] );
+		DisconnectSinkStream( i );
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Send the data of ulRoute to a sink of ulKind. pszTarget is the path of a pipe or a socket.
+BOOL SetSinkRoute( ULONG ulRoute, ULONG ulKind, const char* pszTarget )
+{
+	if ( ulRoute >= kSinkRoute_Count || ulKind > kSinkKind_Memory ) return FALSE;
+	if ( ( ulKind == kSinkKind_Pipe || ulKind == kSinkKind_Socket ) && ( pszTarget == NULL || pszTarget[0] == 0 ) ) return FALSE;
+
+	std::lock_guard<std::mutex> lock( g_SinkMutex[ulRoute] );
+	DisconnectSinkStream( ulRoute );
+	g_stSinkRoute[ulRoute].ulKind = ulKind;
+	if ( ulKind == kSinkKind_Pipe || ulKind == kSinkKind_Socket ) {
+		strncpy( g_stSinkRoute[ulRoute].szTarget, pszTarget, sizeof(g_stSinkRoute[ulRoute].szTarget) - 1 );
+		g_stSinkRoute[ulRoute].szTarget[sizeof(g_stSinkRoute[ulRoute].szTarget) - 1] = 0;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Show the sinks of the routes and set the sink of a route.
+BOOL SinkMenu( void )
+{
+	char	buf[256];
+	ULONG	ulRoute, ulKind, i;
+
+	printf( "[Output Sinks]\n" );
+	for ( i = 0; i < kSinkRoute_Count; i++ ) {
+		printf( " %u. %-15s: %s %s\n", (unsigned)( i + 1 ), g_pszSinkRoute[i], g_pszSinkKind[g_stSinkRoute[i].ulKind],
+				( g_stSinkRoute[i].ulKind == kSinkKind_Pipe || g_stSinkRoute[i].ulKind == kSinkKind_Socket ) ? g_stSinkRoute[i].szTarget : "" );
+	}
+	printf( "Select Route (1-%d, 0)\n>", kSinkRoute_Count );
+	scanf( "%s", buf );
+	ulRoute = atoi( buf );
+	if ( ulRoute == 0 || ulRoute > kSinkRoute_Count ) return TRUE;
+	ulRoute--;
+
+	printf( "Select Sink (1-4)\n" );
+	printf( " 1. File\n" );
+	printf( " 2. Pipe\n" );
+	printf( " 3. Unix domain socket\n" );
+	printf( " 4. Frame bus\n>" );
+	scanf( "%s", buf );
+	ulKind = atoi( buf );
+	if ( ulKind < 1 || ulKind > 4 ) return TRUE;
+	ulKind--;
+	if ( ulKind == kSinkKind_FrameBus && IsFrameBusOpen() == FALSE ) {
+		printf( "Create the frame bus first.\n" );
+		return TRUE;
+	}
+	if ( ulKind == kSinkKind_Pipe || ulKind == kSinkKind_Socket ) {
+		printf( "Input the path of the %s\n>", ulKind == kSinkKind_Pipe ? "pipe" : "socket" );
+		scanf( "%255s", buf );
+	}
+	return SetSinkRoute( ulRoute, ulKind, buf );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,245 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Contrast autofocus on the host.
+// The focus is driven by kNkMAIDCapability_MFDrive while the live view runs, and every frame is
+// scored by MeasureSharpness. The search is a hill climb: it moves in one direction while the score
+// rises, and when the score falls it tries the other side of the best position with half of the
+// step. When the step is smaller than the minimum, the focus is driven back to the best position.
+// The positions are counted in the steps of MFDriveStep from the start position, so they are not
+// exact after the lens hit an end.
+// Every measurement is written to SoftAF.csv with its time.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define SOFTAF_STEP_DEFAULT		400
+#define SOFTAF_MIN_STEP_DEFAULT	10
+#define SOFTAF_STEP_MAX			32767
+#define SOFTAF_MOVE_MAX			200		// a search stops after this number of moves
+#define SOFTAF_READY_TIMEOUT	5000	// msec
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// wait until the camera is not busy
+BOOL WaitDeviceReady( LPRefObj pRefSrc, ULONG ulTimeout )
+{
+	NK_UINT_64 ullEnd = GetHostTimeUs() + (NK_UINT_64)ulTimeout * 1000;
+	SLONG nResult;
+
+	do {
+		Command_CapStart( pRefSrc->pObject, kNkMAIDCapability_DeviceReady, NULL, NULL, &nResult );
+		if ( nResult != kNkMAIDResult_DeviceBusy ) return ( nResult == kNkMAIDResult_NoError ) ? TRUE : FALSE;
+		Command_Async( pRefSrc->pObject );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+	} while ( GetHostTimeUs() < ullEnd );
+	printf( "The camera is still busy.\n" );
+	return FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// drive the focus by ulSteps. *pbEnd is set to TRUE if the lens reached an end.
+BOOL DriveManualFocus( LPRefObj pRefSrc, ULONG ulDirection, ULONG ulSteps, BOOL* pbEnd )
+{
+	SLONG nResult;
+
+	*pbEnd = FALSE;
+	if ( ulSteps == 0 ) return TRUE;
+	if ( ulSteps > SOFTAF_STEP_MAX ) ulSteps = SOFTAF_STEP_MAX;
+	if ( Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_MFDriveStep, kNkMAIDDataType_Unsigned, (NKPARAM)ulSteps, NULL, NULL ) == FALSE )
+		return FALSE;
+	if ( Command_CapSetSB( pRefSrc->pObject, kNkMAIDCapability_MFDrive, kNkMAIDDataType_Unsigned, (NKPARAM)ulDirection, NULL, NULL, &nResult ) == FALSE ) {
+		if ( nResult != kNkMAIDResult_MFDriveEnd ) return FALSE;
+		*pbEnd = TRUE;
+	}
+	return WaitDeviceReady( pRefSrc, SOFTAF_READY_TIMEOUT );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// drive the focus to a position counted from the start of the search
+BOOL MoveSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, SLONG lTarget )
+{
+	SLONG lDelta = lTarget - pAF->lPosition;
+	ULONG ulDirection = ( lDelta > 0 ) ? kNkMAIDMFDrive_ClosestToInfinity : kNkMAIDMFDrive_InfinityToClosest;
+	NK_UINT_64 ullStart = GetHostTimeUs();
+	BOOL bEnd, bRet;
+
+	bRet = DriveManualFocus( pRefSrc, ulDirection, (ULONG)( lDelta > 0 ? lDelta : -lDelta ), &bEnd );
+	pAF->ullMoveTime += GetHostTimeUs() - ullStart;
+	pAF->ulMoves++;
+	pAF->ulSteps += (ULONG)( lDelta > 0 ? lDelta : -lDelta );
+	pAF->lPosition = lTarget;
+	pAF->bEnd = bEnd;
+	// The frames read during the move show the old focus.
+	pAF->ulSkip = pAF->ulSettleFrames;
+	pAF->ulSampled = 0;
+	pAF->fAccum = 0.0f;
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// decide the next move from the score at the current position. The moves are made from the best position.
+BOOL StepSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, float fScore )
+{
+	if ( pAF->ulPhase == kSoftAFPhase_Return ) {
+		pAF->fFinalScore = fScore;
+		pAF->ulPhase = kSoftAFPhase_Done;
+		return FALSE;
+	}
+
+	if ( pAF->ulMeasured == 1 || fScore > pAF->fBestScore ) {
+		if ( pAF->ulMeasured > 1 ) pAF->bImproved = TRUE;
+		pAF->fBestScore = fScore;
+		pAF->lBestPosition = pAF->lPosition;
+		if ( pAF->bEnd == TRUE ) {
+			// The lens can't go further in this direction.
+			pAF->lDirection = -pAF->lDirection;
+			pAF->ulReversals++;
+			pAF->ulStep /= 2;
+		}
+	} else if ( pAF->bImproved == FALSE && pAF->ulReversals == 0 ) {
+		// The first move went the wrong way. Try the other side with the same step.
+		pAF->lDirection = -pAF->lDirection;
+		pAF->ulReversals++;
+	} else {
+		// The peak was passed. Try the other side with a finer step.
+		pAF->lDirection = -pAF->lDirection;
+		pAF->ulReversals++;
+		pAF->ulStep /= 2;
+	}
+
+	if ( pAF->ulStep < pAF->ulMinStep || pAF->ulMoves >= SOFTAF_MOVE_MAX ) {
+		if ( pAF->lPosition == pAF->lBestPosition ) {
+			pAF->fFinalScore = fScore;
+			pAF->ulPhase = kSoftAFPhase_Done;
+			return FALSE;
+		}
+		pAF->ulPhase = kSoftAFPhase_Return;
+		return MoveSoftAF( pRefSrc, pAF, pAF->lBestPosition );
+	}
+	return MoveSoftAF( pRefSrc, pAF, pAF->lBestPosition + pAF->lDirection * (SLONG)pAF->ulStep );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// control procedure of the live view to run the search
+BOOL SoftAFControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPSoftAFContext pAF = (LPSoftAFContext)pContext;
+	SharpnessSample stSample;
+	float fScore;
+
+	if ( pAF->ulSkip > 0 ) {
+		pAF->ulSkip--;
+		return TRUE;
+	}
+	if ( MeasureSharpness( pFrame, pAF->ulScale, &pAF->stLuma, &stSample ) == FALSE ) {
+		pAF->ulErrors++;
+		return ( pAF->ulErrors < 10 ) ? TRUE : FALSE;
+	}
+	pAF->fAccum += stSample.fScore;
+	if ( ++pAF->ulSampled < pAF->ulFramesPerStep ) return TRUE;
+	fScore = pAF->fAccum / pAF->ulSampled;
+	pAF->ulMeasured++;
+
+	if ( pAF->pLog != NULL )
+		fprintf( pAF->pLog, "%llu,%llu,%d,%u,%.1f,%u,%llu\n", (unsigned long long)( pFrame->ullTime - pAF->ullStartTime ),
+					(unsigned long long)pFrame->ullSeq, (int)pAF->lPosition, (unsigned)pAF->ulStep, fScore,
+					(unsigned)stSample.ulProcessTime, (unsigned long long)pAF->ullMoveTime );
+
+	if ( StepSoftAF( pRefSrc, pAF, fScore ) == FALSE ) {
+		if ( pAF->ulPhase != kSoftAFPhase_Done ) {
+			printf( "Failed in driving the focus.\n" );
+			pAF->bFailed = TRUE;
+		}
+		return FALSE;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Focus on the live view by the contrast. Returns FALSE if the search could not be completed.
+BOOL RunSoftAF( LPRefObj pRefSrc, LPSoftAFContext pAF, ULONG ulFps, ULONG ulTimeout )
+{
+	pAF->lDirection = ( pAF->lDirection < 0 ) ? -1 : 1;
+	pAF->lPosition = 0;
+	pAF->lBestPosition = 0;
+	pAF->ulPhase = kSoftAFPhase_Search;
+	pAF->ulSkip = pAF->ulSettleFrames;
+	pAF->ullStartTime = GetHostTimeUs();
+	if ( pAF->ulFramesPerStep == 0 ) pAF->ulFramesPerStep = 1;
+
+	// SoftAFControl stops the live view by FALSE when the search is done, so only the phase tells the result.
+	RunLiveView( pRefSrc, ulFps, ulTimeout, SoftAFControl, pAF );
+	pAF->ullTotalTime = GetHostTimeUs() - pAF->ullStartTime;
+	if ( pAF->bFailed == TRUE ) return FALSE;
+	return ( pAF->ulPhase == kSoftAFPhase_Done ) ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Focus on the live view by the contrast with the settings input by the user.
+BOOL SoftAFMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSaved;
+	SoftAFContext	stAF;
+	BOOL	bRet;
+
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_MFDrive, kNkMAIDCapOperation_Set ) ) {
+		printf( "MFDrive is not supported.\n" );
+		return TRUE;
+	}
+	memset( &stAF, 0, sizeof(stAF) );
+	printf( "Input the first step of MFDrive (1-%d, 0: %d)\n>", SOFTAF_STEP_MAX, SOFTAF_STEP_DEFAULT );
+	scanf( "%s", buf );
+	stAF.ulStep = atoi( buf );
+	if ( stAF.ulStep == 0 || stAF.ulStep > SOFTAF_STEP_MAX ) stAF.ulStep = SOFTAF_STEP_DEFAULT;
+	printf( "Input the minimum step (0: %d)\n>", SOFTAF_MIN_STEP_DEFAULT );
+	scanf( "%s", buf );
+	stAF.ulMinStep = atoi( buf );
+	if ( stAF.ulMinStep == 0 ) stAF.ulMinStep = SOFTAF_MIN_STEP_DEFAULT;
+	printf( "Select the first direction (1: To the infinity, 2: To the closest)\n>" );
+	scanf( "%s", buf );
+	stAF.lDirection = ( atoi( buf ) == 2 ) ? -1 : 1;
+	printf( "Input the number of frames to average at each position (1-8, 0: 1)\n>" );
+	scanf( "%s", buf );
+	stAF.ulFramesPerStep = atoi( buf );
+	if ( stAF.ulFramesPerStep == 0 || stAF.ulFramesPerStep > 8 ) stAF.ulFramesPerStep = 1;
+	printf( "Input the number of frames to skip after a move (0-8)\n>" );
+	scanf( "%s", buf );
+	stAF.ulSettleFrames = atoi( buf );
+	if ( stAF.ulSettleFrames > 8 ) stAF.ulSettleFrames = 8;
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	stAF.ulScale = 2;
+
+	stAF.pLog = fopen( "SoftAF.csv", "w" );
+	if ( stAF.pLog != NULL )
+		fprintf( stAF.pLog, "time_us,seq,position,step,score,process_us,move_us\n" );
+
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		if ( stAF.pLog != NULL ) fclose( stAF.pLog );
+		return FALSE;
+	}
+	printf( "Focusing. Please press the Ctrl+C to stop.\n" );
+	bRet = RunSoftAF( pRefSrc, &stAF, ulFps, 60 );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+	if ( stAF.pLog != NULL ) fclose( stAF.pLog );
+	FreeJpegLuma( &stAF.stLuma );
+
+	if ( bRet == TRUE )
+		printf( "Focused at %d: score %.1f (best %.1f)\n", (int)stAF.lBestPosition, stAF.fFinalScore, stAF.fBestScore );
+	else
+		printf( "The focus was not found. The best position was %d: score %.1f\n", (int)stAF.lBestPosition, stAF.fBestScore );
+	printf( "%u measurements, %u moves, %u steps, %u reversals\n",
+			(unsigned)stAF.ulMeasured, (unsigned)stAF.ulMoves, (unsigned)stAF.ulSteps, (unsigned)stAF.ulReversals );
+	printf( "%llu msec in total, %llu msec in driving the focus\n",
+			(unsigned long long)( stAF.ullTotalTime / 1000 ), (unsigned long long)( stAF.ullMoveTime / 1000 ) );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
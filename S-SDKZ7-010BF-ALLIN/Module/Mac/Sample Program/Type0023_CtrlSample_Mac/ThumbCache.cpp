@@ -0,0 +1,435 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Persistent thumbnail cache.
+// The cache is one file of a fixed size that is mapped into memory. The record area is a circular
+// log: records are appended at the tail, and the oldest records are dropped by moving the head.
+//
+//   ThumbCacheHeader | ... | head: ThumbCacheRecord + data | ThumbCacheRecord + data | ... | tail: free | ...
+//
+// A record that does not fit at the end of the area goes to its top; the rest of the area is
+// filled by a pad record, or skipped if it is smaller than a record. A record becomes visible
+// only after its data was written and the tail was moved, so a record that was being written
+// when the program stopped is simply ignored. The head and the tail are never equal unless the
+// log is empty.
+// The records are found through an index in memory from the key to the offset of the record. It is
+// built when the file is opened, and follows the records stored and dropped.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define THUMBCACHE_FILE_NAME	"ThumbCache.dat"
+#define THUMBCACHE_BUDGET		0x4000000		// size of the cache file : 64MB
+#define THUMBCACHE_MAGIC		"NKTHUMB"
+#define THUMBCACHE_VERSION		2
+#define THUMBCACHE_PAD_KEY		0				// key of the pad record. GetThumbCacheKey never makes 0.
+#define THUMBCACHE_ALIGN(x)	(((x) + 7) & ~(NK_UINT_64)7)
+#define THUMBCACHE_INDEX_MIN	1024			// entries of the index at first
+#define THUMBCACHE_INDEX_HOME(key, mask)	( (ULONG)( (key) ^ ( (key) >> 32 ) ) & (mask) )
+
+ThumbCache	g_stThumbCache;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// get the bytes from the head to the tail of the log.
+NK_UINT_64 GetThumbCacheUsed( LPThumbCacheHeader pHeader )
+{
+	return ( pHeader->ullTail + pHeader->ullCapacity - pHeader->ullHead ) % pHeader->ullCapacity;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// drop all records of the mapped cache.
+void ResetThumbCache( void )
+{
+	LPThumbCacheHeader pHeader = (LPThumbCacheHeader)g_stThumbCache.pView;
+
+	memset( pHeader, 0, sizeof(ThumbCacheHeader) );
+	memcpy( pHeader->szMagic, THUMBCACHE_MAGIC, sizeof(THUMBCACHE_MAGIC) );
+	pHeader->ulVersion = THUMBCACHE_VERSION;
+	pHeader->ullCapacity = g_stThumbCache.ullSize - sizeof(ThumbCacheHeader);
+	if ( g_stThumbCache.pIndex != NULL )
+		memset( g_stThumbCache.pIndex, 0, g_stThumbCache.ulIndexSize * sizeof(ThumbCacheIndex) );
+	g_stThumbCache.ulIndexCount = 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the record at *pullPos, and move *pullPos to the next one. *pullLeft is the number of bytes left up to the tail.
+// *ppRecord is NULL at the tail. Returns FALSE if a record does not fit in the area or the bytes left.
+BOOL NextThumbCacheRecord( NK_UINT_64* pullPos, NK_UINT_64* pullLeft, LPThumbCacheRecord* ppRecord )
+{
+	LPThumbCacheHeader pHeader = (LPThumbCacheHeader)g_stThumbCache.pView;
+	char*	pArea = (char*)g_stThumbCache.pView + sizeof(ThumbCacheHeader);
+	LPThumbCacheRecord pRecord;
+	NK_UINT_64	ullRest, ullSize;
+
+	*ppRecord = NULL;
+	while ( *pullLeft > 0 ) {
+		ullRest = pHeader->ullCapacity - *pullPos;
+		if ( ullRest < sizeof(ThumbCacheRecord) ) {
+			// The end of the area is too small for a record. The log goes on from the top.
+			if ( ullRest > *pullLeft ) return FALSE;
+			*pullLeft -= ullRest;
+			*pullPos = 0;
+			continue;
+		}
+		pRecord = (LPThumbCacheRecord)(pArea + *pullPos);
+		ullSize = sizeof(ThumbCacheRecord) + THUMBCACHE_ALIGN( pRecord->ulLength );
+		if ( ullSize > ullRest || ullSize > *pullLeft ) return FALSE;
+		*pullLeft -= ullSize;
+		*pullPos = ( *pullPos + ullSize ) % pHeader->ullCapacity;
+		if ( pRecord->ullKey == THUMBCACHE_PAD_KEY ) {
+			// A pad fills the area up to its end.
+			if ( *pullPos != 0 ) return FALSE;
+			continue;
+		}
+		*ppRecord = pRecord;
+		return TRUE;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// get the entry of the key in the index, or the free entry where the key goes. The index must not be empty.
+ULONG FindThumbCacheIndex( NK_UINT_64 ullKey )
+{
+	ULONG	ulMask = g_stThumbCache.ulIndexSize - 1;
+	ULONG	i = THUMBCACHE_INDEX_HOME( ullKey, ulMask );
+
+	while ( g_stThumbCache.pIndex[i].ullKey != 0 && g_stThumbCache.pIndex[i].ullKey != ullKey )
+		i = ( i + 1 ) & ulMask;
+	return i;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// point the key to the record at ullPos. Returns FALSE if the index can't grow; the record is not found then.
+BOOL SetThumbCacheIndex( NK_UINT_64 ullKey, NK_UINT_64 ullPos )
+{
+	LPThumbCacheIndex pOld = g_stThumbCache.pIndex;
+	ULONG	i, ulOldSize = g_stThumbCache.ulIndexSize;
+
+	if ( ( g_stThumbCache.ulIndexCount + 1 ) * 2 > g_stThumbCache.ulIndexSize ) {
+		ULONG ulSize = ( ulOldSize == 0 ) ? THUMBCACHE_INDEX_MIN : ulOldSize * 2;
+		LPThumbCacheIndex pNew = (LPThumbCacheIndex)calloc( ulSize, sizeof(ThumbCacheIndex) );
+		if ( pNew == NULL ) return FALSE;
+		g_stThumbCache.pIndex = pNew;
+		g_stThumbCache.ulIndexSize = ulSize;
+		for ( i = 0; i < ulOldSize; i++ ) {
+			if ( pOld[i].ullKey != 0 )
+				pNew[FindThumbCacheIndex( pOld[i].ullKey )] = pOld[i];
+		}
+		free( pOld );
+	}
+	i = FindThumbCacheIndex( ullKey );
+	if ( g_stThumbCache.pIndex[i].ullKey == 0 ) g_stThumbCache.ulIndexCount++;
+	g_stThumbCache.pIndex[i].ullKey = ullKey;
+	g_stThumbCache.pIndex[i].ullPos = ullPos;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// remove the key from the index if it points to the record at ullPos, which is being dropped.
+// A newer record of the same key is kept.
+void RemoveThumbCacheIndex( NK_UINT_64 ullKey, NK_UINT_64 ullPos )
+{
+	LPThumbCacheIndex pIndex = g_stThumbCache.pIndex;
+	ULONG	i, j, ulHome, ulMask = g_stThumbCache.ulIndexSize - 1;
+
+	if ( pIndex == NULL ) return;
+	i = FindThumbCacheIndex( ullKey );
+	if ( pIndex[i].ullKey != ullKey || pIndex[i].ullPos != ullPos ) return;
+
+	// The entries after it are moved up, so that each of them is still found from its home.
+	for ( j = ( i + 1 ) & ulMask; pIndex[j].ullKey != 0; j = ( j + 1 ) & ulMask ) {
+		ulHome = THUMBCACHE_INDEX_HOME( pIndex[j].ullKey, ulMask );
+		if ( ( ( j - ulHome ) & ulMask ) >= ( ( j - i ) & ulMask ) ) {
+			pIndex[i] = pIndex[j];
+			i = j;
+		}
+	}
+	pIndex[i].ullKey = 0;
+	g_stThumbCache.ulIndexCount--;
+}
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// map the cache file. If the file is broken or its size is different from the budget, it is initialized.
+BOOL OpenThumbCache( const char* pszFileName, NK_UINT_64 ullBudget )
+{
+	LPThumbCacheHeader pHeader;
+	BOOL	bInit = FALSE;
+
+	if ( g_stThumbCache.pView != NULL ) return TRUE;
+	if ( ullBudget <= sizeof(ThumbCacheHeader) ) return FALSE;
+
+#if defined( _WIN32 )
+	LARGE_INTEGER	liSize;
+	HANDLE	hFile, hMap;
+
+	hFile = CreateFileA( pszFileName, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( hFile == INVALID_HANDLE_VALUE ) {
+		printf( "%s can't be opened.\n", pszFileName );
+		return FALSE;
+	}
+	if ( GetFileSizeEx( hFile, &liSize ) == FALSE || (NK_UINT_64)liSize.QuadPart != ullBudget ) {
+		liSize.QuadPart = ullBudget;
+		if ( SetFilePointerEx( hFile, liSize, NULL, FILE_BEGIN ) == FALSE || SetEndOfFile( hFile ) == FALSE ) {
+			CloseHandle( hFile );
+			return FALSE;
+		}
+		bInit = TRUE;
+	}
+	hMap = CreateFileMappingA( hFile, NULL, PAGE_READWRITE, (DWORD)(ullBudget >> 32), (DWORD)ullBudget, NULL );
+	if ( hMap == NULL ) {
+		CloseHandle( hFile );
+		return FALSE;
+	}
+	g_stThumbCache.pView = MapViewOfFile( hMap, FILE_MAP_ALL_ACCESS, 0, 0, 0 );
+	if ( g_stThumbCache.pView == NULL ) {
+		CloseHandle( hMap );
+		CloseHandle( hFile );
+		return FALSE;
+	}
+	g_stThumbCache.hFile = hFile;
+	g_stThumbCache.hMap = hMap;
+#elif defined(__APPLE__)
+	struct stat	st;
+	int	fd;
+	void*	pView;
+
+	fd = open( pszFileName, O_RDWR | O_CREAT, 0644 );
+	if ( fd < 0 ) {
+		printf( "%s can't be opened.\n", pszFileName );
+		return FALSE;
+	}
+	if ( fstat( fd, &st ) != 0 || (NK_UINT_64)st.st_size != ullBudget ) {
+		if ( ftruncate( fd, (off_t)ullBudget ) != 0 ) {
+			close( fd );
+			return FALSE;
+		}
+		bInit = TRUE;
+	}
+	pView = mmap( NULL, (size_t)ullBudget, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	if ( pView == MAP_FAILED ) {
+		close( fd );
+		return FALSE;
+	}
+	g_stThumbCache.pView = pView;
+	g_stThumbCache.fd = fd;
+#endif
+	g_stThumbCache.ullSize = ullBudget;
+
+	pHeader = (LPThumbCacheHeader)g_stThumbCache.pView;
+	if ( bInit == FALSE ) {
+		// check the header that was written by the previous session.
+		if ( memcmp( pHeader->szMagic, THUMBCACHE_MAGIC, sizeof(THUMBCACHE_MAGIC) ) != 0 ||
+			pHeader->ulVersion != THUMBCACHE_VERSION ||
+			pHeader->ullCapacity != ullBudget - sizeof(ThumbCacheHeader) ||
+			pHeader->ullHead >= pHeader->ullCapacity || ( pHeader->ullHead & 7 ) != 0 ||
+			pHeader->ullTail >= pHeader->ullCapacity || ( pHeader->ullTail & 7 ) != 0 )
+			bInit = TRUE;
+	}
+	if ( bInit == FALSE ) {
+		// check every record, count them again since the count is updated after the tail, and index them.
+		LPThumbCacheRecord pRecord;
+		NK_UINT_64 ullPos = pHeader->ullHead, ullLeft = GetThumbCacheUsed( pHeader );
+		ULONG ulRecords = 0L;
+
+		for ( ;; ) {
+			if ( NextThumbCacheRecord( &ullPos, &ullLeft, &pRecord ) == FALSE ) {
+				bInit = TRUE;
+				break;
+			}
+			if ( pRecord == NULL ) break;
+			SetThumbCacheIndex( pRecord->ullKey, (NK_UINT_64)( (char*)pRecord - (char*)pHeader - sizeof(ThumbCacheHeader) ) );
+			ulRecords++;
+		}
+		pHeader->ulRecords = ulRecords;
+	}
+	if ( bInit == TRUE )
+		ResetThumbCache();
+	printf( "Thumbnail cache: %u records, %llu/%llu[byte] used.\n", pHeader->ulRecords,
+			(unsigned long long)GetThumbCacheUsed( pHeader ), (unsigned long long)pHeader->ullCapacity );
+
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the mapped view back and unmap the cache file.
+BOOL CloseThumbCache( void )
+{
+	if ( g_stThumbCache.pView == NULL ) return TRUE;
+
+#if defined( _WIN32 )
+	FlushViewOfFile( g_stThumbCache.pView, 0 );
+	UnmapViewOfFile( g_stThumbCache.pView );
+	CloseHandle( g_stThumbCache.hMap );
+	CloseHandle( g_stThumbCache.hFile );
+#elif defined(__APPLE__)
+	msync( g_stThumbCache.pView, (size_t)g_stThumbCache.ullSize, MS_SYNC );
+	munmap( g_stThumbCache.pView, (size_t)g_stThumbCache.ullSize );
+	close( g_stThumbCache.fd );
+#endif
+	free( g_stThumbCache.pIndex );
+	memset( &g_stThumbCache, 0, sizeof(ThumbCache) );
+
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// FNV-1a 64bit hash
+NK_UINT_64 HashThumbCacheKey( NK_UINT_64 ullHash, const void* pData, ULONG ulSize )
+{
+	const UCHAR* pucData = (const UCHAR*)pData;
+	while ( ulSize-- ) {
+		ullHash ^= *pucData++;
+		ullHash *= 0x100000001B3ULL;
+	}
+	return ullHash;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// make the key of an item from its Name, DateTime and StoredBytes.
+BOOL GetThumbCacheKey( LPRefObj pRefItm, NK_UINT_64* pullKey )
+{
+	BOOL	bRet;
+	NkMAIDString	stName;
+	NkMAIDDateTime	stDateTime;
+	ULONG	ulStoredBytes = 0L;
+	NK_UINT_64	ullHash = 0xCBF29CE484222325ULL;
+
+	if ( !CheckCapabilityOperation( pRefItm, kNkMAIDCapability_Name, kNkMAIDCapOperation_Get ) ||
+		!CheckCapabilityOperation( pRefItm, kNkMAIDCapability_DateTime, kNkMAIDCapOperation_Get ) ||
+		!CheckCapabilityOperation( pRefItm, kNkMAIDCapability_StoredBytes, kNkMAIDCapOperation_Get ) )
+		return FALSE;
+
+	bRet = Command_CapGet( pRefItm->pObject, kNkMAIDCapability_Name, kNkMAIDDataType_StringPtr, (NKPARAM)&stName, NULL, NULL );
+	if ( bRet == FALSE ) return FALSE;
+	bRet = Command_CapGet( pRefItm->pObject, kNkMAIDCapability_DateTime, kNkMAIDDataType_DateTimePtr, (NKPARAM)&stDateTime, NULL, NULL );
+	if ( bRet == FALSE ) return FALSE;
+	bRet = Command_CapGet( pRefItm->pObject, kNkMAIDCapability_StoredBytes, kNkMAIDDataType_UnsignedPtr, (NKPARAM)&ulStoredBytes, NULL, NULL );
+	if ( bRet == FALSE ) return FALSE;
+
+	// hash each member separately so that the padding of the structure is not included.
+	ullHash = HashThumbCacheKey( ullHash, stName.str, (ULONG)strlen( (char*)stName.str ) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nYear, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nMonth, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nDay, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nHour, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nMinute, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nSecond, sizeof(UWORD) );
+	ullHash = HashThumbCacheKey( ullHash, &stDateTime.nSubsecond, sizeof(ULONG) );
+	ullHash = HashThumbCacheKey( ullHash, &ulStoredBytes, sizeof(ULONG) );
+	// 0 means "no key" in RefDataProc.
+	*pullKey = ( ullHash == 0 ) ? 1 : ullHash;
+
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// search the record of the key. The returned pointer is valid until the next StoreThumbCache.
+// If a record is broken, the cache is initialized.
+LPThumbCacheRecord LookupThumbCache( NK_UINT_64 ullKey )
+{
+	LPThumbCacheHeader pHeader;
+	LPThumbCacheRecord pRecord;
+	NK_UINT_64	ullPos;
+	ULONG	i;
+
+	if ( OpenThumbCache( THUMBCACHE_FILE_NAME, THUMBCACHE_BUDGET ) == FALSE ) return NULL;
+	if ( g_stThumbCache.ulIndexCount == 0 ) return NULL;
+	pHeader = (LPThumbCacheHeader)g_stThumbCache.pView;
+
+	i = FindThumbCacheIndex( ullKey );
+	if ( g_stThumbCache.pIndex[i].ullKey != ullKey ) return NULL;
+	ullPos = g_stThumbCache.pIndex[i].ullPos;
+	pRecord = (LPThumbCacheRecord)( (char*)g_stThumbCache.pView + sizeof(ThumbCacheHeader) + ullPos );
+	if ( pHeader->ullCapacity - ullPos < sizeof(ThumbCacheRecord) || pRecord->ullKey != ullKey ||
+		pHeader->ullCapacity - ullPos - sizeof(ThumbCacheRecord) < pRecord->ulLength ) {
+		printf( "The thumbnail cache is broken. It is initialized.\n" );
+		ResetThumbCache();
+		return NULL;
+	}
+	return pRecord;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// append a thumbnail to the cache. The oldest records are dropped if there is not enough room.
+BOOL StoreThumbCache( NK_UINT_64 ullKey, ULONG ulFileDataType, LPVOID pData, ULONG ulLength )
+{
+	LPThumbCacheHeader pHeader;
+	LPThumbCacheRecord pRecord;
+	char*	pArea;
+	NK_UINT_64	ullNeed, ullTake, ullPos, ullLeft;
+
+	if ( OpenThumbCache( THUMBCACHE_FILE_NAME, THUMBCACHE_BUDGET ) == FALSE ) return FALSE;
+	pHeader = (LPThumbCacheHeader)g_stThumbCache.pView;
+	pArea = (char*)g_stThumbCache.pView + sizeof(ThumbCacheHeader);
+
+	// A record may take twice its size when it goes to the top of the area.
+	ullNeed = sizeof(ThumbCacheRecord) + THUMBCACHE_ALIGN( ulLength );
+	if ( ullNeed > pHeader->ullCapacity / 2 ) return FALSE;
+	ullPos = pHeader->ullTail;
+	ullTake = ullNeed;
+	if ( pHeader->ullCapacity - ullPos < ullNeed ) {
+		ullTake += pHeader->ullCapacity - ullPos;
+		ullPos = 0;
+	}
+
+	// drop the oldest records by moving the head until the new record fits, leaving the head apart from the tail.
+	while ( pHeader->ullCapacity - GetThumbCacheUsed( pHeader ) <= ullTake ) {
+		NK_UINT_64 ullHead = pHeader->ullHead;
+		ullLeft = GetThumbCacheUsed( pHeader );
+		if ( NextThumbCacheRecord( &ullHead, &ullLeft, &pRecord ) == FALSE ) {
+			printf( "The thumbnail cache is broken. It is initialized.\n" );
+			ResetThumbCache();
+			return FALSE;
+		}
+		pHeader->ullHead = ullHead;
+		if ( pRecord != NULL ) {
+			RemoveThumbCacheIndex( pRecord->ullKey, (NK_UINT_64)( (char*)pRecord - pArea ) );
+			pHeader->ulRecords--;
+		}
+	}
+
+	// write the data first, and then publish it by moving the tail.
+	if ( ullPos != pHeader->ullTail && pHeader->ullCapacity - pHeader->ullTail >= sizeof(ThumbCacheRecord) ) {
+		pRecord = (LPThumbCacheRecord)(pArea + pHeader->ullTail);
+		pRecord->ullKey = THUMBCACHE_PAD_KEY;
+		pRecord->ulFileDataType = 0L;
+		pRecord->ulLength = (ULONG)( pHeader->ullCapacity - pHeader->ullTail - sizeof(ThumbCacheRecord) );
+	}
+	pRecord = (LPThumbCacheRecord)(pArea + ullPos);
+	pRecord->ullKey = ullKey;
+	pRecord->ulFileDataType = ulFileDataType;
+	pRecord->ulLength = ulLength;
+	memcpy( (char*)pRecord + sizeof(ThumbCacheRecord), pData, ulLength );
+	pHeader->ullTail = ( ullPos + ullNeed ) % pHeader->ullCapacity;
+	pHeader->ulRecords++;
+	SetThumbCacheIndex( ullKey, ullPos );
+
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// deliver the cached thumbnail of the key to the sink of the thumbnails, as DataProc does.
+// Returns FALSE if the key is not cached or the thumbnail could not be written.
+BOOL SaveThumbCache( NK_UINT_64 ullKey )
+{
+	LPThumbCacheRecord pRecord;
+	DataSink	stSink;
+	char	filename[256];
+
+	pRecord = LookupThumbCache( ullKey );
+	if ( pRecord == NULL ) return FALSE;
+
+	MakeDataFileName( kNkMAIDDataObjType_Thumbnail, pRecord->ulFileDataType, FALSE, filename );
+	if ( OpenDataSink( &stSink, kSinkRoute_Thumbnail, filename, pRecord->ulLength ) == FALSE )
+		return FALSE;
+	if ( WriteDataSink( &stSink, 0, (char*)pRecord + sizeof(ThumbCacheRecord), pRecord->ulLength ) == FALSE ) {
+		printf( "Failed in writing %s.\n", stSink.szName );
+		AbortDataSink( &stSink );
+		return FALSE;
+	}
+	return CommitDataSink( &stSink );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
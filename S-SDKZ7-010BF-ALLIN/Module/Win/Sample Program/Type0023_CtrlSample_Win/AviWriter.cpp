@@ -0,0 +1,379 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Live view recording to MJPEG AVI.
+// The JPEG data of every frame is appended to the 'movi' list of one AVI file as stream 0. Stream 1
+// is a side track that holds the sequence number, the time and the raw 512-byte header of every
+// frame. The chunks are collected in a batch buffer and appended with one write, and the index is
+// kept in memory until the file is closed. Only the fixed-size headers at the top of the file are
+// rewritten when it is closed. A file is closed and the next one is started before it reaches 1GB,
+// so the offsets of the AVI 1.0 index don't overflow.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define AVI_BATCH_SIZE			0x100000		// 1MB
+#define AVI_FILE_LIMIT			0x3F000000		// start the next file before 1GB
+#define AVI_INDEX_GROW			4096
+#define AVI_HEADER_SIZE			(12 + 12 + 64 + (12 + 64 + 48) + (12 + 64 + 12) + 12)
+#define AVI_SIDE_RECORD_SIZE	(8 + 8 + LIVEVIEW_HEADER_SIZE)
+
+#define AVIF_HASINDEX			0x00000010
+#define AVIIF_KEYFRAME			0x00000010
+
+typedef struct tagAviIndexEntry
+{
+	char	ckid[4];
+	ULONG	ulFlags;
+	ULONG	ulOffset;				// offset from the 'movi' fourcc
+	ULONG	ulSize;
+} AviIndexEntry, *LPAviIndexEntry;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// write little endian values
+static unsigned char* PutAviFourCC( unsigned char* p, const char* pszFourCC )
+{
+	memcpy( p, pszFourCC, 4 );
+	return p + 4;
+}
+static unsigned char* PutAviUWORD( unsigned char* p, UWORD wValue )
+{
+	p[0] = (unsigned char)wValue;
+	p[1] = (unsigned char)(wValue >> 8);
+	return p + 2;
+}
+static unsigned char* PutAviULONG( unsigned char* p, ULONG ulValue )
+{
+	p[0] = (unsigned char)ulValue;
+	p[1] = (unsigned char)(ulValue >> 8);
+	p[2] = (unsigned char)(ulValue >> 16);
+	p[3] = (unsigned char)(ulValue >> 24);
+	return p + 4;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// make the headers of the file from the current counters.
+static void MakeAviHeader( LPAviWriter pAvi, unsigned char* pucHeader )
+{
+	unsigned char* p = pucHeader;
+	ULONG ulMicroSecPerFrame = 1000000 / LIVEVIEW_FPS_DEFAULT;
+	ULONG ulMoviSize = pAvi->ulMoviSize + 4;
+	ULONG ulIndexSize = pAvi->ulIndexCount * sizeof(AviIndexEntry);
+	ULONG i;
+
+	if ( pAvi->ulFrames > 1 )
+		ulMicroSecPerFrame = (ULONG)( (pAvi->ullLastTime - pAvi->ullFirstTime) / (pAvi->ulFrames - 1) );
+	if ( ulMicroSecPerFrame == 0 ) ulMicroSecPerFrame = 1;
+
+	p = PutAviFourCC( p, "RIFF" );
+	p = PutAviULONG( p, AVI_HEADER_SIZE - 8 + pAvi->ulMoviSize + ( pAvi->bClosed ? 8 + ulIndexSize : 0 ) );
+	p = PutAviFourCC( p, "AVI " );
+
+	p = PutAviFourCC( p, "LIST" );
+	p = PutAviULONG( p, AVI_HEADER_SIZE - 12 - 12 - 8 );
+	p = PutAviFourCC( p, "hdrl" );
+
+	p = PutAviFourCC( p, "avih" );
+	p = PutAviULONG( p, 56 );
+	p = PutAviULONG( p, ulMicroSecPerFrame );
+	p = PutAviULONG( p, (ULONG)( (NK_UINT_64)pAvi->ulMaxFrameSize * 1000000 / ulMicroSecPerFrame ) );
+	p = PutAviULONG( p, 0 );						// padding granularity
+	p = PutAviULONG( p, AVIF_HASINDEX );
+	p = PutAviULONG( p, pAvi->ulFrames );
+	p = PutAviULONG( p, 0 );						// initial frames
+	p = PutAviULONG( p, 2 );						// streams
+	p = PutAviULONG( p, pAvi->ulMaxFrameSize );
+	p = PutAviULONG( p, pAvi->wWidth );
+	p = PutAviULONG( p, pAvi->wHeight );
+	for ( i = 0; i < 4; i++ )
+		p = PutAviULONG( p, 0 );
+
+	// stream 0 : MJPEG video
+	p = PutAviFourCC( p, "LIST" );
+	p = PutAviULONG( p, 4 + 64 + 48 );
+	p = PutAviFourCC( p, "strl" );
+	p = PutAviFourCC( p, "strh" );
+	p = PutAviULONG( p, 56 );
+	p = PutAviFourCC( p, "vids" );
+	p = PutAviFourCC( p, "MJPG" );
+	p = PutAviULONG( p, 0 );						// flags
+	p = PutAviUWORD( p, 0 );						// priority
+	p = PutAviUWORD( p, 0 );						// language
+	p = PutAviULONG( p, 0 );						// initial frames
+	p = PutAviULONG( p, ulMicroSecPerFrame );		// scale
+	p = PutAviULONG( p, 1000000 );					// rate
+	p = PutAviULONG( p, 0 );						// start
+	p = PutAviULONG( p, pAvi->ulFrames );			// length
+	p = PutAviULONG( p, pAvi->ulMaxFrameSize );
+	p = PutAviULONG( p, 0xFFFFFFFF );				// quality
+	p = PutAviULONG( p, 0 );						// sample size
+	p = PutAviUWORD( p, 0 );
+	p = PutAviUWORD( p, 0 );
+	p = PutAviUWORD( p, pAvi->wWidth );
+	p = PutAviUWORD( p, pAvi->wHeight );
+	p = PutAviFourCC( p, "strf" );
+	p = PutAviULONG( p, 40 );
+	p = PutAviULONG( p, 40 );						// BITMAPINFOHEADER
+	p = PutAviULONG( p, pAvi->wWidth );
+	p = PutAviULONG( p, pAvi->wHeight );
+	p = PutAviUWORD( p, 1 );
+	p = PutAviUWORD( p, 24 );
+	p = PutAviFourCC( p, "MJPG" );
+	p = PutAviULONG( p, (ULONG)pAvi->wWidth * pAvi->wHeight * 3 );
+	for ( i = 0; i < 4; i++ )
+		p = PutAviULONG( p, 0 );
+
+	// stream 1 : side track of the frame times and the live view headers
+	p = PutAviFourCC( p, "LIST" );
+	p = PutAviULONG( p, 4 + 64 + 12 );
+	p = PutAviFourCC( p, "strl" );
+	p = PutAviFourCC( p, "strh" );
+	p = PutAviULONG( p, 56 );
+	p = PutAviFourCC( p, "txts" );
+	p = PutAviULONG( p, 0 );
+	p = PutAviULONG( p, 0 );
+	p = PutAviUWORD( p, 0 );
+	p = PutAviUWORD( p, 0 );
+	p = PutAviULONG( p, 0 );
+	p = PutAviULONG( p, ulMicroSecPerFrame );
+	p = PutAviULONG( p, 1000000 );
+	p = PutAviULONG( p, 0 );
+	p = PutAviULONG( p, pAvi->ulFrames );
+	p = PutAviULONG( p, AVI_SIDE_RECORD_SIZE );
+	p = PutAviULONG( p, 0xFFFFFFFF );
+	p = PutAviULONG( p, AVI_SIDE_RECORD_SIZE );
+	for ( i = 0; i < 4; i++ )
+		p = PutAviUWORD( p, 0 );
+	p = PutAviFourCC( p, "strf" );
+	p = PutAviULONG( p, 4 );
+	p = PutAviULONG( p, AVI_SIDE_RECORD_SIZE );
+
+	p = PutAviFourCC( p, "LIST" );
+	p = PutAviULONG( p, ulMoviSize );
+	p = PutAviFourCC( p, "movi" );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the collected chunks to the file.
+static BOOL FlushAviBatch( LPAviWriter pAvi )
+{
+	if ( pAvi->ulBatchFill == 0 ) return TRUE;
+	if ( fwrite( pAvi->pucBatch, 1, pAvi->ulBatchFill, pAvi->pFile ) != pAvi->ulBatchFill ) return FALSE;
+	pAvi->ulBatchFill = 0;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// append a chunk to the 'movi' list.
+static BOOL AddAviChunk( LPAviWriter pAvi, const char* pszId, ULONG ulFlags, const unsigned char* pucData, ULONG ulSize,
+							const unsigned char* pucData2, ULONG ulSize2 )
+{
+	ULONG ulTotal = ulSize + ulSize2;
+	ULONG ulPadded = ( ulTotal + 1 ) & ~1UL;
+	unsigned char ucChunk[8];
+	LPAviIndexEntry pEntry;
+
+	if ( pAvi->ulIndexCount == pAvi->ulIndexCapacity ) {
+		LPAviIndexEntry pIndex = (LPAviIndexEntry)realloc( pAvi->pIndex, (pAvi->ulIndexCapacity + AVI_INDEX_GROW) * sizeof(AviIndexEntry) );
+		if ( pIndex == NULL ) return FALSE;
+		pAvi->pIndex = pIndex;
+		pAvi->ulIndexCapacity += AVI_INDEX_GROW;
+	}
+	pEntry = &((LPAviIndexEntry)pAvi->pIndex)[pAvi->ulIndexCount++];
+	memcpy( pEntry->ckid, pszId, 4 );
+	pEntry->ulFlags = ulFlags;
+	pEntry->ulOffset = pAvi->ulMoviSize + 4;
+	pEntry->ulSize = ulTotal;
+
+	PutAviULONG( PutAviFourCC( ucChunk, pszId ), ulTotal );
+	// A chunk larger than the batch buffer is written directly.
+	if ( pAvi->ulBatchFill + 8 + ulPadded > AVI_BATCH_SIZE ) {
+		if ( FlushAviBatch( pAvi ) == FALSE ) return FALSE;
+	}
+	if ( 8 + ulPadded > AVI_BATCH_SIZE ) {
+		if ( fwrite( ucChunk, 1, 8, pAvi->pFile ) != 8 ) return FALSE;
+		if ( fwrite( pucData, 1, ulSize, pAvi->pFile ) != ulSize ) return FALSE;
+		if ( ulSize2 > 0 && fwrite( pucData2, 1, ulSize2, pAvi->pFile ) != ulSize2 ) return FALSE;
+		if ( ulPadded > ulTotal && fputc( 0, pAvi->pFile ) == EOF ) return FALSE;
+	} else {
+		memcpy( pAvi->pucBatch + pAvi->ulBatchFill, ucChunk, 8 );
+		memcpy( pAvi->pucBatch + pAvi->ulBatchFill + 8, pucData, ulSize );
+		if ( ulSize2 > 0 )
+			memcpy( pAvi->pucBatch + pAvi->ulBatchFill + 8 + ulSize, pucData2, ulSize2 );
+		if ( ulPadded > ulTotal )
+			pAvi->pucBatch[pAvi->ulBatchFill + 8 + ulTotal] = 0;
+		pAvi->ulBatchFill += 8 + ulPadded;
+	}
+	pAvi->ulMoviSize += 8 + ulPadded;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// start a new AVI file. The file name is numbered from the base name.
+static BOOL StartAviFile( LPAviWriter pAvi )
+{
+	unsigned char ucHeader[AVI_HEADER_SIZE];
+	FILE* hFile;
+
+	while ( TRUE ) {
+		sprintf( pAvi->szFileName, "%s%03u.avi", pAvi->szBaseName, (unsigned)++pAvi->ulFileIndex );
+		if ( (hFile = fopen( pAvi->szFileName, "r" )) == NULL ) break;
+		// this file name is already used.
+		fclose( hFile );
+	}
+	pAvi->pFile = fopen( pAvi->szFileName, "wb" );
+	if ( pAvi->pFile == NULL ) {
+		printf( "%s can't be opened.\n", pAvi->szFileName );
+		return FALSE;
+	}
+	pAvi->ulMoviSize = 0;
+	pAvi->ulIndexCount = 0;
+	pAvi->ulFrames = 0;
+	pAvi->ulMaxFrameSize = 0;
+	pAvi->bClosed = FALSE;
+	// The headers are written with the counters of an empty file, and rewritten when the file is closed.
+	MakeAviHeader( pAvi, ucHeader );
+	if ( fwrite( ucHeader, 1, AVI_HEADER_SIZE, pAvi->pFile ) != AVI_HEADER_SIZE ) return FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the index and the final headers, and close the file.
+static BOOL FinishAviFile( LPAviWriter pAvi )
+{
+	unsigned char ucHeader[AVI_HEADER_SIZE];
+	unsigned char ucChunk[8];
+	ULONG ulIndexSize = pAvi->ulIndexCount * sizeof(AviIndexEntry);
+	ULONG i;
+	BOOL bRet = TRUE;
+
+	if ( pAvi->pFile == NULL ) return TRUE;
+	if ( FlushAviBatch( pAvi ) == FALSE ) bRet = FALSE;
+
+	PutAviULONG( PutAviFourCC( ucChunk, "idx1" ), ulIndexSize );
+	if ( fwrite( ucChunk, 1, 8, pAvi->pFile ) != 8 ) bRet = FALSE;
+	for ( i = 0; i < pAvi->ulIndexCount && bRet == TRUE; i++ ) {
+		LPAviIndexEntry pEntry = &((LPAviIndexEntry)pAvi->pIndex)[i];
+		unsigned char ucEntry[16];
+		PutAviULONG( PutAviULONG( PutAviULONG( PutAviFourCC( ucEntry, pEntry->ckid ), pEntry->ulFlags ), pEntry->ulOffset ), pEntry->ulSize );
+		if ( fwrite( ucEntry, 1, 16, pAvi->pFile ) != 16 ) bRet = FALSE;
+	}
+
+	pAvi->bClosed = TRUE;
+	MakeAviHeader( pAvi, ucHeader );
+	if ( fseek( pAvi->pFile, 0, SEEK_SET ) != 0 || fwrite( ucHeader, 1, AVI_HEADER_SIZE, pAvi->pFile ) != AVI_HEADER_SIZE ) bRet = FALSE;
+	if ( fclose( pAvi->pFile ) != 0 ) bRet = FALSE;
+	pAvi->pFile = NULL;
+	printf( "%s was saved. (%u frames)\n", pAvi->szFileName, (unsigned)pAvi->ulFrames );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// prepare a recording. The files are named pszBaseName001.avi, pszBaseName002.avi, ...
+BOOL OpenAviWriter( LPAviWriter pAvi, const char* pszBaseName )
+{
+	memset( pAvi, 0, sizeof(AviWriter) );
+	strncpy( pAvi->szBaseName, pszBaseName, sizeof(pAvi->szBaseName) - 1 );
+	pAvi->pucBatch = (unsigned char*)malloc( AVI_BATCH_SIZE );
+	if ( pAvi->pucBatch == NULL ) return FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// append a live view frame.
+BOOL WriteAviFrame( LPAviWriter pAvi, LPLiveViewFrame pFrame )
+{
+	LiveViewHeader stHeader;
+	unsigned char ucRecord[16];
+	ULONG ulNeeded;
+
+	if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ) return FALSE;
+
+	// the next file is started before the offsets overflow.
+	ulNeeded = 8 + stHeader.ulJpegSize + 8 + AVI_SIDE_RECORD_SIZE + (pAvi->ulIndexCount + 2) * sizeof(AviIndexEntry);
+	if ( pAvi->pFile != NULL && AVI_HEADER_SIZE + pAvi->ulMoviSize + ulNeeded > AVI_FILE_LIMIT ) {
+		if ( FinishAviFile( pAvi ) == FALSE ) return FALSE;
+	}
+	if ( pAvi->pFile == NULL ) {
+		UWORD wWholeW, wWholeH;
+		GetLiveViewImageSize( &stHeader, &wWholeW, &wWholeH, &pAvi->wWidth, &pAvi->wHeight );
+		pAvi->ullFirstTime = pFrame->ullTime;
+		if ( StartAviFile( pAvi ) == FALSE ) return FALSE;
+	}
+
+	if ( AddAviChunk( pAvi, "00dc", AVIIF_KEYFRAME, stHeader.pucJpeg, stHeader.ulJpegSize, NULL, 0 ) == FALSE ) return FALSE;
+	// side track : sequence number, time from the first frame in usec, and the header
+	PutAviULONG( ucRecord, (ULONG)pFrame->ullSeq );
+	PutAviULONG( ucRecord + 4, (ULONG)(pFrame->ullSeq >> 32) );
+	PutAviULONG( ucRecord + 8, (ULONG)(pFrame->ullTime - pAvi->ullFirstTime) );
+	PutAviULONG( ucRecord + 12, (ULONG)((pFrame->ullTime - pAvi->ullFirstTime) >> 32) );
+	if ( AddAviChunk( pAvi, "01tx", 0, ucRecord, 16, stHeader.pucHeader, LIVEVIEW_HEADER_SIZE ) == FALSE ) return FALSE;
+
+	if ( stHeader.ulJpegSize > pAvi->ulMaxFrameSize ) pAvi->ulMaxFrameSize = stHeader.ulJpegSize;
+	pAvi->ullLastTime = pFrame->ullTime;
+	pAvi->ulFrames++;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// finish the current file and free the buffers.
+BOOL CloseAviWriter( LPAviWriter pAvi )
+{
+	BOOL bRet = FinishAviFile( pAvi );
+	free( pAvi->pucBatch );
+	pAvi->pucBatch = NULL;
+	free( pAvi->pIndex );
+	pAvi->pIndex = NULL;
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// consumer of the live view frames to record them
+void AviWriterConsumer( LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPAviWriter pAvi = (LPAviWriter)pContext;
+	if ( pAvi->bFailed == TRUE ) return;
+	if ( WriteAviFrame( pAvi, pFrame ) == FALSE ) {
+		printf( "Failed in recording the live view to %s.\n", pAvi->szFileName );
+		pAvi->bFailed = TRUE;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Record the live view to AVI files.
+BOOL LiveViewRecordMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSeconds, ulSaved;
+	NK_UINT_64	ullLastPrint = 0, ullFrames = 0, ullDropped = 0;
+	AviWriter	stAvi;
+	SLONG	lConsumer;
+	BOOL	bRet;
+
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	printf( "Input the duration in seconds (0: until Ctrl+C)\n>" );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+
+	if ( OpenAviWriter( &stAvi, "LiveView" ) == FALSE ) return FALSE;
+	lConsumer = AddLiveViewConsumer( "AVI", AviWriterConsumer, &stAvi );
+	if ( lConsumer < 0 ) {
+		CloseAviWriter( &stAvi );
+		return FALSE;
+	}
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		RemoveLiveViewConsumer( lConsumer );
+		CloseAviWriter( &stAvi );
+		return FALSE;
+	}
+	printf( "Recording the live view. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, ulSeconds, LiveViewStatsControl, &ullLastPrint );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+
+	GetLiveViewConsumerStats( lConsumer, &ullFrames, &ullDropped );
+	RemoveLiveViewConsumer( lConsumer );
+	if ( CloseAviWriter( &stAvi ) == FALSE ) bRet = FALSE;
+	printf( "%llu frames were recorded, %llu frames were dropped by the recorder.\n",
+			(unsigned long long)ullFrames, (unsigned long long)ullDropped );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -8,21 +8,11 @@
 #include <stdio.h>
 #if defined( _WIN32 )
 	#include <windows.h>
-	#include <mmsystem.h>
-#elif defined(__APPLE__)
-    #include <sys/times.h>
 #endif
 #include "Maid3.h"
 #include "Maid3d1.h"
 #include "CtrlSample.h"
 
-#if defined( _WIN32 )
-ULONG g_ulProgressValue;// used in only ProgressProc
-#elif defined(__APPLE__)
-unsigned long g_ulProgressValue;// used in only ProgressProc
-#endif
-BOOL	g_bFirstCall = TRUE;// used in ProgressProc, and DoDeleteDramImage
-
 //------------------------------------------------------------------------------------------------------------------------------------
 
 void CALLPASCAL CALLBACK ModEventProc( NKREF refProc, ULONG ulEvent, NKPARAM data )
@@ -308,6 +298,49 @@ void CALLPASCAL CALLBACK DatEventProc( NKREF refProc, ULONG ulEvent, NKPARAM dat
 	}
 }
 //------------------------------------------------------------------------------------------------------------------------------------
+// make an unused file name such as "Image001.jpg" for the delivered data.
+BOOL MakeDataFileName( ULONG ulObjType, ULONG ulFileDataType, BOOL bRawImage, char* pszFileName )
+{
+	FILE *stream;
+	char Prefix[16], Ext[16];
+	UWORD i = 0;
+
+	if ( ulObjType & kNkMAIDDataObjType_Image )
+		strcpy(Prefix,"Image");
+	else if ( ulObjType & kNkMAIDDataObjType_Thumbnail )
+		strcpy(Prefix,"Thumb");
+	else
+		strcpy(Prefix,"Unknown");
+	if ( bRawImage == TRUE ) {
+		strcpy(Ext,".raw");
+	} else {
+		switch( ulFileDataType ) {
+			case kNkMAIDFileDataType_JPEG:
+				strcpy(Ext,".jpg");
+				break;
+			case kNkMAIDFileDataType_TIFF:
+				strcpy(Ext,".tif");
+				break;
+			case kNkMAIDFileDataType_NIF:
+				strcpy(Ext,".nef");
+				break;
+			case kNkMAIDFileDataType_NDF:
+				strcpy(Ext,".ndf");
+				break;
+			default:
+				strcpy(Ext,".dat");
+		}
+	}
+	while( TRUE ) {
+		sprintf( pszFileName, "%s%03d%s", Prefix, ++i, Ext );
+		if ( (stream = fopen(pszFileName, "r") ) != NULL )
+			fclose(stream);
+		else
+			break;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
 // copy the delivered data
 NKERROR CALLPASCAL CALLBACK DataProc( NKREF ref, LPVOID pInfo, LPVOID pData )
 {
@@ -319,61 +352,58 @@ NKERROR CALLPASCAL CALLBACK DataProc( NKREF ref, LPVOID pInfo, LPVOID pData )
 	ULONG ulByte;
 
 	if ( pDataInfo->ulType & kNkMAIDDataObjType_File ) {
-		if( ((LPRefDataProc)ref)->ulOffset == 0 && ((LPRefDataProc)ref)->pBuffer == NULL )
-			((LPRefDataProc)ref)->pBuffer = malloc( pFileInfo->ulTotalLength );
-		if ( ((LPRefDataProc)ref)->pBuffer == NULL ) {
-			puts( "There is not enough memory." );
-			return kNkMAIDResult_OutOfMemory;
+		LPRefDataProc pRefDeliver = (LPRefDataProc)ref;
+		LPDataSink pSink = (LPDataSink)pRefDeliver->pSink;
+
+		if ( pSink == NULL ) {
+			// This is the first delivery of the file. Open the sink of its type, and write the chunks into it while delivered.
+			char filename[256];
+			MakeDataFileName( pDataInfo->ulType, pFileInfo->ulFileDataType, FALSE, filename );
+			pSink = (LPDataSink)malloc( sizeof(DataSink) );// this block will be freed at the end of the delivery or in CompletionProc.
+			if ( pSink == NULL ) {
+				puts( "There is not enough memory." );
+				return kNkMAIDResult_OutOfMemory;
+			}
+			if ( OpenDataSink( pSink, GetDataSinkRoute( pDataInfo->ulType ), filename, pFileInfo->ulTotalLength ) == FALSE ) {
+				free( pSink );
+				return kNkMAIDResult_UnexpectedError;
+			}
+			pRefDeliver->pSink = pSink;
+			pRefDeliver->ulOffset = 0;
+			// The whole file is kept in memory only if it is stored in the thumbnail cache.
+			if ( pRefDeliver->ullCacheKey != 0 && pRefDeliver->pBuffer == NULL )
+				pRefDeliver->pBuffer = malloc( pFileInfo->ulTotalLength );
 		}
-		ulOffset = ((LPRefDataProc)ref)->ulOffset;
-		pCurrentBuffer = (LPVOID)((char*)((LPRefDataProc)ref)->pBuffer + ((LPRefDataProc)ref)->ulOffset);
-		memmove( pCurrentBuffer, pData, pFileInfo->ulLength);
-		ulOffset += pFileInfo->ulLength;
+		if ( WriteDataSink( pSink, pRefDeliver->ulOffset, pData, pFileInfo->ulLength ) == FALSE ) {
+			printf( "Failed in writing %s.\n", pSink->szName );
+			return kNkMAIDResult_UnexpectedError;
+		}
+		if ( pRefDeliver->pBuffer != NULL ) {
+			pCurrentBuffer = (LPVOID)((char*)pRefDeliver->pBuffer + pRefDeliver->ulOffset);
+			memmove( pCurrentBuffer, pData, pFileInfo->ulLength);
+		}
+		ulOffset = pRefDeliver->ulOffset + pFileInfo->ulLength;
+		AddProgressBytes( pRefDeliver->refProgress, pFileInfo->ulLength );
 
 		if( ulOffset < pFileInfo->ulTotalLength ) {
 			// We have not finished the delivery.
-			((LPRefDataProc)ref)->ulOffset = ulOffset;
+			pRefDeliver->ulOffset = ulOffset;
 		} else {
-			// We have finished the delivery. We will save this file.
-			FILE *stream;
-			char filename[256], Prefix[16], Ext[16];
-			UWORD i = 0;
-			if ( pDataInfo->ulType & kNkMAIDDataObjType_Image )
-				strcpy(Prefix,"Image");
-			else if ( pDataInfo->ulType & kNkMAIDDataObjType_Thumbnail )
-				strcpy(Prefix,"Thumb");
-			else
-				strcpy(Prefix,"Unknown");
-			switch( pFileInfo->ulFileDataType ) {
-				case kNkMAIDFileDataType_JPEG:
-					strcpy(Ext,".jpg");
-					break;
-				case kNkMAIDFileDataType_TIFF:
-					strcpy(Ext,".tif");
-					break;
-				case kNkMAIDFileDataType_NIF:
-					strcpy(Ext,".nef");
-					break;
-				case kNkMAIDFileDataType_NDF:
-					strcpy(Ext,".ndf");
-					break;
-				default:
-					strcpy(Ext,".dat");
-			}
-			while( TRUE ) {
-				sprintf( filename, "%s%03d%s", Prefix, ++i, Ext );
-				if ( (stream = fopen(filename, "r") ) != NULL )
-					fclose(stream);
-				else
-					break;
-			}
-			if ( (stream = fopen(filename, "wb") ) == NULL)
+			// We have finished the delivery. We will commit this file.
+			BOOL bWritten = CommitDataSink( pSink );
+			if ( bWritten == TRUE && pRefDeliver->pszFileName != NULL && pSink->ulKind == kSinkKind_File )
+				strcpy( pRefDeliver->pszFileName, pSink->szName );
+			free( pSink );
+			pRefDeliver->pSink = NULL;
+			if ( bWritten == FALSE )
 				return kNkMAIDResult_UnexpectedError;
-			fwrite(((LPRefDataProc)ref)->pBuffer, 1, pFileInfo->ulTotalLength, stream);
-			fclose(stream);
-			free(((LPRefDataProc)ref)->pBuffer);
-			((LPRefDataProc)ref)->pBuffer = NULL;
-			((LPRefDataProc)ref)->ulOffset = 0;
+			// keep the thumbnail for the next browsing.
+			if ( pRefDeliver->pBuffer != NULL ) {
+				StoreThumbCache( pRefDeliver->ullCacheKey, pFileInfo->ulFileDataType, pRefDeliver->pBuffer, pFileInfo->ulTotalLength );
+				free( pRefDeliver->pBuffer );
+				pRefDeliver->pBuffer = NULL;
+			}
+			pRefDeliver->ulOffset = 0;
 			// If the flag of fRemoveObject in NkMAIDFileInfo structure is TRUE, we should remove this item.
 			if ( pFileInfo->fRemoveObject && (pDataInfo->ulType & kNkMAIDDataObjType_Image) )
 				g_bFileRemoved = TRUE;
@@ -391,35 +421,22 @@ NKERROR CALLPASCAL CALLBACK DataProc( NKREF ref, LPVOID pInfo, LPVOID pData )
 		ulByte = pImageInfo->ulRowBytes * pImageInfo->rData.h;
 		memmove( pCurrentBuffer, pData, ulByte );
 		ulOffset += ulByte;
+		AddProgressBytes( ((LPRefDataProc)ref)->refProgress, ulByte );
 
 		if( ulOffset < ullTotalSize ) {
 			// We have not finished the delivery.
 			((LPRefDataProc)ref)->ulOffset = ulOffset;
 		} else {
 			// We have finished the delivery. We will save this file.
-			FILE *stream;
-			char filename[256], Prefix[16];
-			UWORD i = 0;
-			if ( pDataInfo->ulType & kNkMAIDDataObjType_Image )
-				strcpy(Prefix,"Image");
-			else if ( pDataInfo->ulType & kNkMAIDDataObjType_Thumbnail )
-				strcpy(Prefix,"Thumb");
-			else
-				strcpy(Prefix,"Unknown");
-			while( TRUE ) {
-				sprintf( filename, "%s%03d.raw", Prefix, ++i );
-				if ( (stream = fopen(filename, "r") ) != NULL )
-					fclose(stream);
-				else
-					break;
-			}
-			if ( (stream = fopen(filename, "wb") ) == NULL)
-				return kNkMAIDResult_UnexpectedError;
-			fwrite(((LPRefDataProc)ref)->pBuffer, 1, ullTotalSize, stream);
-			fclose(stream);
+			char filename[256];
+			BOOL bWritten;
+			MakeDataFileName( pDataInfo->ulType, kNkMAIDFileDataType_NotSpecified, TRUE, filename );
+			bWritten = SaveDataSink( GetDataSinkRoute( pDataInfo->ulType ), filename, ((LPRefDataProc)ref)->pBuffer, ullTotalSize );
 			free(((LPRefDataProc)ref)->pBuffer);
 			((LPRefDataProc)ref)->pBuffer = NULL;
 			((LPRefDataProc)ref)->ulOffset = 0;
+			if ( bWritten == FALSE )
+				return kNkMAIDResult_UnexpectedError;
 			// If the flag of fRemoveObject in NkMAIDFileInfo structure is TRUE, we should remove this item.
 			if ( pImageInfo->fRemoveObject && (pDataInfo->ulType & kNkMAIDDataObjType_Image) )
 				g_bFileRemoved = TRUE;
@@ -438,6 +455,9 @@ void CALLPASCAL CALLBACK CompletionProc(
 			NKREF				refComplete,	// Reference set by client
 			NKERROR			nResult )		// One of eNkMAIDResult)
 {
+	if ( pObject != NULL )
+		FinishProgress( pObject->refClient, ulCommand, ulParam );
+
 	((LPRefCompletionProc)refComplete)->nResult = nResult;
 	(*((LPRefCompletionProc)refComplete)->pulCount) ++;
 
@@ -447,6 +467,11 @@ void CALLPASCAL CALLBACK CompletionProc(
 		if ( pRefDeliver != NULL ) {
 			if ( pRefDeliver->pBuffer != NULL )
 				free( pRefDeliver->pBuffer );
+			// The delivery was stopped on the way.
+			if ( pRefDeliver->pSink != NULL ) {
+				AbortDataSink( (LPDataSink)pRefDeliver->pSink );
+				free( pRefDeliver->pSink );
+			}
 			free( pRefDeliver );
 		}
 	}
@@ -464,54 +489,8 @@ void CALLPASCAL CALLBACK ProgressProc(
 		ULONG				ulDone,				// Numerator
 		ULONG				ulTotal )			// Denominator
 {
-#if defined( _WIN32 )
-    ULONG ulNewProgressValue, ulCount;
-#elif defined(__APPLE__)
-    unsigned long ulNewProgressValue, ulCount;
-#endif
-	if ( ulTotal == 0 ) {
-		// when we don't know how long this process is, we show such as barber's pole.
-		if ( ulDone == 1 ) {
-		#if defined( _WIN32 )
-			ulNewProgressValue = timeGetTime();
-			if( (ulNewProgressValue < g_ulProgressValue) || (ulNewProgressValue > g_ulProgressValue + 500) ) {
-				printf( "c" );
-				g_ulProgressValue = ulNewProgressValue;
-			}
-		#elif defined(__APPLE__)
-            struct tms tm;
-            ulNewProgressValue = times(&tm);
-			if( (ulNewProgressValue < g_ulProgressValue) || (ulNewProgressValue > g_ulProgressValue + 30) ) {
-				printf( "c" );
-				g_ulProgressValue = ulNewProgressValue;
-			}
-		#endif
-		} else if ( ulDone == 0 ) {
-				printf( "o" );
-		}
-	} else {
-		// when we know how long this process is, we show progress bar.
-		if ( ulDone == 0 ) {
-			if ( g_bFirstCall == TRUE ) {
-				g_ulProgressValue = 0;
-				g_bFirstCall = FALSE;
-				printf("\n0       20        40        60        80        100");
-				printf("\n---------+---------+---------+---------+---------+\n");
-			}
-		} else {
-			// show progress bar
-            NK_UINT_64 ullwork = 50 * ( NK_UINT_64 )ulDone;
-            ulNewProgressValue = ( ULONG )( ( ullwork + ulTotal - 1 ) / ulTotal );
-			ulCount = ulNewProgressValue - g_ulProgressValue;
-			while ( ulCount-- )
-				printf( "]" );
-			g_ulProgressValue = ulNewProgressValue;
-			if ( ulDone == ulTotal ) {
-				printf( "\n" );
-				g_bFirstCall = TRUE;
-			}
-		}
-	}
+	// Only the progress record is updated here. It is shown by the progress renderer.
+	UpdateProgress( refProc, ulCommand, ulParam, ulDone, ulTotal );
 }
 //------------------------------------------------------------------------------------------------------------------------------------
 
@@ -0,0 +1,207 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Focus map on the zoomed live view.
+// The whole area is divided into 3x3 regions. For each region, the focus point is moved to its
+// center by kNkMAIDCapability_ContrastAFArea, and the live view is zoomed there by
+// kNkMAIDCapability_LiveViewZoomArea. The live view is read while LiveViewImageStatus allows it,
+// until the display area in the header contains the center of the region, so a frame of the last
+// region is never scored. The first frame which shows the region is taken. The map has one time
+// budget, and the rest of it is shared by the regions left. The luma of the frame is decoded at
+// full size and scored by the variance of the Laplacian. The zoom and the focus point are restored
+// at the end.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define FOCUS_MAP_ZOOM_DEFAULT		kNkMAIDLiveViewZoomArea_1024	// 100% on the monitor
+#define FOCUS_MAP_BUDGET			1000	// msec for the whole map
+#define FOCUS_MAP_WEAK				50		// percent of the best score to warn
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// Read the live view until it shows the point (lX, lY) of the whole area zoomed. Returns FALSE on timeout.
+BOOL WaitFocusMapFrame( LPRefObj pRefSrc, LPLiveViewFrame pFrame, SLONG lX, SLONG lY, ULONG ulTimeout, ULONG* pulFrames )
+{
+	NK_UINT_64 ullEnd = GetHostTimeUs() + (NK_UINT_64)ulTimeout * 1000;
+	LiveViewHeader stHeader;
+	LiveViewRect stDisplay;
+	UWORD wWholeWidth, wWholeHeight, wImageWidth, wImageHeight;
+	ULONG ulStatus;
+
+	while ( GetHostTimeUs() < ullEnd ) {
+		Command_Async( pRefSrc->pObject );
+		if ( GetEnumUnsignedCapability( pRefSrc, kNkMAIDCapability_LiveViewImageStatus, &ulStatus, NULL, FALSE ) == TRUE &&
+			 ulStatus != kNkMAIDLiveViewImageStatus_CanAcquire ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+			continue;
+		}
+		if ( ReadLiveViewImage( pRefSrc, pFrame ) == FALSE ) continue;
+		(*pulFrames)++;
+		if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ) continue;
+		GetLiveViewImageSize( &stHeader, &wWholeWidth, &wWholeHeight, &wImageWidth, &wImageHeight );
+		GetLiveViewDisplayArea( &stHeader, &stDisplay );
+		if ( stDisplay.wWidth == 0 || stDisplay.wWidth >= wWholeWidth ) continue;
+		if ( lX < stDisplay.wCenterX - stDisplay.wWidth / 2 || lX > stDisplay.wCenterX + stDisplay.wWidth / 2 ) continue;
+		if ( lY < stDisplay.wCenterY - stDisplay.wHeight / 2 || lY > stDisplay.wCenterY + stDisplay.wHeight / 2 ) continue;
+		pFrame->ullTime = GetHostTimeUs();
+		return TRUE;
+	}
+	return FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Score the 3x3 regions on the live view zoomed to ulZoom. The remote live view must be on.
+BOOL RunFocusMap( LPRefObj pRefSrc, ULONG ulZoom, LPFocusMap pMap )
+{
+	LiveViewFrame stFrame;
+	LiveViewHeader stHeader;
+	LiveViewRect stAF;
+	JpegLuma stLuma;
+	SharpnessSample stSample;
+	NkMAIDPoint stPoint, stSavedPoint;
+	UWORD wWholeWidth = 0, wWholeHeight = 0, wImageWidth, wImageHeight;
+	ULONG ulSavedZoom, ulFrames, i, j;
+	BOOL bSavedPoint = FALSE, bRet = TRUE;
+	NK_UINT_64 ullStart = GetHostTimeUs(), ullEnd = ullStart + FOCUS_MAP_BUDGET * 1000, ullRegion, ullDeadline, ullNow;
+
+	memset( pMap, 0, sizeof(FocusMap) );
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_ContrastAFArea, kNkMAIDCapOperation_Set ) ||
+		 GetEnumUnsignedCapability( pRefSrc, kNkMAIDCapability_LiveViewZoomArea, &ulSavedZoom, NULL, FALSE ) == FALSE ) {
+		printf( "ContrastAFArea or LiveViewZoomArea is not available.\n" );
+		return FALSE;
+	}
+	memset( &stFrame, 0, sizeof(stFrame) );
+	memset( &stLuma, 0, sizeof(stLuma) );
+
+	// The size of the whole area and the focus point to restore are read from the current frame.
+	if ( ReadLiveViewImage( pRefSrc, &stFrame ) == TRUE && ParseLiveViewHeader( stFrame.pucData, stFrame.ulSize, &stHeader ) == TRUE ) {
+		GetLiveViewImageSize( &stHeader, &wWholeWidth, &wWholeHeight, &wImageWidth, &wImageHeight );
+		if ( GetLiveViewAFFrame( &stHeader, 0, &stAF ) == TRUE ) {
+			stSavedPoint.x = stAF.wCenterX;
+			stSavedPoint.y = stAF.wCenterY;
+			bSavedPoint = TRUE;
+		}
+	}
+	if ( wWholeWidth == 0 || wWholeHeight == 0 ) {
+		printf( "Failed in reading the live view.\n" );
+		free( stFrame.pucData );
+		return FALSE;
+	}
+
+	for ( j = 0; j < 3 && bRet == TRUE; j++ ) {
+		for ( i = 0; i < 3 && bRet == TRUE; i++ ) {
+			ULONG ulRegion = j * 3 + i;
+			ullRegion = GetHostTimeUs();
+			ulFrames = 0;
+			// A region after the budget is left without a frame, so a slow camera does not delay the sequence.
+			if ( ullRegion >= ullEnd ) continue;
+			ullDeadline = ullRegion + ( ullEnd - ullRegion ) / ( 9 - ulRegion );
+			stPoint.x = wWholeWidth * ( 2 * i + 1 ) / 6;
+			stPoint.y = wWholeHeight * ( 2 * j + 1 ) / 6;
+			if ( Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_ContrastAFArea, kNkMAIDDataType_PointPtr, (NKPARAM)&stPoint, NULL, NULL ) == FALSE ) {
+				bRet = FALSE;
+				break;
+			}
+			// The zoom follows the focus point. The zoom is set again if it did not move.
+			if ( SetEnumUnsignedValue( pRefSrc, kNkMAIDCapability_LiveViewZoomArea, ulZoom ) == FALSE ) {
+				printf( "LiveViewZoomArea %u cannot be set.\n", (unsigned)ulZoom );
+				bRet = FALSE;
+				break;
+			}
+			// Half of the share of the region is waited before the zoom is set again.
+			ullNow = GetHostTimeUs();
+			if ( ullNow < ullDeadline )
+				pMap->bFresh[ulRegion] = WaitFocusMapFrame( pRefSrc, &stFrame, stPoint.x, stPoint.y, (ULONG)( ( ullDeadline - ullNow ) / 2000 ), &ulFrames );
+			if ( pMap->bFresh[ulRegion] == FALSE && GetHostTimeUs() < ullDeadline ) {
+				SetEnumUnsignedValue( pRefSrc, kNkMAIDCapability_LiveViewZoomArea, kNkMAIDLiveViewZoomArea_0 );
+				SetEnumUnsignedValue( pRefSrc, kNkMAIDCapability_LiveViewZoomArea, ulZoom );
+				ullNow = GetHostTimeUs();
+				if ( ullNow < ullDeadline )
+					pMap->bFresh[ulRegion] = WaitFocusMapFrame( pRefSrc, &stFrame, stPoint.x, stPoint.y, (ULONG)( ( ullDeadline - ullNow ) / 1000 ), &ulFrames );
+			}
+			pMap->ulFrames[ulRegion] = ulFrames;
+			if ( pMap->bFresh[ulRegion] == TRUE && MeasureSharpness( &stFrame, 1, &stLuma, &stSample ) == TRUE )
+				pMap->fScore[ulRegion] = stSample.fScore;
+			pMap->ulRegionTime[ulRegion] = (ULONG)( GetHostTimeUs() - ullRegion );
+		}
+	}
+
+	// restore the zoom and the focus point
+	if ( SetEnumUnsignedValue( pRefSrc, kNkMAIDCapability_LiveViewZoomArea, ulSavedZoom ) == FALSE ) bRet = FALSE;
+	if ( bSavedPoint == TRUE )
+		Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_ContrastAFArea, kNkMAIDDataType_PointPtr, (NKPARAM)&stSavedPoint, NULL, NULL );
+	pMap->ullTotalTime = GetHostTimeUs() - ullStart;
+	FreeJpegLuma( &stLuma );
+	free( stFrame.pucData );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Show the scores of the regions relative to the best one.
+void PrintFocusMap( LPFocusMap pMap )
+{
+	float fBest = 0.0f;
+	ULONG i, j, ulWeak = 0;
+
+	for ( i = 0; i < 9; i++ )
+		if ( pMap->fScore[i] > fBest ) fBest = pMap->fScore[i];
+	printf( "Focus map (percent of the best region):\n" );
+	for ( j = 0; j < 3; j++ ) {
+		for ( i = 0; i < 3; i++ ) {
+			ULONG ulRegion = j * 3 + i;
+			if ( pMap->bFresh[ulRegion] == FALSE ) {
+				printf( "    --" );
+				continue;
+			}
+			ULONG ulPercent = ( fBest > 0 ) ? (ULONG)( pMap->fScore[ulRegion] * 100 / fBest + 0.5f ) : 0;
+			if ( ulPercent < FOCUS_MAP_WEAK ) ulWeak++;
+			printf( "  %3u%%", (unsigned)ulPercent );
+		}
+		printf( "\n" );
+	}
+	for ( i = 0; i < 9; i++ )
+		printf( "Region %u: score %.1f, %u frames, %u msec%s\n", (unsigned)( i + 1 ), pMap->fScore[i], (unsigned)pMap->ulFrames[i],
+				(unsigned)( pMap->ulRegionTime[i] / 1000 ), pMap->bFresh[i] ? "" : " (no frame of the region)" );
+	printf( "The map took %llu msec of the budget of %d msec.\n", (unsigned long long)( pMap->ullTotalTime / 1000 ), FOCUS_MAP_BUDGET );
+	if ( ulWeak > 0 )
+		printf( "%u regions are under %d%% of the best one. Please check the focus.\n", (unsigned)ulWeak, FOCUS_MAP_WEAK );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Make the focus map with the zoom input by the user.
+BOOL FocusMapMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulZoom, ulSaved;
+	FocusMap	stMap;
+	BOOL	bRet;
+
+	printf( "Input LiveViewZoomArea (0: %d)\n>", FOCUS_MAP_ZOOM_DEFAULT );
+	scanf( "%s", buf );
+	ulZoom = atoi( buf );
+	if ( ulZoom == 0 ) ulZoom = FOCUS_MAP_ZOOM_DEFAULT;
+
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) return FALSE;
+	bRet = RunFocusMap( pRefSrc, ulZoom, &stMap );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+	if ( bRet == TRUE ) PrintFocusMap( &stMap );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Check the focus before a long sequence. The remote live view must be on. The sequence goes on even if the map failed.
+void CheckFocusBeforeSequence( LPRefObj pRefSrc )
+{
+	FocusMap	stMap;
+
+	printf( "Checking the focus...\n" );
+	if ( RunFocusMap( pRefSrc, FOCUS_MAP_ZOOM_DEFAULT, &stMap ) == TRUE )
+		PrintFocusMap( &stMap );
+	else
+		printf( "The focus could not be checked.\n" );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,279 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Intervalometer on a fixed grid.
+// The pictures are taken at ullStart + k * ullPeriod. Each point of the grid is an absolute time,
+// so the time spent in taking a picture or in the events is not added to the period, and the
+// error does not grow with the number of pictures.
+// Until INTERVAL_QUIET_US before a point, the events of the module are processed by Command_Async.
+// Then the thread sleeps until INTERVAL_SPIN_US before the point, and spins on the clock for the
+// rest, since a sleep of the system wakes up late by up to a tick. CaptureAsync is started on the
+// point without waiting for its completion, and the time it was started after the point is kept.
+// A point is overrun if the capture of the previous point has not completed at the quiet time, or
+// if the point passed by more than a period. kIntervalPolicy_Skip skips such points and stays on
+// the grid; kIntervalPolicy_CatchUp takes them late, back to back, until it is on the grid again.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+	#include <mmsystem.h>
+#elif defined(__APPLE__)
+	#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define INTERVAL_QUIET_US			20000		// no events are processed in the last 20 msec before a point
+#define INTERVAL_PUMP_US			10000		// Command_Async every 10 msec while waiting
+#if defined( _WIN32 )
+	#define INTERVAL_SPIN_US		2000		// a sleep may be late by a tick of 1 msec
+#elif defined(__APPLE__)
+	#define INTERVAL_SPIN_US		500
+#endif
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// sleep until the host time ullTime, in usec.
+void SleepUntilHostTime( NK_UINT_64 ullTime )
+{
+	std::this_thread::sleep_until( std::chrono::steady_clock::time_point( std::chrono::microseconds( ullTime ) ) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Prepare the intervalometer for ulShots pictures every ullPeriod usec. The grid starts after ullDelay usec.
+BOOL InitIntervalometer( LPIntervalometer pInterval, NK_UINT_64 ullPeriod, ULONG ulShots, ULONG ulPolicy, NK_UINT_64 ullDelay )
+{
+	memset( pInterval, 0, sizeof(Intervalometer) );
+	if ( ullPeriod < (NK_UINT_64)INTERVAL_PERIOD_MIN * 1000 || ulShots == 0 || ulShots > INTERVAL_SHOTS_MAX ) return FALSE;
+	pInterval->plLate = (SLONG*)malloc( ulShots * sizeof(SLONG) );
+	if ( pInterval->plLate == NULL ) return FALSE;
+	pInterval->ullPeriod = ullPeriod;
+	pInterval->ulShots = ulShots;
+	pInterval->ulPolicy = ( ulPolicy == kIntervalPolicy_CatchUp ) ? kIntervalPolicy_CatchUp : kIntervalPolicy_Skip;
+	pInterval->ullDelay = ullDelay;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the buffer of the intervalometer and close its log.
+void FreeIntervalometer( LPIntervalometer pInterval )
+{
+	free( pInterval->plLate );
+	pInterval->plLate = NULL;
+	if ( pInterval->pLog != NULL ) fclose( pInterval->pLog );
+	pInterval->pLog = NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Wait for the point at ullDeadline. The events are processed until the quiet time. Returns FALSE if it was canceled.
+BOOL WaitIntervalPoint( LPRefObj pRefSrc, NK_UINT_64 ullDeadline )
+{
+	NK_UINT_64 ullNow = GetHostTimeUs();
+
+	while ( g_bCancel == FALSE && ullNow + INTERVAL_QUIET_US < ullDeadline ) {
+		Command_Async( pRefSrc->pObject );
+		ullNow = GetHostTimeUs();
+		if ( ullNow + INTERVAL_QUIET_US >= ullDeadline ) break;
+		SleepUntilHostTime( ( ullNow + INTERVAL_PUMP_US < ullDeadline - INTERVAL_QUIET_US ) ? ullNow + INTERVAL_PUMP_US : ullDeadline - INTERVAL_QUIET_US );
+		ullNow = GetHostTimeUs();
+	}
+	if ( g_bCancel == TRUE ) return FALSE;
+	if ( ullNow + INTERVAL_SPIN_US < ullDeadline ) SleepUntilHostTime( ullDeadline - INTERVAL_SPIN_US );
+	while ( GetHostTimeUs() < ullDeadline )
+		;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Wait for the completion of the captures started so far. Returns FALSE if it was canceled.
+BOOL WaitIntervalCompletion( LPRefObj pRefSrc, LPIntervalometer pInterval )
+{
+	while ( g_bCancel == FALSE && pInterval->ulCompleted < pInterval->ulFired ) {
+		Command_Async( pRefSrc->pObject );
+		std::this_thread::sleep_for( std::chrono::microseconds( INTERVAL_PUMP_US / 10 ) );
+	}
+	return ( g_bCancel == FALSE );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Start CaptureAsync for the point at ullDeadline, and record how late it was started.
+BOOL FireIntervalPoint( LPRefObj pRefSrc, LPIntervalometer pInterval, ULONG ulPoint, NK_UINT_64 ullDeadline )
+{
+	NK_UINT_64 ullFired, ullIssued;
+	BOOL bRet;
+
+	ullFired = GetHostTimeUs();
+	bRet = StartCaptureAsync( pRefSrc, &pInterval->ulCompleted );
+	ullIssued = GetHostTimeUs();
+	if ( bRet == FALSE ) {
+		pInterval->ulErrors++;
+		return FALSE;
+	}
+	pInterval->plLate[pInterval->ulFired] = (SLONG)( ullFired - ullDeadline );
+	pInterval->ulFired++;
+	pInterval->ullIssueTotal += ullIssued - ullFired;
+	if ( ullIssued - ullFired > pInterval->ullIssueMax ) pInterval->ullIssueMax = ullIssued - ullFired;
+	if ( pInterval->pLog != NULL )
+		fprintf( pInterval->pLog, "%u,%u,%llu,%llu,%lld,%llu\n", (unsigned)pInterval->ulFired, (unsigned)ulPoint,
+				(unsigned long long)( ullDeadline - pInterval->ullStart ), (unsigned long long)( ullFired - pInterval->ullStart ),
+				(long long)( ullFired - ullDeadline ), (unsigned long long)( ullIssued - ullFired ) );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the pictures on the grid until all are taken or it is canceled.
+// A picture that could not be started is counted as an error, and its point is not taken again.
+// Returns FALSE if it was canceled or no picture could be started.
+BOOL RunIntervalometer( LPRefObj pRefSrc, LPIntervalometer pInterval )
+{
+	NK_UINT_64 ullDeadline, ullNow;
+	ULONG ulPoint = 0, ulNext;
+
+#if defined( _WIN32 )
+	// The sleeps of the system are made precise to 1 msec during the run.
+	timeBeginPeriod( 1 );
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+
+	pInterval->ullStart = GetHostTimeUs() + pInterval->ullDelay;
+	while ( g_bCancel == FALSE && pInterval->ulFired + pInterval->ulErrors < pInterval->ulShots ) {
+		ullDeadline = pInterval->ullStart + ulPoint * pInterval->ullPeriod;
+		if ( WaitIntervalPoint( pRefSrc, ullDeadline ) == FALSE ) break;
+		ullNow = GetHostTimeUs();
+
+		// The capture of the previous point is still running.
+		if ( pInterval->ulCompleted < pInterval->ulFired ) {
+			pInterval->ulOverruns++;
+			if ( pInterval->ulPolicy == kIntervalPolicy_Skip ) {
+				pInterval->ulSkipped++;
+				ulPoint++;
+				continue;
+			}
+			if ( WaitIntervalCompletion( pRefSrc, pInterval ) == FALSE ) break;
+		} else if ( ullNow >= ullDeadline + pInterval->ullPeriod ) {
+			// The point passed by more than a period.
+			pInterval->ulOverruns++;
+			if ( pInterval->ulPolicy == kIntervalPolicy_Skip ) {
+				ulNext = (ULONG)( ( ullNow - pInterval->ullStart ) / pInterval->ullPeriod ) + 1;
+				pInterval->ulSkipped += ulNext - ulPoint;
+				ulPoint = ulNext;
+				continue;
+			}
+		}
+		FireIntervalPoint( pRefSrc, pInterval, ulPoint, ullDeadline );
+		ulPoint++;
+	}
+	IdleLoop( pRefSrc->pObject, &pInterval->ulCompleted, pInterval->ulFired );
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+	timeEndPeriod( 1 );
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	pInterval->bCanceled = g_bCancel;
+	g_bCancel = FALSE;
+	return ( pInterval->bCanceled == FALSE && pInterval->ulFired > 0 ) ? TRUE : FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+int CompareIntervalLate( const void* p1, const void* p2 )
+{
+	SLONG l1 = *(const SLONG*)p1, l2 = *(const SLONG*)p2;
+	return ( l1 < l2 ) ? -1 : ( l1 > l2 ) ? 1 : 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// compute the statistics of the time each picture was started after its point.
+void GetIntervalStats( LPIntervalometer pInterval, LPIntervalStats pStats )
+{
+	SLONG* plSorted;
+	double dSum = 0, dSquare = 0;
+	ULONG i, ulCount = pInterval->ulFired;
+
+	memset( pStats, 0, sizeof(IntervalStats) );
+	pStats->ulFired = ulCount;
+	pStats->ulSkipped = pInterval->ulSkipped;
+	pStats->ulOverruns = pInterval->ulOverruns;
+	pStats->ulErrors = pInterval->ulErrors;
+	if ( ulCount == 0 ) return;
+
+	for ( i = 0; i < ulCount; i++ ) {
+		dSum += pInterval->plLate[i];
+		dSquare += (double)pInterval->plLate[i] * pInterval->plLate[i];
+	}
+	pStats->dLateMean = dSum / ulCount;
+	pStats->dLateStdDev = sqrt( fmax( dSquare / ulCount - pStats->dLateMean * pStats->dLateMean, 0.0 ) );
+	pStats->dIssueMean = (double)pInterval->ullIssueTotal / ulCount;
+	pStats->ullIssueMax = pInterval->ullIssueMax;
+
+	plSorted = (SLONG*)malloc( ulCount * sizeof(SLONG) );
+	if ( plSorted == NULL ) return;
+	memcpy( plSorted, pInterval->plLate, ulCount * sizeof(SLONG) );
+	qsort( plSorted, ulCount, sizeof(SLONG), CompareIntervalLate );
+	pStats->lLateMin = plSorted[0];
+	pStats->lLateMedian = plSorted[ulCount / 2];
+	pStats->lLateP99 = plSorted[( ulCount * 99 + 99 ) / 100 - 1];		// nearest rank
+	pStats->lLateMax = plSorted[ulCount - 1];
+	free( plSorted );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// print the statistics of the intervalometer.
+void PrintIntervalStats( LPIntervalStats pStats )
+{
+	printf( "%u shots, %u points skipped, %u overruns, %u errors\n", (unsigned)pStats->ulFired, (unsigned)pStats->ulSkipped,
+			(unsigned)pStats->ulOverruns, (unsigned)pStats->ulErrors );
+	if ( pStats->ulFired == 0 ) return;
+	printf( "Late after the point: mean %.1f usec, sd %.1f, min %d, median %d, p99 %d, max %d\n",
+			pStats->dLateMean, pStats->dLateStdDev, (int)pStats->lLateMin, (int)pStats->lLateMedian, (int)pStats->lLateP99, (int)pStats->lLateMax );
+	printf( "Starting CaptureAsync: mean %.1f usec, max %llu\n", pStats->dIssueMean, (unsigned long long)pStats->ullIssueMax );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the pictures on a grid set by the user.
+BOOL IntervalometerMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulPeriod, ulShots, ulPolicy, ulDelay;
+	Intervalometer	stInterval;
+	IntervalStats	stStats;
+	BOOL	bRet;
+
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_CaptureAsync, kNkMAIDCapOperation_Start ) ) {
+		printf( "This camera does not support CaptureAsync.\n" );
+		return TRUE;
+	}
+	printf( "Input the period in msec, including the exposure (%d-3600000)\n>", INTERVAL_PERIOD_MIN );
+	scanf( "%s", buf );
+	ulPeriod = atoi( buf );
+	if ( ulPeriod < INTERVAL_PERIOD_MIN || ulPeriod > 3600000 ) ulPeriod = 10000;
+	printf( "Input the number of shots (1-%d)\n>", INTERVAL_SHOTS_MAX );
+	scanf( "%s", buf );
+	ulShots = atoi( buf );
+	if ( ulShots == 0 || ulShots > INTERVAL_SHOTS_MAX ) ulShots = 1;
+	printf( "Select the policy on an overrun (1: Skip the point, 2: Catch up)\n>" );
+	scanf( "%s", buf );
+	ulPolicy = atoi( buf );
+	printf( "Input the delay before the first shot in seconds (0-3600)\n>" );
+	scanf( "%s", buf );
+	ulDelay = atoi( buf );
+	if ( ulDelay > 3600 ) ulDelay = 0;
+
+	if ( InitIntervalometer( &stInterval, (NK_UINT_64)ulPeriod * 1000, ulShots, ulPolicy, (NK_UINT_64)ulDelay * 1000000 ) == FALSE ) return FALSE;
+	stInterval.pLog = fopen( "Interval.csv", "w" );
+	if ( stInterval.pLog != NULL )
+		fprintf( stInterval.pLog, "shot,point,point_us,fired_us,late_us,issue_us\n" );
+
+	printf( "Taking %u pictures every %u msec (%s). Please press the Ctrl+C to stop.\n", (unsigned)ulShots, (unsigned)ulPeriod,
+			( stInterval.ulPolicy == kIntervalPolicy_Skip ) ? "skip" : "catch up" );
+	bRet = RunIntervalometer( pRefSrc, &stInterval );
+	GetIntervalStats( &stInterval, &stStats );
+	PrintIntervalStats( &stStats );
+	FreeIntervalometer( &stInterval );
+	return bRet;
+}
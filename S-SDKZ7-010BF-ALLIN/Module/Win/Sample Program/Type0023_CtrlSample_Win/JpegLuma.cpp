@@ -0,0 +1,466 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Luma decoder for the live view JPEG.
+// Only the Y component of a baseline JPEG is reconstructed, and only at a reduced scale: a block of
+// 8x8 pixels becomes N x N pixels (N = 1, 2, 4 or 8) by a reduced inverse DCT of its lowest N x N
+// coefficients. N = 1 is the DC coefficient alone, so no inverse DCT is done at all. The chroma
+// blocks are entropy decoded to keep the position in the stream, and are thrown away.
+// The output buffer belongs to the JpegLuma structure and is reused for the later frames.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define JPEG_FAST_BITS		9
+
+typedef struct tagJpegHuffman
+{
+	UWORD	wFast[1 << JPEG_FAST_BITS];	// (length << 8) | symbol, 0 if the code is longer
+	SLONG	lMaxCode[18];
+	SLONG	lValPtr[17];
+	SLONG	lMinCode[17];
+	UCHAR	ucValues[256];
+} JpegHuffman, *LPJpegHuffman;
+
+typedef struct tagJpegComponent
+{
+	UCHAR	ucID;
+	UCHAR	ucH;
+	UCHAR	ucV;
+	UCHAR	ucTq;
+	UCHAR	ucTd;
+	UCHAR	ucTa;
+	SLONG	lPred;
+} JpegComponent, *LPJpegComponent;
+
+typedef struct tagJpegBits
+{
+	const UCHAR*	p;
+	const UCHAR*	pEnd;
+	ULONG	ulBits;					// MSB aligned
+	SLONG	lCount;
+	BOOL	bMarker;					// TRUE if a marker was reached
+} JpegBits, *LPJpegBits;
+
+typedef struct tagJpegDecoder
+{
+	UWORD	wQuant[4][64];			// in zigzag order
+	JpegHuffman	stHuff[2][4];			// [0] DC, [1] AC
+	JpegComponent	stComp[4];
+	ULONG	ulComponents;
+	UWORD	wWidth;
+	UWORD	wHeight;
+	ULONG	ulRestart;
+	JpegBits	stBits;
+} JpegDecoder, *LPJpegDecoder;
+
+static const UCHAR g_ucZigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+static float g_fIdct[4][8][8];		// [log2 N][x][u]
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// make the tables of the reduced inverse DCT. This is done once before main, so the decoding threads only read them.
+static BOOL InitJpegIdct( void )
+{
+	ULONG ulLog, x, u, n;
+	for ( ulLog = 0; ulLog < 4; ulLog++ ) {
+		n = 1 << ulLog;
+		for ( x = 0; x < n; x++ )
+			for ( u = 0; u < n; u++ )
+				g_fIdct[ulLog][x][u] = (float)( (u == 0 ? sqrt( 0.5 ) : 1.0) / 2.0 * cos( (2 * x + 1) * u * 3.14159265358979 / (2 * n) ) );
+	}
+	return TRUE;
+}
+static BOOL g_bIdctReady = InitJpegIdct();
+//------------------------------------------------------------------------------------------------------------------------------------
+// build the decoding tables from the code counts and the symbols
+static BOOL BuildJpegHuffman( LPJpegHuffman pHuff, const UCHAR* pucCounts, const UCHAR* pucSymbols, ULONG ulSymbols )
+{
+	SLONG lCode = 0, lIndex = 0;
+	ULONG ulLength, i;
+
+	if ( ulSymbols > 256 ) return FALSE;
+	memset( pHuff, 0, sizeof(JpegHuffman) );
+	memcpy( pHuff->ucValues, pucSymbols, ulSymbols );
+	for ( ulLength = 1; ulLength <= 16; ulLength++ ) {
+		ULONG ulCount = pucCounts[ulLength - 1];
+		pHuff->lValPtr[ulLength] = lIndex;
+		pHuff->lMinCode[ulLength] = lCode;
+		for ( i = 0; i < ulCount; i++, lIndex++, lCode++ ) {
+			if ( ulLength <= JPEG_FAST_BITS ) {
+				ULONG ulFill = 1 << (JPEG_FAST_BITS - ulLength);
+				ULONG ulFirst = (ULONG)lCode << (JPEG_FAST_BITS - ulLength);
+				ULONG j;
+				for ( j = 0; j < ulFill; j++ )
+					pHuff->wFast[ulFirst + j] = (UWORD)( (ulLength << 8) | pucSymbols[lIndex] );
+			}
+		}
+		pHuff->lMaxCode[ulLength] = ( ulCount > 0 ) ? lCode - 1 : -1;
+		lCode <<= 1;
+	}
+	pHuff->lMaxCode[17] = 0x7FFFFFFF;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// keep at least 25 bits in the bit buffer. Zeros are fed after a marker.
+static void FillJpegBits( LPJpegBits pBits )
+{
+	while ( pBits->lCount <= 24 ) {
+		ULONG ulByte = 0;
+		if ( pBits->bMarker == FALSE && pBits->p < pBits->pEnd ) {
+			ulByte = *pBits->p;
+			if ( ulByte == 0xFF ) {
+				UCHAR ucNext = ( pBits->p + 1 < pBits->pEnd ) ? pBits->p[1] : 0xD9;
+				if ( ucNext == 0x00 ) {
+					pBits->p += 2;
+				} else {
+					pBits->bMarker = TRUE;
+					ulByte = 0;
+				}
+			} else {
+				pBits->p++;
+			}
+		}
+		pBits->ulBits |= ulByte << (24 - pBits->lCount);
+		pBits->lCount += 8;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// decode a Huffman symbol. Returns -1 for a bad code.
+static SLONG DecodeJpegHuffman( LPJpegBits pBits, LPJpegHuffman pHuff )
+{
+	ULONG ulEntry, ulLength;
+
+	FillJpegBits( pBits );
+	ulEntry = pHuff->wFast[pBits->ulBits >> (32 - JPEG_FAST_BITS)];
+	if ( ulEntry != 0 ) {
+		ulLength = ulEntry >> 8;
+		pBits->ulBits <<= ulLength;
+		pBits->lCount -= ulLength;
+		return (SLONG)(ulEntry & 0xFF);
+	}
+	for ( ulLength = JPEG_FAST_BITS + 1; ulLength <= 16; ulLength++ ) {
+		SLONG lCode = (SLONG)(pBits->ulBits >> (32 - ulLength));
+		if ( lCode <= pHuff->lMaxCode[ulLength] ) {
+			pBits->ulBits <<= ulLength;
+			pBits->lCount -= ulLength;
+			return pHuff->ucValues[pHuff->lValPtr[ulLength] + lCode - pHuff->lMinCode[ulLength]];
+		}
+	}
+	return -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// read ulSize bits and extend the sign
+static SLONG ReceiveJpegBits( LPJpegBits pBits, ULONG ulSize )
+{
+	SLONG lValue;
+
+	if ( ulSize == 0 ) return 0;
+	FillJpegBits( pBits );
+	lValue = (SLONG)(pBits->ulBits >> (32 - ulSize));
+	pBits->ulBits <<= ulSize;
+	pBits->lCount -= ulSize;
+	if ( lValue < (1L << (ulSize - 1)) )
+		lValue -= (1L << ulSize) - 1;
+	return lValue;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// decode a block. The dequantized coefficients are stored in natural order if plCoef is not NULL.
+static BOOL DecodeJpegBlock( LPJpegDecoder pDec, LPJpegComponent pComp, SLONG* plCoef )
+{
+	LPJpegBits pBits = &pDec->stBits;
+	const UWORD* pwQuant = pDec->wQuant[pComp->ucTq];
+	SLONG lSymbol, lRun, lSize;
+	ULONG k;
+
+	lSymbol = DecodeJpegHuffman( pBits, &pDec->stHuff[0][pComp->ucTd] );
+	if ( lSymbol < 0 || lSymbol > 11 ) return FALSE;
+	pComp->lPred += ReceiveJpegBits( pBits, (ULONG)lSymbol );
+	if ( plCoef != NULL ) {
+		memset( plCoef, 0, 64 * sizeof(SLONG) );
+		plCoef[0] = pComp->lPred * pwQuant[0];
+	}
+	for ( k = 1; k < 64; ) {
+		lSymbol = DecodeJpegHuffman( pBits, &pDec->stHuff[1][pComp->ucTa] );
+		if ( lSymbol < 0 ) return FALSE;
+		lRun = lSymbol >> 4;
+		lSize = lSymbol & 0x0F;
+		if ( lSize == 0 ) {
+			if ( lRun != 15 ) break;			// end of block
+			k += 16;
+			continue;
+		}
+		k += lRun;
+		if ( k > 63 ) return FALSE;
+		if ( plCoef != NULL )
+			plCoef[g_ucZigzag[k]] = ReceiveJpegBits( pBits, (ULONG)lSize ) * pwQuant[k];
+		else
+			ReceiveJpegBits( pBits, (ULONG)lSize );
+		k++;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// reconstruct N x N pixels of a block into the luma plane
+static void PutJpegBlock( const SLONG* plCoef, ULONG ulLog, UCHAR* pucOut, ULONG ulStride )
+{
+	ULONG n = 1 << ulLog;
+	float fTmp[8][8];
+	ULONG x, y, u, v;
+
+	if ( n == 1 ) {
+		SLONG lValue = 128 + ( (plCoef[0] + (plCoef[0] >= 0 ? 4 : -4)) / 8 );
+		*pucOut = (UCHAR)( lValue < 0 ? 0 : (lValue > 255 ? 255 : lValue) );
+		return;
+	}
+	// rows, then columns
+	for ( v = 0; v < n; v++ ) {
+		for ( x = 0; x < n; x++ ) {
+			float fSum = 0.0f;
+			for ( u = 0; u < n; u++ )
+				fSum += g_fIdct[ulLog][x][u] * (float)plCoef[v * 8 + u];
+			fTmp[v][x] = fSum;
+		}
+	}
+	for ( y = 0; y < n; y++ ) {
+		for ( x = 0; x < n; x++ ) {
+			float fSum = 128.5f;
+			for ( v = 0; v < n; v++ )
+				fSum += g_fIdct[ulLog][y][v] * fTmp[v][x];
+			pucOut[y * ulStride + x] = (UCHAR)( fSum < 0.0f ? 0 : (fSum > 255.0f ? 255 : (SLONG)fSum) );
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// skip the restart marker, and reset the predictions
+static BOOL RestartJpeg( LPJpegDecoder pDec )
+{
+	LPJpegBits pBits = &pDec->stBits;
+	ULONG i;
+
+	pBits->ulBits = 0;
+	pBits->lCount = 0;
+	pBits->bMarker = FALSE;
+	while ( pBits->p + 1 < pBits->pEnd && !(pBits->p[0] == 0xFF && pBits->p[1] >= 0xD0 && pBits->p[1] <= 0xD7) )
+		pBits->p++;
+	if ( pBits->p + 1 >= pBits->pEnd ) return FALSE;
+	pBits->p += 2;
+	for ( i = 0; i < pDec->ulComponents; i++ )
+		pDec->stComp[i].lPred = 0;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// decode the scan
+static BOOL DecodeJpegScan( LPJpegDecoder pDec, LPJpegComponent* ppScan, ULONG ulScan, ULONG ulLog, LPJpegLuma pLuma )
+{
+	ULONG ulHmax = 1, ulVmax = 1, ulMcuX, ulMcuY, mx, my, i, h, v;
+	ULONG ulMcus = 0, n = 1 << ulLog;
+	SLONG lCoef[64];
+	LPJpegComponent pY = &pDec->stComp[0];
+
+	for ( i = 0; i < pDec->ulComponents; i++ ) {
+		if ( pDec->stComp[i].ucH > ulHmax ) ulHmax = pDec->stComp[i].ucH;
+		if ( pDec->stComp[i].ucV > ulVmax ) ulVmax = pDec->stComp[i].ucV;
+	}
+	if ( ulScan == 1 ) {
+		// A scan of one component has no MCU of several blocks. The caller passes the luma only.
+		ulMcuX = ( ((ULONG)pDec->wWidth * pY->ucH + ulHmax - 1) / ulHmax + 7 ) / 8;
+		ulMcuY = ( ((ULONG)pDec->wHeight * pY->ucV + ulVmax - 1) / ulVmax + 7 ) / 8;
+	} else {
+		ulMcuX = ( pDec->wWidth + 8 * ulHmax - 1 ) / (8 * ulHmax);
+		ulMcuY = ( pDec->wHeight + 8 * ulVmax - 1 ) / (8 * ulVmax);
+	}
+
+	for ( my = 0; my < ulMcuY; my++ ) {
+		for ( mx = 0; mx < ulMcuX; mx++ ) {
+			if ( pDec->ulRestart > 0 && ulMcus > 0 && ulMcus % pDec->ulRestart == 0 ) {
+				if ( RestartJpeg( pDec ) == FALSE ) return FALSE;
+			}
+			ulMcus++;
+			if ( ulScan == 1 ) {
+				if ( DecodeJpegBlock( pDec, pY, lCoef ) == FALSE ) return FALSE;
+				PutJpegBlock( lCoef, ulLog, pLuma->pucLuma + my * n * pLuma->ulStride + mx * n, pLuma->ulStride );
+				continue;
+			}
+			for ( i = 0; i < ulScan; i++ ) {
+				LPJpegComponent pComp = ppScan[i];
+				for ( v = 0; v < pComp->ucV; v++ ) {
+					for ( h = 0; h < pComp->ucH; h++ ) {
+						if ( pComp != pY ) {
+							if ( DecodeJpegBlock( pDec, pComp, NULL ) == FALSE ) return FALSE;
+							continue;
+						}
+						if ( DecodeJpegBlock( pDec, pComp, lCoef ) == FALSE ) return FALSE;
+						PutJpegBlock( lCoef, ulLog,
+										pLuma->pucLuma + ((my * pY->ucV + v) * n) * pLuma->ulStride + (mx * pY->ucH + h) * n,
+										pLuma->ulStride );
+					}
+				}
+			}
+		}
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Decode the luma of a baseline JPEG at 1/ulScale of its size. ulScale is 1, 2, 4 or 8.
+BOOL DecodeJpegLuma( const unsigned char* pucJpeg, ULONG ulSize, ULONG ulScale, LPJpegLuma pLuma )
+{
+	LPJpegDecoder pDec;
+	const UCHAR* p = pucJpeg;
+	const UCHAR* pEnd = pucJpeg + ulSize;
+	ULONG ulLog, ulLength, i, j;
+	BOOL bFrame = FALSE;
+
+	if ( ulScale == 8 ) ulLog = 0;
+	else if ( ulScale == 4 ) ulLog = 1;
+	else if ( ulScale == 2 ) ulLog = 2;
+	else if ( ulScale == 1 ) ulLog = 3;
+	else return FALSE;
+	if ( ulSize < 4 || p[0] != 0xFF || p[1] != 0xD8 ) return FALSE;
+
+	// The decoder tables are large, so a decoder is kept for each thread which decodes.
+	pDec = (LPJpegDecoder)pLuma->pDecoder;
+	if ( pDec == NULL ) {
+		pDec = (LPJpegDecoder)malloc( sizeof(JpegDecoder) );
+		if ( pDec == NULL ) return FALSE;
+		pLuma->pDecoder = pDec;
+	}
+	memset( pDec, 0, sizeof(JpegDecoder) );
+	p += 2;
+
+	while ( p + 4 <= pEnd ) {
+		UCHAR ucMarker;
+		if ( p[0] != 0xFF ) { p++; continue; }
+		ucMarker = p[1];
+		if ( ucMarker == 0xFF ) { p++; continue; }
+		if ( ucMarker == 0xD8 || (ucMarker >= 0xD0 && ucMarker <= 0xD7) ) { p += 2; continue; }
+		if ( ucMarker == 0xD9 ) break;
+		ulLength = ( (ULONG)p[2] << 8 ) | p[3];
+		if ( ulLength < 2 || p + 2 + ulLength > pEnd ) return FALSE;
+		const UCHAR* pSeg = p + 4;
+		const UCHAR* pSegEnd = p + 2 + ulLength;
+
+		switch ( ucMarker ) {
+			case 0xDB:// DQT
+				while ( pSeg < pSegEnd ) {
+					ULONG ulPq = pSeg[0] >> 4, ulTq = pSeg[0] & 3;
+					pSeg++;
+					if ( pSeg + ( ulPq ? 128 : 64 ) > pSegEnd ) return FALSE;
+					for ( i = 0; i < 64; i++ ) {
+						if ( ulPq == 0 ) pDec->wQuant[ulTq][i] = *pSeg++;
+						else { pDec->wQuant[ulTq][i] = (UWORD)( (pSeg[0] << 8) | pSeg[1] ); pSeg += 2; }
+					}
+				}
+				break;
+			case 0xC0:// SOF0 baseline
+			case 0xC1:// SOF1 extended sequential, Huffman
+				if ( pSeg[0] != 8 ) return FALSE;
+				pDec->wHeight = (UWORD)( (pSeg[1] << 8) | pSeg[2] );
+				pDec->wWidth = (UWORD)( (pSeg[3] << 8) | pSeg[4] );
+				pDec->ulComponents = pSeg[5];
+				if ( pDec->ulComponents == 0 || pDec->ulComponents > 4 || pDec->wWidth == 0 || pDec->wHeight == 0 ) return FALSE;
+				for ( i = 0; i < pDec->ulComponents; i++ ) {
+					pDec->stComp[i].ucID = pSeg[6 + i * 3];
+					pDec->stComp[i].ucH = pSeg[7 + i * 3] >> 4;
+					pDec->stComp[i].ucV = pSeg[7 + i * 3] & 0x0F;
+					pDec->stComp[i].ucTq = pSeg[8 + i * 3] & 3;
+					if ( pDec->stComp[i].ucH == 0 || pDec->stComp[i].ucV == 0 ) return FALSE;
+				}
+				bFrame = TRUE;
+				break;
+			case 0xC2:// progressive and the others are not used by the live view
+			case 0xC3:
+			case 0xC5: case 0xC6: case 0xC7:
+			case 0xC9: case 0xCA: case 0xCB:
+			case 0xCD: case 0xCE: case 0xCF:
+				return FALSE;
+			case 0xC4:// DHT
+				while ( pSeg + 17 <= pSegEnd ) {
+					ULONG ulTc = pSeg[0] >> 4, ulTh = pSeg[0] & 3, ulSymbols = 0;
+					for ( i = 0; i < 16; i++ ) ulSymbols += pSeg[1 + i];
+					if ( ulTc > 1 || pSeg + 17 + ulSymbols > pSegEnd ) return FALSE;
+					if ( BuildJpegHuffman( &pDec->stHuff[ulTc][ulTh], pSeg + 1, pSeg + 17, ulSymbols ) == FALSE ) return FALSE;
+					pSeg += 17 + ulSymbols;
+				}
+				break;
+			case 0xDD:// DRI
+				pDec->ulRestart = ( (ULONG)pSeg[0] << 8 ) | pSeg[1];
+				break;
+			case 0xDA:// SOS
+			{
+				LPJpegComponent pScan[4];
+				ULONG ulScan = pSeg[0];
+				ULONG ulWidth, ulHeight, ulHmax = 1, ulVmax = 1;
+				BOOL bLuma = FALSE;
+				if ( bFrame == FALSE || ulScan == 0 || ulScan > pDec->ulComponents ) return FALSE;
+				for ( i = 0; i < ulScan; i++ ) {
+					pScan[i] = NULL;
+					for ( j = 0; j < pDec->ulComponents; j++ ) {
+						if ( pDec->stComp[j].ucID == pSeg[1 + i * 2] ) pScan[i] = &pDec->stComp[j];
+					}
+					if ( pScan[i] == NULL || ( pSeg[2 + i * 2] >> 4 ) > 3 ) return FALSE;
+					pScan[i]->ucTd = pSeg[2 + i * 2] >> 4;
+					pScan[i]->ucTa = pSeg[2 + i * 2] & 3;
+					pScan[i]->lPred = 0;
+					if ( pScan[i] == &pDec->stComp[0] ) bLuma = TRUE;
+				}
+				if ( bLuma == FALSE ) {
+					// A scan of the chroma only is passed over up to the next marker which is not a restart.
+					p = pSegEnd;
+					while ( p + 1 < pEnd && ( p[0] != 0xFF || p[1] == 0x00 || p[1] == 0xFF || (p[1] >= 0xD0 && p[1] <= 0xD7) ) ) p++;
+					continue;
+				}
+				// The output covers whole blocks of the luma.
+				for ( i = 0; i < pDec->ulComponents; i++ ) {
+					if ( pDec->stComp[i].ucH > ulHmax ) ulHmax = pDec->stComp[i].ucH;
+					if ( pDec->stComp[i].ucV > ulVmax ) ulVmax = pDec->stComp[i].ucV;
+				}
+				ulWidth = ( (pDec->wWidth + 8 * ulHmax - 1) / (8 * ulHmax) ) * pDec->stComp[0].ucH << ulLog;
+				ulHeight = ( (pDec->wHeight + 8 * ulVmax - 1) / (8 * ulVmax) ) * pDec->stComp[0].ucV << ulLog;
+				if ( ulWidth * ulHeight > pLuma->ulCapacity ) {
+					UCHAR* pucLuma = (UCHAR*)realloc( pLuma->pucLuma, ulWidth * ulHeight );
+					if ( pucLuma == NULL ) return FALSE;
+					pLuma->pucLuma = pucLuma;
+					pLuma->ulCapacity = ulWidth * ulHeight;
+				}
+				pLuma->ulStride = ulWidth;
+				pLuma->wWidth = (UWORD)( ((ULONG)pDec->wWidth * pDec->stComp[0].ucH / ulHmax * (1 << ulLog) + 7) / 8 );
+				pLuma->wHeight = (UWORD)( ((ULONG)pDec->wHeight * pDec->stComp[0].ucV / ulVmax * (1 << ulLog) + 7) / 8 );
+				pLuma->ulScale = ulScale;
+
+				pDec->stBits.p = pSegEnd;
+				pDec->stBits.pEnd = pEnd;
+				pDec->stBits.ulBits = 0;
+				pDec->stBits.lCount = 0;
+				pDec->stBits.bMarker = FALSE;
+				if ( DecodeJpegScan( pDec, pScan, ulScan, ulLog, pLuma ) == FALSE ) return FALSE;
+				// The luma is complete after the first scan which has it; the chroma scans after it are not needed.
+				return TRUE;
+			}
+			default:
+				break;
+		}
+		p += 2 + ulLength;
+	}
+	return FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the buffers of the luma
+void FreeJpegLuma( LPJpegLuma pLuma )
+{
+	free( pLuma->pucLuma );
+	free( pLuma->pDecoder );
+	memset( pLuma, 0, sizeof(JpegLuma) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,433 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Continuous live view.
+// RunLiveView polls kNkMAIDCapability_GetLiveViewImage at a target rate on the calling thread, so
+// all MAID commands stay on one thread. Each image is read into a buffer of a small ring, and the
+// buffers are reused for the later frames. A published frame has a sequence number and the host
+// time when it arrived.
+// Consumers run on their own threads and always take the latest frame. The frames a consumer was
+// too slow to take are counted as dropped for that consumer. A control procedure is called on
+// the polling thread after every frame, and may issue MAID commands.
+// A caller that polls by itself, such as the nkmaid Python module, grabs one frame at a time. The
+// grabbed frame is published like the others, and its buffer is held until the caller releases it.
+
+#if defined( _WIN32 )
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <signal.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define LIVEVIEW_RING_COUNT		(LIVEVIEW_CONSUMER_MAX + 2)	// a frame per consumer, the latest one and the one being read
+
+typedef struct tagLiveViewSlot
+{
+	LiveViewFrame	stFrame;
+	ULONG	ulRef;					// number of consumers using the frame
+	BOOL	bWriting;				// TRUE while the frame is being read from the camera
+} LiveViewSlot, *LPLiveViewSlot;
+
+typedef struct tagLiveViewConsumerEntry
+{
+	BOOL	bUsed;
+	BOOL	bStop;
+	char	szName[32];
+	LPLiveViewProc	pfnFrame;
+	LPVOID	pContext;
+	NK_UINT_64	ullLastSeq;
+	NK_UINT_64	ullFrames;
+	NK_UINT_64	ullDropped;
+	std::thread	Thread;
+} LiveViewConsumerEntry, *LPLiveViewConsumerEntry;
+
+LiveViewSlot	g_stLiveViewRing[LIVEVIEW_RING_COUNT];
+LiveViewConsumerEntry	g_stLiveViewConsumer[LIVEVIEW_CONSUMER_MAX];
+SLONG	g_lLiveViewLatest = -1;		// index of the slot of the latest frame
+NK_UINT_64	g_ullLiveViewSeq = 0;		// sequence number of the latest frame
+LiveViewStats	g_stLiveViewStats;
+std::mutex	g_LiveViewMutex;
+std::condition_variable	g_LiveViewCond;	// signaled when a frame was published
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// monotonic time in usec
+NK_UINT_64 GetHostTimeUs( void )
+{
+	return (NK_UINT_64)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// loop of a consumer thread
+void LiveViewConsumerLoop( LPLiveViewConsumerEntry pEntry )
+{
+	LPLiveViewSlot pSlot;
+
+	std::unique_lock<std::mutex> lock( g_LiveViewMutex );
+	while ( 1 ) {
+		while ( pEntry->bStop == FALSE && (g_lLiveViewLatest < 0 || g_ullLiveViewSeq <= pEntry->ullLastSeq) )
+			g_LiveViewCond.wait( lock );
+		if ( pEntry->bStop == TRUE ) break;
+
+		pSlot = &g_stLiveViewRing[g_lLiveViewLatest];
+		pSlot->ulRef++;
+		if ( pEntry->ullLastSeq != 0 && pSlot->stFrame.ullSeq > pEntry->ullLastSeq + 1 )
+			pEntry->ullDropped += pSlot->stFrame.ullSeq - pEntry->ullLastSeq - 1;
+		pEntry->ullLastSeq = pSlot->stFrame.ullSeq;
+		pEntry->ullFrames++;
+		lock.unlock();
+
+		pEntry->pfnFrame( &pSlot->stFrame, pEntry->pContext );
+
+		lock.lock();
+		pSlot->ulRef--;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// add a consumer of the frames. Returns the index of the consumer, or -1.
+SLONG AddLiveViewConsumer( const char* pszName, LPLiveViewProc pfnFrame, LPVOID pContext )
+{
+	SLONG i;
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+
+	for ( i = 0; i < LIVEVIEW_CONSUMER_MAX; i++ ) {
+		LPLiveViewConsumerEntry pEntry = &g_stLiveViewConsumer[i];
+		if ( pEntry->bUsed == TRUE ) continue;
+		pEntry->bUsed = TRUE;
+		pEntry->bStop = FALSE;
+		strncpy( pEntry->szName, pszName, sizeof(pEntry->szName) - 1 );
+		pEntry->szName[sizeof(pEntry->szName) - 1] = 0;
+		pEntry->pfnFrame = pfnFrame;
+		pEntry->pContext = pContext;
+		// The consumer starts from the next frame.
+		pEntry->ullLastSeq = g_ullLiveViewSeq;
+		pEntry->ullFrames = 0;
+		pEntry->ullDropped = 0;
+		pEntry->Thread = std::thread( LiveViewConsumerLoop, pEntry );
+		return i;
+	}
+	return -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// stop a consumer and wait for its thread.
+void RemoveLiveViewConsumer( SLONG lIndex )
+{
+	LPLiveViewConsumerEntry pEntry;
+
+	if ( lIndex < 0 || lIndex >= LIVEVIEW_CONSUMER_MAX ) return;
+	pEntry = &g_stLiveViewConsumer[lIndex];
+	{
+		std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+		if ( pEntry->bUsed == FALSE ) return;
+		pEntry->bStop = TRUE;
+		g_LiveViewCond.notify_all();
+	}
+	pEntry->Thread.join();
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+	pEntry->bUsed = FALSE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// get the counters of a consumer.
+BOOL GetLiveViewConsumerStats( SLONG lIndex, NK_UINT_64* pullFrames, NK_UINT_64* pullDropped )
+{
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+	if ( lIndex < 0 || lIndex >= LIVEVIEW_CONSUMER_MAX || g_stLiveViewConsumer[lIndex].bUsed == FALSE ) return FALSE;
+	*pullFrames = g_stLiveViewConsumer[lIndex].ullFrames;
+	*pullDropped = g_stLiveViewConsumer[lIndex].ullDropped;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// get the counters of the live view.
+void GetLiveViewStats( LPLiveViewStats pStats )
+{
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+	*pStats = g_stLiveViewStats;
+	if ( pStats->ullStopTime > pStats->ullStartTime )
+		pStats->ulFps100 = (ULONG)( pStats->ullFrames * 100000000 / (pStats->ullStopTime - pStats->ullStartTime) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// take a free slot of the ring for the next frame. Returns NULL if all slots are used by the consumers.
+LPLiveViewSlot GetLiveViewSlot( void )
+{
+	SLONG i;
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+
+	// The lowest free slot is taken, so only as many buffers as needed are allocated.
+	for ( i = 0; i < LIVEVIEW_RING_COUNT; i++ ) {
+		LPLiveViewSlot pSlot = &g_stLiveViewRing[i];
+		if ( i == g_lLiveViewLatest || pSlot->ulRef > 0 || pSlot->bWriting == TRUE ) continue;
+		pSlot->bWriting = TRUE;
+		return pSlot;
+	}
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// read the live view image into the frame. The buffer of the frame is reused, and grown if the image is larger.
+BOOL ReadLiveViewImage( LPRefObj pRefSrc, LPLiveViewFrame pFrame )
+{
+	NkMAIDArray	stArray;
+	ULONG	ulSize;
+
+	memset( &stArray, 0, sizeof(NkMAIDArray) );
+	if ( Command_CapGet( pRefSrc->pObject, kNkMAIDCapability_GetLiveViewImage, kNkMAIDDataType_ArrayPtr, (NKPARAM)&stArray, NULL, NULL ) == FALSE )
+		return FALSE;
+	ulSize = stArray.ulElements * stArray.wPhysicalBytes;
+	if ( ulSize <= LIVEVIEW_HEADER_SIZE ) return FALSE;
+
+	if ( ulSize > pFrame->ulCapacity ) {
+		unsigned char* pucData = (unsigned char*)realloc( pFrame->pucData, ulSize );
+		if ( pucData == NULL ) return FALSE;
+		pFrame->pucData = pucData;
+		pFrame->ulCapacity = ulSize;
+	}
+	stArray.pData = pFrame->pucData;
+	if ( Command_CapGetArray( pRefSrc->pObject, kNkMAIDCapability_GetLiveViewImage, kNkMAIDDataType_ArrayPtr, (NKPARAM)&stArray, NULL, NULL ) == FALSE )
+		return FALSE;
+	pFrame->ulSize = stArray.ulElements * stArray.wPhysicalBytes;
+	pFrame->ulHeaderSize = LIVEVIEW_HEADER_SIZE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// read the live view image into the slot.
+BOOL ReadLiveViewFrame( LPRefObj pRefSrc, LPLiveViewSlot pSlot )
+{
+	return ReadLiveViewImage( pRefSrc, &pSlot->stFrame );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Poll the live view images at ulFps until ulSeconds passed, the user canceled or pfnControl returned FALSE.
+// If ulSeconds is 0, the live view runs until it is canceled. Returns FALSE if pfnControl returned FALSE.
+BOOL RunLiveView( LPRefObj pRefSrc, ULONG ulFps, ULONG ulSeconds, LPLiveViewControlProc pfnControl, LPVOID pContext )
+{
+	LPNkMAIDCapInfo pCapInfo = GetCapInfo( pRefSrc, kNkMAIDCapability_GetLiveViewImage );
+	LPLiveViewSlot pSlot;
+	NK_UINT_64 ullPeriod, ullNext, ullEnd, ullNow;
+	BOOL bPublished;
+	BOOL bRet = TRUE;
+
+	if ( pCapInfo == NULL ) return FALSE;
+	if ( pCapInfo->ulType != kNkMAIDCapType_Array ) return FALSE;
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_GetLiveViewImage, kNkMAIDCapOperation_Get ) ) return FALSE;
+	if ( !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_GetLiveViewImage, kNkMAIDCapOperation_GetArray ) ) return FALSE;
+	if ( ulFps == 0 ) ulFps = LIVEVIEW_FPS_DEFAULT;
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, TRUE);
+#elif defined(__APPLE__)
+	struct sigaction action, oldaction;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = cancelhandler;
+	action.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &action, &oldaction);
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+		memset( &g_stLiveViewStats, 0, sizeof(LiveViewStats) );
+		g_stLiveViewStats.ulTargetFps = ulFps;
+		g_stLiveViewStats.ullStartTime = GetHostTimeUs();
+	}
+	ullPeriod = 1000000 / ulFps;
+	ullNext = GetHostTimeUs();
+	ullEnd = ( ulSeconds > 0 ) ? ullNext + (NK_UINT_64)ulSeconds * 1000000 : 0;
+
+	while ( g_bCancel == FALSE && bRet == TRUE ) {
+		ullNow = GetHostTimeUs();
+		if ( ullEnd != 0 && ullNow >= ullEnd ) break;
+		if ( ullNow < ullNext ) {
+			std::this_thread::sleep_for( std::chrono::microseconds( ullNext - ullNow ) );
+			continue;
+		}
+		// If the polling fell behind, the missed periods are not caught up.
+		if ( ullNow > ullNext + ullPeriod ) {
+			std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+			g_stLiveViewStats.ullLate += ( ullNow - ullNext ) / ullPeriod;
+			ullNext = ullNow;
+		}
+		ullNext += ullPeriod;
+		Command_Async( pRefSrc->pObject );
+
+		bPublished = FALSE;
+		pSlot = GetLiveViewSlot();
+		if ( pSlot == NULL ) {
+			// All buffers are held by the consumers.
+			std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+			g_stLiveViewStats.ullDropped++;
+			continue;
+		}
+		BOOL bRead = ReadLiveViewFrame( pRefSrc, pSlot );
+		{
+			std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+			g_stLiveViewStats.ullPolled++;
+			pSlot->bWriting = FALSE;
+			if ( bRead == TRUE ) {
+				pSlot->stFrame.ullSeq = ++g_ullLiveViewSeq;
+				pSlot->stFrame.ullTime = GetHostTimeUs();
+				g_lLiveViewLatest = (SLONG)(pSlot - g_stLiveViewRing);
+				g_stLiveViewStats.ullFrames++;
+				g_stLiveViewStats.ullBytes += pSlot->stFrame.ulSize;
+				g_stLiveViewStats.ullStopTime = pSlot->stFrame.ullTime;
+				bPublished = TRUE;
+				g_LiveViewCond.notify_all();
+			} else {
+				g_stLiveViewStats.ullErrors++;
+			}
+		}
+		// The latest frame is not reused while it is the latest, so the control procedure can read it.
+		// It is also handed to the other processes if the live view goes to the frame bus; a frame no slot is free for is dropped.
+		if ( bPublished == TRUE && GetSinkKind( kSinkRoute_LiveView ) == kSinkKind_FrameBus ) {
+			char szName[64];
+			sprintf( szName, "LiveView%08llu.jpg", (unsigned long long)pSlot->stFrame.ullSeq );
+			PublishFrameBus( kSinkRoute_LiveView, szName, pSlot->stFrame.pucData, pSlot->stFrame.ulSize );
+		}
+		if ( bPublished == TRUE && pfnControl != NULL )
+			bRet = pfnControl( pRefSrc, &pSlot->stFrame, pContext );
+	}
+
+#if defined( _WIN32 )
+	SetConsoleCtrlHandler(cancelhandler, FALSE);
+#elif defined(__APPLE__)
+	sigaction(SIGINT, &oldaction, NULL);
+#endif
+	g_bCancel = FALSE;
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Read one live view image and publish it. The frame is held until ReleaseLiveViewFrame, so it can be read in place.
+// Returns NULL if the image can't be read or all buffers of the ring are held.
+LPLiveViewFrame GrabLiveViewFrame( LPRefObj pRefSrc )
+{
+	LPLiveViewSlot pSlot;
+	BOOL bRead;
+
+	Command_Async( pRefSrc->pObject );
+	pSlot = GetLiveViewSlot();
+	if ( pSlot == NULL ) {
+		std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+		g_stLiveViewStats.ullDropped++;
+		return NULL;
+	}
+	bRead = ReadLiveViewFrame( pRefSrc, pSlot );
+
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+	g_stLiveViewStats.ullPolled++;
+	pSlot->bWriting = FALSE;
+	if ( bRead == FALSE ) {
+		g_stLiveViewStats.ullErrors++;
+		return NULL;
+	}
+	pSlot->stFrame.ullSeq = ++g_ullLiveViewSeq;
+	pSlot->stFrame.ullTime = GetHostTimeUs();
+	pSlot->ulRef++;
+	g_lLiveViewLatest = (SLONG)(pSlot - g_stLiveViewRing);
+	g_stLiveViewStats.ullFrames++;
+	g_stLiveViewStats.ullBytes += pSlot->stFrame.ulSize;
+	if ( g_stLiveViewStats.ullStartTime == 0 ) g_stLiveViewStats.ullStartTime = pSlot->stFrame.ullTime;
+	g_stLiveViewStats.ullStopTime = pSlot->stFrame.ullTime;
+	g_LiveViewCond.notify_all();
+	return &pSlot->stFrame;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give back a frame grabbed by GrabLiveViewFrame.
+void ReleaseLiveViewFrame( LPLiveViewFrame pFrame )
+{
+	ULONG i;
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+
+	for ( i = 0; i < LIVEVIEW_RING_COUNT; i++ ) {
+		if ( &g_stLiveViewRing[i].stFrame != pFrame ) continue;
+		if ( g_stLiveViewRing[i].ulRef > 0 ) g_stLiveViewRing[i].ulRef--;
+		return;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the buffers of the ring. All consumers must be removed.
+void FreeLiveViewRing( void )
+{
+	ULONG i;
+	std::lock_guard<std::mutex> lock( g_LiveViewMutex );
+	for ( i = 0; i < LIVEVIEW_RING_COUNT; i++ ) {
+		if ( g_stLiveViewRing[i].ulRef > 0 ) continue;
+		free( g_stLiveViewRing[i].stFrame.pucData );
+		memset( &g_stLiveViewRing[i].stFrame, 0, sizeof(LiveViewFrame) );
+	}
+	g_lLiveViewLatest = -1;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// print the counters of the live view once a second.
+BOOL LiveViewStatsControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	NK_UINT_64* pullLastPrint = (NK_UINT_64*)pContext;
+	LiveViewStats stStats;
+	LiveViewHeader stHeader;
+	LiveViewFocusState stFocus;
+
+	if ( pFrame->ullTime - *pullLastPrint < 1000000 ) return TRUE;
+	*pullLastPrint = pFrame->ullTime;
+	GetLiveViewStats( &stStats );
+	memset( &stFocus, 0, sizeof(stFocus) );
+	if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == TRUE )
+		GetLiveViewFocusState( &stHeader, &stFocus );
+	printf( "Frame %llu  %u.%02u fps  %llu KB  dropped %llu  late %llu  errors %llu  focus %u\n",
+			(unsigned long long)pFrame->ullSeq, (unsigned)(stStats.ulFps100 / 100), (unsigned)(stStats.ulFps100 % 100),
+			(unsigned long long)(stStats.ullBytes / 1024), (unsigned long long)stStats.ullDropped,
+			(unsigned long long)stStats.ullLate, (unsigned long long)stStats.ullErrors, stFocus.ucFocusJudge );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// turn on the remote live view if it is off. *pulSaved receives the status to restore.
+BOOL StartRemoteLiveView( LPRefObj pRefSrc, ULONG* pulSaved )
+{
+	ULONG ulStatus = kNkMAIDLiveViewStatus_OFF;
+
+	if ( GetUnsignedCapability( pRefSrc, kNkMAIDCapability_LiveViewStatus, &ulStatus ) == FALSE ) return FALSE;
+	*pulSaved = ulStatus;
+	if ( ulStatus != kNkMAIDLiveViewStatus_OFF ) return TRUE;
+	return Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_LiveViewStatus, kNkMAIDDataType_Unsigned, (NKPARAM)kNkMAIDLiveViewStatus_ON_RemoteLV, NULL, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// restore the live view status saved by StartRemoteLiveView.
+BOOL StopRemoteLiveView( LPRefObj pRefSrc, ULONG ulSaved )
+{
+	if ( ulSaved != kNkMAIDLiveViewStatus_OFF ) return TRUE;
+	return Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_LiveViewStatus, kNkMAIDDataType_Unsigned, (NKPARAM)kNkMAIDLiveViewStatus_OFF, NULL, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Stream the live view and show the counters.
+BOOL LiveViewStreamMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSeconds, ulSaved;
+	NK_UINT_64	ullLastPrint = 0;
+	LiveViewStats	stStats;
+	BOOL	bRet;
+
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	printf( "Input the duration in seconds (0: until Ctrl+C)\n>" );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) return FALSE;
+	printf( "Streaming the live view. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, ulSeconds, LiveViewStatsControl, &ullLastPrint );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+
+	GetLiveViewStats( &stStats );
+	printf( "%llu frames in %llu polls, %u.%02u fps (target %u), dropped %llu, late %llu, errors %llu\n",
+			(unsigned long long)stStats.ullFrames, (unsigned long long)stStats.ullPolled,
+			(unsigned)(stStats.ulFps100 / 100), (unsigned)(stStats.ulFps100 % 100), (unsigned)stStats.ulTargetFps,
+			(unsigned long long)stStats.ullDropped, (unsigned long long)stStats.ullLate, (unsigned long long)stStats.ullErrors );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,412 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Streaming index of a downloaded movie.
+// The writer of the movie download hands every block it wrote to FeedMovieIndex, which walks the
+// boxes of the MOV/MP4 file as they go by. Only the boxes on the way to the track headers are
+// entered (moov, trak, mdia, minf, stbl), the first bytes of a few leaf boxes are kept to read
+// the brand, the durations, the track headers, the sample descriptions and the first chunk of the
+// timecode track, and every other box, mdat included, is skipped without being looked at.
+// The parser is a fixed size structure without pointers, so it is saved with the checkpoint of
+// the download and a resumed download goes on parsing where it stopped.
+// The timecode sample is caught in the stream when moov comes before it. The camera writes moov
+// at the end, so the sample has usually been passed; then the 4 bytes of it are read back from
+// the file when the download finishes, which is the only read of the indexer.
+// The index is recorded in the session manifest with the TimeCodeOrigin setting of the camera.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define MOVIE_INDEX_HEADER		0		// reading the header of a box
+#define MOVIE_INDEX_PAYLOAD		1		// keeping the start of the payload
+#define MOVIE_INDEX_SKIP		2		// skipping to the end of the box
+#define MOVIE_INDEX_LOST		3		// not a box stream, or the start of the file was not seen
+
+#define MOVIE_BOX( a, b, c, d )	( ( (ULONG)(a) << 24 ) | ( (ULONG)(b) << 16 ) | ( (ULONG)(c) << 8 ) | (ULONG)(d) )
+#define MOVIE_BOX_OPEN			0xFFFFFFFFFFFFFFFFULL	// end of a box that runs to the end of the file
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// big endian values in a box
+static ULONG MovieULONG( const UCHAR* p )
+{
+	return ( (ULONG)p[0] << 24 ) | ( (ULONG)p[1] << 16 ) | ( (ULONG)p[2] << 8 ) | (ULONG)p[3];
+}
+static NK_UINT_64 MovieUINT64( const UCHAR* p )
+{
+	return ( (NK_UINT_64)MovieULONG( p ) << 32 ) | MovieULONG( p + 4 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// start parsing a new file from its first byte.
+void InitMovieIndex( LPMovieIndex pIndex )
+{
+	memset( pIndex, 0, sizeof(MovieIndex) );
+	pIndex->ulState = MOVIE_INDEX_HEADER;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The bytes before ullPosition were not parsed, e.g. the checkpoint of a resumed download has no parser. Nothing is indexed.
+void SkipMovieIndex( LPMovieIndex pIndex, NK_UINT_64 ullPosition )
+{
+	memset( pIndex, 0, sizeof(MovieIndex) );
+	pIndex->ulState = MOVIE_INDEX_LOST;
+	pIndex->ullPosition = ullPosition;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// keep the bytes of the first timecode sample in [ullPosition, ullPosition + ulSize).
+static void CatchMovieTimecode( LPMovieIndex pIndex, const UCHAR* pucData, ULONG ulSize )
+{
+	NK_UINT_64 ullFrom = pIndex->ullTimecodeOffset + pIndex->ulTimecodeBytes;
+
+	if ( pIndex->ullTimecodeOffset == 0 || pIndex->ulTimecodeBytes == 4 ) return;
+	if ( ullFrom < pIndex->ullPosition || ullFrom >= pIndex->ullPosition + ulSize ) return;
+	while ( pIndex->ulTimecodeBytes < 4 && ullFrom < pIndex->ullPosition + ulSize ) {
+		pIndex->ucTimecode[pIndex->ulTimecodeBytes++] = pucData[ullFrom - pIndex->ullPosition];
+		ullFrom++;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the containers that end at the current position. A closed trak is added to the tracks.
+static void CloseMovieContainers( LPMovieIndex pIndex )
+{
+	while ( pIndex->ulDepth > 0 && pIndex->ullPosition >= pIndex->ullContainerEnd[pIndex->ulDepth - 1] ) {
+		pIndex->ulDepth--;
+		if ( pIndex->ulContainerType[pIndex->ulDepth] == MOVIE_BOX( 't','r','a','k' ) && pIndex->bInTrack == TRUE ) {
+			pIndex->bInTrack = FALSE;
+			if ( pIndex->ulTracks < MOVIE_INDEX_TRACKS ) pIndex->ulTracks++;
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// read the kept start of the payload of a leaf box.
+static void ParseMovieBox( LPMovieIndex pIndex )
+{
+	const UCHAR* p = pIndex->ucCapture;
+	ULONG ulSize = pIndex->ulCaptureBytes;
+	LPMovieTrack pTrack = NULL;
+	const UCHAR* pEntry = p + 8;
+
+	if ( pIndex->bInTrack == TRUE && pIndex->ulTracks < MOVIE_INDEX_TRACKS ) pTrack = &pIndex->stTrack[pIndex->ulTracks];
+
+	switch ( pIndex->ulBoxType ) {
+	case MOVIE_BOX( 'f','t','y','p' ):
+		if ( ulSize >= 4 ) pIndex->ulBrand = MovieULONG( p );
+		break;
+	case MOVIE_BOX( 'm','v','h','d' ):
+		if ( p[0] == 1 && ulSize >= 32 ) {
+			pIndex->ulTimeScale = MovieULONG( p + 20 );
+			pIndex->ullDuration = MovieUINT64( p + 24 );
+		} else if ( p[0] == 0 && ulSize >= 20 ) {
+			pIndex->ulTimeScale = MovieULONG( p + 12 );
+			pIndex->ullDuration = MovieULONG( p + 16 );
+		}
+		break;
+	case MOVIE_BOX( 't','k','h','d' ):
+		if ( pTrack == NULL ) break;
+		// the width and the height are 16.16 fixed point after the matrix
+		if ( p[0] == 1 && ulSize >= 96 ) {
+			pTrack->ulTrackID = MovieULONG( p + 20 );
+			pTrack->ulWidth = MovieULONG( p + 88 ) >> 16;
+			pTrack->ulHeight = MovieULONG( p + 92 ) >> 16;
+		} else if ( p[0] == 0 && ulSize >= 84 ) {
+			pTrack->ulTrackID = MovieULONG( p + 12 );
+			pTrack->ulWidth = MovieULONG( p + 76 ) >> 16;
+			pTrack->ulHeight = MovieULONG( p + 80 ) >> 16;
+		}
+		break;
+	case MOVIE_BOX( 'm','d','h','d' ):
+		if ( pTrack == NULL ) break;
+		if ( p[0] == 1 && ulSize >= 32 ) {
+			pTrack->ulTimeScale = MovieULONG( p + 20 );
+			pTrack->ullDuration = MovieUINT64( p + 24 );
+		} else if ( p[0] == 0 && ulSize >= 20 ) {
+			pTrack->ulTimeScale = MovieULONG( p + 12 );
+			pTrack->ullDuration = MovieULONG( p + 16 );
+		}
+		break;
+	case MOVIE_BOX( 'h','d','l','r' ):
+		// the hdlr of minf names the data reference, only the one of mdia is the media type.
+		if ( pTrack != NULL && pTrack->ulHandler == 0 && ulSize >= 12 ) pTrack->ulHandler = MovieULONG( p + 8 );
+		break;
+	case MOVIE_BOX( 's','t','s','d' ):
+		// the first sample description follows the version and the entry count.
+		if ( pTrack == NULL || ulSize < 16 ) break;
+		pTrack->ulCodec = MovieULONG( pEntry + 4 );
+		if ( pTrack->ulHandler == MOVIE_BOX( 's','o','u','n' ) && ulSize >= 8 + 36 )
+			pTrack->ulSampleRate = MovieULONG( pEntry + 32 ) >> 16;
+		if ( pTrack->ulHandler == MOVIE_BOX( 't','m','c','d' ) && ulSize >= 8 + 33 ) {
+			pTrack->ulTimecodeFlags = MovieULONG( pEntry + 20 );
+			pTrack->ulFrameRate = pEntry[32];
+		}
+		break;
+	case MOVIE_BOX( 's','t','c','o' ):
+	case MOVIE_BOX( 'c','o','6','4' ):
+		if ( pTrack == NULL || ulSize < 12 || MovieULONG( p + 4 ) == 0 ) break;
+		if ( pIndex->ulBoxType == MOVIE_BOX( 's','t','c','o' ) )
+			pTrack->ullFirstChunk = MovieULONG( p + 8 );
+		else if ( ulSize >= 16 )
+			pTrack->ullFirstChunk = MovieUINT64( p + 8 );
+		if ( pTrack->ulHandler == MOVIE_BOX( 't','m','c','d' ) && pIndex->ullTimecodeOffset == 0 )
+			pIndex->ullTimecodeOffset = pTrack->ullFirstChunk;
+		break;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The header of a box was read. Decide whether to enter it, keep its payload or skip it.
+static void BeginMovieBox( LPMovieIndex pIndex )
+{
+	ULONG ulSize32 = MovieULONG( pIndex->ucHeader );
+	ULONG ulHeaderSize = pIndex->ulHeaderBytes;
+	NK_UINT_64 ullStart = pIndex->ullPosition - ulHeaderSize;
+	NK_UINT_64 ullSize, ullPayload;
+	ULONG ulType = MovieULONG( pIndex->ucHeader + 4 );
+	ULONG i;
+
+	pIndex->ulHeaderBytes = 0;
+	// The type of a box is 4 printable characters. Anything else means this is not a box stream.
+	for ( i = 4; i < 8; i++ ) {
+		if ( pIndex->ucHeader[i] < 0x20 || pIndex->ucHeader[i] > 0x7E ) {
+			pIndex->ulState = MOVIE_INDEX_LOST;
+			return;
+		}
+	}
+	if ( ulSize32 == 1 )
+		ullSize = MovieUINT64( pIndex->ucHeader + 8 );
+	else if ( ulSize32 == 0 )
+		ullSize = MOVIE_BOX_OPEN;
+	else
+		ullSize = ulSize32;
+	if ( ullSize < ulHeaderSize ) {
+		pIndex->ulState = MOVIE_INDEX_LOST;
+		return;
+	}
+	pIndex->ulBoxType = ulType;
+	pIndex->ullBoxEnd = ( ullSize == MOVIE_BOX_OPEN ) ? MOVIE_BOX_OPEN : ullStart + ullSize;
+	if ( pIndex->ulDepth > 0 && pIndex->ullBoxEnd > pIndex->ullContainerEnd[pIndex->ulDepth - 1] ) {
+		pIndex->ulState = MOVIE_INDEX_LOST;
+		return;
+	}
+	ullPayload = ( ullSize == MOVIE_BOX_OPEN ) ? MOVIE_BOX_OPEN : ullSize - ulHeaderSize;
+
+	switch ( ulType ) {
+	case MOVIE_BOX( 'm','d','a','t' ):
+		if ( pIndex->ulDepth == 0 && pIndex->ullMdatOffset == 0 ) {
+			pIndex->ullMdatOffset = ullStart;
+			pIndex->ullMdatSize = ( ullSize == MOVIE_BOX_OPEN ) ? 0 : ullSize;
+		}
+		break;
+	case MOVIE_BOX( 'm','o','o','v' ):
+		if ( pIndex->ulDepth == 0 ) {
+			pIndex->ullMoovOffset = ullStart;
+			pIndex->ullMoovSize = ullSize;
+		}
+		// fall through
+	case MOVIE_BOX( 't','r','a','k' ):
+	case MOVIE_BOX( 'm','d','i','a' ):
+	case MOVIE_BOX( 'm','i','n','f' ):
+	case MOVIE_BOX( 's','t','b','l' ):
+		if ( pIndex->ulDepth == MOVIE_INDEX_DEPTH ) break;
+		if ( ulType == MOVIE_BOX( 't','r','a','k' ) ) {
+			if ( pIndex->bInTrack == TRUE ) break;
+			pIndex->bInTrack = TRUE;
+			if ( pIndex->ulTracks < MOVIE_INDEX_TRACKS ) memset( &pIndex->stTrack[pIndex->ulTracks], 0, sizeof(MovieTrack) );
+		}
+		pIndex->ulContainerType[pIndex->ulDepth] = ulType;
+		pIndex->ullContainerEnd[pIndex->ulDepth] = pIndex->ullBoxEnd;
+		pIndex->ulDepth++;
+		pIndex->ulState = MOVIE_INDEX_HEADER;
+		return;
+	case MOVIE_BOX( 'f','t','y','p' ):
+	case MOVIE_BOX( 'm','v','h','d' ):
+	case MOVIE_BOX( 't','k','h','d' ):
+	case MOVIE_BOX( 'm','d','h','d' ):
+	case MOVIE_BOX( 'h','d','l','r' ):
+	case MOVIE_BOX( 's','t','s','d' ):
+	case MOVIE_BOX( 's','t','c','o' ):
+	case MOVIE_BOX( 'c','o','6','4' ):
+		pIndex->ulCaptureBytes = 0;
+		pIndex->ulCaptureSize = ( ullPayload < MOVIE_INDEX_CAPTURE ) ? (ULONG)ullPayload : MOVIE_INDEX_CAPTURE;
+		pIndex->ulState = MOVIE_INDEX_PAYLOAD;
+		return;
+	}
+	pIndex->ulState = MOVIE_INDEX_SKIP;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Parse the next ulSize bytes of the file. The blocks must be given in the order of the file.
+void FeedMovieIndex( LPMovieIndex pIndex, const UCHAR* pucData, ULONG ulSize )
+{
+	ULONG ulCopy, ulNeed;
+
+	while ( ulSize > 0 ) {
+		switch ( pIndex->ulState ) {
+		case MOVIE_INDEX_HEADER:
+			if ( pIndex->ulHeaderBytes == 0 ) CloseMovieContainers( pIndex );
+			// a size of 1 is followed by the 64-bit size
+			ulNeed = ( pIndex->ulHeaderBytes >= 8 && MovieULONG( pIndex->ucHeader ) == 1 ) ? 16 : 8;
+			ulCopy = ( ulNeed - pIndex->ulHeaderBytes < ulSize ) ? ulNeed - pIndex->ulHeaderBytes : ulSize;
+			memcpy( pIndex->ucHeader + pIndex->ulHeaderBytes, pucData, ulCopy );
+			pIndex->ulHeaderBytes += ulCopy;
+			break;
+		case MOVIE_INDEX_PAYLOAD:
+			ulCopy = ( pIndex->ulCaptureSize - pIndex->ulCaptureBytes < ulSize ) ? pIndex->ulCaptureSize - pIndex->ulCaptureBytes : ulSize;
+			memcpy( pIndex->ucCapture + pIndex->ulCaptureBytes, pucData, ulCopy );
+			pIndex->ulCaptureBytes += ulCopy;
+			break;
+		case MOVIE_INDEX_SKIP:
+			ulCopy = ( pIndex->ullBoxEnd - pIndex->ullPosition < ulSize ) ? (ULONG)( pIndex->ullBoxEnd - pIndex->ullPosition ) : ulSize;
+			break;
+		default:
+			ulCopy = ulSize;
+			break;
+		}
+		CatchMovieTimecode( pIndex, pucData, ulCopy );
+		pIndex->ullPosition += ulCopy;
+		pucData += ulCopy;
+		ulSize -= ulCopy;
+
+		if ( pIndex->ulState == MOVIE_INDEX_HEADER ) {
+			ulNeed = ( pIndex->ulHeaderBytes >= 8 && MovieULONG( pIndex->ucHeader ) == 1 ) ? 16 : 8;
+			if ( pIndex->ulHeaderBytes == ulNeed ) BeginMovieBox( pIndex );
+		}
+		if ( pIndex->ulState == MOVIE_INDEX_PAYLOAD && pIndex->ulCaptureBytes == pIndex->ulCaptureSize ) {
+			ParseMovieBox( pIndex );
+			pIndex->ulState = MOVIE_INDEX_SKIP;
+		}
+		if ( pIndex->ulState == MOVIE_INDEX_SKIP && pIndex->ullPosition == pIndex->ullBoxEnd )
+			pIndex->ulState = MOVIE_INDEX_HEADER;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The whole file was given. Close the open boxes, and read the timecode sample if it was passed before moov told where it is.
+void FinishMovieIndex( LPMovieIndex pIndex, const char* pszFileName, NK_UINT_64 ullFileSize )
+{
+	FILE* pFile;
+
+	if ( pIndex->ulState == MOVIE_INDEX_LOST ) return;
+	CloseMovieContainers( pIndex );
+	if ( pIndex->ullMdatOffset != 0 && pIndex->ullMdatSize == 0 && ullFileSize > pIndex->ullMdatOffset )
+		pIndex->ullMdatSize = ullFileSize - pIndex->ullMdatOffset;
+	if ( pIndex->ullTimecodeOffset == 0 || pIndex->ulTimecodeBytes == 4 || pIndex->ullTimecodeOffset + 4 > ullFileSize ) return;
+
+	// The file was just written, so these bytes come from the cache of the system.
+	pFile = fopen( pszFileName, "rb" );
+	if ( pFile == NULL ) return;
+#if defined( _WIN32 )
+	if ( _fseeki64( pFile, (__int64)pIndex->ullTimecodeOffset, SEEK_SET ) == 0 &&
+#elif defined(__APPLE__)
+	if ( fseeko( pFile, (off_t)pIndex->ullTimecodeOffset, SEEK_SET ) == 0 &&
+#endif
+		 fread( pIndex->ucTimecode, 1, 4, pFile ) == 4 ) {
+		pIndex->ulTimecodeBytes = 4;
+	}
+	fclose( pFile );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Make "hh:mm:ss:ff" of the first timecode sample, with ';' before the frames for drop frame. Empty if there is no timecode.
+void FormatMovieTimecode( LPMovieIndex pIndex, char* pszTimecode )
+{
+	LPMovieTrack pTrack = NULL;
+	NK_UINT_64 ullFrame, ullTenMinutes, ullRest;
+	ULONG i, ulRate, ulDrop;
+
+	pszTimecode[0] = '\0';
+	for ( i = 0; i < pIndex->ulTracks; i++ ) {
+		if ( pIndex->stTrack[i].ulHandler == MOVIE_BOX( 't','m','c','d' ) ) {
+			pTrack = &pIndex->stTrack[i];
+			break;
+		}
+	}
+	if ( pTrack == NULL || pIndex->ulTimecodeBytes < 4 || pTrack->ulFrameRate == 0 ) return;
+	ulRate = pTrack->ulFrameRate;
+	ullFrame = MovieULONG( pIndex->ucTimecode );
+	// bit 3 of the flags: the sample is a counter, not a frame number.
+	if ( pTrack->ulTimecodeFlags & 0x8 ) {
+		sprintf( pszTimecode, "%llu", (unsigned long long)ullFrame );
+		return;
+	}
+	// Drop frame skips 2 numbers (4 at 60 fps) at every minute but every tenth one.
+	ulDrop = ( pTrack->ulTimecodeFlags & 0x1 ) ? ulRate / 15 : 0;
+	if ( ulDrop > 0 ) {
+		ullTenMinutes = (NK_UINT_64)ulRate * 600 - ulDrop * 9;
+		ullRest = ullFrame % ullTenMinutes;
+		ullFrame += (NK_UINT_64)ulDrop * 9 * ( ullFrame / ullTenMinutes );
+		if ( ullRest > ulDrop ) ullFrame += ulDrop * ( ( ullRest - ulDrop ) / ( (NK_UINT_64)ulRate * 60 - ulDrop ) );
+	}
+	sprintf( pszTimecode, "%02u:%02u:%02u%c%02u", (unsigned)( ullFrame / ( ulRate * 3600ULL ) % 24 ), (unsigned)( ullFrame / ( ulRate * 60ULL ) % 60 ),
+				(unsigned)( ullFrame / ulRate % 60 ), ulDrop > 0 ? ';' : ':', (unsigned)( ullFrame % ulRate ) );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write a box type as text, without the spaces at the end.
+static void FormatMovieBox( ULONG ulType, char* psz )
+{
+	int i;
+
+	for ( i = 0; i < 4; i++ )
+		psz[i] = (char)( ulType >> ( 24 - 8 * i ) );
+	for ( i = 4; i > 0 && ( psz[i - 1] == ' ' || psz[i - 1] == '\0' ); i-- ) ;
+	psz[i] = '\0';
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Record the index of a finished download in the session manifest and show it.
+BOOL RecordMovieIndex( LPRefObj pRefSrc, LPMovieIndex pIndex, const char* pszFileName, NK_UINT_64 ullFileSize )
+{
+	char	szInfo[1024], szBox[8], szTimecode[32];
+	size_t	n = 0;			// the tracks take less than 80 characters each, so szInfo does not overflow
+	NkMAIDTimeCodeOrigin	stOrigin;
+	LPMovieTrack	pTrack;
+	ULONG	i;
+
+	FinishMovieIndex( pIndex, pszFileName, ullFileSize );
+	if ( pIndex->ulState == MOVIE_INDEX_LOST || pIndex->ulTracks == 0 ) {
+		printf( "%s could not be indexed.\n", pszFileName );
+		return FALSE;
+	}
+
+	FormatMovieBox( pIndex->ulBrand, szBox );
+	n += snprintf( szInfo + n, sizeof(szInfo) - n, "brand=%s", szBox );
+	if ( pIndex->ulTimeScale > 0 )
+		n += snprintf( szInfo + n, sizeof(szInfo) - n, " duration=%.3f", (double)pIndex->ullDuration / pIndex->ulTimeScale );
+	n += snprintf( szInfo + n, sizeof(szInfo) - n, " moov=%llu+%llu mdat=%llu+%llu",
+				(unsigned long long)pIndex->ullMoovOffset, (unsigned long long)pIndex->ullMoovSize,
+				(unsigned long long)pIndex->ullMdatOffset, (unsigned long long)pIndex->ullMdatSize );
+	for ( i = 0; i < pIndex->ulTracks; i++ ) {
+		pTrack = &pIndex->stTrack[i];
+		FormatMovieBox( pTrack->ulHandler, szBox );
+		n += snprintf( szInfo + n, sizeof(szInfo) - n, " track%u=%s", (unsigned)pTrack->ulTrackID, szBox );
+		FormatMovieBox( pTrack->ulCodec, szBox );
+		n += snprintf( szInfo + n, sizeof(szInfo) - n, ",%s", szBox );
+		if ( pTrack->ulWidth > 0 && pTrack->ulHeight > 0 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, ",%ux%u", (unsigned)pTrack->ulWidth, (unsigned)pTrack->ulHeight );
+		if ( pTrack->ulSampleRate > 0 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, ",%uHz", (unsigned)pTrack->ulSampleRate );
+		if ( pTrack->ulFrameRate > 0 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, ",%ufps%s", (unsigned)pTrack->ulFrameRate, ( pTrack->ulTimecodeFlags & 0x1 ) ? "DF" : "" );
+		if ( pTrack->ulTimeScale > 0 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, ",%.3fs", (double)pTrack->ullDuration / pTrack->ulTimeScale );
+	}
+	FormatMovieTimecode( pIndex, szTimecode );
+	if ( szTimecode[0] != '\0' )
+		n += snprintf( szInfo + n, sizeof(szInfo) - n, " timecode=%s", szTimecode );
+
+	// The origin tells how the camera counted the timecode: from 0, from a preset or from the clock.
+	memset( &stOrigin, 0, sizeof(NkMAIDTimeCodeOrigin) );
+	if ( pRefSrc != NULL &&
+		 CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_TimeCodeOrigin, kNkMAIDCapOperation_Get ) &&
+		 Command_CapGet( pRefSrc->pObject, kNkMAIDCapability_TimeCodeOrigin, kNkMAIDDataType_GenericPtr, (NKPARAM)&stOrigin, NULL, NULL ) == TRUE ) {
+		if ( stOrigin.ucTimeCodeInfo == 0 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, " origin=reset" );
+		else if ( stOrigin.ucTimeCodeInfo == 1 )
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, " origin=%02u:%02u:%02u:%02u", (unsigned)stOrigin.ucTimeCode[0],
+							(unsigned)stOrigin.ucTimeCode[1], (unsigned)stOrigin.ucTimeCode[2], (unsigned)stOrigin.ulFrame );
+		else
+			n += snprintf( szInfo + n, sizeof(szInfo) - n, " origin=current-time" );
+	}
+
+	printf( "%s: %s\n", pszFileName, szInfo );
+	return WriteManifestInfo( pszFileName, ullFileSize, szInfo );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,948 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Python extension module "nkmaid" on the MAID client of this sample.
+// It keeps one Module object and one Source object open between the calls, so a capability is
+// read or set and a picture is taken in the process of the script, without opening the camera again.
+//   nkmaid.open( [module_path] )       open the module and the first camera, returns the source ID
+//   nkmaid.close()
+//   nkmaid.get( cap )                  the current value of a capability of the camera
+//   nkmaid.set( cap, value )           an enum takes the string of an element or its index
+//   nkmaid.choices( cap )              the strings of the elements of an enum
+//   nkmaid.capture( [cap] )            IssueProcess, kNkMAIDCapability_CaptureAsync by default
+//   nkmaid.poll()                      Command_Async to let the module deliver its events
+//   nkmaid.items()                     the IDs of the items of the camera
+//   nkmaid.acquire( item [, data] )    IssueAcquire of the image or another data object of an item
+//   nkmaid.keep( [route [, on]] )      send the files of a route to the memory sink, or to files again
+//   nkmaid.take( [route] )             the oldest file kept by the memory sink as a Frame, or None
+//   nkmaid.start_liveview()            turn the remote live view on
+//   nkmaid.stop_liveview()
+//   nkmaid.liveview()                  read a live view image as a Frame
+// A Frame exposes its data through the buffer protocol without a copy: memoryview( frame ) or
+// numpy.frombuffer( frame, numpy.uint8, offset=frame.offset ) read the buffer of the memory sink
+// or of the live view ring in place. The buffer is not reused until frame.release() is called or
+// the Frame is deleted; release() raises BufferError while a view of the frame is still alive.
+// The module is built by setup.py with the other sources of this sample except main.cpp, whose
+// globals are defined here. All calls must be made from one thread, like all MAID commands.
+// The module file is searched for as in the sample: Type0023.md3 in the current folder on Windows.
+// On Mac the path of "Type0023 Module.bundle" must be given, since the executable is Python.
+// Without a path, the environment variable NKMAID_MODULE is taken before the search.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+LPMAIDEntryPointProc	g_pMAIDEntryPoint = NULL;
+UCHAR	g_bFileRemoved = FALSE;
+ULONG	g_ulCameraType = 0;	// CameraType
+#if defined( _WIN32 )
+	HINSTANCE	g_hInstModule = NULL;
+#elif defined(__APPLE__)
+	CFBundleRef gBundle = NULL;
+#endif
+
+enum ePyFrame
+{
+	kPyFrame_Released = 0,
+	kPyFrame_LiveView,				// a frame of the live view ring
+	kPyFrame_Memory					// a file of the memory sink
+};
+
+// nkmaid.Frame
+typedef struct tagPyFrame
+{
+	PyObject_HEAD
+	ULONG	ulKind;					// ePyFrame
+	LPLiveViewFrame	pLiveView;		// kPyFrame_LiveView only
+	MemorySinkFrame	stFrame;			// the data, its name and its route for both kinds
+	ULONG	ulOffset;				// where the image starts in the data
+	Py_ssize_t	lExports;			// buffers exported and not released yet
+} PyFrame, *LPPyFrame;
+
+LPRefObj	g_pPyRefMod = NULL;
+LPRefObj	g_pPyRefSrc = NULL;
+PyObject*	g_pPyError = NULL;		// nkmaid.error
+PyTypeObject	g_stPyFrameType;
+BOOL	g_bPyLiveView = FALSE;			// TRUE while the live view is turned on by start_liveview
+ULONG	g_ulPyLiveViewSaved = 0;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// raise nkmaid.error for a capability.
+static PyObject* RaiseCapError( const char* pszWhat, ULONG ulCapID )
+{
+	char	szMessage[256];
+
+	// PyErr_Format does not take a width for integers, so the message is formatted here.
+	snprintf( szMessage, sizeof(szMessage), "%s 0x%04lx", pszWhat, (unsigned long)ulCapID );
+	PyErr_SetString( g_pPyError, szMessage );
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the source, or raise nkmaid.error if the session is not open.
+static LPRefObj GetPySource( void )
+{
+	if ( g_pPyRefSrc == NULL ) PyErr_SetString( g_pPyError, "the session is not open" );
+	return g_pPyRefSrc;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the capability of the source, or raise nkmaid.error if it is not supported for ulOperation.
+static LPNkMAIDCapInfo GetPyCapInfo( LPRefObj pRefSrc, ULONG ulCapID, ULONG ulOperation )
+{
+	LPNkMAIDCapInfo pCapInfo = GetCapInfo( pRefSrc, ulCapID );
+
+	if ( pCapInfo == NULL ) {
+		RaiseCapError( "the camera does not have the capability", ulCapID );
+		return NULL;
+	}
+	if ( !CheckCapabilityOperation( pRefSrc, ulCapID, ulOperation ) ) {
+		RaiseCapError( ( ulOperation == kNkMAIDCapOperation_Set ) ? "the capability can't be set:" :
+							( ulOperation == kNkMAIDCapOperation_Start ) ? "the capability can't be started:" : "the capability can't be read:", ulCapID );
+		return NULL;
+	}
+	return pCapInfo;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Read an enum capability with its elements. pstEnum->pData must be freed by the caller; it is NULL if this failed.
+static BOOL ReadPyEnum( LPRefObj pRefSrc, ULONG ulCapID, LPNkMAIDEnum pstEnum )
+{
+	pstEnum->pData = NULL;
+	if ( Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)pstEnum, NULL, NULL ) == FALSE ) return FALSE;
+	if ( pstEnum->ulType != kNkMAIDArrayType_Unsigned && pstEnum->ulType != kNkMAIDArrayType_PackedString && pstEnum->ulType != kNkMAIDArrayType_String )
+		return FALSE;
+	pstEnum->pData = malloc( pstEnum->ulElements * pstEnum->wPhysicalBytes + 1 );
+	if ( pstEnum->pData == NULL ) return FALSE;
+	if ( Command_CapGetArray( pRefSrc->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)pstEnum, NULL, NULL ) == FALSE ) {
+		free( pstEnum->pData );
+		pstEnum->pData = NULL;
+		return FALSE;
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Return the elements of an enum read by ReadPyEnum as a list of strings.
+static PyObject* MakePyEnumList( ULONG ulCapID, LPNkMAIDEnum pstEnum )
+{
+	PyObject* pList = PyList_New( 0 );
+	char psString[64], *psStr;
+	ULONG ulOffset = 0, i;
+
+	if ( pList == NULL ) return NULL;
+	for ( i = 0; i < pstEnum->ulElements; i++ ) {
+		if ( pstEnum->ulType == kNkMAIDArrayType_PackedString ) {
+			// The elements of a packed string are counted from the strings.
+			if ( ulOffset >= pstEnum->ulElements * pstEnum->wPhysicalBytes ) break;
+			psStr = (char*)pstEnum->pData + ulOffset;
+			ulOffset += (ULONG)strlen( psStr ) + 1;
+		} else if ( pstEnum->ulType == kNkMAIDArrayType_String ) {
+			psStr = (char*)((NkMAIDString*)pstEnum->pData)[i].str;
+		} else {
+			psStr = GetEnumString( ulCapID, ((ULONG*)pstEnum->pData)[i], psString );
+		}
+		PyObject* pItem = PyUnicode_DecodeLatin1( psStr, strlen( psStr ), NULL );
+		if ( pItem == NULL || PyList_Append( pList, pItem ) != 0 ) {
+			Py_XDECREF( pItem );
+			Py_DECREF( pList );
+			return NULL;
+		}
+		Py_DECREF( pItem );
+	}
+	return pList;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the source and the module, and unload the module file.
+static void ClosePySession( void )
+{
+	if ( g_pPyRefMod != NULL ) {
+		if ( g_bPyLiveView == TRUE ) StopRemoteLiveView( g_pPyRefSrc, g_ulPyLiveViewSaved );
+		g_bPyLiveView = FALSE;
+		if ( g_pPyRefSrc != NULL ) RemoveChild( g_pPyRefMod, g_pPyRefSrc->lMyID );
+		g_pPyRefSrc = NULL;
+		// The buffers of the frames still held by the script are kept.
+		FreeLiveViewRing();
+		FreeMemorySink();
+		if ( g_pPyRefMod->pObject != NULL && Close_Module( g_pPyRefMod ) == FALSE )
+			puts( "Module object can not be closed." );
+		if ( g_pPyRefMod->pObject != NULL ) free( g_pPyRefMod->pObject );
+		free( g_pPyRefMod );
+		g_pPyRefMod = NULL;
+	}
+#if defined( _WIN32 )
+	if ( g_hInstModule != NULL ) FreeLibrary( g_hInstModule );
+	g_hInstModule = NULL;
+#elif defined(__APPLE__)
+	if ( gBundle != NULL ) {
+		CFBundleUnloadExecutable( gBundle );
+		CFRelease( gBundle );
+		gBundle = NULL;
+	}
+#endif
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Open the module and its first source, as main() and SourceCommandLoop do. Returns an error message or NULL.
+static const char* OpenPySession( const char* pszPath )
+{
+#if defined( _WIN32 )
+	char	ModulePath[MAX_PATH];
+#elif defined(__APPLE__)
+	char	ModulePath[PATH_MAX] = {0};
+#endif
+	NkMAIDEnum	stEnum;
+	ULONG	ulSrcID;
+
+	if ( pszPath == NULL ) pszPath = getenv( "NKMAID_MODULE" );
+	if ( pszPath != NULL ) {
+		strncpy( ModulePath, pszPath, sizeof(ModulePath) - 1 );
+		ModulePath[sizeof(ModulePath) - 1] = '\0';
+	} else if ( Search_Module( ModulePath ) == FALSE ) {
+		return "\"Type0023 Module\" is not found";
+	}
+	if ( Load_Module( ModulePath ) == FALSE ) return "failed in loading \"Type0023 Module\"";
+
+	g_pPyRefMod = (LPRefObj)malloc( sizeof(RefObj) );
+	if ( g_pPyRefMod == NULL ) return "there is not enough memory";
+	InitRefObj( g_pPyRefMod );
+	g_pPyRefMod->pObject = (LPNkMAIDObject)malloc( sizeof(NkMAIDObject) );
+	if ( g_pPyRefMod->pObject == NULL ) return "there is not enough memory";
+	g_pPyRefMod->pObject->refClient = (NKREF)g_pPyRefMod;
+	if ( Command_Open( NULL, g_pPyRefMod->pObject, 0 ) == FALSE ) {
+		free( g_pPyRefMod->pObject );
+		g_pPyRefMod->pObject = NULL;
+		return "module object can't be opened";
+	}
+	if ( EnumCapabilities( g_pPyRefMod->pObject, &(g_pPyRefMod->ulCapCount), &(g_pPyRefMod->pCapArray), NULL, NULL ) == FALSE )
+		return "failed in enumeration of capabilities";
+	if ( SetProc( g_pPyRefMod ) == FALSE ) return "failed in setting a call back function";
+	if ( CheckCapabilityOperation( g_pPyRefMod, kNkMAIDCapability_ModuleMode, kNkMAIDCapOperation_Set ) ) {
+		if ( Command_CapSet( g_pPyRefMod->pObject, kNkMAIDCapability_ModuleMode, kNkMAIDDataType_Unsigned,
+									(NKPARAM)kNkMAIDModuleMode_Controller, NULL, NULL ) == FALSE )
+			return "failed in setting kNkMAIDCapability_ModuleMode";
+	}
+
+#if defined(__APPLE__)
+	// Run the main run loop to pop the "Device Added" event.
+	CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+	do {
+		CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0.01, true );
+	} while ( CFAbsoluteTimeGetCurrent() - startTime <= 1.0 );
+#endif
+	Command_Async( g_pPyRefMod->pObject );
+
+	// The first camera is opened.
+	if ( GetCapInfo( g_pPyRefMod, kNkMAIDCapability_Children ) == NULL ) return "the module has no camera";
+	if ( ReadPyEnum( g_pPyRefMod, kNkMAIDCapability_Children, &stEnum ) == FALSE ) return "failed in reading the cameras";
+	if ( stEnum.ulElements == 0 || stEnum.wPhysicalBytes != 4 ) {
+		free( stEnum.pData );
+		return "there is no camera";
+	}
+	ulSrcID = ((ULONG*)stEnum.pData)[0];
+	free( stEnum.pData );
+	if ( AddChild( g_pPyRefMod, ulSrcID ) == FALSE ) return "source object can't be opened";
+	g_pPyRefSrc = GetRefChildPtr_ID( g_pPyRefMod, ulSrcID );
+	Command_CapGet( g_pPyRefSrc->pObject, kNkMAIDCapability_CameraType, kNkMAIDDataType_UnsignedPtr, (NKPARAM)&g_ulCameraType, NULL, NULL );
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.open( [module_path] )
+static PyObject* PyMaid_Open( PyObject* self, PyObject* args )
+{
+	const char* pszPath = NULL;
+	const char* pszError;
+
+	if ( !PyArg_ParseTuple( args, "|z:open", &pszPath ) ) return NULL;
+	if ( g_pPyRefSrc != NULL ) return PyLong_FromLong( g_pPyRefSrc->lMyID );
+
+	Py_BEGIN_ALLOW_THREADS
+	pszError = OpenPySession( pszPath );
+	if ( pszError != NULL ) ClosePySession();
+	Py_END_ALLOW_THREADS
+	if ( pszError != NULL ) {
+		PyErr_SetString( g_pPyError, pszError );
+		return NULL;
+	}
+	return PyLong_FromLong( g_pPyRefSrc->lMyID );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.close()
+static PyObject* PyMaid_Close( PyObject* self, PyObject* args )
+{
+	Py_BEGIN_ALLOW_THREADS
+	ClosePySession();
+	Py_END_ALLOW_THREADS
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.get( cap )
+static PyObject* PyMaid_Get( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	LPNkMAIDCapInfo pCapInfo;
+	unsigned long ulCapID;
+	PyObject* pResult;
+	BOOL bRet;
+
+	if ( !PyArg_ParseTuple( args, "k:get", &ulCapID ) ) return NULL;
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( (pCapInfo = GetPyCapInfo( pRefSrc, (ULONG)ulCapID, kNkMAIDCapOperation_Get )) == NULL ) return NULL;
+
+	switch ( pCapInfo->ulType ) {
+		case kNkMAIDCapType_Boolean:
+		{
+			BYTE bFlag;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_BooleanPtr, (NKPARAM)&bFlag, NULL, NULL );
+			if ( bRet == TRUE ) return PyBool_FromLong( bFlag );
+			break;
+		}
+		case kNkMAIDCapType_Integer:
+		{
+			SLONG lValue;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_IntegerPtr, (NKPARAM)&lValue, NULL, NULL );
+			if ( bRet == TRUE ) return PyLong_FromLong( lValue );
+			break;
+		}
+		case kNkMAIDCapType_Unsigned:
+		{
+			ULONG ulValue;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_UnsignedPtr, (NKPARAM)&ulValue, NULL, NULL );
+			if ( bRet == TRUE ) return PyLong_FromUnsignedLong( ulValue );
+			break;
+		}
+		case kNkMAIDCapType_Float:
+		{
+			double lfValue;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_FloatPtr, (NKPARAM)&lfValue, NULL, NULL );
+			if ( bRet == TRUE ) return PyFloat_FromDouble( lfValue );
+			break;
+		}
+		case kNkMAIDCapType_Range:
+		{
+			NkMAIDRange stRange;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_RangePtr, (NKPARAM)&stRange, NULL, NULL );
+			if ( bRet == FALSE ) break;
+			// The value of a range with steps is calculated from its index.
+			if ( stRange.ulSteps > 1 )
+				return PyFloat_FromDouble( stRange.lfLower + ( stRange.lfUpper - stRange.lfLower ) * stRange.ulValueIndex / ( stRange.ulSteps - 1 ) );
+			return PyFloat_FromDouble( stRange.lfValue );
+		}
+		case kNkMAIDCapType_String:
+		{
+			NkMAIDString stString;
+			bRet = Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_StringPtr, (NKPARAM)&stString, NULL, NULL );
+			if ( bRet == TRUE ) return PyUnicode_DecodeLatin1( (char*)stString.str, strlen( (char*)stString.str ), NULL );
+			break;
+		}
+		case kNkMAIDCapType_Enum:
+		{
+			NkMAIDEnum stEnum;
+			PyObject* pList;
+			if ( ReadPyEnum( pRefSrc, ulCapID, &stEnum ) == FALSE ) break;
+			pList = MakePyEnumList( ulCapID, &stEnum );
+			free( stEnum.pData );
+			if ( pList == NULL ) return NULL;
+			if ( stEnum.ulValue >= (ULONG)PyList_Size( pList ) ) {
+				Py_DECREF( pList );
+				return RaiseCapError( "the current element is out of the enum", ulCapID );
+			}
+			pResult = PyList_GetItem( pList, stEnum.ulValue );
+			Py_INCREF( pResult );
+			Py_DECREF( pList );
+			return pResult;
+		}
+		default:
+			return RaiseCapError( "the type of the capability is not supported:", ulCapID );
+	}
+	return RaiseCapError( "failed in reading the capability", ulCapID );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.set( cap, value )
+static PyObject* PyMaid_Set( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	LPNkMAIDCapInfo pCapInfo;
+	unsigned long ulCapID;
+	PyObject* pValue;
+	BOOL bRet = FALSE;
+
+	if ( !PyArg_ParseTuple( args, "kO:set", &ulCapID, &pValue ) ) return NULL;
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( (pCapInfo = GetPyCapInfo( pRefSrc, (ULONG)ulCapID, kNkMAIDCapOperation_Set )) == NULL ) return NULL;
+
+	switch ( pCapInfo->ulType ) {
+		case kNkMAIDCapType_Boolean:
+		{
+			int iFlag = PyObject_IsTrue( pValue );
+			if ( iFlag < 0 ) return NULL;
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_Boolean, (NKPARAM)(iFlag ? TRUE : FALSE), NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_Integer:
+		{
+			long lValue = PyLong_AsLong( pValue );
+			if ( lValue == -1 && PyErr_Occurred() ) return NULL;
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_Integer, (NKPARAM)(SLONG)lValue, NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_Unsigned:
+		{
+			unsigned long ulValue = PyLong_AsUnsignedLong( pValue );
+			if ( ulValue == (unsigned long)-1 && PyErr_Occurred() ) return NULL;
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_Unsigned, (NKPARAM)(ULONG)ulValue, NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_Float:
+		{
+			double lfValue = PyFloat_AsDouble( pValue );
+			if ( lfValue == -1.0 && PyErr_Occurred() ) return NULL;
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_FloatPtr, (NKPARAM)&lfValue, NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_Range:
+		{
+			NkMAIDRange stRange;
+			double lfValue = PyFloat_AsDouble( pValue );
+			if ( lfValue == -1.0 && PyErr_Occurred() ) return NULL;
+			if ( Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_RangePtr, (NKPARAM)&stRange, NULL, NULL ) == FALSE ) break;
+			if ( lfValue < stRange.lfLower || lfValue > stRange.lfUpper ) return RaiseCapError( "the value is out of the range of", ulCapID );
+			// A range with steps takes the nearest step.
+			if ( stRange.ulSteps > 1 && stRange.lfUpper > stRange.lfLower )
+				stRange.ulValueIndex = (ULONG)( ( lfValue - stRange.lfLower ) * ( stRange.ulSteps - 1 ) / ( stRange.lfUpper - stRange.lfLower ) + 0.5 );
+			else
+				stRange.lfValue = lfValue;
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_RangePtr, (NKPARAM)&stRange, NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_String:
+		{
+			NkMAIDString stString;
+			const char* psz = PyUnicode_Check( pValue ) ? PyUnicode_AsUTF8( pValue ) : NULL;
+			if ( psz == NULL ) {
+				if ( !PyErr_Occurred() ) PyErr_SetString( PyExc_TypeError, "a string is needed" );
+				return NULL;
+			}
+			memset( &stString, 0, sizeof(stString) );
+			strncpy( (char*)stString.str, psz, sizeof(stString.str) - 1 );
+			bRet = Command_CapSet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_StringPtr, (NKPARAM)&stString, NULL, NULL );
+			break;
+		}
+		case kNkMAIDCapType_Enum:
+		{
+			NkMAIDEnum stEnum;
+			PyObject* pList;
+			Py_ssize_t lIndex;
+			if ( ReadPyEnum( pRefSrc, ulCapID, &stEnum ) == FALSE ) break;
+			pList = MakePyEnumList( ulCapID, &stEnum );
+			free( stEnum.pData );
+			if ( pList == NULL ) return NULL;
+			// An element is given by its string or its index.
+			if ( PyUnicode_Check( pValue ) ) {
+				for ( lIndex = 0; lIndex < PyList_Size( pList ); lIndex++ ) {
+					if ( PyUnicode_Compare( PyList_GetItem( pList, lIndex ), pValue ) == 0 ) break;
+				}
+			} else {
+				lIndex = PyLong_AsSsize_t( pValue );
+				if ( lIndex == -1 && PyErr_Occurred() ) {
+					Py_DECREF( pList );
+					return NULL;
+				}
+			}
+			if ( lIndex < 0 || lIndex >= PyList_Size( pList ) ) {
+				Py_DECREF( pList );
+				return RaiseCapError( "the value is not an element of", ulCapID );
+			}
+			Py_DECREF( pList );
+			bRet = SetEnumIndex( pRefSrc, ulCapID, (ULONG)lIndex );
+			break;
+		}
+		default:
+			return RaiseCapError( "the type of the capability is not supported:", ulCapID );
+	}
+	if ( bRet == FALSE ) return RaiseCapError( "failed in setting the capability", ulCapID );
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.choices( cap )
+static PyObject* PyMaid_Choices( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	LPNkMAIDCapInfo pCapInfo;
+	unsigned long ulCapID;
+	NkMAIDEnum stEnum;
+	PyObject* pList;
+
+	if ( !PyArg_ParseTuple( args, "k:choices", &ulCapID ) ) return NULL;
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( (pCapInfo = GetPyCapInfo( pRefSrc, (ULONG)ulCapID, kNkMAIDCapOperation_Get )) == NULL ) return NULL;
+	if ( pCapInfo->ulType != kNkMAIDCapType_Enum ) return RaiseCapError( "the capability is not an enum:", ulCapID );
+	if ( ReadPyEnum( pRefSrc, ulCapID, &stEnum ) == FALSE ) return RaiseCapError( "failed in reading the capability", ulCapID );
+	pList = MakePyEnumList( ulCapID, &stEnum );
+	free( stEnum.pData );
+	return pList;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.capture( [cap] )
+static PyObject* PyMaid_Capture( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	unsigned long ulCapID = kNkMAIDCapability_CaptureAsync;
+	BOOL bRet;
+
+	if ( !PyArg_ParseTuple( args, "|k:capture", &ulCapID ) ) return NULL;
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( GetPyCapInfo( pRefSrc, (ULONG)ulCapID, kNkMAIDCapOperation_Start ) == NULL ) return NULL;
+
+	// IssueProcess waits for the completion, so other Python threads run in the meantime.
+	Py_BEGIN_ALLOW_THREADS
+	bRet = IssueProcess( pRefSrc, (ULONG)ulCapID );
+	Py_END_ALLOW_THREADS
+	if ( bRet == FALSE ) return RaiseCapError( "failed in starting the capability", ulCapID );
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.poll()
+static PyObject* PyMaid_Poll( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	Command_Async( pRefSrc->pObject );
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// give the buffer of a frame back to the live view ring or the memory sink.
+static void ReleasePyFrameData( LPPyFrame pFrame )
+{
+	if ( pFrame->ulKind == kPyFrame_LiveView )
+		ReleaseLiveViewFrame( pFrame->pLiveView );
+	else if ( pFrame->ulKind == kPyFrame_Memory )
+		ReleaseMemorySinkFrame( &pFrame->stFrame );
+	pFrame->ulKind = kPyFrame_Released;
+	pFrame->pLiveView = NULL;
+	pFrame->stFrame.pucData = NULL;
+	pFrame->stFrame.ulLength = 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// make a Frame of a live view frame or a file of the memory sink. The buffer is released if the Frame can't be made.
+static PyObject* MakePyFrame( LPLiveViewFrame pLiveView, LPMemorySinkFrame pMemory )
+{
+	LPPyFrame pFrame = PyObject_New( PyFrame, &g_stPyFrameType );
+
+	if ( pFrame == NULL ) {
+		if ( pLiveView != NULL ) ReleaseLiveViewFrame( pLiveView );
+		if ( pMemory != NULL ) ReleaseMemorySinkFrame( pMemory );
+		return NULL;
+	}
+	pFrame->lExports = 0;
+	pFrame->pLiveView = pLiveView;
+	if ( pLiveView != NULL ) {
+		pFrame->ulKind = kPyFrame_LiveView;
+		memset( &pFrame->stFrame, 0, sizeof(MemorySinkFrame) );
+		pFrame->stFrame.lBuffer = -1;
+		pFrame->stFrame.ulRoute = kSinkRoute_LiveView;
+		pFrame->stFrame.ulLength = pLiveView->ulSize;
+		pFrame->stFrame.ullSeq = pLiveView->ullSeq;
+		pFrame->stFrame.ullTime = pLiveView->ullTime;
+		pFrame->stFrame.pucData = pLiveView->pucData;
+		sprintf( pFrame->stFrame.szName, "LiveView%08llu.jpg", (unsigned long long)pLiveView->ullSeq );
+		pFrame->ulOffset = pLiveView->ulHeaderSize;
+	} else {
+		pFrame->ulKind = kPyFrame_Memory;
+		pFrame->stFrame = *pMemory;
+		pFrame->ulOffset = 0;
+	}
+	return (PyObject*)pFrame;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The buffer of a frame is read-only, and it is exported as it is.
+static int PyFrame_GetBuffer( PyObject* self, Py_buffer* view, int flags )
+{
+	LPPyFrame pFrame = (LPPyFrame)self;
+
+	if ( pFrame->ulKind == kPyFrame_Released ) {
+		view->obj = NULL;
+		PyErr_SetString( PyExc_ValueError, "the frame was released" );
+		return -1;
+	}
+	if ( PyBuffer_FillInfo( view, self, pFrame->stFrame.pucData, pFrame->stFrame.ulLength, 1, flags ) < 0 ) return -1;
+	pFrame->lExports++;
+	return 0;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+static void PyFrame_ReleaseBuffer( PyObject* self, Py_buffer* view )
+{
+	((LPPyFrame)self)->lExports--;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// The buffer is given back when the Frame is deleted; no view can be alive at that point, since a view refers to the Frame.
+static void PyFrame_Dealloc( PyObject* self )
+{
+	ReleasePyFrameData( (LPPyFrame)self );
+	Py_TYPE( self )->tp_free( self );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Frame.release()
+static PyObject* PyFrame_Release( PyObject* self, PyObject* args )
+{
+	LPPyFrame pFrame = (LPPyFrame)self;
+
+	if ( pFrame->lExports > 0 ) {
+		PyErr_SetString( PyExc_BufferError, "the frame can't be released while a view of it is alive" );
+		return NULL;
+	}
+	ReleasePyFrameData( pFrame );
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// with frame:
+static PyObject* PyFrame_Enter( PyObject* self, PyObject* args )
+{
+	Py_INCREF( self );
+	return self;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+static PyObject* PyFrame_Exit( PyObject* self, PyObject* args )
+{
+	return PyFrame_Release( self, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+//
+static Py_ssize_t PyFrame_Length( PyObject* self )
+{
+	return (Py_ssize_t)((LPPyFrame)self)->stFrame.ulLength;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// the attributes of a Frame
+static PyObject* PyFrame_GetName( PyObject* self, void* closure )
+{
+	return PyUnicode_DecodeLatin1( ((LPPyFrame)self)->stFrame.szName, strlen( ((LPPyFrame)self)->stFrame.szName ), NULL );
+}
+static PyObject* PyFrame_GetRoute( PyObject* self, void* closure )
+{
+	return PyLong_FromUnsignedLong( ((LPPyFrame)self)->stFrame.ulRoute );
+}
+static PyObject* PyFrame_GetSeq( PyObject* self, void* closure )
+{
+	return PyLong_FromUnsignedLongLong( ((LPPyFrame)self)->stFrame.ullSeq );
+}
+static PyObject* PyFrame_GetTime( PyObject* self, void* closure )
+{
+	return PyLong_FromUnsignedLongLong( ((LPPyFrame)self)->stFrame.ullTime );
+}
+static PyObject* PyFrame_GetOffset( PyObject* self, void* closure )
+{
+	return PyLong_FromUnsignedLong( ((LPPyFrame)self)->ulOffset );
+}
+static PyObject* PyFrame_GetReleased( PyObject* self, void* closure )
+{
+	return PyBool_FromLong( ((LPPyFrame)self)->ulKind == kPyFrame_Released );
+}
+
+static PyBufferProcs g_stPyFrameBuffer = { PyFrame_GetBuffer, PyFrame_ReleaseBuffer };
+
+static PySequenceMethods g_stPyFrameSequence = { PyFrame_Length };
+
+static PyMethodDef g_stPyFrameMethods[] = {
+	{ "release", PyFrame_Release, METH_NOARGS, "release() -> None. Give the buffer back. No view of the frame may be alive." },
+	{ "__enter__", PyFrame_Enter, METH_NOARGS, NULL },
+	{ "__exit__", PyFrame_Exit, METH_VARARGS, NULL },
+	{ NULL, NULL, 0, NULL }
+};
+
+static PyGetSetDef g_stPyFrameGetSet[] = {
+	{ (char*)"name", PyFrame_GetName, NULL, (char*)"the file name of the data", NULL },
+	{ (char*)"route", PyFrame_GetRoute, NULL, (char*)"the route of the data, one of Route_*", NULL },
+	{ (char*)"seq", PyFrame_GetSeq, NULL, (char*)"the sequence number of the frame", NULL },
+	{ (char*)"time", PyFrame_GetTime, NULL, (char*)"the host time when the frame arrived, usec", NULL },
+	{ (char*)"offset", PyFrame_GetOffset, NULL, (char*)"where the image starts; a live view image has a header before it", NULL },
+	{ (char*)"released", PyFrame_GetReleased, NULL, (char*)"True after release()", NULL },
+	{ NULL, NULL, NULL, NULL, NULL }
+};
+//------------------------------------------------------------------------------------------------------------------------------------
+// fill the type of Frame. It has no constructor; a Frame is made by liveview() or take().
+static int InitPyFrameType( void )
+{
+	memset( &g_stPyFrameType, 0, sizeof(PyTypeObject) );
+	Py_SET_REFCNT( (PyObject*)&g_stPyFrameType, 1 );
+	g_stPyFrameType.tp_name = "nkmaid.Frame";
+	g_stPyFrameType.tp_basicsize = sizeof(PyFrame);
+	g_stPyFrameType.tp_flags = Py_TPFLAGS_DEFAULT;
+	g_stPyFrameType.tp_doc = "A delivered file or a live view image, read in place through the buffer protocol.";
+	g_stPyFrameType.tp_dealloc = PyFrame_Dealloc;
+	g_stPyFrameType.tp_as_buffer = &g_stPyFrameBuffer;
+	g_stPyFrameType.tp_as_sequence = &g_stPyFrameSequence;
+	g_stPyFrameType.tp_methods = g_stPyFrameMethods;
+	g_stPyFrameType.tp_getset = g_stPyFrameGetSet;
+	return PyType_Ready( &g_stPyFrameType );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.items()
+static PyObject* PyMaid_Items( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	NkMAIDEnum stEnum;
+	PyObject* pList;
+	ULONG i;
+
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( GetPyCapInfo( pRefSrc, kNkMAIDCapability_Children, kNkMAIDCapOperation_Get ) == NULL ) return NULL;
+	if ( ReadPyEnum( pRefSrc, kNkMAIDCapability_Children, &stEnum ) == FALSE || stEnum.wPhysicalBytes != 4 ) {
+		free( stEnum.pData );
+		return RaiseCapError( "failed in reading the capability", kNkMAIDCapability_Children );
+	}
+	pList = PyList_New( stEnum.ulElements );
+	for ( i = 0; pList != NULL && i < stEnum.ulElements; i++ ) {
+		PyObject* pItem = PyLong_FromUnsignedLong( ((ULONG*)stEnum.pData)[i] );
+		if ( pItem == NULL ) {
+			Py_CLEAR( pList );
+			break;
+		}
+		PyList_SET_ITEM( pList, i, pItem );
+	}
+	free( stEnum.pData );
+	return pList;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.acquire( item [, data] )
+// The objects are opened as in the Item and Data menus, and the ones opened here are closed again.
+static PyObject* PyMaid_Acquire( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc, pRefItm, pRefDat;
+	unsigned long ulItemID, ulDataType = kNkMAIDDataObjType_Image;
+	BOOL bItemOpened = FALSE, bDataOpened = FALSE, bRet;
+
+	if ( !PyArg_ParseTuple( args, "k|k:acquire", &ulItemID, &ulDataType ) ) return NULL;
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+
+	pRefItm = GetRefChildPtr_ID( pRefSrc, (SLONG)ulItemID );
+	if ( pRefItm == NULL ) {
+		if ( AddChild( pRefSrc, (SLONG)ulItemID ) == FALSE ) {
+			PyErr_SetString( g_pPyError, "the item can't be opened" );
+			return NULL;
+		}
+		pRefItm = GetRefChildPtr_ID( pRefSrc, (SLONG)ulItemID );
+		bItemOpened = TRUE;
+	}
+	pRefDat = GetRefChildPtr_ID( pRefItm, (SLONG)ulDataType );
+	if ( pRefDat == NULL && AddChild( pRefItm, (SLONG)ulDataType ) == TRUE ) {
+		pRefDat = GetRefChildPtr_ID( pRefItm, (SLONG)ulDataType );
+		bDataOpened = TRUE;
+	}
+
+	// IssueAcquire waits for the delivery, so other Python threads run in the meantime.
+	bRet = FALSE;
+	Py_BEGIN_ALLOW_THREADS
+	if ( pRefDat != NULL ) bRet = IssueAcquire( pRefDat );
+	if ( bItemOpened == TRUE )
+		RemoveChild( pRefSrc, (SLONG)ulItemID );
+	else if ( bDataOpened == TRUE )
+		RemoveChild( pRefItm, (SLONG)ulDataType );
+	Py_END_ALLOW_THREADS
+	if ( pRefDat == NULL ) {
+		PyErr_SetString( g_pPyError, "the data object can't be opened" );
+		return NULL;
+	}
+	if ( bRet == FALSE ) {
+		PyErr_SetString( g_pPyError, "failed in acquiring the data" );
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.keep( [route [, on]] )
+static PyObject* PyMaid_Keep( PyObject* self, PyObject* args )
+{
+	unsigned long ulRoute = kSinkRoute_Image;
+	int bOn = 1;
+
+	if ( !PyArg_ParseTuple( args, "|kp:keep", &ulRoute, &bOn ) ) return NULL;
+	if ( SetSinkRoute( (ULONG)ulRoute, bOn ? kSinkKind_Memory : kSinkKind_File, NULL ) == FALSE ) {
+		PyErr_SetString( PyExc_ValueError, "the route is out of range" );
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.take( [route] )
+static PyObject* PyMaid_Take( PyObject* self, PyObject* args )
+{
+	PyObject* pRoute = Py_None;
+	ULONG ulRoute = kSinkRoute_Count;
+	MemorySinkFrame stFrame;
+
+	if ( !PyArg_ParseTuple( args, "|O:take", &pRoute ) ) return NULL;
+	if ( pRoute != Py_None ) {
+		ulRoute = (ULONG)PyLong_AsUnsignedLong( pRoute );
+		if ( PyErr_Occurred() ) return NULL;
+	}
+	if ( TakeMemorySinkFrame( ulRoute, &stFrame ) == FALSE ) Py_RETURN_NONE;
+	return MakePyFrame( NULL, &stFrame );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.start_liveview()
+static PyObject* PyMaid_StartLiveView( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	BOOL bRet;
+
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( g_bPyLiveView == TRUE ) Py_RETURN_NONE;
+	Py_BEGIN_ALLOW_THREADS
+	bRet = StartRemoteLiveView( pRefSrc, &g_ulPyLiveViewSaved );
+	Py_END_ALLOW_THREADS
+	if ( bRet == FALSE ) return RaiseCapError( "failed in setting the capability", kNkMAIDCapability_LiveViewStatus );
+	g_bPyLiveView = TRUE;
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.stop_liveview()
+static PyObject* PyMaid_StopLiveView( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	BOOL bRet;
+
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( g_bPyLiveView == FALSE ) Py_RETURN_NONE;
+	g_bPyLiveView = FALSE;
+	Py_BEGIN_ALLOW_THREADS
+	bRet = StopRemoteLiveView( pRefSrc, g_ulPyLiveViewSaved );
+	Py_END_ALLOW_THREADS
+	if ( bRet == FALSE ) return RaiseCapError( "failed in setting the capability", kNkMAIDCapability_LiveViewStatus );
+	Py_RETURN_NONE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.liveview()
+static PyObject* PyMaid_LiveView( PyObject* self, PyObject* args )
+{
+	LPRefObj pRefSrc;
+	LPLiveViewFrame pLiveView;
+
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( GetPyCapInfo( pRefSrc, kNkMAIDCapability_GetLiveViewImage, kNkMAIDCapOperation_GetArray ) == NULL ) return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	pLiveView = GrabLiveViewFrame( pRefSrc );
+	Py_END_ALLOW_THREADS
+	if ( pLiveView == NULL ) {
+		PyErr_SetString( g_pPyError, "no live view image can be read, or all buffers are held by the frames not released" );
+		return NULL;
+	}
+	return MakePyFrame( pLiveView, NULL );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// nkmaid.intervalometer( period, shots[, policy[, delay]] )
+static PyObject* PyMaid_Intervalometer( PyObject* self, PyObject* args, PyObject* kwargs )
+{
+	static const char* pszKeywords[] = { "period", "shots", "policy", "delay", NULL };
+	LPRefObj pRefSrc;
+	Intervalometer stInterval;
+	IntervalStats stStats;
+	double dPeriod, dDelay = 0.0;
+	unsigned long ulShots, ulPolicy = kIntervalPolicy_Skip;
+	BOOL bRet;
+
+	if ( !PyArg_ParseTupleAndKeywords( args, kwargs, "dk|kd:intervalometer", (char**)pszKeywords, &dPeriod, &ulShots, &ulPolicy, &dDelay ) ) return NULL;
+	if ( dPeriod * 1000 < INTERVAL_PERIOD_MIN || ulShots < 1 || ulShots > INTERVAL_SHOTS_MAX || dDelay < 0.0 ||
+		( ulPolicy != kIntervalPolicy_Skip && ulPolicy != kIntervalPolicy_CatchUp ) ) {
+		PyErr_SetString( PyExc_ValueError, "invalid period, shots, policy or delay" );
+		return NULL;
+	}
+	if ( (pRefSrc = GetPySource()) == NULL ) return NULL;
+	if ( GetPyCapInfo( pRefSrc, kNkMAIDCapability_CaptureAsync, kNkMAIDCapOperation_Start ) == NULL ) return NULL;
+	if ( InitIntervalometer( &stInterval, (NK_UINT_64)( dPeriod * 1000000 ), (ULONG)ulShots, (ULONG)ulPolicy, (NK_UINT_64)( dDelay * 1000000 ) ) == FALSE )
+		return PyErr_NoMemory();
+
+	// The whole run is done here, so other Python threads run in the meantime. Ctrl+C stops it.
+	Py_BEGIN_ALLOW_THREADS
+	bRet = RunIntervalometer( pRefSrc, &stInterval );
+	Py_END_ALLOW_THREADS
+	GetIntervalStats( &stInterval, &stStats );
+	FreeIntervalometer( &stInterval );
+	if ( stInterval.bCanceled == TRUE ) {
+		PyErr_SetString( PyExc_KeyboardInterrupt, "the intervalometer was canceled" );
+		return NULL;
+	}
+	if ( bRet == FALSE ) return RaiseCapError( "failed in starting the capability", kNkMAIDCapability_CaptureAsync );
+	return Py_BuildValue( "{s:k,s:k,s:k,s:k,s:d,s:d,s:l,s:l,s:l,s:l,s:d,s:K}",
+		"fired", (unsigned long)stStats.ulFired, "skipped", (unsigned long)stStats.ulSkipped,
+		"overruns", (unsigned long)stStats.ulOverruns, "errors", (unsigned long)stStats.ulErrors,
+		"late_mean", stStats.dLateMean, "late_sd", stStats.dLateStdDev,
+		"late_min", (long)stStats.lLateMin, "late_median", (long)stStats.lLateMedian,
+		"late_p99", (long)stStats.lLateP99, "late_max", (long)stStats.lLateMax,
+		"issue_mean", stStats.dIssueMean, "issue_max", (unsigned long long)stStats.ullIssueMax );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+
+static PyMethodDef g_stPyMaidMethods[] = {
+	{ "open", PyMaid_Open, METH_VARARGS, "open([module_path]) -> source ID. Open the module and the first camera." },
+	{ "close", PyMaid_Close, METH_NOARGS, "close() -> None. Close the camera and the module." },
+	{ "get", PyMaid_Get, METH_VARARGS, "get(cap) -> the current value of a capability of the camera." },
+	{ "set", PyMaid_Set, METH_VARARGS, "set(cap, value) -> None. An enum takes the string of an element or its index." },
+	{ "choices", PyMaid_Choices, METH_VARARGS, "choices(cap) -> the strings of the elements of an enum capability." },
+	{ "capture", PyMaid_Capture, METH_VARARGS, "capture([cap]) -> None. Issue a process capability, CaptureAsync by default, and wait for it." },
+	{ "poll", PyMaid_Poll, METH_NOARGS, "poll() -> None. Let the module deliver its events." },
+	{ "items", PyMaid_Items, METH_NOARGS, "items() -> the IDs of the items of the camera." },
+	{ "acquire", PyMaid_Acquire, METH_VARARGS, "acquire(item[, data]) -> None. Deliver the image, or another data object, of an item to the sink of its route." },
+	{ "keep", PyMaid_Keep, METH_VARARGS, "keep([route[, on]]) -> None. Keep the files of a route, Route_Image by default, in memory for take()." },
+	{ "take", PyMaid_Take, METH_VARARGS, "take([route]) -> the oldest file kept in memory as a Frame, or None." },
+	{ "start_liveview", PyMaid_StartLiveView, METH_NOARGS, "start_liveview() -> None. Turn the remote live view on." },
+	{ "stop_liveview", PyMaid_StopLiveView, METH_NOARGS, "stop_liveview() -> None. Restore the live view status." },
+	{ "liveview", PyMaid_LiveView, METH_NOARGS, "liveview() -> the next live view image as a Frame." },
+	{ "intervalometer", (PyCFunction)(void(*)(void))PyMaid_Intervalometer, METH_VARARGS | METH_KEYWORDS,
+		"intervalometer(period, shots[, policy[, delay]]) -> stats. Take the pictures every period seconds on a fixed grid; the lateness is in usec." },
+	{ NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef g_stPyMaidModule = {
+	PyModuleDef_HEAD_INIT, "nkmaid", "In-process control of a Nikon camera through the MAID module.", -1, g_stPyMaidMethods
+};
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// The capabilities used by the scripts are given names; any other capability is given by its number.
+PyMODINIT_FUNC PyInit_nkmaid( void )
+{
+	PyObject* pModule;
+
+	if ( InitPyFrameType() < 0 ) return NULL;
+	pModule = PyModule_Create( &g_stPyMaidModule );
+	if ( pModule == NULL ) return NULL;
+	g_pPyError = PyErr_NewException( "nkmaid.error", NULL, NULL );
+	Py_XINCREF( g_pPyError );
+	if ( PyModule_AddObject( pModule, "error", g_pPyError ) < 0 ) {
+		Py_XDECREF( g_pPyError );
+		Py_DECREF( pModule );
+		return NULL;
+	}
+	Py_INCREF( &g_stPyFrameType );
+	if ( PyModule_AddObject( pModule, "Frame", (PyObject*)&g_stPyFrameType ) < 0 ) {
+		Py_DECREF( &g_stPyFrameType );
+		Py_DECREF( pModule );
+		return NULL;
+	}
+	PyModule_AddIntConstant( pModule, "ShutterSpeed", kNkMAIDCapability_ShutterSpeed );
+	PyModule_AddIntConstant( pModule, "Aperture", kNkMAIDCapability_Aperture );
+	PyModule_AddIntConstant( pModule, "Sensitivity", kNkMAIDCapability_Sensitivity );
+	PyModule_AddIntConstant( pModule, "ExposureMode", kNkMAIDCapability_ExposureMode );
+	PyModule_AddIntConstant( pModule, "SaveMedia", kNkMAIDCapability_SaveMedia );
+	PyModule_AddIntConstant( pModule, "SaveMedia_Card", kNkMAIDSaveMedia_Card );
+	PyModule_AddIntConstant( pModule, "SaveMedia_SDRAM", kNkMAIDSaveMedia_SDRAM );
+	PyModule_AddIntConstant( pModule, "SaveMedia_Card_SDRAM", kNkMAIDSaveMedia_Card_SDRAM );
+	PyModule_AddIntConstant( pModule, "Capture", kNkMAIDCapability_Capture );
+	PyModule_AddIntConstant( pModule, "CaptureAsync", kNkMAIDCapability_CaptureAsync );
+	PyModule_AddIntConstant( pModule, "AFCaptureAsync", kNkMAIDCapability_AFCaptureAsync );
+	PyModule_AddIntConstant( pModule, "BatteryLevel", kNkMAIDCapability_BatteryLevel );
+	PyModule_AddIntConstant( pModule, "Route_Image", kSinkRoute_Image );
+	PyModule_AddIntConstant( pModule, "Route_Thumbnail", kSinkRoute_Thumbnail );
+	PyModule_AddIntConstant( pModule, "Route_LiveView", kSinkRoute_LiveView );
+	PyModule_AddIntConstant( pModule, "Data_Image", kNkMAIDDataObjType_Image );
+	PyModule_AddIntConstant( pModule, "Data_Thumbnail", kNkMAIDDataObjType_Thumbnail );
+	PyModule_AddIntConstant( pModule, "Policy_Skip", kIntervalPolicy_Skip );
+	PyModule_AddIntConstant( pModule, "Policy_CatchUp", kIntervalPolicy_CatchUp );
+	return pModule;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
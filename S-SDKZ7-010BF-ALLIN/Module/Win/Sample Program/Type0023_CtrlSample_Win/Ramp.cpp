@@ -0,0 +1,389 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Exposure ramping for the interval shooting.
+// The scene is metered on the live view. Every frame is decoded at 1/8, which needs only the DC
+// coefficients, and the mean of the luma is compared with the target. The difference is converted
+// to stops and added to the current exposure, and the result is smoothed over a time constant.
+// The elements of ShutterSpeed, Aperture and Sensitivity are converted to stops of light and sorted.
+// After a picture was taken, the exposure is moved by one element of one capability toward the
+// smoothed exposure, so the exposure changes by the smallest step between the pictures.
+// For more light, the shutter speed is made slower up to a limit, then the sensitivity is raised
+// and then the aperture is opened. For less light, the order is reversed.
+// The exposure mode of the camera must be M, and the live view must show the exposure.
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+	#include <emmintrin.h>
+	#define RAMP_SSE2
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define RAMP_TARGET_DEFAULT			110		// mean luma of the live view
+#define RAMP_TIME_CONSTANT_DEFAULT	30		// sec
+#define RAMP_SETTLE_DEFAULT			1000	// msec to skip the live view after a change
+#define RAMP_ISO_MAX_DEFAULT		6400
+#define RAMP_GAMMA					2.2f	// the luma of the live view is not linear
+#define RAMP_CORRECTION_MAX			3.0f	// stops from one frame
+#define RAMP_HYSTERESIS				0.1f	// stops over the half of a step
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// Convert an element of ShutterSpeed, Aperture or Sensitivity to stops of light.
+// The elements which do not have a value, like Bulb or Hi 1.0, return FALSE.
+BOOL ParseRampValue( ULONG ulCapID, const char* psz, float* pfEV )
+{
+	char* pszEnd;
+	double dValue;
+
+	switch ( ulCapID ) {
+		case kNkMAIDCapability_ShutterSpeed:
+			// "1/250", "0.3\"" or "30\""
+			if ( strncmp( psz, "1/", 2 ) == 0 ) {
+				dValue = strtod( psz + 2, &pszEnd );
+				if ( pszEnd == psz + 2 || dValue <= 0 ) return FALSE;
+				*pfEV = (float)-log2( dValue );
+				return TRUE;
+			}
+			dValue = strtod( psz, &pszEnd );
+			if ( pszEnd == psz || dValue <= 0 ) return FALSE;
+			if ( *pszEnd != '\"' && *pszEnd != 's' && *pszEnd != '\0' ) return FALSE;
+			*pfEV = (float)log2( dValue );
+			return TRUE;
+		case kNkMAIDCapability_Aperture:
+			// "5.6", "f/5.6" or "F5.6". A wider aperture gives more light.
+			if ( strncmp( psz, "f/", 2 ) == 0 ) psz += 2;
+			else if ( *psz == 'F' || *psz == 'f' ) psz++;
+			dValue = strtod( psz, &pszEnd );
+			if ( pszEnd == psz || dValue <= 0 ) return FALSE;
+			*pfEV = (float)( -2.0 * log2( dValue ) );
+			return TRUE;
+		case kNkMAIDCapability_Sensitivity:
+			// "100" or "ISO 100". Lo and Hi are not used.
+			if ( strncmp( psz, "ISO", 3 ) == 0 ) psz += 3;
+			while ( *psz == ' ' ) psz++;
+			if ( *psz < '0' || *psz > '9' ) return FALSE;
+			dValue = strtod( psz, &pszEnd );
+			if ( dValue <= 0 ) return FALSE;
+			*pfEV = (float)log2( dValue / 100.0 );
+			return TRUE;
+		default:
+			return FALSE;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Read the elements of an enum capability into pAxis in the order of the light.
+BOOL ReadRampAxis( LPRefObj pRefSrc, ULONG ulCapID, LPRampAxis pAxis )
+{
+	NkMAIDEnum	stEnum;
+	RampStop	stStop;
+	char	psString[64], *psStr;
+	ULONG	ulOffset, ulElement, i, j;
+	LPNkMAIDCapInfo pCapInfo = GetCapInfo( pRefSrc, ulCapID );
+
+	memset( pAxis, 0, sizeof(RampAxis) );
+	pAxis->ulCapID = ulCapID;
+	if ( pCapInfo == NULL || pCapInfo->ulType != kNkMAIDCapType_Enum ) return FALSE;
+	if ( !CheckCapabilityOperation( pRefSrc, ulCapID, kNkMAIDCapOperation_Get ) ) return FALSE;
+	if ( !CheckCapabilityOperation( pRefSrc, ulCapID, kNkMAIDCapOperation_Set ) ) return FALSE;
+	if ( Command_CapGet( pRefSrc->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL ) == FALSE ) return FALSE;
+	if ( stEnum.ulElements == 0 ) return FALSE;
+	if ( stEnum.ulType != kNkMAIDArrayType_PackedString && stEnum.ulType != kNkMAIDArrayType_Unsigned ) return FALSE;
+
+	stEnum.pData = malloc( stEnum.ulElements * stEnum.wPhysicalBytes );
+	if ( stEnum.pData == NULL ) return FALSE;
+	if ( Command_CapGetArray( pRefSrc->pObject, ulCapID, kNkMAIDDataType_EnumPtr, (NKPARAM)&stEnum, NULL, NULL ) == FALSE ) {
+		free( stEnum.pData );
+		return FALSE;
+	}
+
+	// The elements of a packed string are counted from the strings.
+	for ( ulOffset = 0, ulElement = 0; ulOffset < stEnum.ulElements * stEnum.wPhysicalBytes && pAxis->ulCount < RAMP_AXIS_MAX; ulElement++ ) {
+		if ( stEnum.ulType == kNkMAIDArrayType_PackedString ) {
+			psStr = (char*)stEnum.pData + ulOffset;
+			ulOffset += (ULONG)strlen( psStr ) + 1;
+		} else {
+			psStr = GetEnumString( ulCapID, ((ULONG*)stEnum.pData)[ulElement], psString );
+			ulOffset += stEnum.wPhysicalBytes;
+		}
+		if ( ParseRampValue( ulCapID, psStr, &stStop.fEV ) == FALSE ) continue;
+		stStop.ulIndex = ulElement;
+		strncpy( stStop.szName, psStr, sizeof(stStop.szName) - 1 );
+		stStop.szName[sizeof(stStop.szName) - 1] = '\0';
+		// insert in the order of the light
+		for ( i = pAxis->ulCount; i > 0 && pAxis->stStop[i - 1].fEV > stStop.fEV; i-- )
+			pAxis->stStop[i] = pAxis->stStop[i - 1];
+		pAxis->stStop[i] = stStop;
+		pAxis->ulCount++;
+	}
+	free( stEnum.pData );
+	if ( pAxis->ulCount == 0 ) return FALSE;
+
+	// The current element must have a value to start the ramp.
+	for ( j = 0; j < pAxis->ulCount; j++ )
+		if ( pAxis->stStop[j].ulIndex == stEnum.ulValue ) break;
+	if ( j == pAxis->ulCount ) {
+		printf( "The current %s cannot be used for the ramp.\n", pCapInfo->szDescription );
+		return FALSE;
+	}
+	pAxis->ulPos = j;
+	pAxis->ulLow = 0;
+	pAxis->ulHigh = pAxis->ulCount - 1;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Limit the positions of pAxis to the stops between fLow and fHigh. The current position is always included.
+void LimitRampAxis( LPRampAxis pAxis, float fLow, float fHigh )
+{
+	ULONG i;
+
+	pAxis->ulLow = pAxis->ulPos;
+	pAxis->ulHigh = pAxis->ulPos;
+	for ( i = 0; i < pAxis->ulCount; i++ ) {
+		if ( pAxis->stStop[i].fEV < fLow - 0.01f || pAxis->stStop[i].fEV > fHigh + 0.01f ) continue;
+		if ( i < pAxis->ulLow ) pAxis->ulLow = i;
+		if ( i > pAxis->ulHigh ) pAxis->ulHigh = i;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Return the mean of the luma.
+float GetMeanLuma( LPJpegLuma pLuma )
+{
+	NK_UINT_64 ullSum = 0;
+	ULONG x, y;
+
+	if ( pLuma->wWidth == 0 || pLuma->wHeight == 0 ) return 0.0f;
+	for ( y = 0; y < pLuma->wHeight; y++ ) {
+		const UCHAR* p = pLuma->pucLuma + y * pLuma->ulStride;
+		x = 0;
+#if defined( RAMP_SSE2 )
+		// _mm_sad_epu8 against zero sums each half of 16 bytes.
+		__m128i vZero = _mm_setzero_si128();
+		__m128i vSum = _mm_setzero_si128();
+		for ( ; x + 16 <= pLuma->wWidth; x += 16 )
+			vSum = _mm_add_epi64( vSum, _mm_sad_epu8( _mm_loadu_si128( (const __m128i*)(p + x) ), vZero ) );
+		ullSum += (ULONG)_mm_cvtsi128_si32( vSum ) + (ULONG)_mm_cvtsi128_si32( _mm_srli_si128( vSum, 8 ) );
+#endif
+		for ( ; x < pLuma->wWidth; x++ )
+			ullSum += p[x];
+	}
+	return (float)ullSum / ( (float)pLuma->wWidth * pLuma->wHeight );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Return the current exposure in stops of light.
+float GetRampExposure( LPExposureRamp pRamp )
+{
+	return pRamp->stShutter.stStop[pRamp->stShutter.ulPos].fEV +
+			pRamp->stAperture.stStop[pRamp->stAperture.ulPos].fEV +
+			pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulPos].fEV;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Add the exposure measured on a frame to the smoothed exposure.
+void UpdateRampEstimate( LPExposureRamp pRamp, float fMeanLuma, NK_UINT_64 ullTime )
+{
+	float fCorrection, fSample, fAlpha;
+
+	if ( fMeanLuma < 1.0f ) fMeanLuma = 1.0f;
+	fCorrection = RAMP_GAMMA * (float)log2( pRamp->ulTarget / fMeanLuma );
+	if ( fCorrection > RAMP_CORRECTION_MAX ) fCorrection = RAMP_CORRECTION_MAX;
+	if ( fCorrection < -RAMP_CORRECTION_MAX ) fCorrection = -RAMP_CORRECTION_MAX;
+	fSample = GetRampExposure( pRamp ) + fCorrection;
+
+	if ( pRamp->bEstimated == FALSE ) {
+		pRamp->fDesired = fSample;
+		pRamp->bEstimated = TRUE;
+	} else {
+		// The weight of a frame depends on the time from the last frame, so it does not depend on the frame rate.
+		fAlpha = 1.0f - (float)exp( -(double)( ullTime - pRamp->ullLastSample ) / ( pRamp->ulTimeConstant * 1000000.0 ) );
+		pRamp->fDesired += fAlpha * ( fSample - pRamp->fDesired );
+	}
+	pRamp->fMeanLuma = fMeanLuma;
+	pRamp->ullLastSample = ullTime;
+	pRamp->ulMeasured++;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Select the capability and the direction of the next step. Returns NULL if the exposure is close enough or at the limit.
+LPRampAxis PlanRampStep( LPExposureRamp pRamp, SLONG* plDelta )
+{
+	LPRampAxis pOrder[3] = { &pRamp->stShutter, &pRamp->stSensitivity, &pRamp->stAperture };
+	LPRampAxis pAxis;
+	float fError = pRamp->fDesired - GetRampExposure( pRamp );
+	ULONG i;
+
+	for ( i = 0; i < 3; i++ ) {
+		if ( fError > 0 ) {
+			// more light: shutter, sensitivity, aperture
+			pAxis = pOrder[i];
+			if ( pAxis->ulPos >= pAxis->ulHigh ) continue;
+			if ( fError < ( pAxis->stStop[pAxis->ulPos + 1].fEV - pAxis->stStop[pAxis->ulPos].fEV ) * 0.5f + RAMP_HYSTERESIS ) return NULL;
+			*plDelta = 1;
+			return pAxis;
+		} else {
+			// less light: aperture, sensitivity, shutter
+			pAxis = pOrder[2 - i];
+			if ( pAxis->ulPos <= pAxis->ulLow ) continue;
+			if ( -fError < ( pAxis->stStop[pAxis->ulPos].fEV - pAxis->stStop[pAxis->ulPos - 1].fEV ) * 0.5f + RAMP_HYSTERESIS ) return NULL;
+			*plDelta = -1;
+			return pAxis;
+		}
+	}
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Move the exposure by one step toward the smoothed exposure. Returns TRUE if the exposure was changed.
+BOOL StepRamp( LPRefObj pRefSrc, LPExposureRamp pRamp )
+{
+	LPRampAxis pAxis;
+	SLONG lDelta = 0;
+	ULONG ulPos;
+
+	pAxis = PlanRampStep( pRamp, &lDelta );
+	if ( pAxis == NULL ) return FALSE;
+	ulPos = (ULONG)( (SLONG)pAxis->ulPos + lDelta );
+	if ( SetEnumIndex( pRefSrc, pAxis->ulCapID, pAxis->stStop[ulPos].ulIndex ) == FALSE ) {
+		pRamp->ulErrors++;
+		return FALSE;
+	}
+	printf( "%s -> %s\n", pAxis->stStop[pAxis->ulPos].szName, pAxis->stStop[ulPos].szName );
+	pAxis->ulPos = ulPos;
+	pRamp->ulChanges++;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// control procedure of the live view to meter the scene, take the pictures and ramp the exposure between them
+BOOL RampControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPExposureRamp pRamp = (LPExposureRamp)pContext;
+	LiveViewHeader stHeader;
+
+	// The live view during the capture or right after a change does not show the exposure.
+	if ( pRamp->ulCompleted < pRamp->ulCaptures ) return TRUE;
+	if ( pFrame->ullTime >= pRamp->ullSettleEnd ) {
+		if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ||
+			 DecodeJpegLuma( stHeader.pucJpeg, stHeader.ulJpegSize, 8, &pRamp->stLuma ) == FALSE ) {
+			pRamp->ulErrors++;
+			return ( pRamp->ulErrors < 100 ) ? TRUE : FALSE;
+		}
+		UpdateRampEstimate( pRamp, GetMeanLuma( &pRamp->stLuma ), pFrame->ullTime );
+	}
+	if ( pRamp->bEstimated == FALSE ) return TRUE;
+
+	// one step after each picture
+	if ( pRamp->bStepped == FALSE ) {
+		pRamp->bStepped = TRUE;
+		if ( StepRamp( pRefSrc, pRamp ) == TRUE )
+			pRamp->ullSettleEnd = GetHostTimeUs() + (NK_UINT_64)pRamp->ulSettle * 1000;
+	}
+	if ( pRamp->ullNext == 0 ) pRamp->ullNext = pFrame->ullTime;
+	if ( pFrame->ullTime < pRamp->ullNext ) return TRUE;
+	if ( pRamp->ulCaptures == pRamp->ulShots ) return FALSE;
+
+	if ( StartCaptureAsync( pRefSrc, &pRamp->ulCompleted ) == FALSE ) {
+		printf( "Failed in starting CaptureAsync.\n" );
+		pRamp->ulErrors++;
+	} else {
+		pRamp->ulCaptures++;
+		printf( "Shot %u/%u: %s %s %s (luma %.0f)\n", (unsigned)pRamp->ulCaptures, (unsigned)pRamp->ulShots,
+				pRamp->stShutter.stStop[pRamp->stShutter.ulPos].szName, pRamp->stAperture.stStop[pRamp->stAperture.ulPos].szName,
+				pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulPos].szName, pRamp->fMeanLuma );
+		if ( pRamp->pLog != NULL )
+			fprintf( pRamp->pLog, "%u,%llu,%.1f,%.2f,%.2f,%s,%s,%s\n", (unsigned)pRamp->ulCaptures, (unsigned long long)pFrame->ullTime,
+					pRamp->fMeanLuma, pRamp->fDesired, GetRampExposure( pRamp ),
+					pRamp->stShutter.stStop[pRamp->stShutter.ulPos].szName, pRamp->stAperture.stStop[pRamp->stAperture.ulPos].szName,
+					pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulPos].szName );
+	}
+	pRamp->bStepped = FALSE;
+	pRamp->ullNext += (NK_UINT_64)pRamp->ulInterval * 1000000;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the interval pictures with the exposure ramped by the settings input by the user.
+BOOL ExposureRampMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSaved, ulMaxShutter, ulMaxIso;
+	LPExposureRamp	pRamp;
+	BOOL	bRet;
+
+	// The context is large because of the names of the elements.
+	pRamp = (LPExposureRamp)malloc( sizeof(ExposureRamp) );
+	if ( pRamp == NULL ) return FALSE;
+	memset( pRamp, 0, sizeof(ExposureRamp) );
+	if ( ReadRampAxis( pRefSrc, kNkMAIDCapability_ShutterSpeed, &pRamp->stShutter ) == FALSE ||
+		 ReadRampAxis( pRefSrc, kNkMAIDCapability_Aperture, &pRamp->stAperture ) == FALSE ||
+		 ReadRampAxis( pRefSrc, kNkMAIDCapability_Sensitivity, &pRamp->stSensitivity ) == FALSE ) {
+		printf( "ShutterSpeed, Aperture and Sensitivity must be settable. Please set the exposure mode to M.\n" );
+		free( pRamp );
+		return TRUE;
+	}
+
+	printf( "Input the interval in seconds (1-3600)\n>" );
+	scanf( "%s", buf );
+	pRamp->ulInterval = atoi( buf );
+	if ( pRamp->ulInterval == 0 || pRamp->ulInterval > 3600 ) pRamp->ulInterval = 10;
+	printf( "Input the number of shots (1-100000)\n>" );
+	scanf( "%s", buf );
+	pRamp->ulShots = atoi( buf );
+	if ( pRamp->ulShots == 0 || pRamp->ulShots > 100000 ) pRamp->ulShots = 1;
+	printf( "Input the slowest shutter speed in seconds (0: %u)\n>", (unsigned)( ( pRamp->ulInterval + 1 ) / 2 ) );
+	scanf( "%s", buf );
+	ulMaxShutter = atoi( buf );
+	if ( ulMaxShutter == 0 || ulMaxShutter >= pRamp->ulInterval ) ulMaxShutter = ( pRamp->ulInterval + 1 ) / 2;
+	printf( "Input the highest sensitivity (0: %d)\n>", RAMP_ISO_MAX_DEFAULT );
+	scanf( "%s", buf );
+	ulMaxIso = atoi( buf );
+	if ( ulMaxIso == 0 ) ulMaxIso = RAMP_ISO_MAX_DEFAULT;
+	printf( "Input the target luma of the live view (1-254, 0: %d)\n>", RAMP_TARGET_DEFAULT );
+	scanf( "%s", buf );
+	pRamp->ulTarget = atoi( buf );
+	if ( pRamp->ulTarget == 0 || pRamp->ulTarget > 254 ) pRamp->ulTarget = RAMP_TARGET_DEFAULT;
+	printf( "Input the time constant of the smoothing in seconds (0: %d)\n>", RAMP_TIME_CONSTANT_DEFAULT );
+	scanf( "%s", buf );
+	pRamp->ulTimeConstant = atoi( buf );
+	if ( pRamp->ulTimeConstant == 0 ) pRamp->ulTimeConstant = RAMP_TIME_CONSTANT_DEFAULT;
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	pRamp->ulSettle = RAMP_SETTLE_DEFAULT;
+
+	// The aperture is not closed and the sensitivity is not lowered from the start.
+	LimitRampAxis( &pRamp->stShutter, -100.0f, (float)log2( (double)ulMaxShutter ) );
+	LimitRampAxis( &pRamp->stSensitivity, pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulPos].fEV, (float)log2( ulMaxIso / 100.0 ) );
+	LimitRampAxis( &pRamp->stAperture, pRamp->stAperture.stStop[pRamp->stAperture.ulPos].fEV, 100.0f );
+	printf( "Shutter %s - %s, Sensitivity %s - %s, Aperture %s - %s\n",
+			pRamp->stShutter.stStop[pRamp->stShutter.ulLow].szName, pRamp->stShutter.stStop[pRamp->stShutter.ulHigh].szName,
+			pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulLow].szName, pRamp->stSensitivity.stStop[pRamp->stSensitivity.ulHigh].szName,
+			pRamp->stAperture.stStop[pRamp->stAperture.ulLow].szName, pRamp->stAperture.stStop[pRamp->stAperture.ulHigh].szName );
+
+	pRamp->pLog = fopen( "Ramp.csv", "w" );
+	if ( pRamp->pLog != NULL )
+		fprintf( pRamp->pLog, "shot,time_us,luma,target_ev,exposure_ev,shutter,aperture,sensitivity\n" );
+
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		if ( pRamp->pLog != NULL ) fclose( pRamp->pLog );
+		free( pRamp );
+		return FALSE;
+	}
+	CheckFocusBeforeSequence( pRefSrc );
+	printf( "Ramping. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, 0, RampControl, pRamp );
+	// RampControl stops the live view by FALSE after the last shot.
+	if ( pRamp->ulCaptures == pRamp->ulShots ) bRet = TRUE;
+	IdleLoop( pRefSrc->pObject, &pRamp->ulCompleted, pRamp->ulCaptures );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+	if ( pRamp->pLog != NULL ) fclose( pRamp->pLog );
+	FreeJpegLuma( &pRamp->stLuma );
+
+	printf( "%u shots, %u changes, %u measurements, %u errors\n",
+			(unsigned)pRamp->ulCaptures, (unsigned)pRamp->ulChanges, (unsigned)pRamp->ulMeasured, (unsigned)pRamp->ulErrors );
+	free( pRamp );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
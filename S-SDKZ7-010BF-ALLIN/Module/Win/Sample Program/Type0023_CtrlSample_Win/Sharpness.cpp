@@ -0,0 +1,292 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Sharpness of the live view.
+// The luma of a frame is decoded at a reduced scale, and the score is the variance of its Laplacian
+// (4c - l - r - u - d). It is measured for each region of a 3x3 grid in one pass, and the score of
+// the whole frame is made from the sums of the regions. With SSE2, 8 pixels are processed at once.
+// The scores are kept as a time series. A peaking image marks the pixels with a strong Laplacian.
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+	#include <emmintrin.h>
+	#define SHARPNESS_SSE2
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define SHARPNESS_SERIES_MAX		1024
+#define SHARPNESS_SCALE_DEFAULT		2		// the luma is decoded at 1/2
+#define PEAKING_THRESHOLD			48
+
+SharpnessSample	g_stSharpnessSeries[SHARPNESS_SERIES_MAX];
+NK_UINT_64	g_ullSharpnessCount = 0;			// number of samples ever added
+std::mutex	g_SharpnessMutex;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// sums of the Laplacian of a rectangle. Pixels on the edge of the luma are not used.
+void SumLaplacian( const UCHAR* pucLuma, ULONG ulStride, ULONG ulWidth, ULONG ulHeight,
+					ULONG ulLeft, ULONG ulTop, ULONG ulRight, ULONG ulBottom, LPLaplacianSums pSums )
+{
+	ULONG x, y;
+
+	if ( ulLeft < 1 ) ulLeft = 1;
+	if ( ulTop < 1 ) ulTop = 1;
+	if ( ulRight > ulWidth - 1 ) ulRight = ulWidth - 1;
+	if ( ulBottom > ulHeight - 1 ) ulBottom = ulHeight - 1;
+	if ( ulWidth < 3 || ulHeight < 3 || ulLeft >= ulRight || ulTop >= ulBottom ) return;
+
+	for ( y = ulTop; y < ulBottom; y++ ) {
+		const UCHAR* pucRow = pucLuma + y * ulStride;
+		const UCHAR* pucUp = pucRow - ulStride;
+		const UCHAR* pucDown = pucRow + ulStride;
+		SLONG lSum = 0;
+		NK_UINT_64 ullSquare = 0;
+		x = ulLeft;
+#if defined( SHARPNESS_SSE2 )
+		{
+			__m128i vZero = _mm_setzero_si128();
+			__m128i vOne = _mm_set1_epi16( 1 );
+			__m128i vSum = _mm_setzero_si128();
+			__m128i vSquare = _mm_setzero_si128();
+			SLONG lLanes[4];
+			for ( ; x + 8 <= ulRight; x += 8 ) {
+				__m128i vC = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)(pucRow + x) ), vZero );
+				__m128i vL = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)(pucRow + x - 1) ), vZero );
+				__m128i vR = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)(pucRow + x + 1) ), vZero );
+				__m128i vU = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)(pucUp + x) ), vZero );
+				__m128i vD = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*)(pucDown + x) ), vZero );
+				__m128i vLap = _mm_sub_epi16( _mm_slli_epi16( vC, 2 ), _mm_add_epi16( _mm_add_epi16( vL, vR ), _mm_add_epi16( vU, vD ) ) );
+				vSum = _mm_add_epi32( vSum, _mm_madd_epi16( vLap, vOne ) );
+				// A lane holds at most 2 * 1020^2 per step, so a row of 8000 pixels fits in 32 bits.
+				vSquare = _mm_add_epi32( vSquare, _mm_madd_epi16( vLap, vLap ) );
+			}
+			_mm_storeu_si128( (__m128i*)lLanes, vSum );
+			lSum += lLanes[0] + lLanes[1] + lLanes[2] + lLanes[3];
+			_mm_storeu_si128( (__m128i*)lLanes, vSquare );
+			ullSquare += (NK_UINT_64)(ULONG)lLanes[0] + (ULONG)lLanes[1] + (ULONG)lLanes[2] + (ULONG)lLanes[3];
+		}
+#endif
+		for ( ; x < ulRight; x++ ) {
+			SLONG lLap = 4 * pucRow[x] - pucRow[x - 1] - pucRow[x + 1] - pucUp[x] - pucDown[x];
+			lSum += lLap;
+			ullSquare += (NK_UINT_64)( lLap * lLap );
+		}
+		pSums->llSum += lSum;
+		pSums->ullSquare += ullSquare;
+		pSums->ullCount += ulRight - ulLeft;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// variance of the Laplacian
+float GetLaplacianVariance( LPLaplacianSums pSums )
+{
+	double dMean, dSquare;
+	if ( pSums->ullCount == 0 ) return 0.0f;
+	dMean = (double)pSums->llSum / pSums->ullCount;
+	dSquare = (double)pSums->ullSquare / pSums->ullCount;
+	return (float)( dSquare - dMean * dMean );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// score the sharpness of the whole luma and of the 3x3 regions
+void ScoreSharpness( LPJpegLuma pLuma, LPSharpnessSample pSample )
+{
+	LaplacianSums stTotal, stRegion;
+	ULONG i, j;
+
+	memset( &stTotal, 0, sizeof(stTotal) );
+	for ( j = 0; j < 3; j++ ) {
+		for ( i = 0; i < 3; i++ ) {
+			memset( &stRegion, 0, sizeof(stRegion) );
+			SumLaplacian( pLuma->pucLuma, pLuma->ulStride, pLuma->wWidth, pLuma->wHeight,
+							pLuma->wWidth * i / 3, pLuma->wHeight * j / 3, pLuma->wWidth * (i + 1) / 3, pLuma->wHeight * (j + 1) / 3, &stRegion );
+			pSample->fRegion[j * 3 + i] = GetLaplacianVariance( &stRegion );
+			stTotal.llSum += stRegion.llSum;
+			stTotal.ullSquare += stRegion.ullSquare;
+			stTotal.ullCount += stRegion.ullCount;
+		}
+	}
+	pSample->fScore = GetLaplacianVariance( &stTotal );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// decode a live view frame and score it. pLuma keeps the decoded luma and is reused for the later frames.
+BOOL MeasureSharpness( LPLiveViewFrame pFrame, ULONG ulScale, LPJpegLuma pLuma, LPSharpnessSample pSample )
+{
+	LiveViewHeader stHeader;
+	NK_UINT_64 ullStart = GetHostTimeUs();
+
+	memset( pSample, 0, sizeof(SharpnessSample) );
+	if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ) return FALSE;
+	if ( DecodeJpegLuma( stHeader.pucJpeg, stHeader.ulJpegSize, ulScale, pLuma ) == FALSE ) return FALSE;
+	ScoreSharpness( pLuma, pSample );
+	pSample->ullSeq = pFrame->ullSeq;
+	pSample->ullTime = pFrame->ullTime;
+	pSample->ulProcessTime = (ULONG)( GetHostTimeUs() - ullStart );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// add a sample to the time series
+void AddSharpnessSample( LPSharpnessSample pSample )
+{
+	std::lock_guard<std::mutex> lock( g_SharpnessMutex );
+	g_stSharpnessSeries[g_ullSharpnessCount % SHARPNESS_SERIES_MAX] = *pSample;
+	g_ullSharpnessCount++;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// copy the latest samples of the time series, oldest first. Returns the number of samples.
+ULONG GetSharpnessSeries( LPSharpnessSample pSamples, ULONG ulMax )
+{
+	ULONG ulCount, i;
+	std::lock_guard<std::mutex> lock( g_SharpnessMutex );
+
+	ulCount = ( g_ullSharpnessCount < SHARPNESS_SERIES_MAX ) ? (ULONG)g_ullSharpnessCount : SHARPNESS_SERIES_MAX;
+	if ( ulCount > ulMax ) ulCount = ulMax;
+	for ( i = 0; i < ulCount; i++ )
+		pSamples[i] = g_stSharpnessSeries[(g_ullSharpnessCount - ulCount + i) % SHARPNESS_SERIES_MAX];
+	return ulCount;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// copy the latest sample of the time series
+BOOL GetLatestSharpness( LPSharpnessSample pSample )
+{
+	std::lock_guard<std::mutex> lock( g_SharpnessMutex );
+	if ( g_ullSharpnessCount == 0 ) return FALSE;
+	*pSample = g_stSharpnessSeries[(g_ullSharpnessCount - 1) % SHARPNESS_SERIES_MAX];
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// save the luma as PGM. The pixels with a strong Laplacian are painted white if bPeaking is TRUE.
+BOOL SavePeakingImage( LPJpegLuma pLuma, const char* pszFileName, BOOL bPeaking )
+{
+	FILE* hFile;
+	UCHAR* pucRow;
+	ULONG x, y;
+
+	hFile = fopen( pszFileName, "wb" );
+	if ( hFile == NULL ) {
+		printf( "%s can't be opened.\n", pszFileName );
+		return FALSE;
+	}
+	pucRow = (UCHAR*)malloc( pLuma->wWidth );
+	if ( pucRow == NULL ) {
+		fclose( hFile );
+		return FALSE;
+	}
+	fprintf( hFile, "P5\n%u %u\n255\n", pLuma->wWidth, pLuma->wHeight );
+	for ( y = 0; y < pLuma->wHeight; y++ ) {
+		const UCHAR* p = pLuma->pucLuma + y * pLuma->ulStride;
+		for ( x = 0; x < pLuma->wWidth; x++ ) {
+			pucRow[x] = p[x] / 2;
+			if ( bPeaking == TRUE && x > 0 && y > 0 && x + 1 < pLuma->wWidth && y + 1 < pLuma->wHeight ) {
+				SLONG lLap = 4 * p[x] - p[x - 1] - p[x + 1] - (p - pLuma->ulStride)[x] - (p + pLuma->ulStride)[x];
+				if ( lLap > PEAKING_THRESHOLD || lLap < -PEAKING_THRESHOLD ) pucRow[x] = 255;
+			}
+		}
+		fwrite( pucRow, 1, pLuma->wWidth, hFile );
+	}
+	free( pucRow );
+	fclose( hFile );
+	printf( "%s was saved.\n", pszFileName );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// consumer of the live view frames to score them
+void SharpnessConsumer( LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPSharpnessContext pSharp = (LPSharpnessContext)pContext;
+	SharpnessSample stSample;
+	ULONG i;
+
+	if ( MeasureSharpness( pFrame, pSharp->ulScale, &pSharp->stLuma, &stSample ) == FALSE ) {
+		pSharp->ulErrors++;
+		return;
+	}
+	AddSharpnessSample( &stSample );
+	if ( pSharp->pCsv != NULL ) {
+		fprintf( pSharp->pCsv, "%llu,%llu,%u,%.1f", (unsigned long long)stSample.ullSeq, (unsigned long long)stSample.ullTime,
+					(unsigned)stSample.ulProcessTime, stSample.fScore );
+		for ( i = 0; i < 9; i++ )
+			fprintf( pSharp->pCsv, ",%.1f", stSample.fRegion[i] );
+		fprintf( pSharp->pCsv, "\n" );
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// print the latest score once a second
+BOOL SharpnessControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	NK_UINT_64* pullLastPrint = (NK_UINT_64*)pContext;
+	SharpnessSample stSample;
+
+	if ( pFrame->ullTime - *pullLastPrint < 1000000 ) return TRUE;
+	*pullLastPrint = pFrame->ullTime;
+	if ( GetLatestSharpness( &stSample ) == FALSE ) return TRUE;
+	printf( "Frame %llu  sharpness %.1f  [%.0f %.0f %.0f / %.0f %.0f %.0f / %.0f %.0f %.0f]  %u usec\n",
+			(unsigned long long)stSample.ullSeq, stSample.fScore,
+			stSample.fRegion[0], stSample.fRegion[1], stSample.fRegion[2], stSample.fRegion[3], stSample.fRegion[4],
+			stSample.fRegion[5], stSample.fRegion[6], stSample.fRegion[7], stSample.fRegion[8], (unsigned)stSample.ulProcessTime );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Score the sharpness of the live view continuously.
+BOOL LiveViewSharpnessMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSeconds, ulSaved;
+	NK_UINT_64	ullLastPrint = 0, ullFrames = 0, ullDropped = 0;
+	SharpnessContext	stSharp;
+	SLONG	lConsumer;
+	BOOL	bRet;
+
+	memset( &stSharp, 0, sizeof(stSharp) );
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	printf( "Input the duration in seconds (0: until Ctrl+C)\n>" );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+	printf( "Select the scale of the analysis (1: 1/1, 2: 1/2, 4: 1/4, 8: 1/8)\n>" );
+	scanf( "%s", buf );
+	stSharp.ulScale = atoi( buf );
+	if ( stSharp.ulScale != 1 && stSharp.ulScale != 2 && stSharp.ulScale != 4 && stSharp.ulScale != 8 )
+		stSharp.ulScale = SHARPNESS_SCALE_DEFAULT;
+	printf( "Save the time series to Sharpness.csv? (1: Yes, 0: No)\n>" );
+	scanf( "%s", buf );
+	if ( atoi( buf ) == 1 ) {
+		stSharp.pCsv = fopen( "Sharpness.csv", "w" );
+		if ( stSharp.pCsv != NULL )
+			fprintf( stSharp.pCsv, "seq,time_us,process_us,score,r0,r1,r2,r3,r4,r5,r6,r7,r8\n" );
+	}
+
+	lConsumer = AddLiveViewConsumer( "Sharpness", SharpnessConsumer, &stSharp );
+	if ( lConsumer < 0 || StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		RemoveLiveViewConsumer( lConsumer );
+		if ( stSharp.pCsv != NULL ) fclose( stSharp.pCsv );
+		return FALSE;
+	}
+	printf( "Scoring the live view. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, ulSeconds, SharpnessControl, &ullLastPrint );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+
+	GetLiveViewConsumerStats( lConsumer, &ullFrames, &ullDropped );
+	RemoveLiveViewConsumer( lConsumer );
+	printf( "%llu frames were scored, %llu frames were dropped by the analysis, %u errors.\n",
+			(unsigned long long)ullFrames, (unsigned long long)ullDropped, (unsigned)stSharp.ulErrors );
+	if ( stSharp.pCsv != NULL ) fclose( stSharp.pCsv );
+
+	if ( stSharp.stLuma.pucLuma != NULL ) {
+		printf( "Save the peaking image of the last frame? (1: Yes, 0: No)\n>" );
+		scanf( "%s", buf );
+		if ( atoi( buf ) == 1 )
+			SavePeakingImage( &stSharp.stLuma, "Peaking.pgm", TRUE );
+	}
+	FreeJpegLuma( &stSharp.stLuma );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,397 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Durability of the delivered files.
+// Every closed file is recorded in the session manifest. A file is recorded as "written" when
+// its data was handed to the system, and as "committed" only after it was flushed to the device.
+//   kWriteSync_None  : files are only written.
+//   kWriteSync_File  : every file is flushed when it is closed.
+//   kWriteSync_Group : closed files are queued, and the syncer thread flushes the queue when it
+//                      holds N files or the oldest file waited T msec (group commit).
+// On Mac, fsync hands the data of each file to the device and a single F_FULLFSYNC per group
+// flushes the cache of the device.
+// A downloaded movie also gets an "indexed" line with its duration, tracks and timecode, with
+// the description as the last field.
+
+#if defined( _WIN32 )
+	#include <io.h>
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define SYNC_QUEUE_MAX				256
+#define SYNC_GROUP_FILES_DEFAULT	16
+#define SYNC_GROUP_INTERVAL_DEFAULT	1000		// msec
+#define MANIFEST_FILE_NAME			"Manifest.txt"
+
+typedef struct tagSyncEntry
+{
+	char	szFileName[256];
+	NK_UINT_64	ullSize;
+	NK_UINT_64	ullQueued;				// msec
+#if defined( _WIN32 )
+	HANDLE	hFile;
+#elif defined(__APPLE__)
+	int	fd;
+#endif
+} SyncEntry, *LPSyncEntry;
+
+ULONG	g_ulSyncGroupFiles = SYNC_GROUP_FILES_DEFAULT;
+ULONG	g_ulSyncGroupInterval = SYNC_GROUP_INTERVAL_DEFAULT;
+
+SyncEntry	g_stSyncQueue[SYNC_QUEUE_MAX];
+ULONG	g_ulSyncQueued = 0;
+ULONG	g_ulSyncInFlight = 0;			// files taken by the syncer and not committed yet
+BOOL	g_bSyncerRunning = FALSE;
+BOOL	g_bSyncerStop = FALSE;
+BOOL	g_bSyncerFlush = FALSE;			// set by DrainSyncer to flush the queue without waiting
+std::mutex	g_SyncMutex;
+std::condition_variable	g_SyncCond;		// signaled when the queue should be flushed
+std::condition_variable	g_SyncDrained;	// signaled when a group was committed
+std::thread	g_Syncer;
+
+FILE*	g_pManifest = NULL;
+std::mutex	g_ManifestMutex;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// append a line to the session manifest. If bSync is TRUE, the manifest itself is flushed to the device.
+BOOL WriteManifest( const char* pszState, const char* pszFileName, NK_UINT_64 ullSize, BOOL bSync )
+{
+	BOOL bRet = TRUE;
+	std::lock_guard<std::mutex> lock( g_ManifestMutex );
+
+	if ( g_pManifest == NULL ) {
+		g_pManifest = fopen( MANIFEST_FILE_NAME, "a" );
+		if ( g_pManifest == NULL ) return FALSE;
+	}
+	fprintf( g_pManifest, "%llu\t%s\t%llu\t%s\n", (unsigned long long)GetProgressTime(), pszState, (unsigned long long)ullSize, pszFileName );
+	if ( fflush( g_pManifest ) != 0 ) bRet = FALSE;
+	if ( bRet == TRUE && bSync == TRUE ) {
+	#if defined( _WIN32 )
+		if ( FlushFileBuffers( (HANDLE)_get_osfhandle( _fileno( g_pManifest ) ) ) == FALSE ) bRet = FALSE;
+	#elif defined(__APPLE__)
+		if ( fcntl( fileno( g_pManifest ), F_FULLFSYNC ) != 0 ) bRet = FALSE;
+	#endif
+	}
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// append an "indexed" line with the contents of a file to the session manifest.
+BOOL WriteManifestInfo( const char* pszFileName, NK_UINT_64 ullSize, const char* pszInfo )
+{
+	std::lock_guard<std::mutex> lock( g_ManifestMutex );
+
+	if ( g_pManifest == NULL ) {
+		g_pManifest = fopen( MANIFEST_FILE_NAME, "a" );
+		if ( g_pManifest == NULL ) return FALSE;
+	}
+	fprintf( g_pManifest, "%llu\tindexed\t%llu\t%s\t%s\n", (unsigned long long)GetProgressTime(), (unsigned long long)ullSize, pszFileName, pszInfo );
+	return ( fflush( g_pManifest ) == 0 );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// close the session manifest.
+void CloseManifest( void )
+{
+	std::lock_guard<std::mutex> lock( g_ManifestMutex );
+	if ( g_pManifest != NULL ) {
+		fclose( g_pManifest );
+		g_pManifest = NULL;
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// flush the queued files to the device, close them and commit them in the manifest.
+void CommitSyncGroup( LPSyncEntry pEntry, ULONG ulCount )
+{
+	BOOL bSynced[SYNC_QUEUE_MAX];
+	ULONG ulNamed = 0;
+	ULONG i;
+
+	for ( i = 0; i < ulCount; i++ ) {
+	#if defined( _WIN32 )
+		bSynced[i] = FlushFileBuffers( pEntry[i].hFile );
+	#elif defined(__APPLE__)
+		bSynced[i] = ( fsync( pEntry[i].fd ) == 0 ) ? TRUE : FALSE;
+	#endif
+	}
+#if defined(__APPLE__)
+	// fsync doesn't flush the cache of the device. One F_FULLFSYNC flushes it for the whole group.
+	if ( ulCount > 0 && fcntl( pEntry[ulCount - 1].fd, F_FULLFSYNC ) != 0 ) {
+		for ( i = 0; i < ulCount; i++ )
+			bSynced[i] = FALSE;
+	}
+#endif
+	for ( i = 0; i < ulCount; i++ ) {
+	#if defined( _WIN32 )
+		CloseHandle( pEntry[i].hFile );
+	#elif defined(__APPLE__)
+		close( pEntry[i].fd );
+	#endif
+		// The files not recorded in the manifest have no name.
+		if ( pEntry[i].szFileName[0] == 0 ) continue;
+		if ( bSynced[i] == TRUE ) {
+			WriteManifest( "committed", pEntry[i].szFileName, pEntry[i].ullSize, FALSE );
+			ulNamed++;
+		} else {
+			printf( "Failed in flushing %s.\n", pEntry[i].szFileName );
+		}
+	}
+	if ( ulNamed > 0 )
+		WriteManifest( "group", "", ulNamed, TRUE );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// loop of the syncer thread
+void SyncerLoop( void )
+{
+	static SyncEntry stGroup[SYNC_QUEUE_MAX];
+	ULONG ulCount;
+
+	std::unique_lock<std::mutex> lock( g_SyncMutex );
+	while ( 1 ) {
+		if ( g_ulSyncQueued == 0 ) {
+			if ( g_bSyncerStop == TRUE ) break;
+			g_SyncCond.wait( lock );
+			continue;
+		}
+		// wait until the group is full or the oldest file waited long enough.
+		if ( g_ulSyncQueued < g_ulSyncGroupFiles && g_bSyncerStop == FALSE && g_bSyncerFlush == FALSE ) {
+			NK_UINT_64 ullDeadline = g_stSyncQueue[0].ullQueued + g_ulSyncGroupInterval;
+			NK_UINT_64 ullNow = GetProgressTime();
+			if ( ullNow < ullDeadline ) {
+				g_SyncCond.wait_for( lock, std::chrono::milliseconds( ullDeadline - ullNow ) );
+				continue;
+			}
+		}
+		ulCount = g_ulSyncQueued;
+		memcpy( stGroup, g_stSyncQueue, ulCount * sizeof(SyncEntry) );
+		g_ulSyncQueued = 0;
+		g_ulSyncInFlight = ulCount;
+
+		lock.unlock();
+		CommitSyncGroup( stGroup, ulCount );
+		lock.lock();
+
+		g_ulSyncInFlight = 0;
+		g_SyncDrained.notify_all();
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// start the syncer thread for the group commit.
+BOOL StartSyncer( void )
+{
+	std::lock_guard<std::mutex> lock( g_SyncMutex );
+	if ( g_bSyncerRunning == TRUE ) return TRUE;
+	g_bSyncerStop = FALSE;
+	g_Syncer = std::thread( SyncerLoop );
+	g_bSyncerRunning = TRUE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// commit the queued files and stop the syncer thread.
+BOOL StopSyncer( void )
+{
+	{
+		std::lock_guard<std::mutex> lock( g_SyncMutex );
+		if ( g_bSyncerRunning == FALSE ) return TRUE;
+		g_bSyncerStop = TRUE;
+		g_SyncCond.notify_all();
+	}
+	g_Syncer.join();
+	std::lock_guard<std::mutex> lock( g_SyncMutex );
+	g_bSyncerRunning = FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// commit the queued files now, and wait until they are committed.
+BOOL DrainSyncer( void )
+{
+	std::unique_lock<std::mutex> lock( g_SyncMutex );
+	if ( g_bSyncerRunning == FALSE ) return TRUE;
+	// The syncer flushes without waiting for a full group or the interval, while the group size stays as it was set.
+	g_bSyncerFlush = TRUE;
+	while ( g_ulSyncQueued > 0 || g_ulSyncInFlight > 0 ) {
+		g_SyncCond.notify_all();
+		g_SyncDrained.wait( lock );
+	}
+	g_bSyncerFlush = FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// apply the durability policy to a file whose data was written. This is called by CloseDataWriter before it closes the file.
+// In the group commit, the syncer takes over the file handle of a direct writer.
+BOOL CommitDataWriter( LPDataWriter pWriter )
+{
+	BOOL bRet = TRUE;
+	BOOL bQueued = FALSE;
+	BOOL bRunning;
+
+	if ( g_ulWriteSync == kWriteSync_None ) {
+		if ( pWriter->bManifest == TRUE )
+			WriteManifest( "written", pWriter->szFileName, pWriter->ullWritten, FALSE );
+		return TRUE;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( g_SyncMutex );
+		bRunning = g_bSyncerRunning;
+	}
+	if ( g_ulWriteSync == kWriteSync_Group && bRunning == TRUE ) {
+		SyncEntry stEntry;
+		strncpy( stEntry.szFileName, pWriter->bManifest == TRUE ? pWriter->szFileName : "", sizeof(stEntry.szFileName) - 1 );
+		stEntry.szFileName[sizeof(stEntry.szFileName) - 1] = 0;
+		stEntry.ullSize = pWriter->ullWritten;
+		stEntry.ullQueued = GetProgressTime();
+	#if defined( _WIN32 )
+		if ( pWriter->bDirect == TRUE ) {
+			stEntry.hFile = pWriter->hFile;
+		} else {
+			if ( DuplicateHandle( GetCurrentProcess(), (HANDLE)_get_osfhandle( _fileno( pWriter->pStream ) ),
+									GetCurrentProcess(), &stEntry.hFile, 0, FALSE, DUPLICATE_SAME_ACCESS ) == FALSE )
+				stEntry.hFile = INVALID_HANDLE_VALUE;
+		}
+		if ( stEntry.hFile != INVALID_HANDLE_VALUE )
+	#elif defined(__APPLE__)
+		stEntry.fd = ( pWriter->bDirect == TRUE ) ? pWriter->fd : dup( fileno( pWriter->pStream ) );
+		if ( stEntry.fd >= 0 )
+	#endif
+		{
+			std::lock_guard<std::mutex> lock( g_SyncMutex );
+			// The syncer may have been stopped since it was checked.
+			if ( g_bSyncerRunning == TRUE && g_ulSyncQueued < SYNC_QUEUE_MAX ) {
+				g_stSyncQueue[g_ulSyncQueued++] = stEntry;
+				if ( g_ulSyncQueued >= g_ulSyncGroupFiles )
+					g_SyncCond.notify_all();
+				bQueued = TRUE;
+			} else if ( pWriter->bDirect == FALSE ) {
+			#if defined( _WIN32 )
+				CloseHandle( stEntry.hFile );
+			#elif defined(__APPLE__)
+				close( stEntry.fd );
+			#endif
+			}
+		}
+		if ( bQueued == TRUE ) {
+			// The syncer closes the handle of the direct writer.
+			if ( pWriter->bDirect == TRUE ) {
+			#if defined( _WIN32 )
+				pWriter->hFile = INVALID_HANDLE_VALUE;
+			#elif defined(__APPLE__)
+				pWriter->fd = -1;
+			#endif
+			}
+			if ( pWriter->bManifest == TRUE )
+				WriteManifest( "written", pWriter->szFileName, pWriter->ullWritten, FALSE );
+			return TRUE;
+		}
+	}
+
+	// kWriteSync_File, or the queue is not available.
+	// The data is not in the system cache with the direct writer, but the metadata and the cache of the device may be.
+#if defined( _WIN32 )
+	HANDLE hFile = ( pWriter->bDirect == TRUE ) ? pWriter->hFile : (HANDLE)_get_osfhandle( _fileno( pWriter->pStream ) );
+	if ( FlushFileBuffers( hFile ) == FALSE ) bRet = FALSE;
+#elif defined(__APPLE__)
+	int fd = ( pWriter->bDirect == TRUE ) ? pWriter->fd : fileno( pWriter->pStream );
+	if ( fcntl( fd, F_FULLFSYNC ) != 0 ) bRet = FALSE;
+#endif
+	if ( bRet == TRUE && pWriter->bManifest == TRUE )
+		WriteManifest( "committed", pWriter->szFileName, pWriter->ullWritten, TRUE );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Write files with each durability policy, and show the throughput.
+BOOL BenchmarkWriter( void )
+{
+	static const ULONG ulPolicy[3] = { kWriteSync_None, kWriteSync_File, kWriteSync_Group };
+	static const char* pszPolicy[3] = { "None", "Every file", "Group" };
+	char	buf[256], filename[256];
+	ULONG	ulFiles, ulSizeKB, ulChunk, ulLeft, i, j;
+	ULONG	ulSaveSync = g_ulWriteSync;
+	NK_UINT_64	ullStart, ullWritten, ullCommitted;
+	LPVOID	pData;
+	DataWriter	stWriter;
+	BOOL	bSyncer;
+	BOOL	bRet = TRUE;
+
+	printf( "[Write Benchmark] Mode: %s\n", g_ulWriteMode == kWriteMode_Direct ? "Direct" : "Buffered" );
+	printf( "Input the number of files (1-%d)\n>", SYNC_QUEUE_MAX );
+	scanf( "%s", buf );
+	ulFiles = atoi( buf );
+	printf( "Input the size of a file in KB\n>" );
+	scanf( "%s", buf );
+	ulSizeKB = atoi( buf );
+	if ( ulFiles == 0 || ulFiles > SYNC_QUEUE_MAX || ulSizeKB == 0 ) return TRUE;
+
+	// The data is delivered in chunks of 1MB like DataProc.
+	pData = malloc( 0x100000 );
+	if ( pData == NULL ) {
+		puts( "There is not enough memory." );
+		return FALSE;
+	}
+	for ( i = 0; i < 0x100000; i++ )
+		((UCHAR*)pData)[i] = (UCHAR)(i * 31 + 7);
+	{
+		std::lock_guard<std::mutex> lock( g_SyncMutex );
+		bSyncer = g_bSyncerRunning;
+	}
+	StartSyncer();
+
+	printf( "%-12s %10s %10s %12s %12s\n", "Sync", "Files", "MB", "Written MB/s", "Durable MB/s" );
+	for ( j = 0; j < 3 && bRet == TRUE; j++ ) {
+		g_ulWriteSync = ulPolicy[j];
+		ullStart = GetProgressTime();
+		for ( i = 0; i < ulFiles && bRet == TRUE; i++ ) {
+			sprintf( filename, "Bench%03d.dat", (int)i );
+			if ( OpenDataWriter( &stWriter, filename, (NK_UINT_64)ulSizeKB * 1024 ) == FALSE ) {
+				bRet = FALSE;
+				break;
+			}
+			stWriter.bManifest = FALSE;
+			ulLeft = ulSizeKB * 1024;
+			while ( ulLeft > 0 && bRet == TRUE ) {
+				ulChunk = ( ulLeft > 0x100000 ) ? 0x100000 : ulLeft;
+				bRet = WriteDataWriter( &stWriter, pData, ulChunk );
+				ulLeft -= ulChunk;
+			}
+			if ( CloseDataWriter( &stWriter ) == FALSE ) bRet = FALSE;
+		}
+		ullWritten = GetProgressTime() - ullStart;
+		DrainSyncer();
+		ullCommitted = GetProgressTime() - ullStart;
+		if ( ullWritten == 0 ) ullWritten = 1;
+		if ( ullCommitted == 0 ) ullCommitted = 1;
+		// Without the sync the data is never known to be durable.
+		if ( ulPolicy[j] == kWriteSync_None )
+			printf( "%-12s %10u %10.1f %12.1f %12s\n", pszPolicy[j], (unsigned)ulFiles, ulFiles * ulSizeKB / 1024.0,
+					ulFiles * ulSizeKB / 1.024 / ullWritten, "-" );
+		else
+			printf( "%-12s %10u %10.1f %12.1f %12.1f\n", pszPolicy[j], (unsigned)ulFiles, ulFiles * ulSizeKB / 1024.0,
+					ulFiles * ulSizeKB / 1.024 / ullWritten, ulFiles * ulSizeKB / 1.024 / ullCommitted );
+		for ( i = 0; i < ulFiles; i++ ) {
+			sprintf( filename, "Bench%03d.dat", (int)i );
+			remove( filename );
+		}
+	}
+	if ( bRet == FALSE )
+		puts( "Failed in writing the benchmark files." );
+
+	if ( bSyncer == FALSE )
+		StopSyncer();
+	g_ulWriteSync = ulSaveSync;
+	free( pData );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,380 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// Subject tracking on the host.
+// A consumer of the live view decodes the luma of every frame at 1/4 and searches a template of
+// 16x16 pixels around the position predicted from the last frames. The best match is refined to
+// a fraction of a pixel, and the template follows the subject slowly while the match is good.
+// The position is converted to the coordinates of the whole area, which the AF frames in the
+// header of the live view use, and posted to a mailbox of one update. A newer update replaces
+// the one not sent yet, so the camera always gets the latest position. The control procedure
+// takes the update on the polling thread and sets kNkMAIDCapability_TrackingAFArea.
+// The latency from the arrival of the frame to the end of CapSet is written to Tracker.csv.
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+	#include <emmintrin.h>
+	#define TRACKER_SSE2
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <mutex>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define TRACKER_SCALE				4		// the luma is decoded at 1/4
+#define TRACKER_RADIUS_DEFAULT		12		// pixels of the luma to search around the prediction
+#define TRACKER_LOST_DEFAULT		24		// mean absolute difference of a lost match
+#define TRACKER_LOST_FRAMES			5		// frames of bad matches until the lock is lost
+#define TRACKER_BLEND_MAX			12		// the template is updated only under this difference
+
+TrackerUpdate	g_stTrackerPending;				// mailbox of the latest update
+BOOL	g_bTrackerPending = FALSE;
+std::mutex	g_TrackerMutex;
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// Sum the absolute differences between the template and the luma from pucLuma.
+ULONG SumTemplateDifference( const UCHAR* pucTemplate, const UCHAR* pucLuma, ULONG ulStride )
+{
+	ULONG ulSad = 0, y;
+#if defined( TRACKER_SSE2 )
+	__m128i vSum = _mm_setzero_si128();
+
+	// A row of the template is 16 bytes, and _mm_sad_epu8 sums each half.
+	for ( y = 0; y < TRACKER_TEMPLATE; y++ )
+		vSum = _mm_add_epi64( vSum, _mm_sad_epu8( _mm_loadu_si128( (const __m128i*)(pucTemplate + y * TRACKER_TEMPLATE) ),
+												  _mm_loadu_si128( (const __m128i*)(pucLuma + y * ulStride) ) ) );
+	ulSad = (ULONG)_mm_cvtsi128_si32( vSum ) + (ULONG)_mm_cvtsi128_si32( _mm_srli_si128( vSum, 8 ) );
+#else
+	ULONG x;
+	for ( y = 0; y < TRACKER_TEMPLATE; y++ ) {
+		for ( x = 0; x < TRACKER_TEMPLATE; x++ ) {
+			UCHAR a = pucTemplate[y * TRACKER_TEMPLATE + x], b = pucLuma[y * ulStride + x];
+			ulSad += ( a > b ) ? a - b : b - a;
+		}
+	}
+#endif
+	return ulSad;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Copy the luma from pucLuma to the template, or move the template a quarter of the way to it.
+void UpdateTemplate( UCHAR* pucTemplate, const UCHAR* pucLuma, ULONG ulStride, BOOL bBlend )
+{
+	ULONG y;
+
+	for ( y = 0; y < TRACKER_TEMPLATE; y++ ) {
+		UCHAR* pucDst = pucTemplate + y * TRACKER_TEMPLATE;
+		const UCHAR* pucSrc = pucLuma + y * ulStride;
+		if ( bBlend == FALSE ) {
+			memcpy( pucDst, pucSrc, TRACKER_TEMPLATE );
+			continue;
+		}
+#if defined( TRACKER_SSE2 )
+		__m128i vDst = _mm_loadu_si128( (const __m128i*)pucDst );
+		__m128i vSrc = _mm_loadu_si128( (const __m128i*)pucSrc );
+		_mm_storeu_si128( (__m128i*)pucDst, _mm_avg_epu8( vDst, _mm_avg_epu8( vDst, vSrc ) ) );
+#else
+		ULONG x;
+		for ( x = 0; x < TRACKER_TEMPLATE; x++ )
+			pucDst[x] = (UCHAR)( ( pucDst[x] + ( ( pucDst[x] + pucSrc[x] + 1 ) >> 1 ) + 1 ) >> 1 );
+#endif
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Find the template around (lCenterX, lCenterY). Returns the sum of the absolute differences of the best match.
+// The position of the template is its top left corner.
+ULONG SearchTemplate( LPSubjectTracker pTracker, SLONG lCenterX, SLONG lCenterY, ULONG ulRadius, float* pfX, float* pfY )
+{
+	LPJpegLuma pLuma = &pTracker->stLuma;
+	SLONG lMaxX = pLuma->wWidth - TRACKER_TEMPLATE, lMaxY = pLuma->wHeight - TRACKER_TEMPLATE;
+	SLONG lLeft, lRight, lTop, lBottom, x, y, lBestX, lBestY;
+	ULONG ulSad, ulBest = 0xFFFFFFFF;
+	ULONG ulLeft, ulRight, ulUp, ulDown;
+	float fDenominator;
+
+	// The prediction can be out of the luma.
+	if ( lCenterX < 0 ) lCenterX = 0;
+	if ( lCenterY < 0 ) lCenterY = 0;
+	if ( lCenterX > lMaxX ) lCenterX = lMaxX;
+	if ( lCenterY > lMaxY ) lCenterY = lMaxY;
+	lBestX = lCenterX;
+	lBestY = lCenterY;
+	lLeft = lCenterX - (SLONG)ulRadius;
+	lRight = lCenterX + (SLONG)ulRadius;
+	lTop = lCenterY - (SLONG)ulRadius;
+	lBottom = lCenterY + (SLONG)ulRadius;
+	if ( lLeft < 0 ) lLeft = 0;
+	if ( lTop < 0 ) lTop = 0;
+	if ( lRight > lMaxX ) lRight = lMaxX;
+	if ( lBottom > lMaxY ) lBottom = lMaxY;
+	for ( y = lTop; y <= lBottom; y++ ) {
+		for ( x = lLeft; x <= lRight; x++ ) {
+			ulSad = SumTemplateDifference( pTracker->ucTemplate, pLuma->pucLuma + y * pLuma->ulStride + x, pLuma->ulStride );
+			if ( ulSad < ulBest ) {
+				ulBest = ulSad;
+				lBestX = x;
+				lBestY = y;
+			}
+		}
+	}
+	*pfX = (float)lBestX;
+	*pfY = (float)lBestY;
+	if ( ulBest == 0xFFFFFFFF ) return ulBest;
+
+	// fit a parabola to the neighbors for the fraction of a pixel
+	if ( lBestX > 0 && lBestX < lMaxX ) {
+		ulLeft = SumTemplateDifference( pTracker->ucTemplate, pLuma->pucLuma + lBestY * pLuma->ulStride + lBestX - 1, pLuma->ulStride );
+		ulRight = SumTemplateDifference( pTracker->ucTemplate, pLuma->pucLuma + lBestY * pLuma->ulStride + lBestX + 1, pLuma->ulStride );
+		fDenominator = (float)ulLeft + (float)ulRight - 2.0f * ulBest;
+		if ( fDenominator > 0 ) *pfX += 0.5f * ( (float)ulLeft - (float)ulRight ) / fDenominator;
+	}
+	if ( lBestY > 0 && lBestY < lMaxY ) {
+		ulUp = SumTemplateDifference( pTracker->ucTemplate, pLuma->pucLuma + ( lBestY - 1 ) * pLuma->ulStride + lBestX, pLuma->ulStride );
+		ulDown = SumTemplateDifference( pTracker->ucTemplate, pLuma->pucLuma + ( lBestY + 1 ) * pLuma->ulStride + lBestX, pLuma->ulStride );
+		fDenominator = (float)ulUp + (float)ulDown - 2.0f * ulBest;
+		if ( fDenominator > 0 ) *pfY += 0.5f * ( (float)ulUp - (float)ulDown ) / fDenominator;
+	}
+	return ulBest;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Replace the update in the mailbox. The update not sent yet is counted as superseded.
+void PostTrackerUpdate( LPSubjectTracker pTracker, LPTrackerUpdate pUpdate )
+{
+	std::lock_guard<std::mutex> lock( g_TrackerMutex );
+	if ( g_bTrackerPending == TRUE ) pTracker->ulSuperseded++;
+	g_stTrackerPending = *pUpdate;
+	g_stTrackerPending.ullPosted = GetHostTimeUs();
+	g_bTrackerPending = TRUE;
+	pTracker->ulPosted++;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Take the update from the mailbox. Returns FALSE if there is no new update.
+BOOL TakeTrackerUpdate( LPTrackerUpdate pUpdate )
+{
+	std::lock_guard<std::mutex> lock( g_TrackerMutex );
+	if ( g_bTrackerPending == FALSE ) return FALSE;
+	*pUpdate = g_stTrackerPending;
+	g_bTrackerPending = FALSE;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// consumer of the live view frames to track the subject
+void TrackerConsumer( LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPSubjectTracker pTracker = (LPSubjectTracker)pContext;
+	LiveViewHeader stHeader;
+	LiveViewRect stDisplay;
+	TrackerUpdate stUpdate;
+	UWORD wWholeWidth, wWholeHeight, wImageWidth, wImageHeight;
+	NK_UINT_64 ullStart = GetHostTimeUs(), ullProcess;
+	float fX, fY, fCenter = ( TRACKER_TEMPLATE - 1 ) / 2.0f;
+	ULONG ulSad, ulMad;
+
+	if ( ParseLiveViewHeader( pFrame->pucData, pFrame->ulSize, &stHeader ) == FALSE ||
+		 DecodeJpegLuma( stHeader.pucJpeg, stHeader.ulJpegSize, TRACKER_SCALE, &pTracker->stLuma ) == FALSE ||
+		 pTracker->stLuma.wWidth < TRACKER_TEMPLATE || pTracker->stLuma.wHeight < TRACKER_TEMPLATE ) {
+		pTracker->ulErrors++;
+		return;
+	}
+	// The luma is mapped to the display area, which is a part of the whole area while the live view is zoomed.
+	GetLiveViewImageSize( &stHeader, &wWholeWidth, &wWholeHeight, &wImageWidth, &wImageHeight );
+	GetLiveViewDisplayArea( &stHeader, &stDisplay );
+	if ( wImageWidth == 0 || wImageHeight == 0 || stDisplay.wWidth == 0 || stDisplay.wHeight == 0 ) {
+		pTracker->ulErrors++;
+		return;
+	}
+	pTracker->fMapScaleX = (float)stDisplay.wWidth * TRACKER_SCALE / wImageWidth;
+	pTracker->fMapScaleY = (float)stDisplay.wHeight * TRACKER_SCALE / wImageHeight;
+	pTracker->fMapOffsetX = (float)stDisplay.wCenterX - stDisplay.wWidth / 2.0f;
+	pTracker->fMapOffsetY = (float)stDisplay.wCenterY - stDisplay.wHeight / 2.0f;
+
+	if ( pTracker->bTemplate == FALSE || pTracker->stLuma.wWidth != pTracker->wLumaWidth || pTracker->stLuma.wHeight != pTracker->wLumaHeight ) {
+		// The template is taken at the start point, or at the last position after the size of the luma changed.
+		if ( pTracker->bTemplate == FALSE ) {
+			if ( pTracker->lStartX == 0 && pTracker->lStartY == 0 ) {
+				pTracker->fX = pTracker->stLuma.wWidth / 2.0f - fCenter;
+				pTracker->fY = pTracker->stLuma.wHeight / 2.0f - fCenter;
+			} else {
+				pTracker->fX = ( pTracker->lStartX - pTracker->fMapOffsetX ) / pTracker->fMapScaleX - fCenter;
+				pTracker->fY = ( pTracker->lStartY - pTracker->fMapOffsetY ) / pTracker->fMapScaleY - fCenter;
+			}
+		}
+		if ( pTracker->fX < 0 ) pTracker->fX = 0;
+		if ( pTracker->fY < 0 ) pTracker->fY = 0;
+		if ( pTracker->fX > pTracker->stLuma.wWidth - TRACKER_TEMPLATE ) pTracker->fX = (float)( pTracker->stLuma.wWidth - TRACKER_TEMPLATE );
+		if ( pTracker->fY > pTracker->stLuma.wHeight - TRACKER_TEMPLATE ) pTracker->fY = (float)( pTracker->stLuma.wHeight - TRACKER_TEMPLATE );
+		UpdateTemplate( pTracker->ucTemplate, pTracker->stLuma.pucLuma + (ULONG)( pTracker->fY + 0.5f ) * pTracker->stLuma.ulStride + (ULONG)( pTracker->fX + 0.5f ),
+						pTracker->stLuma.ulStride, FALSE );
+		pTracker->wLumaWidth = pTracker->stLuma.wWidth;
+		pTracker->wLumaHeight = pTracker->stLuma.wHeight;
+		pTracker->fVX = pTracker->fVY = 0;
+		pTracker->bTemplate = TRUE;
+		pTracker->bLocked = TRUE;
+		pTracker->ulLost = 0;
+		// The first position is sent as it is.
+		pTracker->fPostX = pTracker->fPostY = -1000.0f;
+	}
+
+	// Search around the prediction, and wider while the lock is lost.
+	ulSad = SearchTemplate( pTracker, (SLONG)( pTracker->fX + pTracker->fVX + 0.5f ), (SLONG)( pTracker->fY + pTracker->fVY + 0.5f ),
+							pTracker->bLocked ? pTracker->ulRadius : pTracker->ulRadius * 2, &fX, &fY );
+	ulMad = ulSad / ( TRACKER_TEMPLATE * TRACKER_TEMPLATE );
+	pTracker->ulFrames++;
+	if ( ulMad > pTracker->ulLostMad ) {
+		if ( pTracker->bLocked == TRUE && ++pTracker->ulLost >= TRACKER_LOST_FRAMES ) {
+			pTracker->bLocked = FALSE;
+			pTracker->fVX = pTracker->fVY = 0;
+			pTracker->ulLocksLost++;
+		}
+		pTracker->ulBadFrames++;
+	} else {
+		if ( pTracker->bLocked == FALSE ) pTracker->ulLocksRegained++;
+		pTracker->bLocked = TRUE;
+		pTracker->ulLost = 0;
+		pTracker->fVX = 0.5f * pTracker->fVX + 0.5f * ( fX - pTracker->fX );
+		pTracker->fVY = 0.5f * pTracker->fVY + 0.5f * ( fY - pTracker->fY );
+		pTracker->fX = fX;
+		pTracker->fY = fY;
+		if ( ulMad <= TRACKER_BLEND_MAX )
+			UpdateTemplate( pTracker->ucTemplate, pTracker->stLuma.pucLuma + (ULONG)( fY + 0.5f ) * pTracker->stLuma.ulStride + (ULONG)( fX + 0.5f ),
+							pTracker->stLuma.ulStride, TRUE );
+	}
+	ullProcess = GetHostTimeUs() - ullStart;
+	pTracker->ullProcessTime += ullProcess;
+	if ( ullProcess > pTracker->ullProcessMax ) pTracker->ullProcessMax = ullProcess;
+
+	// The camera is updated when the subject moved by a pixel of the luma.
+	if ( pTracker->bLocked == FALSE ) return;
+	if ( fabsf( pTracker->fX - pTracker->fPostX ) < 1.0f && fabsf( pTracker->fY - pTracker->fPostY ) < 1.0f ) return;
+	pTracker->fPostX = pTracker->fX;
+	pTracker->fPostY = pTracker->fY;
+	memset( &stUpdate, 0, sizeof(stUpdate) );
+	stUpdate.ullSeq = pFrame->ullSeq;
+	stUpdate.ullFrameTime = pFrame->ullTime;
+	stUpdate.ulProcessTime = (ULONG)ullProcess;
+	stUpdate.ulMad = ulMad;
+	stUpdate.lX = (SLONG)( pTracker->fMapOffsetX + ( pTracker->fX + fCenter + 0.5f ) * pTracker->fMapScaleX );
+	stUpdate.lY = (SLONG)( pTracker->fMapOffsetY + ( pTracker->fY + fCenter + 0.5f ) * pTracker->fMapScaleY );
+	PostTrackerUpdate( pTracker, &stUpdate );
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// control procedure of the live view to send the latest position to the camera
+BOOL TrackerControl( LPRefObj pRefSrc, LPLiveViewFrame pFrame, LPVOID pContext )
+{
+	LPSubjectTracker pTracker = (LPSubjectTracker)pContext;
+	NkMAIDTrackingAFArea stArea;
+	TrackerUpdate stUpdate;
+	NK_UINT_64 ullSetStart, ullSetEnd, ullLatency;
+
+	(void)pFrame;// the position comes from the consumer, not from this frame.
+	if ( TakeTrackerUpdate( &stUpdate ) == FALSE ) return TRUE;
+
+	memset( &stArea, 0, sizeof(stArea) );
+	stArea.ulTrackingStatus = 1;
+	stArea.stAfPoint.x = stUpdate.lX;
+	stArea.stAfPoint.y = stUpdate.lY;
+	ullSetStart = GetHostTimeUs();
+	if ( Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_TrackingAFArea, kNkMAIDDataType_GenericPtr, (NKPARAM)&stArea, NULL, NULL ) == FALSE ) {
+		pTracker->ulSetErrors++;
+		return ( pTracker->ulSetErrors < 10 ) ? TRUE : FALSE;
+	}
+	ullSetEnd = GetHostTimeUs();
+	ullLatency = ullSetEnd - stUpdate.ullFrameTime;
+	pTracker->ulSent++;
+	pTracker->ullQueueTime += ullSetStart - stUpdate.ullPosted;
+	pTracker->ullSetTime += ullSetEnd - ullSetStart;
+	pTracker->ullLatency += ullLatency;
+	if ( ullLatency > pTracker->ullLatencyMax ) pTracker->ullLatencyMax = ullLatency;
+	if ( pTracker->pLog != NULL )
+		fprintf( pTracker->pLog, "%llu,%llu,%d,%d,%u,%u,%llu,%llu,%llu\n",
+				(unsigned long long)stUpdate.ullSeq, (unsigned long long)stUpdate.ullFrameTime, (int)stUpdate.lX, (int)stUpdate.lY,
+				(unsigned)stUpdate.ulMad, (unsigned)stUpdate.ulProcessTime, (unsigned long long)( ullSetStart - stUpdate.ullPosted ),
+				(unsigned long long)( ullSetEnd - ullSetStart ), (unsigned long long)ullLatency );
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Track the subject from the point input by the user.
+BOOL SubjectTrackerMenu( LPRefObj pRefSrc )
+{
+	char	buf[256];
+	ULONG	ulFps, ulSeconds, ulSaved;
+	SLONG	lConsumer;
+	SubjectTracker	stTracker;
+	NkMAIDTrackingAFArea	stArea;
+	TrackerUpdate	stUpdate;
+	BOOL	bRet;
+
+	LPNkMAIDCapInfo pCapInfo = GetCapInfo( pRefSrc, kNkMAIDCapability_TrackingAFArea );
+	if ( pCapInfo == NULL || pCapInfo->ulType != kNkMAIDCapType_Generic ||
+		 !CheckCapabilityOperation( pRefSrc, kNkMAIDCapability_TrackingAFArea, kNkMAIDCapOperation_Set ) ) {
+		printf( "TrackingAFArea is not supported.\n" );
+		return TRUE;
+	}
+	memset( &stTracker, 0, sizeof(stTracker) );
+	printf( "Input XY coordinates of the subject in the whole area (0 0: center of the live view)\n" );
+	printf( "X = \n" );
+	scanf( "%s", buf );
+	stTracker.lStartX = atoi( buf );
+	printf( "Y = \n" );
+	scanf( "%s", buf );
+	stTracker.lStartY = atoi( buf );
+	printf( "Input the search radius in pixels of 1/%d (1-64, 0: %d)\n>", TRACKER_SCALE, TRACKER_RADIUS_DEFAULT );
+	scanf( "%s", buf );
+	stTracker.ulRadius = atoi( buf );
+	if ( stTracker.ulRadius == 0 || stTracker.ulRadius > 64 ) stTracker.ulRadius = TRACKER_RADIUS_DEFAULT;
+	printf( "Input the target frame rate (1-60, 0: %d)\n>", LIVEVIEW_FPS_DEFAULT );
+	scanf( "%s", buf );
+	ulFps = atoi( buf );
+	if ( ulFps > 60 ) ulFps = 60;
+	printf( "Input the duration in seconds (0: until Ctrl+C)\n>" );
+	scanf( "%s", buf );
+	ulSeconds = atoi( buf );
+	stTracker.ulLostMad = TRACKER_LOST_DEFAULT;
+
+	stTracker.pLog = fopen( "Tracker.csv", "w" );
+	if ( stTracker.pLog != NULL )
+		fprintf( stTracker.pLog, "seq,arrival_us,x,y,difference,process_us,queue_us,capset_us,latency_us\n" );
+	// An update left from the last run is not sent.
+	TakeTrackerUpdate( &stUpdate );
+
+	if ( StartRemoteLiveView( pRefSrc, &ulSaved ) == FALSE ) {
+		if ( stTracker.pLog != NULL ) fclose( stTracker.pLog );
+		return FALSE;
+	}
+	lConsumer = AddLiveViewConsumer( "Tracker", TrackerConsumer, &stTracker );
+	if ( lConsumer < 0 ) {
+		StopRemoteLiveView( pRefSrc, ulSaved );
+		if ( stTracker.pLog != NULL ) fclose( stTracker.pLog );
+		return FALSE;
+	}
+	printf( "Tracking. Please press the Ctrl+C to stop.\n" );
+	bRet = RunLiveView( pRefSrc, ulFps, ulSeconds, TrackerControl, &stTracker );
+	RemoveLiveViewConsumer( lConsumer );
+	TakeTrackerUpdate( &stUpdate );
+
+	// The camera stops tracking with the host.
+	memset( &stArea, 0, sizeof(stArea) );
+	Command_CapSet( pRefSrc->pObject, kNkMAIDCapability_TrackingAFArea, kNkMAIDDataType_GenericPtr, (NKPARAM)&stArea, NULL, NULL );
+	StopRemoteLiveView( pRefSrc, ulSaved );
+	if ( stTracker.pLog != NULL ) fclose( stTracker.pLog );
+	FreeJpegLuma( &stTracker.stLuma );
+
+	printf( "%u frames tracked (%u errors), %u bad matches, the lock was lost %u times and regained %u times.\n",
+			(unsigned)stTracker.ulFrames, (unsigned)stTracker.ulErrors, (unsigned)stTracker.ulBadFrames,
+			(unsigned)stTracker.ulLocksLost, (unsigned)stTracker.ulLocksRegained );
+	if ( stTracker.ulFrames > 0 )
+		printf( "Tracking took %llu usec per frame on average, %llu usec at most.\n",
+				(unsigned long long)( stTracker.ullProcessTime / stTracker.ulFrames ), (unsigned long long)stTracker.ullProcessMax );
+	printf( "%u updates posted, %u sent, %u replaced by a newer one, %u failed.\n",
+			(unsigned)stTracker.ulPosted, (unsigned)stTracker.ulSent, (unsigned)stTracker.ulSuperseded, (unsigned)stTracker.ulSetErrors );
+	if ( stTracker.ulSent > 0 )
+		printf( "Latency from the arrival to the end of CapSet: %llu usec on average, %llu usec at most (queue %llu, CapSet %llu).\n",
+				(unsigned long long)( stTracker.ullLatency / stTracker.ulSent ), (unsigned long long)stTracker.ullLatencyMax,
+				(unsigned long long)( stTracker.ullQueueTime / stTracker.ulSent ), (unsigned long long)( stTracker.ullSetTime / stTracker.ulSent ) );
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
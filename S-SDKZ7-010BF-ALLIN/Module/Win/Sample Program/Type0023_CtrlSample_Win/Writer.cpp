@@ -0,0 +1,336 @@
+//================================================================================================
+// Copyright Nikon Corporation - All rights reserved
+//
+// View this file in a non-proportional font, tabs = 3
+//================================================================================================
+// File writer for delivered data.
+// DataProc passes each delivered chunk to a DataWriter through the file sink (Sink.cpp), so a file
+// is written while it is being transferred. In the direct mode the file bypasses the system cache:
+//   Windows : FILE_FLAG_NO_BUFFERING, the block size is the sector size of the volume.
+//   Mac     : F_NOCACHE, the block size is the block size of the file system.
+// The chunks are collected into an aligned buffer taken from a small pool and written in whole
+// blocks. The unaligned tail is padded to a block, written and cut off by truncating the file.
+// Small files and files that can't get a pool buffer are written through the system cache.
+
+#if defined( _WIN32 )
+	#include <io.h>
+	#include <windows.h>
+#elif defined(__APPLE__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/param.h>
+	#include <sys/mount.h>
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <atomic>
+#include "Maid3.h"
+#include "Maid3d1.h"
+#include "CtrlSample.h"
+
+#define WRITER_POOL_COUNT		4
+#define WRITER_BUFFER_SIZE		0x400000		// size of a pool buffer : 4MB
+#define WRITER_BUFFER_ALIGN		0x1000
+#define WRITER_DIRECT_MIN		0x100000		// files smaller than this are written through the cache : 1MB
+
+ULONG	g_ulWriteMode = kWriteMode_Buffered;
+ULONG	g_ulWriteSync = kWriteSync_None;
+
+LPVOID	g_pWriterPool[WRITER_POOL_COUNT];
+std::atomic<bool>	g_bWriterPoolUsed[WRITER_POOL_COUNT];
+
+//------------------------------------------------------------------------------------------------------------------------------------
+// take an aligned buffer from the pool. Returns NULL if all buffers are used.
+LPVOID GetWriterBuffer( void )
+{
+	ULONG i;
+	for ( i = 0; i < WRITER_POOL_COUNT; i++ ) {
+		bool bExpected = false;
+		if ( !g_bWriterPoolUsed[i].compare_exchange_strong( bExpected, true ) ) continue;
+		if ( g_pWriterPool[i] == NULL ) {
+		#if defined( _WIN32 )
+			g_pWriterPool[i] = _aligned_malloc( WRITER_BUFFER_SIZE, WRITER_BUFFER_ALIGN );
+		#elif defined(__APPLE__)
+			if ( posix_memalign( &g_pWriterPool[i], WRITER_BUFFER_ALIGN, WRITER_BUFFER_SIZE ) != 0 )
+				g_pWriterPool[i] = NULL;
+		#endif
+			if ( g_pWriterPool[i] == NULL ) {
+				g_bWriterPoolUsed[i].store( false );
+				return NULL;
+			}
+		}
+		return g_pWriterPool[i];
+	}
+	return NULL;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// return the buffer to the pool.
+void ReleaseWriterBuffer( LPVOID pBuffer )
+{
+	ULONG i;
+	for ( i = 0; i < WRITER_POOL_COUNT; i++ ) {
+		if ( g_pWriterPool[i] == pBuffer ) {
+			g_bWriterPoolUsed[i].store( false );
+			return;
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// free the pool buffers. All writers must be closed.
+void FreeWriterPool( void )
+{
+	ULONG i;
+	for ( i = 0; i < WRITER_POOL_COUNT; i++ ) {
+		if ( g_pWriterPool[i] != NULL && g_bWriterPoolUsed[i].load() == false ) {
+		#if defined( _WIN32 )
+			_aligned_free( g_pWriterPool[i] );
+		#elif defined(__APPLE__)
+			free( g_pWriterPool[i] );
+		#endif
+			g_pWriterPool[i] = NULL;
+		}
+	}
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write whole blocks of the buffer to the file.
+BOOL FlushDataWriter( LPDataWriter pWriter, ULONG ulLength )
+{
+#if defined( _WIN32 )
+	DWORD dwWritten = 0;
+	if ( WriteFile( pWriter->hFile, pWriter->pBuffer, ulLength, &dwWritten, NULL ) == FALSE || dwWritten != ulLength )
+		return FALSE;
+#elif defined(__APPLE__)
+	ULONG ulDone = 0;
+	while ( ulDone < ulLength ) {
+		ssize_t n = write( pWriter->fd, (char*)pWriter->pBuffer + ulDone, ulLength - ulDone );
+		if ( n <= 0 ) return FALSE;
+		ulDone += (ULONG)n;
+	}
+#endif
+	pWriter->ullWritten += ulLength;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// open a file for the delivered data. ullTotal is the size of the data if it is known.
+BOOL OpenDataWriter( LPDataWriter pWriter, const char* pszFileName, NK_UINT_64 ullTotal )
+{
+	memset( pWriter, 0, sizeof(DataWriter) );
+	strncpy( pWriter->szFileName, pszFileName, sizeof(pWriter->szFileName) - 1 );
+	pWriter->bManifest = TRUE;
+
+	if ( g_ulWriteMode == kWriteMode_Direct && ullTotal >= WRITER_DIRECT_MIN )
+		pWriter->pBuffer = GetWriterBuffer();
+
+	if ( pWriter->pBuffer != NULL ) {
+	#if defined( _WIN32 )
+		DWORD dwSectorsPerCluster, dwBytesPerSector, dwFreeClusters, dwClusters;
+		if ( GetDiskFreeSpaceA( NULL, &dwSectorsPerCluster, &dwBytesPerSector, &dwFreeClusters, &dwClusters ) == FALSE )
+			dwBytesPerSector = 0x1000;
+		pWriter->ulBlockSize = dwBytesPerSector;
+		pWriter->hFile = CreateFileA( pszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+										FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+		if ( pWriter->hFile != INVALID_HANDLE_VALUE )
+			pWriter->bDirect = TRUE;
+	#elif defined(__APPLE__)
+		struct statfs stFs;
+		pWriter->fd = open( pszFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+		if ( pWriter->fd >= 0 ) {
+			fcntl( pWriter->fd, F_NOCACHE, 1 );
+			pWriter->ulBlockSize = ( fstatfs( pWriter->fd, &stFs ) == 0 ) ? (ULONG)stFs.f_bsize : 0x1000;
+			pWriter->bDirect = TRUE;
+		}
+	#endif
+		// The buffer must hold whole blocks.
+		if ( pWriter->bDirect == TRUE && (pWriter->ulBlockSize == 0 || WRITER_BUFFER_SIZE % pWriter->ulBlockSize != 0) ) {
+		#if defined( _WIN32 )
+			CloseHandle( pWriter->hFile );
+		#elif defined(__APPLE__)
+			close( pWriter->fd );
+		#endif
+			pWriter->bDirect = FALSE;
+		}
+		if ( pWriter->bDirect == FALSE ) {
+			ReleaseWriterBuffer( pWriter->pBuffer );
+			pWriter->pBuffer = NULL;
+		}
+		pWriter->ulBufferSize = WRITER_BUFFER_SIZE;
+	}
+
+	if ( pWriter->bDirect == FALSE ) {
+		pWriter->pStream = fopen( pszFileName, "wb" );
+		if ( pWriter->pStream == NULL ) {
+			printf( "%s can't be opened.\n", pszFileName );
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// open a partial file through the system cache, cut it to ullOffset bytes and write after that.
+BOOL ResumeDataWriter( LPDataWriter pWriter, const char* pszFileName, NK_UINT_64 ullOffset )
+{
+	int	iRet;
+
+	memset( pWriter, 0, sizeof(DataWriter) );
+	strncpy( pWriter->szFileName, pszFileName, sizeof(pWriter->szFileName) - 1 );
+	pWriter->bManifest = TRUE;
+
+	pWriter->pStream = fopen( pszFileName, ( ullOffset > 0 ) ? "r+b" : "wb" );
+	if ( pWriter->pStream == NULL ) {
+		printf( "%s can't be opened.\n", pszFileName );
+		return FALSE;
+	}
+#if defined( _WIN32 )
+	iRet = _chsize_s( _fileno( pWriter->pStream ), (__int64)ullOffset );
+	if ( iRet == 0 ) iRet = _fseeki64( pWriter->pStream, (__int64)ullOffset, SEEK_SET );
+#elif defined(__APPLE__)
+	iRet = ftruncate( fileno( pWriter->pStream ), (off_t)ullOffset );
+	if ( iRet == 0 ) iRet = fseeko( pWriter->pStream, (off_t)ullOffset, SEEK_SET );
+#endif
+	if ( iRet != 0 ) {
+		printf( "%s can't be resumed.\n", pszFileName );
+		fclose( pWriter->pStream );
+		pWriter->pStream = NULL;
+		return FALSE;
+	}
+	pWriter->ullWritten = ullOffset;
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// flush the data written so far to the device. Only for a writer through the system cache.
+BOOL SyncDataWriter( LPDataWriter pWriter )
+{
+	if ( pWriter->bDirect == TRUE || pWriter->pStream == NULL ) return FALSE;
+	if ( fflush( pWriter->pStream ) != 0 ) return FALSE;
+#if defined( _WIN32 )
+	if ( FlushFileBuffers( (HANDLE)_get_osfhandle( _fileno( pWriter->pStream ) ) ) == FALSE ) return FALSE;
+#elif defined(__APPLE__)
+	if ( fcntl( fileno( pWriter->pStream ), F_FULLFSYNC ) != 0 ) return FALSE;
+#endif
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write a delivered chunk.
+BOOL WriteDataWriter( LPDataWriter pWriter, const void* pData, ULONG ulLength )
+{
+	const char* pcData = (const char*)pData;
+	ULONG ulCopy;
+
+	if ( pWriter->bDirect == FALSE ) {
+		if ( fwrite( pData, 1, ulLength, pWriter->pStream ) != ulLength ) return FALSE;
+		pWriter->ullWritten += ulLength;
+		return TRUE;
+	}
+
+	// collect the chunks into the aligned buffer, and write it when it is full.
+	while ( ulLength > 0 ) {
+		ulCopy = pWriter->ulBufferSize - pWriter->ulFill;
+		if ( ulCopy > ulLength ) ulCopy = ulLength;
+		memcpy( (char*)pWriter->pBuffer + pWriter->ulFill, pcData, ulCopy );
+		pWriter->ulFill += ulCopy;
+		pcData += ulCopy;
+		ulLength -= ulCopy;
+		if ( pWriter->ulFill == pWriter->ulBufferSize ) {
+			if ( FlushDataWriter( pWriter, pWriter->ulFill ) == FALSE ) return FALSE;
+			pWriter->ulFill = 0;
+		}
+	}
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// write the rest of the data and close the file.
+BOOL CloseDataWriter( LPDataWriter pWriter )
+{
+	BOOL bRet = TRUE;
+
+	if ( pWriter->bDirect == FALSE ) {
+		if ( pWriter->pStream == NULL ) return FALSE;
+		if ( fflush( pWriter->pStream ) != 0 ) bRet = FALSE;
+		if ( bRet == TRUE && CommitDataWriter( pWriter ) == FALSE ) bRet = FALSE;
+		fclose( pWriter->pStream );
+		pWriter->pStream = NULL;
+		return bRet;
+	}
+
+	// The tail is padded to a whole block, and the padding is cut off after writing.
+	if ( pWriter->ulFill > 0 ) {
+		NK_UINT_64 ullSize = pWriter->ullWritten + pWriter->ulFill;
+		ULONG ulPadded = ( (pWriter->ulFill + pWriter->ulBlockSize - 1) / pWriter->ulBlockSize ) * pWriter->ulBlockSize;
+		memset( (char*)pWriter->pBuffer + pWriter->ulFill, 0, ulPadded - pWriter->ulFill );
+		if ( FlushDataWriter( pWriter, ulPadded ) == FALSE ) bRet = FALSE;
+	#if defined( _WIN32 )
+		FILE_END_OF_FILE_INFO stEof;
+		stEof.EndOfFile.QuadPart = (LONGLONG)ullSize;
+		if ( SetFileInformationByHandle( pWriter->hFile, FileEndOfFileInfo, &stEof, sizeof(stEof) ) == FALSE ) bRet = FALSE;
+	#elif defined(__APPLE__)
+		if ( ftruncate( pWriter->fd, (off_t)ullSize ) != 0 ) bRet = FALSE;
+	#endif
+		pWriter->ullWritten = ullSize;
+		pWriter->ulFill = 0;
+	}
+	if ( bRet == TRUE && CommitDataWriter( pWriter ) == FALSE ) bRet = FALSE;
+	// If CommitDataWriter handed the file to the syncer, it made the handle invalid, so nothing is closed here.
+#if defined( _WIN32 )
+	if ( pWriter->hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( pWriter->hFile );
+	pWriter->hFile = INVALID_HANDLE_VALUE;
+#elif defined(__APPLE__)
+	if ( pWriter->fd >= 0 )
+		close( pWriter->fd );
+	pWriter->fd = -1;
+#endif
+	ReleaseWriterBuffer( pWriter->pBuffer );
+	pWriter->pBuffer = NULL;
+
+	return bRet;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
+// Show the current write mode and set a new one.
+BOOL SetWriteModeMenu( void )
+{
+	char	buf[256];
+	UWORD	wSel;
+
+	printf( "[Write Mode]\n" );
+	printf( "Current Mode: %s, Sync: ", g_ulWriteMode == kWriteMode_Direct ? "Direct" : "Buffered" );
+	if ( g_ulWriteSync == kWriteSync_Group )
+		printf( "Group (%u files or %u msec)\n", (unsigned)g_ulSyncGroupFiles, (unsigned)g_ulSyncGroupInterval );
+	else
+		printf( "%s\n", g_ulWriteSync == kWriteSync_File ? "Every file" : "None" );
+	printf( "Select Mode (1-2, 0)\n" );
+	printf( " 1. Buffered (through the system cache)\n" );
+	printf( " 2. Direct (bypass the system cache)\n" );
+	printf( " 0. Exit\n>" );
+	scanf( "%s", buf );
+	wSel = atoi( buf );
+	if ( wSel == 1 )
+		g_ulWriteMode = kWriteMode_Buffered;
+	else if ( wSel == 2 )
+		g_ulWriteMode = kWriteMode_Direct;
+	else
+		return TRUE;
+
+	printf( "Select Sync (1-3)\n" );
+	printf( " 1. None\n" );
+	printf( " 2. Every file\n" );
+	printf( " 3. Group commit\n>" );
+	scanf( "%s", buf );
+	wSel = atoi( buf );
+	if ( wSel == 3 ) {
+		printf( "Input the number of files in a group\n>" );
+		scanf( "%s", buf );
+		if ( atoi( buf ) > 0 ) g_ulSyncGroupFiles = atoi( buf );
+		printf( "Input the maximum wait of a file in msec\n>" );
+		scanf( "%s", buf );
+		if ( atoi( buf ) > 0 ) g_ulSyncGroupInterval = atoi( buf );
+		StartSyncer();
+		g_ulWriteSync = kWriteSync_Group;
+	} else {
+		g_ulWriteSync = ( wSel == 2 ) ? kWriteSync_File : kWriteSync_None;
+		// commit the files waiting in the queue.
+		StopSyncer();
+	}
+
+	return TRUE;
+}
+//------------------------------------------------------------------------------------------------------------------------------------
@@ -14,6 +14,8 @@ LPMAIDEntryPointProc	g_pMAIDEntryPoint = NULL;
 UCHAR	g_bFileRemoved = FALSE;
 ULONG	g_ulCameraType = 0;	// CameraType
 
+#define PROGRESS_RENDER_INTERVAL	500	// msec
+
 #if defined( _WIN32 )
 	HINSTANCE	g_hInstModule = NULL;
 #elif defined(__APPLE__)
@@ -113,11 +115,16 @@ int main()
 		}
 	}
 
+	// Show the progress of the operations from the renderer thread.
+	StartProgressRenderer( PROGRESS_RENDER_INTERVAL );
+
 	// Module Command Loop
 	do {
-		printf( "\nSelect (1-6, 0)\n" );
+		printf( "\nSelect (1-11, 0)\n" );
 		printf( " 1. Select Device            2. AsyncRate                3. IsAlive\n" );
 		printf( " 4. Name                     5. ModuleType               6. Version\n" );
+		printf( " 7. Progress Monitor(%s)      8. Write Mode            9. Write Benchmark\n", IsProgressRendering() ? "ON" : "OFF" );
+		printf( "10. Output Sinks            11. Frame Bus\n" );
 		printf( " 0. Exit\n>" );
 		scanf( "%s", buf );
 		wSel = atoi( buf );
@@ -159,6 +166,24 @@ int main()
 			case 6:// Version
 				bRet = SetUnsignedCapability( pRefMod, kNkMAIDCapability_Version );
 				break;
+			case 7:// Progress Monitor
+				if ( IsProgressRendering() )
+					bRet = StopProgressRenderer();
+				else
+					bRet = StartProgressRenderer( PROGRESS_RENDER_INTERVAL );
+				break;
+			case 8:// Write Mode
+				bRet = SetWriteModeMenu();
+				break;
+			case 9:// Write Benchmark
+				bRet = BenchmarkWriter();
+				break;
+			case 10:// Output Sinks
+				bRet = SinkMenu();
+				break;
+			case 11:// Frame Bus
+				bRet = FrameBusMenu();
+				break;
 			default:
 				wSel = 0;
 		}
@@ -169,6 +194,18 @@ int main()
 		}
 	} while( wSel > 0 && bRet == TRUE );
 
+	// Write back the thumbnail cache.
+	CloseThumbCache();
+	StopProgressRenderer();
+	StopSyncer();
+	CloseManifest();
+	CloseSinkStreams();
+	CloseFrameBus();
+	FreeWriterPool();
+	FreeMoviePool();
+	FreeLiveViewRing();
+	FreeMemorySink();
+
 	// Close Module_Object
 	bRet = Close_Module( pRefMod );
 	if ( bRet == FALSE )
@@ -227,6 +264,7 @@ BOOL SourceCommandLoop( LPRefObj pRefMod, ULONG ulSrcID )
 		printf( " 7. Custom Menu              8. SB Menu                  9. Async\n" );
 		printf( "10. Capture                 11. TerminateCapture        12. PreCapture\n" );
 		printf( "13. CaptureAsync            14. AFCaptureAsync          15. DeviceReady\n" );
+		printf( "16. Thumbnails              17. Offload Movies          18. Intervalometer\n" );
 		printf( " 0. Exit\n>" );
 		scanf( "%s", buf );
 		wSel = atoi( buf );
@@ -319,6 +357,17 @@ BOOL SourceCommandLoop( LPRefObj pRefMod, ULONG ulSrcID )
 			case 15:// DeviceReady
 				bRet = IssueProcess( pRefSrc, kNkMAIDCapability_DeviceReady );
 				break;
+			case 16:// Thumbnails
+				printf( "Input the number of transfers in flight (0: default)\n>" );
+				scanf( "%s", buf );
+				bRet = IssueThumbnail( pRefSrc, (ULONG)atoi( buf ) );
+				break;
+			case 17:// Offload Movies
+				bRet = OffloadMenu( pRefSrc );
+				break;
+			case 18:// Intervalometer
+				bRet = IntervalometerMenu( pRefSrc );
+				break;
 			default:
 				wSel = 0;
 		}
@@ -754,6 +803,10 @@ BOOL SetLiveView( LPRefObj pRefSrc )
 		printf( " 1. LiveViewProhibit      2. LiveViewStatus             3. LiveViewImageSize\n" );
 		printf( " 4. GetLiveViewImage      5. LiveViewImageStatus        6. MovRecInCardProhibit\n");
 		printf( " 7. MovRecInCardStatus    8. LiveViewZoomArea           9. TrackingAFArea\n");
+		printf( "10. LiveView Stream      11. LiveView Record           12. LiveView Sharpness\n");
+		printf( "13. Software AF          14. Focus Stack               15. Motion Trigger\n");
+		printf( "16. Pre-trigger Ring     17. Exposure Ramp             18. Subject Tracking\n");
+		printf( "19. Focus Map\n");
 		printf( " 0. Exit\n>" );
 		scanf( "%s", buf );
 		wSel = atoi( buf );
@@ -788,6 +841,36 @@ BOOL SetLiveView( LPRefObj pRefSrc )
 			case 9:// TrackingAFArea
 				bRet = SetTrackingAFAreaCapability(pRefSrc);
 				break;
+			case 10:// LiveView Stream
+				bRet = LiveViewStreamMenu(pRefSrc);
+				break;
+			case 11:// LiveView Record
+				bRet = LiveViewRecordMenu(pRefSrc);
+				break;
+			case 12:// LiveView Sharpness
+				bRet = LiveViewSharpnessMenu(pRefSrc);
+				break;
+			case 13:// Software AF
+				bRet = SoftAFMenu(pRefSrc);
+				break;
+			case 14:// Focus Stack
+				bRet = FocusStackMenu(pRefSrc);
+				break;
+			case 15:// Motion Trigger
+				bRet = MotionTriggerMenu(pRefSrc);
+				break;
+			case 16:// Pre-trigger Ring
+				bRet = PreTriggerMenu(pRefSrc);
+				break;
+			case 17:// Exposure Ramp
+				bRet = ExposureRampMenu(pRefSrc);
+				break;
+			case 18:// Subject Tracking
+				bRet = SubjectTrackerMenu(pRefSrc);
+				break;
+			case 19:// Focus Map
+				bRet = FocusMapMenu(pRefSrc);
+				break;
 			default:
 				wSel = 0;
 				break;
@@ -1,7 +1,7 @@
-import subprocess
 import fractions
 import time
 import serial
+import nkmaid
 
 class Intervalometer:
     def __init__(self, numShots, interval, default_exposure=1.0):
@@ -12,55 +12,50 @@ class Intervalometer:
         self.interval = interval
         self.default_exposure = default_exposure
         # self.steps_per_shot = steps_per_shot
+        # One session stays open until close()
+        nkmaid.open()
         self.set_capture_target()
 
         # self.slider = StepperSlider(port=slider_port)
     
     # Camera Control Methods
     def set_capture_target(self):
+        """Set camera to save images to memory card."""
         try:
-            subprocess.run(
-                ["gphoto2", "--set-config", "capturetarget=1"],
-                check=True
-            )
-        except subprocess.CalledProcessError as e:
-            print(f"Error setting capture target: {e.stderr}")
-    
+            nkmaid.set(nkmaid.SaveMedia, nkmaid.SaveMedia_Card)
+        except nkmaid.error as e:
+            print(f"Error setting capture target: {e}")
+
     def get_shutter_speed(self):
         """Return the current shutter speed in seconds."""
         try:
-            result = subprocess.run(
-                ["gphoto2", "--get-config", "shutterspeed"],
-                stdout=subprocess.PIPE,
-                stderr=subprocess.PIPE,
-                text=True,
-                check=True
-            )
-            for line in result.stdout.splitlines():
-                if line.startswith("Current:"):
-                    speed_str = line.split("Current:")[1].strip()
-                    # Remove trailing 's' if present
-                    if speed_str.endswith('s'):
-                        speed_str = speed_str[:-1]
-                    # Convert to float
-                    try:
-                        exposure_sec = float(fractions.Fraction(speed_str))
-                    except ValueError:
-                        exposure_sec = float(speed_str)
-                    # Apply default if shorter than 1 second
-                    return exposure_sec if exposure_sec > self.default_exposure else self.default_exposure
-                return self.default_exposure
-        except subprocess.CalledProcessError as e:
-            print(f"Error reading shutter speed: {e.stderr}")
+            speed_str = nkmaid.get(nkmaid.ShutterSpeed).strip()
+        except nkmaid.error as e:
+            print(f"Error reading shutter speed: {e}")
+            return self.default_exposure
+        # Remove trailing '"' or 's' if present, and read 1"3 as 1.3
+        if speed_str.endswith('"') or speed_str.endswith('s'):
+            speed_str = speed_str[:-1]
+        speed_str = speed_str.replace('"', '.')
+        # Convert to float
+        try:
+            exposure_sec = float(fractions.Fraction(speed_str))
+        except ValueError:
             return self.default_exposure
-        
+        # Apply default if shorter than 1 second
+        return exposure_sec if exposure_sec > self.default_exposure else self.default_exposure
+
     def trigger_shutter(self):
         """Trigger the camera shutter."""
         try:
-            subprocess.run(["gphoto2", "--trigger-capture"], check=True)
-        except subprocess.CalledProcessError as e:
-            print(f"Error triggering shutter: {e.stderr}")
-        
+            nkmaid.capture()
+        except nkmaid.error as e:
+            print(f"Error triggering shutter: {e}")
+
+    def close(self):
+        """Close the camera session."""
+        nkmaid.close()
+
     # Main Interval Sequence
     def run_sequence(self):
         """Run the intervalometer sequence."""
@@ -110,4 +105,5 @@ class MotionTimelapse:
                 time.sleep(max(0, self.intervalometer.interval - exposure))
 
     def close(self):
-        self.slider.close()
\ No newline at end of file
+        self.slider.close()
+        self.intervalometer.close()
\ No newline at end of file
@@ -1,57 +1,54 @@
-import subprocess
 import fractions
 import time
 import serial
+import nkmaid
 
 class Intervalometer:
-    """Controls camera triggering and exposure reading via gphoto2."""
+    """Controls camera triggering and exposure reading through the nkmaid module."""
     def __init__(self, num_shots, interval, default_exposure=1.0):
         self.num_shots = num_shots
         self.interval = interval
         self.default_exposure = default_exposure
+        # One session stays open until close()
+        nkmaid.open()
         self.set_capture_target()
 
     def set_capture_target(self):
-        """Set camera to save images to memory card (capture target 1)."""
+        """Set camera to save images to memory card."""
         try:
-            subprocess.run(
-                ["gphoto2", "--set-config", "capturetarget=1"],
-                check=True
-            )
-        except subprocess.CalledProcessError as e:
-            print(f"Error setting capture target: {e.stderr}")
+            nkmaid.set(nkmaid.SaveMedia, nkmaid.SaveMedia_Card)
+        except nkmaid.error as e:
+            print(f"Error setting capture target: {e}")
 
     def get_shutter_speed(self):
-        """Return current shutter speed in seconds."""
+        """Return the current shutter speed in seconds."""
         try:
-            result = subprocess.run(
-                ["gphoto2", "--get-config", "shutterspeed"],
-                stdout=subprocess.PIPE,
-                stderr=subprocess.PIPE,
-                text=True,
-                check=True
-            )
-            for line in result.stdout.splitlines():
-                if line.startswith("Current:"):
-                    speed_str = line.split("Current:")[1].strip()
-                    if speed_str.endswith('s'):
-                        speed_str = speed_str[:-1]
-                    try:
-                        exposure_sec = float(fractions.Fraction(speed_str))
-                    except ValueError:
-                        exposure_sec = float(speed_str)
-                    return exposure_sec if exposure_sec > self.default_exposure else self.default_exposure
+            speed_str = nkmaid.get(nkmaid.ShutterSpeed).strip()
+        except nkmaid.error as e:
+            print(f"Error reading shutter speed: {e}")
             return self.default_exposure
-        except subprocess.CalledProcessError as e:
-            print(f"Error reading shutter speed: {e.stderr}")
+        # Remove trailing '"' or 's' if present, and read 1"3 as 1.3
+        if speed_str.endswith('"') or speed_str.endswith('s'):
+            speed_str = speed_str[:-1]
+        speed_str = speed_str.replace('"', '.')
+        # Convert to float
+        try:
+            exposure_sec = float(fractions.Fraction(speed_str))
+        except ValueError:
             return self.default_exposure
+        # Apply default if shorter than 1 second
+        return exposure_sec if exposure_sec > self.default_exposure else self.default_exposure
 
     def trigger_shutter(self):
         """Trigger the camera shutter."""
         try:
-            subprocess.run(["gphoto2", "--trigger-capture"], check=True)
-        except subprocess.CalledProcessError as e:
-            print(f"Error triggering shutter: {e.stderr}")
+            nkmaid.capture()
+        except nkmaid.error as e:
+            print(f"Error triggering shutter: {e}")
+
+    def close(self):
+        """Close the camera session."""
+        nkmaid.close()
 
 class GRBLSlider:
     """Controls the GRBL-based slider in millimeters."""
@@ -109,6 +106,7 @@ class MotionTimelapse:
 
     def close(self):
         self.slider.close()
+        self.intervalometer.close()
 
 # Example usage
 if __name__ == "__main__":
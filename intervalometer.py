@@ -10,8 +10,8 @@ hopefully result in smoother motion in timelapse films.)
 """
 # Import time for timing purposes (lol)
 import time
-# Import subprocess to relay commands to camera
-import subprocess
+# Import nkmaid to relay commands to camera (built by setup.py)
+import nkmaid
 # Import fractions to interpret camera shutter speed data
 import fractions
 
@@ -38,64 +38,47 @@ def setFps():
 
 ### Camera Control ###
 def trigger_camera():
-    subprocess.run(["gphoto2", "--trigger-capture"], check=True)
+    nkmaid.capture()
 
 def get_shutter_speed(default=1.0):
     """
-    Queries the Nikon Z7 via gphoto2 and returns the current shutter speed in seconds.
+    Reads the current shutter speed of the Nikon Z7 through nkmaid and returns it in seconds.
     - Defaults to `default` (1 second) for exposures shorter than that.
-    - Handles fractions, decimals, or values with 's' suffix.
+    - Handles fractions, decimals, or values with a '"' or 's' suffix.
     """
     try:
-        result = subprocess.run(
-            ["gphoto2", "--get-config", "shutterspeed"],
-            stdout=subprocess.PIPE,
-            stderr=subprocess.PIPE,
-            text=True,
-            check=True
-        )
-
-        for line in result.stdout.splitlines():
-            if line.startswith("Current:"):
-                speed_str = line.split("Current:")[1].strip()
-
-                # Remove trailing 's' if present
-                if speed_str.endswith('s'):
-                    speed_str = speed_str[:-1]
-
-                # Convert to float
-                try:
-                    exposure_sec = float(fractions.Fraction(speed_str))
-                except ValueError:
-                    exposure_sec = float(speed_str)
-
-                # Use the actual exposure only if it's above default
-                return exposure_sec if exposure_sec > default else default
-
-        # Fallback if Current not found
-        print("Warning: Could not find current shutter speed, using default 1 sec.")
+        speed_str = nkmaid.get(nkmaid.ShutterSpeed).strip()
+    except nkmaid.error as e:
+        print(f"Error reading shutter speed: {e}")
         return default
 
-    except subprocess.CalledProcessError as e:
-        print(f"Error reading shutter speed: {e.stderr}")
+    # Remove trailing '"' or 's' if present, and read 1"3 as 1.3
+    if speed_str.endswith('"') or speed_str.endswith('s'):
+        speed_str = speed_str[:-1]
+    speed_str = speed_str.replace('"', '.')
+
+    # Convert to float
+    try:
+        exposure_sec = float(fractions.Fraction(speed_str))
+    except ValueError:
+        # Bulb, Time and the like have no length
+        print("Warning: Could not read current shutter speed, using default 1 sec.")
         return default
 
+    # Use the actual exposure only if it's above default
+    return exposure_sec if exposure_sec > default else default
+
 def runSequence(delay, exp, interval, num):
-    '''Runs the sequence.'''
+    '''Runs the sequence.
+    The shots are started on a fixed grid of exposure + interval seconds by
+    nkmaid, so the time taken by each shot does not add up over the sequence.'''
     print(f"\nWaiting {delay} seconds before starting...")
-    time.sleep(delay)
-
-    for i in range(1, num + 1):
-        print(f"Shot {i+1}: Exposure = {exp:.1f} seconds.")
-        print(f"Capturing shot {i}/{num}...")
-        # Trigger the shutter
-        trigger_camera()
-        # Wait for exposure to finish
-        time.sleep(exp)
-        # Interval
-        if i != num: 
-            time.sleep(interval)
-    print("\nSequence complete!")
+    print(f"Capturing {num} shots every {exp + interval:.1f} seconds (exposure = {exp:.1f} seconds)...")
+    stats = nkmaid.intervalometer(exp + interval, num, nkmaid.Policy_Skip, delay)
+
+    print(f"\nSequence complete! {stats['fired']} shots taken, {stats['skipped']} skipped, {stats['errors']} failed.")
+    print(f"Shots started late by {stats['late_mean'] / 1000:.2f} ms on average "
+          f"(p99 {stats['late_p99'] / 1000:.2f} ms, max {stats['late_max'] / 1000:.2f} ms).")
 
 ### Calculations ###
 def calcClipTime(numShots, fps):
@@ -110,12 +93,17 @@ def calcTotTime(delay, exp, intvl, numShots):
 
 
 if __name__ == "__main__":
-    delay = setDelay()
-    exp = get_shutter_speed(default=1.0)
-    interval = setInterval()
-    num = setNumShots()
-    fps = setFps()
-
-    clipSeconds = print(f"\nYour timelapse clip will be {calcClipTime(num, fps):.2f} seconds long.")
-    print(f"Your clip will be {calcClipTime(num, fps):.1f} seconds long.")
-    runSequence(delay, exp, interval, num)
+    # One session stays open for the whole sequence
+    nkmaid.open()
+    try:
+        delay = setDelay()
+        exp = get_shutter_speed(default=1.0)
+        interval = setInterval()
+        num = setNumShots()
+        fps = setFps()
+
+        clipSeconds = print(f"\nYour timelapse clip will be {calcClipTime(num, fps):.2f} seconds long.")
+        print(f"Your clip will be {calcClipTime(num, fps):.1f} seconds long.")
+        runSequence(delay, exp, interval, num)
+    finally:
+        nkmaid.close()
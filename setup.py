@@ -0,0 +1,54 @@
+"""
+Builds the nkmaid extension module, which gives the Python scripts direct
+access to the camera through Nikon's Type0023 MAID module instead of running
+gphoto2 for each shot.
+
+    python setup.py build_ext --inplace
+
+The extension is compiled from the control sample sources of the SDK; only
+main.cpp is left out, since PythonModule.cpp takes its place. On Mac, set
+NKMAID_MODULE to the path of "Type0023 Module.bundle" before running a script.
+"""
+import glob
+import os
+import sys
+
+from setuptools import Extension, setup
+
+SDK = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                   "S-SDKZ7-010BF-ALLIN", "Module")
+
+if sys.platform == "win32":
+    sample = os.path.join(SDK, "Win", "Sample Program", "Type0023_CtrlSample_Win")
+    define_macros = [("WIN32", None), ("_CRT_SECURE_NO_WARNINGS", None), ("_WINDOWS", None)]
+    extra_compile_args = ["/std:c++14"]
+    extra_link_args = []
+    libraries = ["winmm", "ws2_32", "user32"]
+else:
+    sample = os.path.join(SDK, "Mac", "Sample Program", "Type0023_CtrlSample_Mac")
+    define_macros = []
+    # Xcode includes the prefix header, which brings in Carbon and CoreFoundation.
+    extra_compile_args = ["-std=gnu++14", "-Wno-deprecated-declarations",
+                          "-include", os.path.join(sample, "mac", "CtrlSample.pch")]
+    extra_link_args = ["-framework", "CoreFoundation", "-framework", "Carbon"]
+    libraries = []
+
+sources = sorted(path for path in glob.glob(os.path.join(sample, "*.cpp"))
+                 if os.path.basename(path) != "main.cpp")
+
+setup(
+    name="nkmaid",
+    version="1.0",
+    description="In-process control of Nikon Z cameras through the MAID module",
+    ext_modules=[
+        Extension(
+            "nkmaid",
+            sources=sources,
+            include_dirs=[sample],
+            define_macros=define_macros,
+            extra_compile_args=extra_compile_args,
+            extra_link_args=extra_link_args,
+            libraries=libraries,
+        )
+    ],
+)